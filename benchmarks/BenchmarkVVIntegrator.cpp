@@ -0,0 +1,589 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2015 Stanford University and the Authors.      *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * Benchmark of VVIntegrator on every available platform.
+ *
+ * The synthetic systems are made of polarizable diatomic ions on a lattice, with PME electrostatics,
+ * one constraint and one Drude particle per molecule. They are timed for combinations of
+ * integration scheme (VV or middle), thermostat (Nose-Hoover, Langevin or mixed), COM temperature group
+ * and one extra feature (cosine acceleration, image charges or electric field).
+ * The thermostat can also be massive Nose-Hoover chains, Langevin with Ornstein-Uhlenbeck velocity update,
+ * or isokinetic Nose-Hoover RESPA (SIN(R)), which is timed on flexible molecules without Drude particles.
+ * For Nose-Hoover and massive Nose-Hoover chains, the time per call of the thermostat is added to the records,
+ * which is one call per half step with VV scheme, and the cost of massive chains is compared against Nose-Hoover.
+ * A real system (e.g. one of examples/models) can be timed by providing its System and State in XML,
+ * optionally together with the serialized VVIntegrator.
+ *
+ * The results are written as JSON, one record per run.
+ * With --phases 1, the time of each phase of the step measured by VVIntegrator is added to the records.
+ * Run with --help for the options.
+ */
+
+#include "OpenMM.h"
+#include "openmm/DrudeForce.h"
+#include "openmm/VVIntegrator.h"
+#include "openmm/serialization/XmlSerializer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+using std::string;
+using std::vector;
+
+struct BenchmarkSystem {
+    string name;
+    std::unique_ptr<System> system;
+    vector<Vec3> positions;
+    // the pairs of (image, parent) and the location of mirror, if the system is built for image charges
+    vector<std::pair<int, int> > imagePairs;
+    double mirrorLocation = 0;
+    // the force groups integrated with the inner time step in SIN(R) scheme
+    int fastForceGroups = 0;
+    // the serialized integrator of a real system, which is used as is except the integration scheme
+    string integratorXml;
+};
+
+struct BenchmarkMode {
+    string scheme;
+    string thermostat;
+    bool comGroup;
+    string feature;
+};
+
+struct BenchmarkOptions {
+    vector<int> sizes = {1000, 10000, 100000, 1000000};
+    vector<string> schemes = {"vv", "middle"};
+    vector<string> thermostats = {"nh", "langevin", "mixed", "massive", "sinr", "ou"};
+    vector<string> comGroups = {"0", "1"};
+    vector<string> features = {"none", "cos", "image", "field"};
+    vector<string> platforms;
+    string precision = "mixed";
+    int warmupSteps = 20;
+    int steps = 200;
+    double stepSize = 0.001;
+    bool phases = false;
+    string systemXml, stateXml, integratorXml, name = "real";
+    string output;
+};
+
+static vector<string> splitList(const string& list) {
+    vector<string> items;
+    std::stringstream ss(list);
+    string item;
+    while (std::getline(ss, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static string readFile(const string& file) {
+    std::ifstream in(file.c_str());
+    if (!in)
+        throw OpenMMException("Cannot open " + file);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+static string escapeJson(const string& s) {
+    string escaped;
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+/**
+ * Build a box of polarizable diatomic ions with about numParticles particles (including Drude particles).
+ * If withImages is true, the ions are put in a slab below the mirror and each particle gets an image above it.
+ * If flexible is true, the ions have a harmonic bond instead of the constraint and no Drude particle,
+ * as required by SIN(R) scheme, and the bonds are put in a separate force group as fast forces.
+ */
+static BenchmarkSystem createSyntheticSystem(int numParticles, bool withImages, bool flexible = false) {
+    const double density = 33.0;  // molecules per nm^3, about 100 particles per nm^3
+    const double bondLength = 0.15;
+    const int numMolecules = std::max(2, numParticles / 3 / 2 * 2);
+    const double length = std::cbrt(numMolecules / density);
+    const double cutoff = std::min(1.2, 0.45 * length);
+    const int perSide = (int) std::ceil(std::cbrt((double) numMolecules));
+    const double spacing = length / perSide;
+    // in the system with images, the slab of ions is between 0.5 and length+0.5 nm, and the mirror is above it
+    const double mirror = length + 1.0;
+    const double lengthZ = withImages ? 2 * mirror : length;
+
+    BenchmarkSystem bench;
+    std::stringstream name;
+    name << "synthetic_" << numParticles << (withImages ? "_image" : "") << (flexible ? "_flexible" : "");
+    bench.name = name.str();
+    bench.system.reset(new System());
+    System& system = *bench.system;
+    system.setDefaultPeriodicBoxVectors(Vec3(length, 0, 0), Vec3(0, length, 0), Vec3(0, 0, lengthZ));
+
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(cutoff);
+    DrudeForce* drude = new DrudeForce();
+    system.addForce(nonbonded);
+    system.addForce(drude);
+    HarmonicBondForce* flexibleBonds = NULL;
+    if (flexible) {
+        flexibleBonds = new HarmonicBondForce();
+        flexibleBonds->setForceGroup(1);
+        system.addForce(flexibleBonds);
+        bench.fastForceGroups = 1 << 1;
+    }
+
+    for (int mol = 0; mol < numMolecules; mol++) {
+        const double sign = (mol % 2 == 0) ? 1 : -1;
+        const double drudeCharge = -1.5;
+        int ix = mol % perSide, iy = (mol / perSide) % perSide, iz = mol / perSide / perSide;
+        Vec3 center((ix + 0.25) * spacing, (iy + 0.5) * spacing, (iz + 0.5) * spacing);
+        if (withImages)
+            center[2] += 0.5;
+
+        if (flexible) {
+            int atom0 = system.addParticle(12.0);
+            int atom1 = system.addParticle(12.0);
+            nonbonded->addParticle(0.6 * sign, 0.3, 0.5);
+            nonbonded->addParticle(0.4 * sign, 0.3, 0.5);
+            nonbonded->addException(atom0, atom1, 0, 1, 0);
+            flexibleBonds->addBond(atom0, atom1, bondLength, 200000);
+            bench.positions.push_back(center);
+            bench.positions.push_back(center + Vec3(bondLength, 0, 0));
+            continue;
+        }
+
+        int atom0 = system.addParticle(11.6);
+        int atom1 = system.addParticle(12.0);
+        int drudeParticle = system.addParticle(0.4);
+        nonbonded->addParticle(0.6 * sign - drudeCharge, 0.3, 0.5);
+        nonbonded->addParticle(0.4 * sign, 0.3, 0.5);
+        nonbonded->addParticle(drudeCharge, 1, 0);
+        nonbonded->addException(atom0, atom1, 0, 1, 0);
+        nonbonded->addException(atom0, drudeParticle, 0, 1, 0);
+        nonbonded->addException(atom1, drudeParticle, 0, 1, 0);
+        system.addConstraint(atom0, atom1, bondLength);
+        drude->addParticle(drudeParticle, atom0, -1, -1, -1, drudeCharge, 0.001, 1, 1);
+
+        bench.positions.push_back(center);
+        bench.positions.push_back(center + Vec3(bondLength, 0, 0));
+        bench.positions.push_back(center + Vec3(0.005, 0, 0));
+    }
+
+    if (withImages) {
+        HarmonicBondForce* bonds = new HarmonicBondForce();
+        system.addForce(bonds);
+        int numReal = system.getNumParticles();
+        for (int parent = 0; parent < numReal; parent++) {
+            double charge, sigma, epsilon;
+            nonbonded->getParticleParameters(parent, charge, sigma, epsilon);
+            int image = system.addParticle(0);
+            nonbonded->addParticle(-charge, 1, 0);
+            // the fake bond keeps the image and its parent in the same periodic cell
+            bonds->addBond(image, parent, 0, 0);
+            Vec3 pos = bench.positions[parent];
+            bench.positions.push_back(Vec3(pos[0], pos[1], 2 * mirror - pos[2]));
+            bench.imagePairs.push_back(std::make_pair(image, parent));
+        }
+        bench.mirrorLocation = mirror;
+    }
+    return bench;
+}
+
+static BenchmarkSystem loadRealSystem(const BenchmarkOptions& options) {
+    BenchmarkSystem bench;
+    bench.name = options.name;
+    std::stringstream systemStream(readFile(options.systemXml));
+    bench.system.reset(XmlSerializer::deserialize<System>(systemStream));
+    std::stringstream stateStream(readFile(options.stateXml));
+    std::unique_ptr<State> state(XmlSerializer::deserialize<State>(stateStream));
+    bench.positions = state->getPositions();
+    if (!options.integratorXml.empty())
+        bench.integratorXml = readFile(options.integratorXml);
+    return bench;
+}
+
+/**
+ * Get the molecule of each particle from the constraints, bonds and Drude pairs, for splitting the thermostats.
+ */
+static vector<int> getMoleculeIds(const System& system) {
+    vector<int> pairs;
+    for (int i = 0; i < system.getNumConstraints(); i++) {
+        int p1, p2;
+        double distance;
+        system.getConstraintParameters(i, p1, p2, distance);
+        pairs.push_back(p1);
+        pairs.push_back(p2);
+    }
+    for (int i = 0; i < system.getNumForces(); i++) {
+        const HarmonicBondForce* bonds = dynamic_cast<const HarmonicBondForce*>(&system.getForce(i));
+        if (bonds != NULL) {
+            for (int j = 0; j < bonds->getNumBonds(); j++) {
+                int p1, p2;
+                double length, k;
+                bonds->getBondParameters(j, p1, p2, length, k);
+                pairs.push_back(p1);
+                pairs.push_back(p2);
+            }
+        }
+        const DrudeForce* drude = dynamic_cast<const DrudeForce*>(&system.getForce(i));
+        if (drude != NULL) {
+            for (int j = 0; j < drude->getNumParticles(); j++) {
+                int p, p1, p2, p3, p4;
+                double charge, polarizability, aniso12, aniso34;
+                drude->getParticleParameters(j, p, p1, p2, p3, p4, charge, polarizability, aniso12, aniso34);
+                pairs.push_back(p);
+                pairs.push_back(p1);
+            }
+        }
+    }
+    return VVIntegrator::findMolecules(system.getNumParticles(), pairs);
+}
+
+static VVIntegrator* createIntegrator(const BenchmarkSystem& bench, const BenchmarkMode& mode, double stepSize) {
+    VVIntegrator* integrator;
+    if (!bench.integratorXml.empty()) {
+        std::stringstream stream(bench.integratorXml);
+        Integrator* base = XmlSerializer::deserialize<Integrator>(stream);
+        integrator = dynamic_cast<VVIntegrator*>(base);
+        if (integrator == NULL) {
+            delete base;
+            throw OpenMMException("The serialized integrator is not a VVIntegrator");
+        }
+        integrator->setUseMiddleScheme(mode.scheme == "middle");
+        return integrator;
+    }
+
+    integrator = new VVIntegrator(300, 10, 1, 40, stepSize);
+    integrator->setUseMiddleScheme(mode.scheme == "middle");
+    integrator->setMaxDrudeDistance(0.02);
+    integrator->setUseCOMTempGroup(mode.comGroup);
+    const System& system = *bench.system;
+
+    vector<char> isImage(system.getNumParticles(), 0);
+    for (auto& pair : bench.imagePairs)
+        isImage[pair.first] = 1;
+    if (mode.thermostat == "langevin" || mode.thermostat == "mixed" || mode.thermostat == "ou") {
+        vector<int> molIds = getMoleculeIds(system);
+        for (int i = 0; i < system.getNumParticles(); i++)
+            if (!isImage[i] && system.getParticleMass(i) > 0 && (mode.thermostat != "mixed" || molIds[i] % 2 == 1))
+                integrator->addParticleLangevin(i);
+        integrator->setUseLangevinOU(mode.thermostat == "ou");
+    }
+    else if (mode.thermostat == "massive") {
+        integrator->setUseMassiveNH(true);
+    }
+    else if (mode.thermostat == "sinr") {
+        integrator->setUseSINR(true);
+        integrator->setFastForceGroups(bench.fastForceGroups);
+    }
+
+    if (mode.feature == "cos") {
+        integrator->setCosAcceleration(0.01);
+    }
+    else if (mode.feature == "image") {
+        for (auto& pair : bench.imagePairs)
+            integrator->addImagePair(pair.first, pair.second);
+        integrator->setMirrorLocation(bench.mirrorLocation);
+    }
+    else if (mode.feature == "field") {
+        for (int i = 0; i < system.getNumParticles(); i++)
+            if (!isImage[i])
+                integrator->addParticleElectrolyte(i);
+        integrator->setElectricField(10.0);
+    }
+    return integrator;
+}
+
+/**
+ * Run one benchmark and write it as a JSON object.
+ * Return the time per call of the thermostat in microseconds, or -1 if it is not measured.
+ */
+static double runBenchmark(std::ostream& out, bool& first, Platform& platform, const BenchmarkSystem& bench,
+                         const BenchmarkMode& mode, const BenchmarkOptions& options) {
+    std::stringstream record;
+    record << "{\"platform\": \"" << platform.getName() << "\", \"system\": \"" << escapeJson(bench.name)
+           << "\", \"particles\": " << bench.system->getNumParticles()
+           << ", \"scheme\": \"" << mode.scheme << "\"";
+    if (bench.integratorXml.empty())
+        record << ", \"thermostat\": \"" << mode.thermostat << "\", \"comGroup\": " << (mode.comGroup ? "true" : "false")
+               << ", \"feature\": \"" << mode.feature << "\"";
+    // the timing events are resolved lazily, so timing the thermostat doesn't add synchronization to the step
+    const bool timeThermostat = mode.thermostat == "nh" || mode.thermostat == "massive";
+    double thermostatUsPerCall = -1;
+    try {
+        std::unique_ptr<VVIntegrator> integrator(createIntegrator(bench, mode, options.stepSize));
+        integrator->setTimingEnabled(options.phases || timeThermostat);
+        std::map<string, string> properties;
+        if (platform.getName() == "CUDA" || platform.getName() == "OpenCL")
+            properties["Precision"] = options.precision;
+        Context context(*bench.system, *integrator, platform, properties);
+        context.setPositions(bench.positions);
+        context.setVelocitiesToTemperature(300, 1);
+        integrator->step(options.warmupSteps);
+        // downloading the positions waits for the queued kernels to finish
+        context.getState(State::Positions);
+        integrator->resetTimings();
+
+        auto start = std::chrono::steady_clock::now();
+        integrator->step(options.steps);
+        context.getState(State::Positions);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double usPerStep = seconds / options.steps * 1e6;
+        double nsPerDay = integrator->getStepSize() * options.steps * 1e-3 / (seconds / 86400);
+        record << ", \"steps\": " << options.steps << ", \"seconds\": " << seconds
+               << ", \"usPerStep\": " << usPerStep << ", \"nsPerDay\": " << nsPerDay;
+        vector<double> timings;
+        if (options.phases || timeThermostat)
+            timings = integrator->getTimings();
+        if (timeThermostat && timings[2 * VVIntegrator::TimingThermostat] > 0) {
+            thermostatUsPerCall = timings[2 * VVIntegrator::TimingThermostat + 1] / timings[2 * VVIntegrator::TimingThermostat] * 1e6;
+            record << ", \"thermostatUsPerCall\": " << thermostatUsPerCall;
+        }
+        if (options.phases) {
+            record << ", \"phases\": {";
+            for (int phase = 0; phase < VVIntegrator::NumTimingPhases; phase++)
+                record << (phase == 0 ? "" : ", ") << "\"" << VVIntegrator::getTimingPhaseName(phase)
+                       << "\": {\"calls\": " << timings[2 * phase] << ", \"seconds\": " << timings[2 * phase + 1] << "}";
+            record << "}";
+        }
+    }
+    catch (std::exception& e) {
+        record << ", \"error\": \"" << escapeJson(e.what()) << "\"";
+    }
+    record << "}";
+    out << (first ? "\n  " : ",\n  ") << record.str();
+    out.flush();
+    first = false;
+    std::cerr << record.str() << std::endl;
+    return thermostatUsPerCall;
+}
+
+/**
+ * Compare the time per call of massive Nose-Hoover chains against Nose-Hoover thermostat of the same run
+ */
+static void printMassiveComparison(const std::map<string, std::pair<double, double> >& thermostatCosts) {
+    for (auto& item : thermostatCosts) {
+        double nh = item.second.first, massive = item.second.second;
+        if (nh <= 0 || massive <= 0)
+            continue;
+        std::cerr << "Thermostat per call, " << item.first << ": nh " << nh << " us, massive " << massive
+                  << " us (" << massive / nh << "x)" << std::endl;
+    }
+}
+
+static void printUsage() {
+    std::cout << "Usage: BenchmarkVVIntegrator [options]\n"
+              << "  --sizes N1,N2,...           number of particles of synthetic systems (default 1000,10000,100000,1000000)\n"
+              << "  --schemes vv,middle\n"
+              << "  --thermostats nh,langevin,mixed,massive,sinr,ou\n"
+              << "  --com 0,1                   whether to use COM temperature group\n"
+              << "  --features none,cos,image,field\n"
+              << "  --platforms P1,P2,...       default all available platforms\n"
+              << "  --precision mixed           precision of CUDA and OpenCL platforms\n"
+              << "  --steps 200                 number of timed steps\n"
+              << "  --warmup 20                 number of steps before timing\n"
+              << "  --dt 0.001                  step size in ps\n"
+              << "  --phases 0                  whether to record the time of each phase of the step\n"
+              << "  --system system.xml         time a real system instead of synthetic ones\n"
+              << "  --state state.xml           the positions of the real system\n"
+              << "  --integrator integrator.xml the serialized VVIntegrator of the real system (optional)\n"
+              << "  --name NAME                 the name of the real system in the output\n"
+              << "  --output results.json       default standard output\n";
+}
+
+static BenchmarkOptions parseOptions(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; i++) {
+        string key = argv[i];
+        if (key == "--help" || key == "-h") {
+            printUsage();
+            exit(0);
+        }
+        if (i + 1 >= argc)
+            throw OpenMMException("Missing value for option " + key);
+        string value = argv[++i];
+        if (key == "--sizes") {
+            options.sizes.clear();
+            for (auto& size : splitList(value))
+                options.sizes.push_back(std::atoi(size.c_str()));
+        }
+        else if (key == "--schemes")
+            options.schemes = splitList(value);
+        else if (key == "--thermostats")
+            options.thermostats = splitList(value);
+        else if (key == "--com")
+            options.comGroups = splitList(value);
+        else if (key == "--features")
+            options.features = splitList(value);
+        else if (key == "--platforms")
+            options.platforms = splitList(value);
+        else if (key == "--precision")
+            options.precision = value;
+        else if (key == "--steps")
+            options.steps = std::atoi(value.c_str());
+        else if (key == "--warmup")
+            options.warmupSteps = std::atoi(value.c_str());
+        else if (key == "--dt")
+            options.stepSize = std::atof(value.c_str());
+        else if (key == "--phases")
+            options.phases = std::atoi(value.c_str()) != 0;
+        else if (key == "--system")
+            options.systemXml = value;
+        else if (key == "--state")
+            options.stateXml = value;
+        else if (key == "--integrator")
+            options.integratorXml = value;
+        else if (key == "--name")
+            options.name = value;
+        else if (key == "--output")
+            options.output = value;
+        else
+            throw OpenMMException("Unknown option " + key);
+    }
+    if (options.steps < 1)
+        throw OpenMMException("The number of timed steps should be positive");
+    if (!options.systemXml.empty() && options.stateXml.empty())
+        throw OpenMMException("The state of the real system is required");
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        BenchmarkOptions options = parseOptions(argc, argv);
+        Platform::loadPluginsFromDirectory(Platform::getDefaultPluginsDirectory());
+
+        vector<Platform*> platforms;
+        for (int i = 0; i < Platform::getNumPlatforms(); i++) {
+            Platform& platform = Platform::getPlatform(i);
+            if (options.platforms.empty() ||
+                std::find(options.platforms.begin(), options.platforms.end(), platform.getName()) != options.platforms.end())
+                platforms.push_back(&platform);
+        }
+
+        const bool isReal = !options.systemXml.empty();
+        const bool hasIntegrator = !options.integratorXml.empty();
+        vector<BenchmarkMode> modes;
+        bool useSINR = false;
+        for (auto& scheme : options.schemes) {
+            // only the scheme is varied for a serialized integrator
+            if (isReal && hasIntegrator) {
+                modes.push_back(BenchmarkMode{scheme, "", false, ""});
+                continue;
+            }
+            for (auto& thermostat : options.thermostats) {
+                // SIN(R) has its own integration scheme, and it can't be used with periodic perturbation or image charges
+                if (thermostat == "sinr" && scheme != "vv")
+                    continue;
+                for (auto& com : options.comGroups) {
+                    // COM temperature group is not used by massive Nose-Hoover chains or SIN(R)
+                    if (com == "1" && (thermostat == "massive" || thermostat == "sinr"))
+                        continue;
+                    for (auto& feature : options.features) {
+                        if (thermostat == "sinr" && (feature == "cos" || feature == "image"))
+                            continue;
+                        // the image pairs of a real system are only known from its serialized integrator
+                        if (!isReal || feature != "image") {
+                            modes.push_back(BenchmarkMode{scheme, thermostat, com == "1", feature});
+                            useSINR = useSINR || thermostat == "sinr";
+                        }
+                    }
+                }
+            }
+        }
+
+        std::ofstream file;
+        if (!options.output.empty()) {
+            file.open(options.output.c_str());
+            if (!file)
+                throw OpenMMException("Cannot open " + options.output);
+        }
+        std::ostream& out = options.output.empty() ? std::cout : file;
+        bool first = true;
+        out << "[";
+        // the time per call of Nose-Hoover and massive Nose-Hoover chains for the same platform, system and mode
+        std::map<string, std::pair<double, double> > thermostatCosts;
+        auto run = [&](Platform& platform, const BenchmarkSystem& bench, const BenchmarkMode& mode) {
+            double cost = runBenchmark(out, first, platform, bench, mode, options);
+            if (mode.thermostat == "nh" || mode.thermostat == "massive") {
+                std::stringstream key;
+                key << platform.getName() << " " << bench.name << " " << mode.scheme
+                    << (mode.comGroup ? " com" : "") << " " << mode.feature;
+                auto& costs = thermostatCosts[key.str()];
+                (mode.thermostat == "nh" ? costs.first : costs.second) = cost;
+            }
+        };
+
+        if (isReal) {
+            BenchmarkSystem bench = loadRealSystem(options);
+            for (Platform* platform : platforms)
+                for (auto& mode : modes)
+                    run(*platform, bench, mode);
+        }
+        else {
+            for (int size : options.sizes) {
+                BenchmarkSystem bulk = createSyntheticSystem(size, false);
+                BenchmarkSystem slab;
+                if (std::find(options.features.begin(), options.features.end(), "image") != options.features.end())
+                    slab = createSyntheticSystem(size, true);
+                BenchmarkSystem flexible;
+                if (useSINR)
+                    flexible = createSyntheticSystem(size, false, true);
+                for (Platform* platform : platforms)
+                    for (auto& mode : modes)
+                        run(*platform, mode.thermostat == "sinr" ? flexible : mode.feature == "image" ? slab : bulk, mode);
+            }
+        }
+        out << "\n]\n";
+        printMassiveComparison(thermostatCosts);
+    }
+    catch (std::exception& e) {
+        std::cerr << "exception: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""
+Time the processing of PSF and PRM files by OplsPsfFile, as it is done in run-edl.py,
+and check that the System produced is the same as another version of oplspsffile.py, e.g. the one before a change:
+
+    git show <commit>:examples/ommhelper/oplspsffile.py > oplspsffile_ref.py
+    python3 bench-psf.py --gro models/edl_Im21/conf.gro --psf models/edl_Im21/topol.psf --prm models/edl_Im21/ff.prm \
+                         --ref oplspsffile_ref.py
+
+The Systems are compared by their XML from XmlSerializer. Instead of a reference implementation,
+the XML written by --xml of a previous run can be given with --ref-xml.
+"""
+
+import argparse
+import difflib
+import importlib.util
+import sys
+import time
+import simtk.openmm as mm
+from simtk.openmm import app
+import ommhelper as oh
+from ommhelper.unit import *
+
+parser = argparse.ArgumentParser(formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+parser.add_argument('--gro', type=str, default='models/edl_Im21/conf.gro', help='gro file')
+parser.add_argument('--psf', type=str, default='models/edl_Im21/topol.psf', help='psf file')
+parser.add_argument('--prm', type=str, default='models/edl_Im21/ff.prm', help='prm file')
+parser.add_argument('-r', '--repeat', type=int, default=3, help='number of repeats, the best time is reported')
+parser.add_argument('--ref', type=str, help='the reference oplspsffile.py to time and compare against')
+parser.add_argument('--ref-xml', type=str, help='the reference System in XML to compare against')
+parser.add_argument('--xml', type=str, help='write the System built by the current implementation in XML')
+args = parser.parse_args()
+
+
+def load_reference(path):
+    spec = importlib.util.spec_from_file_location('oplspsffile_ref', path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module.OplsPsfFile
+
+
+def time_system(name, psf_class, gro):
+    best_psf = best_system = float('inf')
+    for i in range(args.repeat):
+        t0 = time.perf_counter()
+        psf = psf_class(args.psf, periodicBoxVectors=gro.getPeriodicBoxVectors())
+        t1 = time.perf_counter()
+        prm = app.CharmmParameterSet(args.prm)
+        system = psf.createSystem(prm, nonbondedMethod=app.PME, nonbondedCutoff=1.2 * nm,
+                                  constraints=app.HBonds, rigidWater=True)
+        t2 = time.perf_counter()
+        best_psf = min(best_psf, t1 - t0)
+        best_system = min(best_system, t2 - t1)
+    print('%-10s read PSF %8.3f s    createSystem %8.3f s    total %8.3f s'
+          % (name, best_psf, best_system, best_psf + best_system))
+    return mm.XmlSerializer.serialize(system)
+
+
+def compare(xml, xml_ref, name):
+    if xml == xml_ref:
+        print('System is identical to %s' % name)
+        return True
+    print('System differs from %s:' % name)
+    diff = difflib.unified_diff(xml_ref.splitlines(), xml.splitlines(), name, 'current', lineterm='', n=1)
+    for i, line in enumerate(diff):
+        if i >= 20:
+            print('...')
+            break
+        print(line)
+    return False
+
+
+gro = oh.GroFile(args.gro)
+print('%s, %i atoms' % (args.psf, len(gro.positions)))
+xml = time_system('current', oh.OplsPsfFile, gro)
+if args.xml:
+    with open(args.xml, 'w') as f:
+        f.write(xml)
+
+identical = True
+if args.ref:
+    xml_ref = time_system('reference', load_reference(args.ref), gro)
+    identical = compare(xml, xml_ref, args.ref) and identical
+if args.ref_xml:
+    with open(args.ref_xml) as f:
+        identical = compare(xml, f.read(), args.ref_xml) and identical
+sys.exit(0 if identical else 1)
@@ -1,5 +1,8 @@
 from .grofile import GroFile
+from .trjfile import TrjFile
+from .statistics import StreamingStatistics
 from .oplspsffile import OplsPsfFile
+from .preparedcache import prepared_cache_key, save_prepared, load_prepared
 from .reporter import *
 from .util import *
 from .force import *
@@ -369,7 +369,7 @@ class OplsPsfFile(object):
             i3 = holder[3*i+2]
             group_list.append(Group(i1, i2, i3))
         group_list.changed = False
-        # Assign all of the atoms to molecules recursively
+        # Assign all of the atoms to molecules
         holder = psfsections['MOLNT'][1]
         set_molecules(atom_list)
         molecule_list = [atom.marked for atom in atom_list]
@@ -581,10 +581,16 @@ class OplsPsfFile(object):
                 data.append(line)
                 line = psf.readline().strip()
         else:
+            # collect the lines first and convert all the words at once
+            lines = []
             while line:
-                words = line.split()
-                data.extend([conv(w, int, 'PSF data') for w in words])
+                lines.append(line)
                 line = psf.readline().strip()
+            try:
+                data = list(map(int, ' '.join(lines).split()))
+            except ValueError as e:
+                print(e)
+                raise CharmmPSFError('Could not convert PSF data')
         return title, pointers, data
 
     def loadParameters(self, parmset):
@@ -963,6 +969,8 @@ class OplsPsfFile(object):
         # Add virtual sites
         if hasattr(self, 'lonepair_list'):
             if verbose: print('Adding lonepairs...')
+            # bonded partners of each atom in the order of bond_list, only required for colinear lonepair
+            bond_partners = None
             for lpsite in self.lonepair_list:
                 index=lpsite[0]
                 atom1=lpsite[1]
@@ -982,11 +990,15 @@ class OplsPsfFile(object):
                     system.setVirtualSite(index, mm.LocalCoordinatesSite(atom1, atom3, atom2, mm.Vec3(1.0, 0.0, 0.0), mm.Vec3(xweights[0],xweights[1],xweights[2]), mm.Vec3(0.0, -1.0, 1.0), mm.Vec3(p[0],p[1],p[2])))
                 else: # colinear lonepair type
                     # find a real atom to be the third one for LocalCoordinatesSite
-                    for bond in self.bond_list:
-                        if (bond.atom1.idx == atom2 and bond.atom2.idx != atom1):
-                            a3=bond.atom2.idx
-                        elif (bond.atom2.idx == atom2 and bond.atom1.idx != atom1):
-                            a3=bond.atom1.idx
+                    # the last one bonded to atom2 in bond_list is used
+                    if bond_partners is None:
+                        bond_partners = [[] for atom in self.atom_list]
+                        for bond in self.bond_list:
+                            bond_partners[bond.atom1.idx].append(bond.atom2.idx)
+                            bond_partners[bond.atom2.idx].append(bond.atom1.idx)
+                    for partner in bond_partners[atom2]:
+                        if partner != atom1:
+                            a3 = partner
                     r = lpsite[4] / 10.0 # in nanometer
                     system.setVirtualSite(index, mm.LocalCoordinatesSite(atom1, atom2, a3, mm.Vec3(1.0, 0.0, 0.0), mm.Vec3(1.0,-1.0, 0.0), mm.Vec3(0.0, -1.0, 1.0), mm.Vec3(r,0.0,0.0)))
         # Add Bond forces
@@ -1265,29 +1277,31 @@ class OplsPsfFile(object):
             force.addParticle(atm.charge, 1.0, 0.0)
         # Now add the custom nonbonded force that implements LJ. First
         # thing we need to do is condense our number of types
+        # An atom is assigned to the first LJ type which either has the same atom type,
+        # or has the same (rmin, epsilon) and is created from a non-NBFIXed and non-NBTholed atom type.
+        # The types are looked up from dicts, so that it is one pass over the atoms
         lj_idx_list = [0 for atom in self.atom_list]
         lj_radii, lj_depths = [], []
         num_lj_types = 0
         lj_type_list = []
+        lj_idx_of_type = {}
+        lj_idx_of_param = {}
         for i, atom in enumerate(self.atom_list):
             atom = atom.type
-            if lj_idx_list[i]: continue # already assigned
+            ljtype = (atom.rmin, atom.epsilon)
+            candidates = [idx for idx in (lj_idx_of_type.get(id(atom)), lj_idx_of_param.get(ljtype)) if idx]
+            if candidates:
+                lj_idx_list[i] = min(candidates)
+                continue
             num_lj_types += 1
             lj_idx_list[i] = num_lj_types
-            ljtype = (atom.rmin, atom.epsilon)
             lj_type_list.append(atom)
             lj_radii.append(atom.rmin)
             lj_depths.append(atom.epsilon)
-            for j in range(i+1, len(self.atom_list)):
-                atom2 = self.atom_list[j].type
-                if lj_idx_list[j] > 0: continue # already assigned
-                if atom2 is atom:
-                    lj_idx_list[j] = num_lj_types
-                elif not atom.nbfix and not atom.nbthole:
-                    # Only non-NBFIXed and non-NBTholed atom types can be compressed
-                    ljtype2 = (atom2.rmin, atom2.epsilon)
-                    if ljtype == ljtype2:
-                        lj_idx_list[j] = num_lj_types
+            lj_idx_of_type[id(atom)] = num_lj_types
+            if not atom.nbfix and not atom.nbthole:
+                # Only non-NBFIXed and non-NBTholed atom types can be compressed
+                lj_idx_of_param.setdefault(ljtype, num_lj_types)
         # Now everything is assigned. Create the A-coefficient and
         # B-coefficient arrays
         acoef = [0 for i in range(num_lj_types*num_lj_types)]
@@ -1353,27 +1367,23 @@ class OplsPsfFile(object):
             num_nbt_types = 0
             nbt_type_list = []
             nbt_set_list = []
+            nbt_idx_of_type = {}
             for i, atom in enumerate(self.atom_list):
                 atom = atom.type
                 if not atom.nbthole: continue # get them as zero
                 if nbt_idx_list[i]: continue # already assigned
-                num_nbt_types += 1
-                nbt_idx_list[i] = num_nbt_types
-                nbt_idx_list[i+1] = num_nbt_types
+                idx = nbt_idx_of_type.get(id(atom))
+                if idx is None:
+                    num_nbt_types += 1
+                    idx = nbt_idx_of_type[id(atom)] = num_nbt_types
+                    nbt_type_list.append(atom)
+                    nbt_set_list.append([])
+                nbt_idx_list[i] = idx
+                nbt_idx_list[i+1] = idx
                 nbt_alpha_list[i] = pow(-1*self.drudeconsts_list[i][0],-1./6.)
                 nbt_alpha_list[i+1] = pow(-1*self.drudeconsts_list[i][0],-1./6.)
-                nbt_type_list.append(atom)
-                nbt_set_list.append([i,i+1])
-                for j in range(i+1, len(self.atom_list)):
-                    atom2 = self.atom_list[j].type
-                    if nbt_idx_list[j] > 0: continue # already assigned
-                    if atom2 is atom:
-                        nbt_idx_list[j] = num_nbt_types
-                        nbt_idx_list[j+1] = num_nbt_types
-                        nbt_alpha_list[j] = pow(-1*self.drudeconsts_list[j][0],-1./6.)
-                        nbt_alpha_list[j+1] = pow(-1*self.drudeconsts_list[j][0],-1./6.)
-                        nbt_set_list[num_nbt_types-1].append(j)
-                        nbt_set_list[num_nbt_types-1].append(j+1)
+                nbt_set_list[idx-1].append(i)
+                nbt_set_list[idx-1].append(i+1)
             num_total_nbt=num_nbt_types+1 # use zero index for all the atoms with no nbthole
             nbt_interset_list=[]
             # need to get all other particles as an independent group, so in total num_nbt_types+1
@@ -1417,6 +1427,13 @@ class OplsPsfFile(object):
             print('    Number of 1-3 exclusion: %i' % len(self.pair_13_list))
             print('    Number of 1-4 exclusion: %i' % len(self.pair_14_list))
 
+        # The excluded pairs are recorded as they are added,
+        # so that they don't have to be read back from the NonbondedForce one by one
+        exception_pairs = []
+        def addException(ia1, ia2, charge_prod, sigma, epsilon):
+            force.addException(ia1, ia2, charge_prod, sigma, epsilon)
+            exception_pairs.append((ia1, ia2))
+
         # Add 1-4 interactions
         sigma_scale = 2**(-1/6)
         for ia1, ia4 in self.pair_14_list:
@@ -1430,7 +1447,7 @@ class OplsPsfFile(object):
             epsilon = sqrt(atom1.type.epsilon_14 * atom4.type.epsilon_14) * ene_conv
             sigma = sqrt(atom1.type.rmin_14 * 2 * atom4.type.rmin_14 * 2) * (
                     length_conv * sigma_scale)
-            force.addException(ia1, ia4, charge_prod, sigma, epsilon)
+            addException(ia1, ia4, charge_prod, sigma, epsilon)
 
         # Add excluded atoms
         # Drude and lonepairs will be excluded based on their parent atoms
@@ -1441,24 +1458,24 @@ class OplsPsfFile(object):
             idx = lpsite[1]
             idxa = lpsite[0]
             parent_exclude_list[idx].append(idxa)
-            force.addException(idx, idxa, 0.0, 0.1, 0.0)
+            addException(idx, idxa, 0.0, 0.1, 0.0)
         if has_drude_particle:
             for pair in self.drudepair_list:
                 idx = pair[0]
                 idxa = pair[1]
                 parent_exclude_list[idx].append(idxa)
-                force.addException(idx, idxa, 0.0, 0.1, 0.0)
+                addException(idx, idxa, 0.0, 0.1, 0.0)
             # If lonepairs and Drude particles are bonded to the same parent atom, add exception
             for excludeterm in parent_exclude_list:
                 if(len(excludeterm) >= 2):
                     for i in range(len(excludeterm)):
                         for j in range(i):
-                            force.addException(excludeterm[j], excludeterm[i], 0.0, 0.1, 0.0)
+                            addException(excludeterm[j], excludeterm[i], 0.0, 0.1, 0.0)
         # Exclude all bonds and angles, as well as the lonepair/Drude attached onto them
         for ia1, ia2 in self.pair_12_list + self.pair_13_list:
             for excludeatom in [ia1]+parent_exclude_list[ia1]:
                 for excludeatom2 in [ia2]+parent_exclude_list[ia2]:
-                    force.addException(excludeatom, excludeatom2, 0.0, 0.1, 0.0)
+                    addException(excludeatom, excludeatom2, 0.0, 0.1, 0.0)
         #############################################################################
         # 1-4 scaling for lonepair/Drude
         #############################################################################
@@ -1469,7 +1486,7 @@ class OplsPsfFile(object):
                     if excludeatom == ia1 and excludeatom4 == ia4:
                         continue
                     qq_scaled = (self.atom_list[excludeatom].charge * self.atom_list[excludeatom4].charge) / 2
-                    force.addException(excludeatom, excludeatom4, qq_scaled, 0.1, 0.0)
+                    addException(excludeatom, excludeatom4, qq_scaled, 0.1, 0.0)
         system.addForce(force)
 
         # Add Drude particles (Drude force)
@@ -1477,6 +1494,8 @@ class OplsPsfFile(object):
             if verbose: print('Adding Drude force and Thole screening...')
             drudeforce = mm.DrudeForce()
             drudeforce.setForceGroup(self.DRUDE_FORCE_GROUP)
+            # the last aniso term of a parent atom is used
+            aniso_of_parent = {aniso[0]: aniso for aniso in self.aniso_list}
             for pair in self.drudepair_list:
                 parentatom=pair[0]
                 drudeatom=pair[1]
@@ -1485,26 +1504,24 @@ class OplsPsfFile(object):
                 a22 = 0
                 charge = self.atom_list[drudeatom].charge
                 polarizability = self.drudeconsts_list[parentatom][0]/(-1000.0)
-                for aniso in self.aniso_list: # not smart to do another loop, but the number of aniso is small anyway
-                    if (parentatom==aniso[0]):
-                        p[0]=aniso[1]
-                        p[1]=aniso[2]
-                        p[2]=aniso[3]
-                        k11=aniso[4]
-                        k22=aniso[5]
-                        k33=aniso[6]
-                        # solve out DrudeK, which should equal 500.0
-                        a = k11+k22+3*k33
-                        b = 2*k11*k22+4*k11*k33+4*k22*k33+6*k33*k33
-                        c = 3*k33*(k11+k33)*(k22+k33)
-                        DrudeK = (sqrt(b*b-4*a*c)-b)/2/a
-                        a11=round(DrudeK/(k11+k33+DrudeK),5)
-                        a22=round(DrudeK/(k22+k33+DrudeK),5)
+                aniso = aniso_of_parent.get(parentatom)
+                if aniso is not None:
+                    p[0]=aniso[1]
+                    p[1]=aniso[2]
+                    p[2]=aniso[3]
+                    k11=aniso[4]
+                    k22=aniso[5]
+                    k33=aniso[6]
+                    # solve out DrudeK, which should equal 500.0
+                    a = k11+k22+3*k33
+                    b = 2*k11*k22+4*k11*k33+4*k22*k33+6*k33*k33
+                    c = 3*k33*(k11+k33)*(k22+k33)
+                    DrudeK = (sqrt(b*b-4*a*c)-b)/2/a
+                    a11=round(DrudeK/(k11+k33+DrudeK),5)
+                    a22=round(DrudeK/(k22+k33+DrudeK),5)
                 drudeforce.addParticle(drudeatom, parentatom, p[0], p[1], p[2], charge, polarizability, a11, a22 )
             system.addForce(drudeforce)
-            particleMap = {}
-            for i in range(drudeforce.getNumParticles()):
-                particleMap[drudeforce.getParticleParameters(i)[0]] = i
+            particleMap = {pair[1]: i for i, pair in enumerate(self.drudepair_list)}
 
             for ia1, ia2 in self.pair_12_list + self.pair_13_list:
                 alpha1 = self.drudeconsts_list[ia1][0]
@@ -1518,14 +1535,12 @@ class OplsPsfFile(object):
 
         # If we needed a CustomNonbondedForce, map all of the exceptions from
         # the NonbondedForce to the CustomNonbondedForce
-        for i in range(force.getNumExceptions()):
-            ii, jj, q, eps, sig = force.getExceptionParameters(i)
+        for ii, jj in exception_pairs:
             cforce.addExclusion(ii, jj)
         system.addForce(cforce)
 
         if has_drude_particle and has_nbthole_terms:
-            for i in range(force.getNumExceptions()):
-                ii, jj, q, eps, sig = force.getExceptionParameters(i)
+            for ii, jj in exception_pairs:
                 nbtforce.addExclusion(ii, jj)
 
         # Add GB model if we're doing one
@@ -1685,64 +1700,54 @@ class OplsPsfFile(object):
 def set_molecules(atom_list):
     """
     Correctly sets the molecularity of the system based on connectivity
+
+    The molecules are found with union-find over the flat array of bonded pairs,
+    which is done by VVIntegrator.findMolecules in compiled code if the plugin is available.
+    The molecules are numbered from 1 in the order of their first atom, as atom.marked
     """
-    from sys import setrecursionlimit, getrecursionlimit
-    # Since we use a recursive function here, we make sure that the recursion
-    # limit is large enough to handle the maximum possible recursion depth we'll
-    # need (NATOM). We don't want to shrink it, though, since we use list
-    # comprehensions in list constructors in some places that have an implicit
-    # (shallow) recursion, therefore, reducing the recursion limit too much here
-    # could raise a recursion depth exceeded exception during a _Type/Atom/XList
-    # creation. Therefore, set the recursion limit to the greater of the current
-    # limit or the number of atoms
-    setrecursionlimit(max(len(atom_list), getrecursionlimit()))
-
-    # Unmark all atoms so we can track which molecule each goes into
-    atom_list.unmark()
-
-    # The molecule "ownership" list
-    owner = []
-    # The way I do this is via a recursive algorithm, in which
-    # the "set_owner" method is called for each bonded partner an atom
-    # has, which in turn calls set_owner for each of its partners and
-    # so on until everything has been assigned.
-    molecule_number = 1 # which molecule number we are on
-    for i in range(len(atom_list)):
-        # If this atom has not yet been "owned", make it the next molecule
-        # However, we only increment which molecule number we're on if
-        # we actually assigned a new molecule (obviously)
-        if not atom_list[i].marked:
-            tmp = [i]
-            _set_owner(atom_list, tmp, i, molecule_number)
-            # Make sure the atom indexes are sorted
-            tmp.sort()
-            owner.append(tmp)
-            molecule_number += 1
+    bonded_pairs = []
+    for atom in atom_list:
+        for partner in atom.bond_partners:
+            if partner.idx > atom.idx:
+                bonded_pairs.append(atom.idx)
+                bonded_pairs.append(partner.idx)
+    mol_ids = _find_molecules(len(atom_list), bonded_pairs)
+
+    owner = [[] for i in range(max(mol_ids) + 1 if mol_ids else 0)]
+    for i, atom in enumerate(atom_list):
+        atom.marked = mol_ids[i] + 1
+        owner[mol_ids[i]].append(i)
     return owner
 
 # ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
-def _set_owner(atom_list, owner_array, atm, mol_id):
-    """ Sets ownership of given atom and all bonded partners """
-    # This could be written more simply as a recursive function, but that leads
-    # to stack overflows, so I flattened it into an iterative one.
-    partners = [atom_list[atm].bond_partners]
-    loop_index = [0]
-    atom_list[atm].marked = mol_id
-    while len(partners) > 0:
-        if loop_index[-1] >= len(partners[-1]):
-            partners.pop()
-            loop_index.pop()
-            continue
-        partner = partners[-1][loop_index[-1]]
-        loop_index[-1] += 1
-        if not partner.marked:
-            owner_array.append(partner.idx)
-            partner.marked = mol_id
-            partners.append(partner.bond_partners)
-            loop_index.append(0)
-        elif partner.marked != mol_id:
-            raise MoleculeError('Atom %d in multiple molecules' % partner.idx)
+def _find_molecules(n_atom, bonded_pairs):
+    """ Get the molecule id of each atom from flattened bonded pairs """
+    try:
+        from velocityverletplugin import VVIntegrator
+        return list(VVIntegrator.findMolecules(n_atom, bonded_pairs))
+    except ImportError:
+        pass
+
+    # Same union-find as the plugin, in case it is not installed
+    parent = list(range(n_atom))
+
+    def find(i):
+        while parent[i] != i:
+            parent[i] = parent[parent[i]]
+            i = parent[i]
+        return i
+
+    for k in range(0, len(bonded_pairs), 2):
+        r1, r2 = find(bonded_pairs[k]), find(bonded_pairs[k + 1])
+        if r1 != r2:
+            parent[max(r1, r2)] = min(r1, r2)
+
+    mol_ids = [0] * n_atom
+    root_mol_id = {}
+    for i in range(n_atom):
+        mol_ids[i] = root_mol_id.setdefault(find(i), len(root_mol_id))
+    return mol_ids
 
 # ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
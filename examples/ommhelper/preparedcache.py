@@ -0,0 +1,179 @@
+'''
+Prepared-run cache, so that a restarted simulation doesn't need to process the GRO, PSF and PRM files again.
+
+The System, the Integrator (including the particle roles of VVIntegrator), the Topology, the positions
+and user-defined groups of atoms are stored in one binary file.
+The file starts with a magic, the length of a JSON header and the JSON header itself,
+which describes the sections of the file by offset and length. The sections are aligned to 64 bytes,
+so that the arrays can be used directly from the memory-mapped file.
+'''
+
+import os
+import json
+import mmap
+import struct
+import hashlib
+import numpy as np
+import simtk.openmm as mm
+from simtk.openmm import app
+from simtk.unit import nanometer
+
+_MAGIC = b'OMMPREP1'
+_ALIGN = 64
+
+
+def prepared_cache_key(files, **params):
+    '''
+    Get the key of a prepared run from the content of input files and the parameters.
+
+    Parameters
+    ----------
+    files : list of str
+        The input files, including the script that builds the system,
+        so that the cache is invalidated if any of them is modified.
+    params :
+        The parameters affecting the system. They should be serializable to JSON.
+
+    Returns
+    -------
+    key : str
+    '''
+    sha = hashlib.sha256()
+    for file in files:
+        sha.update(os.path.basename(file).encode())
+        with open(file, 'rb') as f:
+            for chunk in iter(lambda: f.read(1 << 20), b''):
+                sha.update(chunk)
+    sha.update(json.dumps(params, sort_keys=True).encode())
+    return sha.hexdigest()[:16]
+
+
+def save_prepared(file, topology, system, integrator, positions, groups=None):
+    '''
+    Write a prepared run into a cache file.
+    The file is written to a temporary file and renamed, so that an interrupted writing doesn't leave a broken cache.
+
+    Parameters
+    ----------
+    file : str
+    topology : app.Topology
+    system : mm.System
+    integrator : mm.Integrator
+    positions : array_like of shape (n_atom, 3)
+    groups : dict of str to list of int, optional
+        The groups of atoms used by the script, e.g. for reporters
+    '''
+    positions = np.asarray(positions.value_in_unit(nanometer) if hasattr(positions, 'value_in_unit') else positions,
+                           dtype=np.float64).reshape(-1, 3)
+    atoms = list(topology.atoms())
+    residues = list(topology.residues())
+    chains = list(topology.chains())
+    bonds = np.array([(b[0].index, b[1].index) for b in topology.bonds()], dtype=np.int32).reshape(-1, 2)
+    vectors = topology.getPeriodicBoxVectors()
+
+    meta = {
+        'chains': [c.id for c in chains],
+        'residue_names': [r.name for r in residues],
+        'residue_ids': [r.id for r in residues],
+        'atom_names': [a.name for a in atoms],
+        'box_vectors': None if vectors is None else [list(v) for v in vectors.value_in_unit(nanometer)],
+        'groups': {} if groups is None else {k: list(map(int, v)) for k, v in groups.items()},
+    }
+    sections = {
+        'system': mm.XmlSerializer.serialize(system).encode(),
+        'integrator': mm.XmlSerializer.serialize(integrator).encode(),
+        'residue_chain': np.array([r.chain.index for r in residues], dtype=np.int32),
+        'atom_residue': np.array([a.residue.index for a in atoms], dtype=np.int32),
+        'atom_element': np.array([0 if a.element is None else a.element.atomic_number for a in atoms],
+                                 dtype=np.int32),
+        'bonds': bonds,
+        'positions': positions,
+    }
+
+    # the offsets are relative to the end of header, so that the header can be written first
+    index = {}
+    offset = 0
+    for name, data in sections.items():
+        offset = (offset + _ALIGN - 1) // _ALIGN * _ALIGN
+        if isinstance(data, np.ndarray):
+            index[name] = [offset, data.nbytes, data.dtype.str, list(data.shape)]
+            offset += data.nbytes
+        else:
+            index[name] = [offset, len(data), None, None]
+            offset += len(data)
+    meta['sections'] = index
+    header = json.dumps(meta).encode()
+    start = (len(_MAGIC) + 8 + len(header) + _ALIGN - 1) // _ALIGN * _ALIGN
+
+    tmp = file + '.tmp'
+    with open(tmp, 'wb') as f:
+        f.write(_MAGIC)
+        f.write(struct.pack('<Q', len(header)))
+        f.write(header)
+        for name, data in sections.items():
+            f.seek(start + index[name][0])
+            f.write(data.tobytes() if isinstance(data, np.ndarray) else data)
+        f.flush()
+        os.fsync(f.fileno())
+    os.replace(tmp, file)
+
+
+def load_prepared(file):
+    '''
+    Read a prepared run from a cache file.
+
+    Parameters
+    ----------
+    file : str
+
+    Returns
+    -------
+    topology : app.Topology
+    system : mm.System
+    integrator : mm.Integrator
+        If it is a VVIntegrator, it is returned as VVIntegrator
+    positions : np.ndarray of shape (n_atom, 3)
+        The positions in nm
+    groups : dict of str to list of int
+    '''
+    with open(file, 'rb') as f:
+        buffer = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    if buffer[:len(_MAGIC)] != _MAGIC:
+        raise Exception('Invalid prepared run cache: %s' % file)
+    header_length, = struct.unpack('<Q', buffer[len(_MAGIC):len(_MAGIC) + 8])
+    meta = json.loads(buffer[len(_MAGIC) + 8:len(_MAGIC) + 8 + header_length].decode())
+    start = (len(_MAGIC) + 8 + header_length + _ALIGN - 1) // _ALIGN * _ALIGN
+
+    def section(name):
+        offset, length, dtype, shape = meta['sections'][name]
+        if dtype is None:
+            return buffer[start + offset:start + offset + length].decode()
+        return np.frombuffer(buffer, dtype=np.dtype(dtype), count=int(np.prod(shape)),
+                             offset=start + offset).reshape(shape)
+
+    system = mm.XmlSerializer.deserialize(section('system'))
+    integrator = mm.XmlSerializer.deserialize(section('integrator'))
+    if type(integrator) is mm.Integrator:
+        # the type of plugin integrator is not known to XmlSerializer
+        from velocityverletplugin import VVIntegrator
+        base = integrator
+        integrator = VVIntegrator.cast(base)
+        integrator._base = base
+
+    topology = app.Topology()
+    chains = [topology.addChain(id) for id in meta['chains']]
+    residues = [topology.addResidue(name, chains[ic], id)
+                for name, id, ic in zip(meta['residue_names'], meta['residue_ids'], section('residue_chain'))]
+    elements = {}
+    atoms = []
+    for name, ir, z in zip(meta['atom_names'], section('atom_residue'), section('atom_element')):
+        if z not in elements:
+            elements[z] = None if z == 0 else app.element.Element.getByAtomicNumber(int(z))
+        atoms.append(topology.addAtom(name, elements[z], residues[ir]))
+    for i, j in section('bonds'):
+        topology.addBond(atoms[i], atoms[j])
+    if meta['box_vectors'] is not None:
+        topology.setPeriodicBoxVectors([mm.Vec3(*v) for v in meta['box_vectors']] * nanometer)
+
+    positions = np.array(section('positions'))
+    return topology, system, integrator, positions, meta['groups']
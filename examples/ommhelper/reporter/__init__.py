@@ -2,4 +2,5 @@ from .checkpointreporter import CheckpointReporter
 from .drudetemperaturereporter import DrudeTemperatureReporter
 from .groreporter import GroReporter
 from .statedatareporter import StateDataReporter
+from .trjreporter import TrjReporter
 from .viscosityreporter import ViscosityReporter
\ No newline at end of file
@@ -1,34 +1,72 @@
 import os
+import time
+import atexit
+import threading
+import queue
+from collections import deque
 import simtk.openmm as mm
 
 
 class CheckpointReporter():
     '''
     CheckpointReporter saves periodic checkpoints of a simulation.
-    The checkpoints will overwrite old files -- only the latest three will be kept.
+    The checkpoints will overwrite old files -- only the latest `keep` ones will be kept.
+    If the integrator has its own state (e.g. VVIntegrator), it will be saved with suffix '.vv'.
     State XML files can be saved together, in case the checkpoint files are broken.
 
+    The checkpoint is taken into a memory buffer, and written to disk by a background thread,
+    so that the simulation doesn't stall for the whole write.
+    Each file is written to a temporary file, synced and then renamed, so that a crash during writing
+    never leaves a truncated checkpoint with the final name.
+    At most one checkpoint is waiting to be written. If it is still waiting when the next one is taken,
+    the simulation is blocked until the writer catches up. The time blocked is recorded in `blockedTime`.
+
     Parameters
     ----------
     file : string
         The file to write to.
         Any current contents will be overwritten.
-        The latest three checkpoint will be kept with the step appended to the file name.
+        The latest checkpoints will be kept with the step appended to the file name.
     reportInterval : int
         The interval (in time steps) at which to write checkpoints.
     xml : string, optional
         If provided, the state will be serialized into XML format and saved together with checkpoint.
         Any current contents will be overwritten.
-        The latest three XML files will be kept with the step appended to the file name.
+        The latest XML files will be kept with the step appended to the file name.
+    keep : int
+        The number of latest checkpoints to keep.
+    keepInterval : int, optional
+        If provided, the checkpoints at multiple of this step will never be removed.
+    asynchronous : bool
+        If set to False, the checkpoints will be written in the simulation thread.
     '''
 
-    def __init__(self, file, reportInterval, xml=None):
+    def __init__(self, file, reportInterval, xml=None, keep=3, keepInterval=None, asynchronous=True):
         self._reportInterval = reportInterval
         self._file = file
         self._xml = xml
+        self._keep = keep
+        self._keepInterval = keepInterval
+        self._asynchronous = asynchronous
 
         if type(file) is not str:
             raise Exception('file should be str')
+        if keep < 1:
+            raise Exception('keep should be at least 1')
+
+        self._written = deque()
+        self._error = None
+        self.blockedTime = 0.0
+        self.lastBlockedTime = 0.0
+        self.numCheckpoints = 0
+
+        self._queue = None
+        self._thread = None
+        if asynchronous:
+            self._queue = queue.Queue(maxsize=1)
+            self._thread = threading.Thread(target=self._work, name='CheckpointWriter', daemon=True)
+            self._thread.start()
+            atexit.register(self.close)
 
     def describeNextReport(self, simulation):
         """Get information about the next report this object will generate.
@@ -47,7 +85,9 @@ class CheckpointReporter():
             energies respectively.
         """
         steps = self._reportInterval - simulation.currentStep % self._reportInterval
-        return (steps, True, True, False, False, False)
+        # the state is only required for the XML files
+        needState = self._xml is not None
+        return (steps, needState, needState, False, False, False)
 
     def report(self, simulation, state):
         """Generate a report.
@@ -59,21 +99,96 @@ class CheckpointReporter():
         state : State
             The current state of the simulation
         """
+        t0 = time.perf_counter()
+        self._raiseError()
 
-        filename = self._file + '_%i' % simulation.currentStep
-        with open(filename, 'wb') as out:
-            out.write(simulation.context.createCheckpoint())
+        step = simulation.currentStep
+        buffers = [(self._file + '_%i' % step, simulation.context.createCheckpoint())]
+        # the state of thermostats of VVIntegrator is not included in the checkpoint of Context
+        integrator = simulation.integrator
+        if hasattr(integrator, 'createCheckpoint'):
+            buffers.append((self._file + '_%i' % step + '.vv', integrator.createCheckpoint()))
+        # the State is already a copy on the host, so it can be serialized by the writer
+        xml = None
+        if self._xml is not None:
+            xml = (self._xml + '_%i' % step, state)
 
-        file_prev3 = self._file + '_%i' % (simulation.currentStep - 3 * self._reportInterval)
-        if os.path.exists(file_prev3):
-            os.remove(file_prev3)
+        if self._asynchronous:
+            self._queue.put((step, buffers, xml))
+        else:
+            self._write(step, buffers, xml)
 
-        if self._xml is not None:
-            xml_name = self._xml + '_%i' % simulation.currentStep
-            xml = mm.XmlSerializer.serialize(state)
-            with open(xml_name, 'w') as f:
-                f.write(xml)
-
-            xml_prev3 = self._xml + '_%i' % (simulation.currentStep - 3 * self._reportInterval)
-            if os.path.exists(xml_prev3):
-                os.remove(xml_prev3)
+        self.lastBlockedTime = time.perf_counter() - t0
+        self.blockedTime += self.lastBlockedTime
+        self.numCheckpoints += 1
+
+    def flush(self):
+        '''
+        Wait until all the checkpoints taken are written to disk.
+        '''
+        if self._asynchronous:
+            self._queue.join()
+        self._raiseError()
+
+    def close(self):
+        '''
+        Write the pending checkpoint and stop the writer thread.
+        It is called automatically at exit.
+        '''
+        if self._thread is not None and self._thread.is_alive():
+            self._queue.put(None)
+            self._thread.join()
+        self._thread = None
+        self._raiseError()
+
+    def _work(self):
+        while True:
+            job = self._queue.get()
+            try:
+                if job is None:
+                    return
+                if self._error is None:
+                    self._write(*job)
+            except Exception as e:
+                self._error = e
+            finally:
+                self._queue.task_done()
+
+    def _write(self, step, buffers, xml):
+        files = []
+        for filename, data in buffers:
+            self._writeAtomic(filename, data)
+            files.append(filename)
+        if xml is not None:
+            filename, state = xml
+            self._writeAtomic(filename, mm.XmlSerializer.serialize(state).encode())
+            files.append(filename)
+
+        if self._keepInterval is not None and step % self._keepInterval == 0:
+            return
+        self._written.append(files)
+        while len(self._written) > self._keep:
+            for filename in self._written.popleft():
+                if os.path.exists(filename):
+                    os.remove(filename)
+
+    @staticmethod
+    def _writeAtomic(filename, data):
+        tmp = filename + '.tmp'
+        with open(tmp, 'wb') as out:
+            out.write(data)
+            out.flush()
+            os.fsync(out.fileno())
+        os.replace(tmp, filename)
+        # make the rename itself durable
+        if hasattr(os, 'O_DIRECTORY'):
+            fd = os.open(os.path.dirname(os.path.abspath(filename)), os.O_RDONLY | os.O_DIRECTORY)
+            try:
+                os.fsync(fd)
+            finally:
+                os.close(fd)
+
+    def _raiseError(self):
+        if self._error is not None:
+            error, self._error = self._error, None
+            raise Exception('Failed to write checkpoint: %s' % error)
@@ -9,7 +9,7 @@ class DrudeTemperatureReporter(object):
 
     The temperatures for three sets of degrees of freedom are reported
     -- molecular center of mass, internal atomic and Drude temperature.
-    It's better to set the reportInterval larger than 10000 to avoid performance penalty
+    The molecules and Drude pairs are indexed once, so each report only takes one pass over the velocities.
 
     Parameters
     ----------
@@ -49,6 +49,45 @@ class DrudeTemperatureReporter(object):
         steps = self._reportInterval - simulation.currentStep%self._reportInterval
         return (steps, False, True, False, False)
 
+    def _initialize(self, simulation):
+        """Build the index arrays of molecules and Drude pairs, so that each report is one pass over the velocities.
+        """
+        system: mm.System = simulation.system
+        self.n_atom = system.getNumParticles()
+        self.masses = np.array([system.getParticleMass(i).value_in_unit(unit.dalton) for i in range(self.n_atom)])
+
+        molecules = simulation.context.getMolecules()
+        self.n_mol = len(molecules)
+        self.mol_atoms = np.zeros(self.n_atom, dtype=int)  # record which molecule the atoms are in
+        for i, atoms in enumerate(molecules):
+            self.mol_atoms[list(atoms)] = i
+        self.mass_molecules = np.bincount(self.mol_atoms, weights=self.masses, minlength=self.n_mol)
+        self.inv_mass_molecules = np.zeros(self.n_mol)
+        nonzero = self.mass_molecules > 0
+        self.inv_mass_molecules[nonzero] = 1 / self.mass_molecules[nonzero]
+
+        self.dof_com = np.count_nonzero(self.mass_molecules) * 3
+        self.dof_atom = 3 * np.count_nonzero(self.masses) - self.dof_com - system.getNumConstraints()
+        if any(type(f) == mm.CMMotionRemover for f in system.getForces()):
+            self.dof_com -= 3
+
+        force = next(f for f in system.getForces() if type(f) == mm.DrudeForce)
+        pairs = np.array([force.getParticleParameters(i)[:2] for i in range(force.getNumParticles())],
+                         dtype=int).reshape(-1, 2)
+        self.dof_atom -= 3 * len(pairs)
+        self.dof_drude = 3 * len(pairs)
+        self.pair_drude = pairs[:, 0]
+        self.pair_core = pairs[:, 1]
+        m_drude = self.masses[self.pair_drude]
+        m_core = self.masses[self.pair_core]
+        self.pair_mass_com = m_drude + m_core
+        self.pair_mass_rel = m_drude * m_core / self.pair_mass_com
+
+        is_drude = np.zeros(self.n_atom, dtype=bool)
+        is_drude[self.pair_drude] = True
+        self.drude_array = np.nonzero(is_drude)[0]
+        self.atom_array = np.nonzero(~is_drude)[0]
+
     def report(self, simulation, state):
         """Generate a report.
 
@@ -59,70 +98,36 @@ class DrudeTemperatureReporter(object):
         state : State
             The current state of the simulation
         """
-        system: mm.System = simulation.system
         if not self._hasInitialized:
-            self.n_atom = system.getNumParticles()
-            self.molecules: [[int]] = [list(atoms) for atoms in simulation.context.getMolecules()]
-            self.n_mol = len(self.molecules)
-            self.mol_atoms = np.zeros(self.n_atom, dtype=int)  # record which molecule the atoms are in
-            self.mass_molecules = np.zeros(self.n_mol) # record the mass of molecules
-            for i, atoms in enumerate(self.molecules):
-                for atom in atoms:
-                    self.mol_atoms[atom] = i
-                    self.mass_molecules[i] += system.getParticleMass(atom).value_in_unit(unit.dalton)
-
-            self.dof_com = np.count_nonzero(self.mass_molecules) * 3
-            self.dof_atom = self.dof_drude = 0
-            for i in range(self.n_atom):
-                if system.getParticleMass(i) > 0 * unit.dalton:
-                    self.dof_atom += 3
-            self.dof_atom -= (self.dof_com + system.getNumConstraints())
-
-            if any(type(f) == mm.CMMotionRemover for f in system.getForces()):
-                self.dof_com -= 3
-
-            drude_set = set()
-            self.pair_set = set()
-            force = next(f for f in system.getForces() if type(f) == mm.DrudeForce)
-            self.dof_atom -= 3 * force.getNumParticles()
-            self.dof_drude += 3 * force.getNumParticles()
-            for i in range(force.getNumParticles()):
-                i_drude, i_core = force.getParticleParameters(i)[:2]
-                drude_set.add(i_drude)
-                self.pair_set.add((i_drude, i_core))
-            self.drude_array = np.array(list(drude_set))
-            self.atom_array = np.array(list(set(range(self.n_atom)) - drude_set))
-
+            self._initialize(simulation)
             self._hasInitialized = True
             print('#"Step"\t"T_COM"\t"T_Atom"\t"T_Drude"\t"KE_COM"\t"KE_Atom"\t"KE_Drude"', file=self._out)
 
         velocities = state.getVelocities(asNumpy=True).value_in_unit(unit.nanometer / unit.picosecond)
-        masses = np.array([system.getParticleMass(i).value_in_unit(unit.dalton) for i in range(self.n_atom)])
+        velocities = np.array(velocities, dtype=float)
+        masses = self.masses.copy()
 
+        # COM velocities of molecules from one pass over the atoms
+        mv = masses[:, np.newaxis] * velocities
         vel_mol = np.zeros([self.n_mol, 3])
-        for i, atoms in enumerate(self.molecules):
-            if self.mass_molecules[i] == 0:
-                continue
-            mv = masses[atoms][:, np.newaxis] * velocities[atoms]
-            vel_mol[i] = np.sum(mv, axis=0) / self.mass_molecules[i]
+        for k in range(3):
+            vel_mol[:, k] = np.bincount(self.mol_atoms, weights=mv[:, k], minlength=self.n_mol)
+        vel_mol *= self.inv_mass_molecules[:, np.newaxis]
         mvv_com = self.mass_molecules * np.sum(vel_mol ** 2, axis=1)
         ke_com = mvv_com.sum() / 2 * (unit.nanometer / unit.picosecond) ** 2 * unit.dalton
         t_com = (2 * ke_com / (self.dof_com * unit.MOLAR_GAS_CONSTANT_R))
 
-        velocities -= np.array([vel_mol[self.mol_atoms[i]] for i in range(self.n_atom)])
-        for i_drude, i_core in self.pair_set:
-            v_drude = velocities[i_drude]
-            v_core = velocities[i_core]
-            m_drude = masses[i_drude]
-            m_core = masses[i_core]
-            m_com = m_drude + m_core
-            m_rel = m_drude * m_core / m_com
-            v_com = (m_drude * v_drude + m_core * v_core) / m_com
-            v_rel = v_drude - v_core
-            velocities[i_drude] = v_rel
-            velocities[i_core] = v_com
-            masses[i_drude] = m_rel
-            masses[i_core] = m_com
+        velocities -= vel_mol[self.mol_atoms]
+        # Drude pairs are replaced by their COM and relative motion
+        v_drude = velocities[self.pair_drude]
+        v_core = velocities[self.pair_core]
+        m_drude = masses[self.pair_drude][:, np.newaxis]
+        m_core = masses[self.pair_core][:, np.newaxis]
+        velocities[self.pair_drude] = v_drude - v_core
+        velocities[self.pair_core] = (m_drude * v_drude + m_core * v_core) / (m_drude + m_core)
+        masses[self.pair_drude] = self.pair_mass_rel
+        masses[self.pair_core] = self.pair_mass_com
+
         mvv = masses * np.sum(velocities ** 2, axis=1)
         ke = mvv[self.atom_array].sum() / 2 * (unit.nanometer / unit.picosecond) ** 2 * unit.dalton
         ke_drude = mvv[self.drude_array].sum() / 2 * (unit.nanometer / unit.picosecond) ** 2 * unit.dalton
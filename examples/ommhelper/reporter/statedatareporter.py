@@ -52,6 +52,7 @@ import simtk.openmm as mm
 import simtk.unit as unit
 import math
 import time
+from ..statistics import StreamingStatistics
 
 
 class StateDataReporter(object):
@@ -117,12 +118,19 @@ class StateDataReporter(object):
         and defines how many steps will indicate 100% completion.
     cvs : list=[]
         Collective variables defined by CustomCVForce
+    maxBlocks : int=1024
+        The number of blocks kept for the windowed averages of each observable. See StreamingStatistics.
+
+    The statistics of the energies, temperature, volume, box size, density and collective variables
+    are accumulated in bounded memory during the simulation, so that the reporter can run for any number of reports.
+    They can be retrieved with getStatistics().
     '''
 
     def __init__(self, file, reportInterval, step=True, time=True, potentialEnergy=True,
                  kineticEnergy=False, totalEnergy=False, temperature=True, volume=False, box=True,
                  density=True, progress=False, remainingTime=False, speed=True, elapsedTime=True,
-                 separator='\t', systemMass=None, totalSteps=None, append=False, cvs=[]):
+                 separator='\t', systemMass=None, totalSteps=None, append=False, cvs=[],
+                 maxBlocks=1024):
         self._reportInterval = reportInterval
         self._openedFile = isinstance(file, str)
         if (progress or remainingTime) and totalSteps is None:
@@ -157,7 +165,8 @@ class StateDataReporter(object):
         self._needsForces = False
         self._needEnergy = potentialEnergy or kineticEnergy or totalEnergy or temperature
 
-        self._boxSizeList = [[], [], []]
+        self._maxBlocks = maxBlocks
+        self._statistics = {}
 
         self._cvs = cvs
 
@@ -236,6 +245,8 @@ class StateDataReporter(object):
         values = []
         box = state.getPeriodicBoxVectors()
         volume = box[0][0] * box[1][1] * box[2][2]
+        lx, ly, lz = (self._record(name, box[i][i].value_in_unit(unit.nanometer))
+                      for i, name in enumerate(('Lx', 'Ly', 'Lz')))
         clockTime = time.time()
         if self._progress:
             values.append('%.1f%%' % (100.0 * simulation.currentStep / self._totalSteps))
@@ -244,26 +255,27 @@ class StateDataReporter(object):
         if self._time:
             values.append('%.4f' % state.getTime().value_in_unit(unit.picosecond))
         if self._potentialEnergy:
-            values.append(
-                '%.4f' % state.getPotentialEnergy().value_in_unit(unit.kilojoules_per_mole))
+            values.append('%.4f' % self._record(
+                'E_potential', state.getPotentialEnergy().value_in_unit(unit.kilojoules_per_mole)))
         if self._kineticEnergy:
-            values.append('%.4f' % state.getKineticEnergy().value_in_unit(unit.kilojoules_per_mole))
+            values.append('%.4f' % self._record(
+                'E_kinetic', state.getKineticEnergy().value_in_unit(unit.kilojoules_per_mole)))
         if self._totalEnergy:
-            values.append(
-                '%.4f' % (state.getKineticEnergy() + state.getPotentialEnergy()).value_in_unit(
-                    unit.kilojoules_per_mole))
+            values.append('%.4f' % self._record(
+                'E_total', (state.getKineticEnergy() + state.getPotentialEnergy()).value_in_unit(
+                    unit.kilojoules_per_mole)))
         if self._temperature:
-            values.append('%.2f' % (2 * state.getKineticEnergy() / (
-                        self._dof * unit.MOLAR_GAS_CONSTANT_R)).value_in_unit(unit.kelvin))
+            values.append('%.2f' % self._record('T', (2 * state.getKineticEnergy() / (
+                    self._dof * unit.MOLAR_GAS_CONSTANT_R)).value_in_unit(unit.kelvin)))
         if self._volume:
-            values.append('%.4f' % volume.value_in_unit(unit.nanometer ** 3))
+            values.append('%.4f' % self._record('Vol', volume.value_in_unit(unit.nanometer ** 3)))
         if self._box:
-            values.append('%.4f' % box[0][0].value_in_unit(unit.nanometer))
-            values.append('%.4f' % box[1][1].value_in_unit(unit.nanometer))
-            values.append('%.4f' % box[2][2].value_in_unit(unit.nanometer))
+            values.append('%.4f' % lx)
+            values.append('%.4f' % ly)
+            values.append('%.4f' % lz)
         if self._density:
-            values.append('%.4f' % (self._totalMass / volume).value_in_unit(
-                unit.gram / unit.item / unit.milliliter))
+            values.append('%.4f' % self._record('Density', (self._totalMass / volume).value_in_unit(
+                unit.gram / unit.item / unit.milliliter)))
         if self._speed:
             elapsedDays = (clockTime - self._initialClockTime) / 86400.0
             elapsedNs = (state.getTime() - self._initialSimulationTime).value_in_unit(
@@ -299,15 +311,18 @@ class StateDataReporter(object):
                 else:
                     value = "0:%02d" % remainingSeconds
             values.append(value)
-        for cv in self._cvs:
-            values.append(cv.getCollectiveVariableValues(simulation.context)[0])
-
-        self._boxSizeList[0].append(box[0][0].value_in_unit(unit.nanometer)),
-        self._boxSizeList[1].append(box[1][1].value_in_unit(unit.nanometer)),
-        self._boxSizeList[2].append(box[2][2].value_in_unit(unit.nanometer)),
+        for i, cv in enumerate(self._cvs):
+            values.append(self._record('CV%i' % i, cv.getCollectiveVariableValues(simulation.context)[0]))
 
         return values
 
+    def _record(self, name, value):
+        stat = self._statistics.get(name)
+        if stat is None:
+            stat = self._statistics[name] = StreamingStatistics(self._maxBlocks)
+        stat.add(value)
+        return value
+
     def _initializeConstants(self, simulation):
         """Initialize a set of constants required for the reports
 
@@ -408,8 +423,23 @@ class StateDataReporter(object):
         ly : float
         lz : float
         '''
-        n = math.ceil(len(self._boxSizeList[0]) * timeFraction)
-        lx = sum(self._boxSizeList[0][-n:]) / n
-        ly = sum(self._boxSizeList[1][-n:]) / n
-        lz = sum(self._boxSizeList[2][-n:]) / n
-        return (lx, ly, lz)
+        return tuple(self._statistics[name].getWindowAverage(timeFraction) for name in ('Lx', 'Ly', 'Lz'))
+
+    def getStatistics(self, name=None):
+        '''
+        Get the statistics of reported observables since this reporter was added.
+
+        Parameters
+        ----------
+        name : str, optional
+            The header of the observable, e.g. 'E_potential', 'T', 'Density', 'Lz' or 'CV0'.
+            The box size is always recorded, even if it is not written to the file.
+            If not provided, the statistics of all the observables will be returned.
+
+        Returns
+        -------
+        statistics : StreamingStatistics or dict of str to StreamingStatistics
+        '''
+        if name is None:
+            return dict(self._statistics)
+        return self._statistics[name]
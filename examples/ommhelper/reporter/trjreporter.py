@@ -0,0 +1,146 @@
+import math
+import atexit
+import threading
+import queue
+import numpy as np
+from simtk.unit import nanometer, picosecond
+from .. import TrjFile
+
+
+class TrjReporter(object):
+    '''
+    TrjReporter outputs a series of frames from a Simulation to a compressed binary trajectory.
+    It is a much faster and smaller replacement of GroReporter for full frames.
+    See TrjFile for the format.
+
+    The positions are copied out of the State in the simulation thread,
+    and the compression and writing are done by a background thread.
+
+    Parameters
+    ----------
+    file : string
+        The file to write to
+    reportInterval : int
+        The interval (in time steps) at which to write frames
+    logarithm : bool
+        If set to True, then write trajectory at logarithm interval.
+        reportInterval will be the minimum step for reporting.
+        e.g. when reportInterval set to 30, then report at [30, 40, 50, ..., 90, 100, 200, ..., 900, 1000, 2000, ...] steps.
+    enforcePeriodicBox: bool
+        Specifies whether particle positions should be translated
+        so the center of every molecule lies in the same periodic box.
+    subset : list(int)=None
+        If not None, only the selected atoms will be written
+    precision : float
+        The positions are rounded to 1/precision nm. The default 1000 is the same as GRO file.
+    append: bool
+        If set to True, will append to file
+    '''
+
+    def __init__(self, file, reportInterval, logarithm=False, enforcePeriodicBox=False, subset=None, precision=1000.0,
+                 append=False):
+        self._reportInterval = reportInterval
+        self._logarithm = logarithm
+        self._enforcePeriodicBox = enforcePeriodicBox
+        self._precision = precision
+        if append:
+            self._out = open(file, 'ab')
+        else:
+            self._out = open(file, 'wb')
+
+        if subset is None:
+            self._subset = None
+        else:
+            self._subset = np.array(subset, dtype=int)
+
+        self._error = None
+        self._queue = queue.Queue(maxsize=2)
+        self._thread = threading.Thread(target=self._work, name='TrjWriter', daemon=True)
+        self._thread.start()
+        atexit.register(self.close)
+
+    def describeNextReport(self, simulation):
+        """Get information about the next report this object will generate.
+
+        Parameters
+        ----------
+        simulation : Simulation
+            The Simulation to generate a report for
+
+        Returns
+        -------
+        tuple
+            A six element tuple. The first element is the number of steps
+            until the next report. The next four elements specify whether
+            that report will require positions, velocities, forces, and
+            energies respectively.  The final element specifies whether
+            positions should be wrapped to lie in a single periodic box.
+        """
+        if self._logarithm:
+            if simulation.currentStep < self._reportInterval:
+                _base = self._reportInterval
+            else:
+                _base = 10 ** math.floor(math.log10(simulation.currentStep))
+            steps = _base - simulation.currentStep % _base
+        else:
+            steps = self._reportInterval - simulation.currentStep % self._reportInterval
+
+        return (steps, True, False, False, False, self._enforcePeriodicBox)
+
+    def report(self, simulation, state):
+        """Generate a report.
+
+        Parameters
+        ----------
+        simulation : Simulation
+            The Simulation to generate a report for
+        state : State
+            The current state of the simulation
+        """
+        if self._error is not None:
+            error, self._error = self._error, None
+            raise Exception('Failed to write trajectory: %s' % error)
+
+        time = state.getTime().value_in_unit(picosecond)
+        positions = state.getPositions(asNumpy=True).value_in_unit(nanometer)
+        if self._subset is not None:
+            positions = positions[self._subset]
+        else:
+            positions = np.array(positions)
+        vectors = state.getPeriodicBoxVectors(asNumpy=True).value_in_unit(nanometer)
+        self._queue.put((positions, np.array(vectors), simulation.currentStep, time))
+
+    def flush(self):
+        '''
+        Wait until all the frames reported are written to disk.
+        '''
+        self._queue.join()
+
+    def close(self):
+        '''
+        Write the pending frames and close the file.
+        It is called automatically at exit.
+        '''
+        if self._thread is not None and self._thread.is_alive():
+            self._queue.put(None)
+            self._thread.join()
+        self._thread = None
+        if not self._out.closed:
+            self._out.close()
+
+    def _work(self):
+        while True:
+            frame = self._queue.get()
+            try:
+                if frame is None:
+                    return
+                positions, vectors, step, time = frame
+                TrjFile.writeFrame(self._out, positions, vectors, step, time, self._precision)
+                self._out.flush()
+            except Exception as e:
+                self._error = e
+            finally:
+                self._queue.task_done()
+
+    def __del__(self):
+        self.close()
@@ -0,0 +1,154 @@
+import math
+
+
+class StreamingStatistics(object):
+    '''
+    StreamingStatistics accumulates the statistics of a time series in bounded memory.
+
+    The mean and variance are accumulated with Welford's algorithm.
+    The standard error of the mean is estimated by block averaging (Flyvbjerg and Petersen),
+    for which the values are averaged in pairs recursively, so that there is one level per doubling of the length.
+    The average over the last part of the series is obtained from a coarse history of block sums.
+    When the history is full, neighbouring blocks are merged and the block size is doubled.
+
+    Parameters
+    ----------
+    maxBlocks : int
+        The maximum number of blocks kept in the history.
+        The resolution of windowed averages is about n/maxBlocks values.
+    '''
+
+    def __init__(self, maxBlocks=1024):
+        self._maxBlocks = max(2, maxBlocks // 2 * 2)
+        self.reset()
+
+    def reset(self):
+        '''
+        Remove all the values
+        '''
+        self.n = 0
+        self._mean = 0.0
+        self._m2 = 0.0
+        # for each blocking level: [count, mean, M2, value waiting for its pair]
+        self._levels = []
+        # history of full blocks, and the block being filled
+        self._blockSize = 1
+        self._blockSums = []
+        self._partialSum = 0.0
+        self._partialCount = 0
+
+    def add(self, x):
+        '''
+        Add a value to the series
+
+        Parameters
+        ----------
+        x : float
+        '''
+        x = float(x)
+        self.n += 1
+        delta = x - self._mean
+        self._mean += delta / self.n
+        self._m2 += delta * (x - self._mean)
+
+        self._partialSum += x
+        self._partialCount += 1
+        if self._partialCount == self._blockSize:
+            self._blockSums.append(self._partialSum)
+            self._partialSum = 0.0
+            self._partialCount = 0
+            if len(self._blockSums) == self._maxBlocks:
+                self._blockSums = [self._blockSums[i] + self._blockSums[i + 1]
+                                   for i in range(0, self._maxBlocks, 2)]
+                self._blockSize *= 2
+
+        level = 0
+        while True:
+            if level == len(self._levels):
+                self._levels.append([0, 0.0, 0.0, None])
+            stat = self._levels[level]
+            stat[0] += 1
+            delta = x - stat[1]
+            stat[1] += delta / stat[0]
+            stat[2] += delta * (x - stat[1])
+            if stat[3] is None:
+                stat[3] = x
+                break
+            x = (stat[3] + x) / 2
+            stat[3] = None
+            level += 1
+
+    @property
+    def mean(self):
+        return self._mean if self.n > 0 else math.nan
+
+    @property
+    def variance(self):
+        return self._m2 / (self.n - 1) if self.n > 1 else math.nan
+
+    @property
+    def std(self):
+        return math.sqrt(self.variance) if self.n > 1 else math.nan
+
+    def getError(self, minBlocks=16):
+        '''
+        Get the standard error of the mean, taking into account the correlation between consecutive values.
+
+        The error estimated from the block means grows with the block size until the blocks become uncorrelated.
+        The largest estimate over the block sizes with at least minBlocks blocks is returned.
+
+        Parameters
+        ----------
+        minBlocks : int
+            The levels with fewer blocks are too noisy to be used
+
+        Returns
+        -------
+        error : float
+        '''
+        if self.n < 2:
+            return math.nan
+        error = math.sqrt(self._m2 / (self.n - 1) / self.n)
+        for count, _, m2, _ in self._levels[1:]:
+            if count < max(2, minBlocks):
+                break
+            error = max(error, math.sqrt(m2 / (count - 1) / count))
+        return error
+
+    def getWindowAverage(self, fraction=0.5):
+        '''
+        Get the average over the last part of the series.
+        It is exact only when n <= maxBlocks, otherwise the oldest block in the window is taken partially.
+
+        Parameters
+        ----------
+        fraction : float
+            The fraction of the series to be averaged, counted from the end
+
+        Returns
+        -------
+        average : float
+        '''
+        if self.n == 0:
+            return math.nan
+        target = max(1, int(round(self.n * fraction)))
+        total = self._partialSum
+        count = self._partialCount
+        for blockSum in reversed(self._blockSums):
+            if count >= target:
+                break
+            # the oldest block in the window is taken partially, assuming its values are uniform
+            taken = min(self._blockSize, target - count)
+            total += blockSum * taken / self._blockSize
+            count += taken
+        return total / count
+
+    def summary(self):
+        '''
+        Get the number of values, mean, standard deviation and the standard error of the mean
+
+        Returns
+        -------
+        summary : tuple of (int, float, float, float)
+        '''
+        return self.n, self.mean, self.std, self.getError()
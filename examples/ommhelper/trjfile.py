@@ -0,0 +1,123 @@
+import struct
+import zlib
+import numpy as np
+from simtk.unit import nanometer, picosecond, is_quantity
+
+
+class TrjFile():
+    '''
+    TrjFile is a writer and reader for compressed binary trajectory.
+
+    The coordinates are stored in the same lossy way as XTC format.
+    They are rounded to integers with given precision, which is 1000 by default (0.001 nm, as in GRO file),
+    and the difference between consecutive atoms is taken, because neighbouring atoms are close in space.
+    The bytes of the differences are shuffled and compressed with zlib.
+
+    Each frame is stored as a header of magic, number of atoms, step, time (ps), precision and box vectors (nm),
+    followed by the minimum of the integer coordinates, the length of compressed data and the compressed data.
+    '''
+
+    MAGIC = b'TRJ1'
+    _HEADER = struct.Struct('<4sIqdf9f3iI')
+
+    @staticmethod
+    def writeFrame(file, positions, vectors, step=0, time=0.0, precision=1000.0, subset=None):
+        '''
+        Write positions of atoms as one frame
+
+        Parameters
+        ----------
+        file : FileIO
+            The file opened in binary mode
+        positions : array_like of shape (n_atom, 3)
+            The length of positions should equal to the number of atoms, even when subset is provided.
+        vectors : array_like of shape (3, 3)
+            The full box vectors.
+        step : int
+        time : float
+        precision : float
+            The coordinates are rounded to 1/precision nm.
+        subset : array_like of int, optional
+            If not provided, then all atoms will be written.
+        '''
+        file.write(TrjFile.encodeFrame(positions, vectors, step, time, precision, subset))
+
+    @staticmethod
+    def encodeFrame(positions, vectors, step=0, time=0.0, precision=1000.0, subset=None):
+        '''
+        Encode positions of atoms as one frame in bytes. The arguments are the same as writeFrame.
+        '''
+        if is_quantity(positions):
+            positions = positions.value_in_unit(nanometer)
+        if is_quantity(vectors):
+            vectors = vectors.value_in_unit(nanometer)
+        if is_quantity(time):
+            time = time.value_in_unit(picosecond)
+        positions = np.asarray(positions, dtype=np.float64)
+        if subset is not None:
+            positions = positions[subset]
+
+        coords = np.rint(positions * precision).astype(np.int64)
+        lower = coords.min(axis=0) if len(coords) > 0 else np.zeros(3, dtype=np.int64)
+        coords -= lower
+        if len(coords) > 0 and coords.max() >= 2 ** 31:
+            raise ValueError('The coordinates are too large for precision %g' % precision)
+        deltas = np.diff(coords.astype(np.int32), axis=0, prepend=np.zeros((1, 3), dtype=np.int32))
+        # the high bytes of small differences are mostly zero, so they are put together
+        shuffled = deltas.astype('<i4').view(np.uint8).reshape(-1, 4).T.tobytes()
+        data = zlib.compress(shuffled, 6)
+
+        box = np.asarray(vectors, dtype=np.float64).reshape(9)
+        header = TrjFile._HEADER.pack(TrjFile.MAGIC, len(coords), int(step), float(time), float(precision),
+                                      *box, *lower.astype(int).tolist(), len(data))
+        return header + data
+
+    @staticmethod
+    def readFrames(file):
+        '''
+        Read all frames from a file
+
+        Parameters
+        ----------
+        file : str or FileIO
+            The file opened in binary mode
+
+        Yields
+        ------
+        step : int
+        time : float
+            The time in ps
+        positions : np.ndarray of shape (n_atom, 3)
+            The positions in nm
+        vectors : np.ndarray of shape (3, 3)
+            The box vectors in nm
+        '''
+        if type(file) is str:
+            _file = open(file, 'rb')
+        else:
+            _file = file
+
+        try:
+            while True:
+                header = _file.read(TrjFile._HEADER.size)
+                if len(header) == 0:
+                    break
+                if len(header) < TrjFile._HEADER.size:
+                    raise ValueError('Truncated frame header')
+                values = TrjFile._HEADER.unpack(header)
+                if values[0] != TrjFile.MAGIC:
+                    raise ValueError('Invalid frame header')
+                n_atom, step, time, precision = values[1:5]
+                vectors = np.array(values[5:14]).reshape(3, 3)
+                lower = np.array(values[14:17], dtype=np.int64)
+                data = _file.read(values[17])
+                if len(data) < values[17]:
+                    raise ValueError('Truncated frame data')
+
+                shuffled = np.frombuffer(zlib.decompress(data), dtype=np.uint8)
+                deltas = shuffled.reshape(4, -1).T.copy().view('<i4').reshape(n_atom, 3)
+                coords = np.cumsum(deltas, axis=0, dtype=np.int64) + lower
+                yield step, time, coords / precision, vectors
+        finally:
+            if type(file) is str:
+                _file.close()
@@ -54,10 +54,29 @@ def apply_mc_barostat(system, pcoupl, P, T, nsteps=100):
         raise Exception('Available pressure coupling types: iso, semi-iso, xyz, xy, z')
 
 
+def get_force_group_energies(sim: app.Simulation):
+    '''
+    Get the potential energy of all 32 force groups.
+    The groups without any force are skipped, and each group in use costs one energy evaluation,
+    either by VVIntegrator.getForceGroupEnergies() or from the Context.
+
+    Returns
+    -------
+    energies : list of Quantity
+    '''
+    if hasattr(sim.integrator, 'getForceGroupEnergies'):
+        return list(sim.integrator.getForceGroupEnergies())
+
+    groupsInUse = set(f.getForceGroup() for f in sim.system.getForces())
+    return [sim.context.getState(getEnergy=True, groups={group}).getPotentialEnergy()
+            if group in groupsInUse else 0 * kJ_mol for group in range(32)]
+
+
 def energy_decomposition(sim: app.Simulation, groups=None):
     if groups is None:
         groups = range(32)
+    energies = get_force_group_energies(sim)
     for group in groups:
-        energy = sim.context.getState(getEnergy=True, groups={group}).getPotentialEnergy()
+        energy = energies[group]
         if energy.value_in_unit(kJ_mol) != 0 or group < 10:
             print('E_%i:' % group, energy)
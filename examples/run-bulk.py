@@ -1,5 +1,6 @@
 #!/usr/bin/env python3
 
+import os
 import sys
 import argparse
 import simtk.openmm as mm
@@ -26,9 +27,7 @@ parser.add_argument('--min', action='store_true', help='minimize energy before s
 args = parser.parse_args()
 
 
-def gen_simulation(gro_file='conf.gro', psf_file='topol.psf', prm_file='ff.prm',
-                   dt=0.001, T=300, P=1, tcoupl='langevin', pcoupl='iso',
-                   cos=0, restart=None):
+def build_system(gro_file, psf_file, prm_file, dt, T, P, tcoupl, pcoupl, cos):
     print('Building system...')
     gro = oh.GroFile(gro_file)
     psf = oh.OplsPsfFile(psf_file, periodicBoxVectors=gro.getPeriodicBoxVectors())
@@ -44,7 +43,6 @@ def gen_simulation(gro_file='conf.gro', psf_file='topol.psf', prm_file='ff.prm',
         ttforce = oh.CLPolCoulTT(system, donors)
         print(ttforce.getEnergyFunction())
 
-    print('Initializing simulation...')
     if tcoupl == 'langevin':
         if is_drude:
             print('Drude Langevin thermostat: 5.0 /ps, 20 /ps')
@@ -75,23 +73,46 @@ def gen_simulation(gro_file='conf.gro', psf_file='topol.psf', prm_file='ff.prm',
         except:
             raise Exception('Cosine acceleration not compatible with this integrator')
 
+    return psf.topology, system, integrator, gro.positions.value_in_unit(nm)
+
+
+def gen_simulation(gro_file='conf.gro', psf_file='topol.psf', prm_file='ff.prm',
+                   dt=0.001, T=300, P=1, tcoupl='langevin', pcoupl='iso',
+                   cos=0, restart=None):
+    ### the prepared system is cached, so that restarting doesn't need to build it again
+    key = oh.prepared_cache_key([__file__, gro_file, psf_file, prm_file], dt=dt, T=T, P=P,
+                                tcoupl=tcoupl, pcoupl=pcoupl, cos=cos)
+    cache = 'prepared-%s.omm' % key
+    if os.path.exists(cache):
+        print('Loading prepared system from %s...' % cache)
+        topology, system, integrator, positions, _ = oh.load_prepared(cache)
+    else:
+        topology, system, integrator, positions = build_system(gro_file, psf_file, prm_file,
+                                                               dt, T, P, tcoupl, pcoupl, cos)
+        oh.save_prepared(cache, topology, system, integrator, positions)
+    is_drude = any(type(f) == mm.DrudeForce for f in system.getForces())
+
+    print('Initializing simulation...')
     _platform = mm.Platform.getPlatformByName('CUDA')
     _properties = {'CudaPrecision': 'mixed'}
-    sim = app.Simulation(psf.topology, system, integrator, _platform, _properties)
+    sim = app.Simulation(topology, system, integrator, _platform, _properties)
     if restart:
         sim.loadCheckpoint(restart)
+        if os.path.exists(restart + '.vv'):
+            with open(restart + '.vv', 'rb') as f:
+                integrator.loadCheckpoint(f.read())
         sim.currentStep = round(sim.context.getState().getTime().value_in_unit(ps) / dt / 10) * 10
         sim.context.setTime(sim.currentStep * dt)
         append = True
     else:
-        sim.context.setPositions(gro.positions)
+        sim.context.setPositions(positions * nm)
         sim.context.setVelocitiesToTemperature(T * kelvin)
         append = False
 
     sim.reporters.append(app.DCDReporter('dump.dcd', 10000, enforcePeriodicBox=False,
                                          append=append))
     sim.reporters.append(oh.CheckpointReporter('cpt.cpt', 10000))
-    sim.reporters.append(oh.GroReporter('dump.gro', 1000, logarithm=True, append=append))
+    sim.reporters.append(oh.TrjReporter('dump.trj', 1000, logarithm=True, append=append))
     sim.reporters.append(oh.StateDataReporter(sys.stdout, 1000, box=False, volume=True,
                                               append=append))
     if is_drude:
@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 
 import argparse
+import os
 import sys
 import random
 import simtk.openmm as mm
@@ -20,8 +21,7 @@ parser.add_argument('--cpt', type=str, help='load checkpoint')
 args = parser.parse_args()
 
 
-def gen_simulation(gro_file='conf.gro', psf_file='topol.psf', prm_file='ff.prm',
-                   dt=0.001, T=333, voltage=0, restart=None):
+def build_system(gro_file, psf_file, prm_file, dt, T, voltage):
     print('Building system...')
     gro = oh.GroFile(gro_file)
     lz = gro.getUnitCellDimensions()[2].value_in_unit(nm)
@@ -100,24 +100,45 @@ def gen_simulation(gro_file='conf.gro', psf_file='topol.psf', prm_file='ff.prm',
         for i in group_ils:
             integrator.addParticleElectrolyte(i)
 
+    positions = gro.positions.value_in_unit(nm)
+    return psf.topology, system, integrator, positions, {'mos': group_mos, 'ils': group_ils}
+
+
+def gen_simulation(gro_file='conf.gro', psf_file='topol.psf', prm_file='ff.prm',
+                   dt=0.001, T=333, voltage=0, restart=None):
+    ### the prepared system is cached, so that restarting doesn't need to build it again
+    key = oh.prepared_cache_key([__file__, gro_file, psf_file, prm_file], dt=dt, T=T, voltage=voltage)
+    cache = 'prepared-%s.omm' % key
+    if os.path.exists(cache):
+        print('Loading prepared system from %s...' % cache)
+        topology, system, integrator, positions, groups = oh.load_prepared(cache)
+    else:
+        topology, system, integrator, positions, groups = build_system(gro_file, psf_file, prm_file,
+                                                                       dt, T, voltage)
+        oh.save_prepared(cache, topology, system, integrator, positions, groups)
+    group_mos, group_ils = groups['mos'], groups['ils']
+
     print('Initializing simulation...')
     _platform = mm.Platform.getPlatformByName('CUDA')
     _properties = {'CudaPrecision': 'mixed'}
-    sim = app.Simulation(psf.topology, system, integrator, _platform, _properties)
+    sim = app.Simulation(topology, system, integrator, _platform, _properties)
     if restart:
         sim.loadCheckpoint(restart)
+        if os.path.exists(restart + '.vv'):
+            with open(restart + '.vv', 'rb') as f:
+                integrator.loadCheckpoint(f.read())
         sim.currentStep = round(sim.context.getState().getTime().value_in_unit(ps) / dt / 10) * 10
         sim.context.setTime(sim.currentStep * dt)
         append = True
     else:
-        sim.context.setPositions(gro.positions)
+        sim.context.setPositions(positions * nm)
         sim.context.setVelocitiesToTemperature(T * kelvin)
         append = False
 
     sim.reporters.append(app.DCDReporter('dump.dcd', 10000, enforcePeriodicBox=False,
                                          append=append))
     sim.reporters.append(oh.CheckpointReporter('cpt.cpt', 10000))
-    sim.reporters.append(oh.GroReporter('dump.gro', 1000, logarithm=True,
+    sim.reporters.append(oh.TrjReporter('dump.trj', 1000, logarithm=True,
                                         subset=group_mos + group_ils, append=append))
     sim.reporters.append(oh.StateDataReporter(sys.stdout, 10000, box=False, append=append))
     sim.reporters.append(oh.DrudeTemperatureReporter('T_drude.txt', 100000, append=append))
@@ -33,6 +33,8 @@
  * -------------------------------------------------------------------------- */
 
 #include <algorithm>
+#include <iosfwd>
+#include <map>
 #include "openmm/Integrator.h"
 #include "openmm/Kernel.h"
 #include "openmm/internal/windowsExportDrude.h"
@@ -48,6 +50,50 @@ namespace OpenMM {
 
 class OPENMM_EXPORT_DRUDE VVIntegrator : public Integrator {
 public:
+    /**
+     * The parameters which can be varied with time by a schedule
+     */
+    enum ScheduleParameter {
+        ScheduleTemperature = 0,
+        ScheduleDrudeTemperature = 1,
+        ScheduleElectricField = 2,
+        ScheduleCosAcceleration = 3
+    };
+    /**
+     * The groups of particles for which density profiles are accumulated.
+     * Drude particles belong to the group of their parent atoms.
+     */
+    enum ProfileGroup {
+        ProfileElectrolyte = 0,
+        ProfileImage = 1,
+        ProfileOther = 2
+    };
+    /**
+     * The quantities of which density profiles are accumulated
+     */
+    enum ProfileQuantity {
+        ProfileNumber = 0,
+        ProfileCharge = 1,
+        ProfileDipole = 2
+    };
+    /**
+     * The phases of a step whose time is accumulated when timing is enabled.
+     * TimingStep is the whole step. The constraints and reordering are done inside the integration phases,
+     * so their time is also included in TimingFirstIntegrate and TimingSecondIntegrate.
+     */
+    enum TimingPhase {
+        TimingStep = 0,
+        TimingForces = 1,
+        TimingExtraForces = 2,
+        TimingFirstIntegrate = 3,
+        TimingSecondIntegrate = 4,
+        TimingConstraints = 5,
+        TimingThermostat = 6,
+        TimingImageUpdate = 7,
+        TimingReorder = 8,
+        TimingSampling = 9,
+        NumTimingPhases = 10
+    };
     /**
      * Create a VVIntegrator with Nose-Hoover thermostat
      *
@@ -198,6 +244,7 @@ public:
      */
     int addParticleLangevin(int particle) {
         particlesLD.push_back(particle);
+        setParticleFlag(particle, ParticleFlagLD);
         return particlesLD.size();
     };
     /**
@@ -230,6 +277,37 @@ public:
         drudeFriction = fric;
         autoSetFriction = false;
     }
+    /**
+     * Get whether to use massive Nose-Hoover chains
+     */
+    const bool& getUseMassiveNH() const{
+        return useMassiveNH;
+    };
+    /**
+     * Set whether to use massive Nose-Hoover chains.
+     * Instead of one chain for each temperature group, there will be one chain for each molecule and one chain for each Drude pair.
+     * The chains are integrated in parallel on the device, which is useful for fast equilibration of heterogeneous systems.
+     * The COM temperature group is not used in this mode.
+     */
+    void setUseMassiveNH(bool use){
+        useMassiveNH = use;
+    };
+    /**
+     * Get whether to thermolize Langevin particles with Ornstein-Uhlenbeck velocity update
+     */
+    const bool& getUseLangevinOU() const{
+        return useLangevinOU;
+    };
+    /**
+     * Set whether to thermolize Langevin particles with the exact solution of Ornstein-Uhlenbeck process
+     * instead of adding friction and random forces.
+     * With middle scheme, the velocities are updated in the middle of the step (BAOAB ordering).
+     * With velocity-Verlet scheme, the velocities are updated for half step at the beginning and the end of the step (OBABO ordering).
+     * For Drude pairs, the COM motion and the relative motion are thermolized separately.
+     */
+    void setUseLangevinOU(bool use){
+        useLangevinOU = use;
+    };
     /**
      * Get the random number seed. See setRandomNumberSeed() for details.
      */
@@ -336,21 +414,21 @@ public:
      * @return
      */
     bool isParticleNH(int i) const {
-        return std::find(particlesNH.begin(), particlesNH.end(), i) != particlesNH.end();
+        return hasParticleFlag(i, ParticleFlagNH);
     }
     /**
      * Check if a particle thermolized by Langevin dynamics
      * @return
      */
     bool isParticleLD(int i) const {
-        return std::find(particlesLD.begin(), particlesLD.end(), i) != particlesLD.end();
+        return hasParticleFlag(i, ParticleFlagLD);
     }
     /**
      * Check if a particle is image particle
      * @return
      */
     bool isParticleImage(int i) const {
-        return std::find(particlesImage.begin(), particlesImage.end(), i) != particlesImage.end();
+        return hasParticleFlag(i, ParticleFlagImage);
     }
     /**
      * Get the number of molecules in the system
@@ -373,6 +451,16 @@ public:
      * return molid                 the index of the molecule of the particle with index particle
      */
     int getParticleMolId(int particle) const;
+    /**
+     * Find the molecules formed by bonded particles with union-find,
+     * which takes nearly linear time in the number of particles and bonds.
+     * The molecules are numbered in the order of their first particle, so the result is deterministic.
+     *
+     * @param numParticles     the number of particles
+     * @param bondedPairs      the indices of bonded particles flattened as [i0, j0, i1, j1, ...]
+     * @return the index of the molecule of each particle
+     */
+    static std::vector<int> findMolecules(int numParticles, const std::vector<int>& bondedPairs);
     /**
      * Get the strength of cosine acceleration for viscosity calculation
      */
@@ -386,6 +474,43 @@ public:
     void setCosAcceleration(double acceleration) {
         cosAcceleration = acceleration;
     }
+    /**
+     * Add a mode of periodic perturbation in addition to the one controlled by setCosAcceleration().
+     * The acceleration amplitude*cos(2*pi*waveNumber*r/L) is applied along flowAxis,
+     * where r and L are the coordinate and box length along gradientAxis.
+     * The amplitudes of all modes are calculated in the same pass, and the velocity bias of all modes is removed for thermostat.
+     * Modes should be added before the simulation starts, because adding a mode afterwards resets the viscosity statistics.
+     *
+     * @param flowAxis      the direction of the acceleration, 0, 1 or 2 for x, y or z
+     * @param gradientAxis  the direction along which the acceleration varies, 0, 1 or 2 for x, y or z
+     * @param waveNumber    the number of periods in the box (positive integer)
+     * @param amplitude     the strength of the acceleration (in nm/ps^2)
+     * @return the index of the mode. Mode 0 is the x-directed mode modulated along z controlled by setCosAcceleration()
+     */
+    int addCosAccelerationMode(int flowAxis, int gradientAxis, int waveNumber, double amplitude);
+    /**
+     * Get the number of modes of periodic perturbation, including the mode controlled by setCosAcceleration()
+     */
+    int getNumCosAccelerationModes() const {
+        return cosAccelerationModes.size() + 1;
+    }
+    /**
+     * Get the parameters of a mode of periodic perturbation
+     *
+     * @param mode          the index of the mode
+     * @param flowAxis      the direction of the acceleration
+     * @param gradientAxis  the direction along which the acceleration varies
+     * @param waveNumber    the number of periods in the box
+     * @param amplitude     the strength of the acceleration (in nm/ps^2)
+     */
+    void getCosAccelerationModeParameters(int mode, int& flowAxis, int& gradientAxis, int& waveNumber, double& amplitude) const;
+    /**
+     * Set the strength of a mode of periodic perturbation. Setting mode 0 is the same as setCosAcceleration()
+     *
+     * @param mode          the index of the mode
+     * @param amplitude     the strength of the acceleration (in nm/ps^2)
+     */
+    void setCosAccelerationModeAmplitude(int mode, double amplitude);
     /**
      * Get the velocity scaling factor by propagating Nose-Hoover chain
      * @param
@@ -396,9 +521,365 @@ public:
                           double &scale) const;
     /**
      * Get the velocity at z=0 and reciprocal viscosity because of the cos acceleration
-     * @param
+     * @param mode    the index of the mode of periodic perturbation
+     */
+    std::vector<double> getViscosity(int mode=0);
+    /**
+     * Get the interval (in steps) at which the velocity amplitude of the cosine acceleration is accumulated for viscosity statistics.
+     */
+    int getViscosityStatisticsInterval() const {
+        return viscosityStatisticsInterval;
+    }
+    /**
+     * Set the interval (in steps) at which the velocity amplitude of the cosine acceleration is accumulated for viscosity statistics.
+     * The accumulation is performed on the device without any data transfer. If it is set to 0, the statistics are not accumulated.
+     */
+    void setViscosityStatisticsInterval(int steps) {
+        viscosityStatisticsInterval = steps;
+    }
+    /**
+     * Get the statistics of the velocity amplitude and reciprocal viscosity accumulated since the cosine acceleration was enabled
+     * or the statistics were reset. The standard error is estimated by block averaging, so that the correlation between samples is considered.
+     * The velocity amplitudes are converted to reciprocal viscosity with the current cosine acceleration and box size.
+     *
+     * @return the mean velocity amplitude, the mean reciprocal viscosity and its standard error in the units of getViscosity(),
+     *         the integrated autocorrelation time (in picoseconds) and the number of samples
+     * @param mode    the index of the mode of periodic perturbation
+     */
+    std::vector<double> getViscosityStatistics(int mode=0);
+    /**
+     * Discard the accumulated viscosity statistics, e.g. after equilibration
+     */
+    void resetViscosityStatistics();
+    /**
+     * Get the interval (in steps) of momentum exchange for reverse non-equilibrium MD (Muller-Plathe).
+     */
+    int getRNEMDInterval() const {
+        return rnemdInterval;
+    }
+    /**
+     * Set the interval (in steps) of momentum exchange for reverse non-equilibrium MD (Muller-Plathe).
+     * At this interval, the x-momentum of the fastest molecule moving along +x in the slab at z=0
+     * is exchanged with the fastest molecule moving along -x in the slab at z=Lz/2.
+     * The exchange is performed between the centers of mass, so that the constraints and Drude pairs are not affected.
+     * Molecules of different masses are exchanged by an elastic collision along x, which conserves the kinetic energy.
+     * If it is set to 0 (the default), RNEMD is not performed.
+     */
+    void setRNEMDInterval(int steps) {
+        rnemdInterval = steps;
+    }
+    /**
+     * Get the number of slabs along z for reverse non-equilibrium MD.
+     */
+    int getRNEMDNumSlabs() const {
+        return rnemdNumSlabs;
+    }
+    /**
+     * Set the number of slabs along z for reverse non-equilibrium MD. It should be even. The default is 20.
+     * It should be set before the context is created.
+     */
+    void setRNEMDNumSlabs(int slabs) {
+        rnemdNumSlabs = slabs;
+    }
+    /**
+     * Get the results of reverse non-equilibrium MD accumulated since it was enabled or reset.
+     * The velocity gradient is fitted from the average velocity profile, excluding the two exchange slabs.
+     *
+     * @return the transferred momentum (in Da*nm/ps), the elapsed time (in ps), the momentum flux (in Da/nm/ps^2),
+     *         the velocity gradient (in /ps), the viscosity (in Da/nm/ps) and the number of exchanges
+     */
+    std::vector<double> getRNEMDStatistics();
+    /**
+     * Get the average velocity along x of each slab for reverse non-equilibrium MD (in nm/ps).
+     */
+    std::vector<double> getRNEMDVelocityProfile();
+    /**
+     * Discard the accumulated results of reverse non-equilibrium MD, e.g. after the steady state is reached
+     */
+    void resetRNEMDStatistics();
+    /**
+     * Get the interval (in steps) of binning particles for density profiles along z.
+     */
+    int getDensityProfileInterval() const {
+        return densityProfileInterval;
+    }
+    /**
+     * Set the interval (in steps) of binning particles for density profiles along z.
+     * The histograms of number, charge and induced dipole are accumulated on the device,
+     * so that the positions are not downloaded during the simulation.
+     * If it is set to 0 (the default), density profiles are not accumulated.
+     */
+    void setDensityProfileInterval(int steps) {
+        densityProfileInterval = steps;
+    }
+    /**
+     * Get the number of bins along z for density profiles.
+     */
+    int getDensityProfileNumBins() const {
+        return densityProfileNumBins;
+    }
+    /**
+     * Set the number of bins along z for density profiles. The default is 200.
+     * It should be set before the context is created.
+     */
+    void setDensityProfileNumBins(int bins) {
+        densityProfileNumBins = bins;
+    }
+    /**
+     * Get the density profile along z averaged since it was enabled or reset.
+     * The bin volume is calculated from the current box.
+     *
+     * @param group       the group of particles, one of ProfileGroup
+     * @param quantity    the quantity, one of ProfileQuantity
+     * @return the density of each bin, in /nm^3 for number, e/nm^3 for charge and e*nm/nm^3 for the z component of induced dipole
+     */
+    std::vector<double> getDensityProfile(int group, int quantity);
+    /**
+     * Get the number of configurations accumulated in the density profiles
+     */
+    int getDensityProfileNumSamples();
+    /**
+     * Discard the accumulated density profiles, e.g. after equilibration
+     */
+    void resetDensityProfile();
+    /**
+     * Get the interval (in steps) of sampling the COM motion of molecules for the multi-tau correlator.
+     */
+    int getCorrelatorInterval() const {
+        return correlatorInterval;
+    }
+    /**
+     * Set the interval (in steps) of sampling the COM motion of molecules for the multi-tau correlator.
+     * The mean squared displacement and velocity autocorrelation of the COM of molecules are calculated on the fly,
+     * so that full-resolution trajectories are not required for diffusion coefficients.
+     * If it is set to 0 (the default), the correlator is disabled.
+     */
+    void setCorrelatorInterval(int steps) {
+        correlatorInterval = steps;
+    }
+    /**
+     * Get the number of levels of the multi-tau correlator.
+     */
+    int getCorrelatorNumLevels() const {
+        return correlatorNumLevels;
+    }
+    /**
+     * Set the number of levels of the multi-tau correlator. The default is 16.
+     * Each level keeps 16 values and the spacing of lag times is doubled at each level,
+     * so the longest lag time is 15 * 2^(numLevels-1) times the sampling interval.
+     * It should be set before the context is created.
+     */
+    void setCorrelatorNumLevels(int levels) {
+        correlatorNumLevels = levels;
+    }
+    /**
+     * Add a group of molecules to the multi-tau correlator.
+     * All the molecules which contain any of these particles are included in the group.
+     * A molecule shouldn't belong to more than one group. The groups should be added before the context is created.
+     *
+     * @param particles    the indices of particles
+     * @return the index of the group
+     */
+    int addCorrelatorGroup(const std::vector<int>& particles) {
+        correlatorGroups.push_back(particles);
+        return correlatorGroups.size() - 1;
+    }
+    /**
+     * Get the number of groups of the multi-tau correlator
+     */
+    int getNumCorrelatorGroups() const {
+        return correlatorGroups.size();
+    }
+    /**
+     * Get the particles which define a group of the multi-tau correlator
+     */
+    const std::vector<int>& getCorrelatorGroup(int group) const;
+    /**
+     * Get the lag times of the correlation functions (in ps)
+     */
+    std::vector<double> getCorrelatorLagTimes();
+    /**
+     * Get the mean squared displacement of the COM of molecules in a group at each lag time (in nm^2)
+     *
+     * @param group    the index of the group
+     */
+    std::vector<double> getMSD(int group);
+    /**
+     * Get the velocity autocorrelation of the COM of molecules in a group at each lag time (in nm^2/ps^2)
+     *
+     * @param group    the index of the group
+     */
+    std::vector<double> getVACF(int group);
+    /**
+     * Discard the accumulated correlation functions, e.g. after equilibration
+     */
+    void resetCorrelator();
+    /**
+     * Get the interval (in steps) of sampling the charge current for the conductivity.
+     */
+    int getConductivityInterval() const {
+        return conductivityInterval;
+    }
+    /**
+     * Set the interval (in steps) of sampling the charge current for the conductivity.
+     * The charge current sum(q_i*v_i) of all particles except image particles is calculated every step
+     * and integrated into the translational dipole. At this interval they are added to a multi-tau correlator,
+     * which has the number of levels given by getCorrelatorNumLevels().
+     * If it is set to 0 (the default), the conductivity is not calculated.
+     */
+    void setConductivityInterval(int steps) {
+        conductivityInterval = steps;
+    }
+    /**
+     * Get the ionic conductivity accumulated since it was enabled or reset.
+     * The contribution of the mean current is subtracted from the correlation functions,
+     * so that the Green-Kubo and Einstein-Helfand estimates are also meaningful under an electric field.
+     * If image pairs are present, the volume is taken as half of the box.
+     *
+     * @param fitTime   the upper limit of the Green-Kubo integral (in ps).
+     *                  The Einstein-Helfand slope is fitted between fitTime/2 and fitTime
+     * @return the Green-Kubo, Einstein-Helfand and nonequilibrium (mean current / field) conductivity (in e^2/(nm ps kJ/mol)),
+     *         the mean charge current along z (in e*nm/ps) and the number of samples
+     */
+    std::vector<double> getConductivity(double fitTime);
+    /**
+     * Get the lag times of the correlation functions for the conductivity (in ps)
+     */
+    std::vector<double> getConductivityLagTimes();
+    /**
+     * Get the autocorrelation of the charge current at each lag time (in e^2*nm^2/ps^2)
+     */
+    std::vector<double> getChargeCurrentAutocorrelation();
+    /**
+     * Get the mean squared displacement of the translational dipole at each lag time (in e^2*nm^2)
+     */
+    std::vector<double> getDipoleMSD();
+    /**
+     * Discard the accumulated correlation functions and mean current, e.g. after equilibration
+     */
+    void resetConductivity();
+    /**
+     * Get the kinetic energies of the temperature groups of Nose-Hoover thermostat after the last step (in kJ/mol).
+     * The groups are atomic motion, molecular COM motion and Drude relative motion.
+     * They are calculated by the thermostat anyway, so this doesn't require downloading the velocities.
+     * Zeros are returned if Nose-Hoover thermostat is not used.
+     * With massive Nose-Hoover chains, the molecular chains are reported as the atomic motion,
+     * which includes the molecular COM motion, and the molecular COM group is empty.
+     */
+    std::vector<double> getGroupKineticEnergies();
+    /**
+     * Get the temperatures of the temperature groups of Nose-Hoover thermostat after the last step (in K).
+     * The temperature of a group without any degree of freedom is zero.
+     */
+    std::vector<double> getGroupTemperatures();
+    /**
+     * Get the degrees of freedom of the temperature groups of Nose-Hoover thermostat.
      */
-    std::vector<double> getViscosity();
+    std::vector<double> getGroupDOFs();
+    /**
+     * Get the interval (in steps) of recording the group kinetic energies and temperatures.
+     */
+    int getGroupTemperatureInterval() const {
+        return groupTemperatureInterval;
+    }
+    /**
+     * Set the interval (in steps) of recording the group kinetic energies and temperatures,
+     * which can be retrieved in bulk with getGroupTemperatureHistory().
+     * If it is set to 0 (the default), they are not recorded.
+     */
+    void setGroupTemperatureInterval(int steps) {
+        groupTemperatureInterval = steps;
+    }
+    /**
+     * Get the group kinetic energies and temperatures recorded since the interval was set or the history was reset.
+     * The records are kept in a ring buffer on the device, which is only downloaded by this method.
+     * At most the latest 10000 records are kept, the older ones are overwritten.
+     * The records are not cleared by this method, call resetGroupTemperatureHistory() for that.
+     *
+     * @return the records flattened in rows of time (in ps), kinetic energies of three groups (in kJ/mol)
+     *         and temperatures of three groups (in K), from the oldest to the latest
+     */
+    std::vector<double> getGroupTemperatureHistory();
+    /**
+     * Discard the recorded group kinetic energies and temperatures, e.g. after they are retrieved
+     */
+    void resetGroupTemperatureHistory();
+    /**
+     * Get the interval (in steps) of sampling the electrode observables for image charge method.
+     */
+    int getElectrodeStatisticsInterval() const {
+        return electrodeStatisticsInterval;
+    }
+    /**
+     * Set the interval (in steps) of sampling the electrode observables for image charge method.
+     * The z-dipole of electrolyte and images, the moments of electrolyte charge along z
+     * and the lateral distribution of image charge are accumulated on the device,
+     * so that the induced surface charge and the differential capacitance can be obtained without downloading the positions.
+     * It should be set before the context is created, and requires image pairs.
+     * If it is set to 0 (the default), the electrode observables are not sampled.
+     */
+    void setElectrodeStatisticsInterval(int steps) {
+        electrodeStatisticsInterval = steps;
+    }
+    /**
+     * Get the number of lateral bins in each of x and y direction for the distribution of image charge.
+     */
+    int getElectrodeNumBins() const {
+        return electrodeNumBins;
+    }
+    /**
+     * Set the number of lateral bins in each of x and y direction for the distribution of image charge.
+     * It should be set before the context is created. The default value is 10.
+     */
+    void setElectrodeNumBins(int numBins) {
+        electrodeNumBins = numBins;
+    }
+    /**
+     * Get the electrode observables averaged since they were enabled or reset.
+     * Because the images carry the opposite charges of electrolyte, the z-dipole of electrolyte and images
+     * doesn't depend on the origin. Its variance gives the differential capacitance by C = var(M_z)/(kT L^2),
+     * where L is the distance between the electrodes.
+     * The moments of electrolyte charge are calculated from z=0, and give the potential drop from Poisson equation.
+     *
+     * @return the mean (in e*nm) and variance (in e^2*nm^2) of z-dipole of electrolyte and images,
+     *         the mean of zeroth (in e), first (in e*nm) and second (in e*nm^2) moment of electrolyte charge along z
+     *         and the number of samples
+     */
+    std::vector<double> getElectrodeStatistics();
+    /**
+     * Get the mean image charge density in each lateral bin (in e/nm^2),
+     * which is the induced surface charge density of the electrode at the mirror with opposite sign.
+     * The bins are ordered as ix*numBins+iy.
+     */
+    std::vector<double> getImageChargeDistribution();
+    /**
+     * Discard the accumulated electrode observables, e.g. after equilibration
+     */
+    void resetElectrodeStatistics();
+    /**
+     * Get the potential energy of each force group (in kJ/mol) at the current positions.
+     * Each group in use is evaluated once with its own energy evaluation, and the groups without any force are skipped.
+     * So the cost is the same as calling Context::getState() for each non-empty group.
+     * The forces are recalculated at the beginning of the next step.
+     *
+     * @return the energies of the 32 force groups. The groups without any force have zero energy
+     */
+    std::vector<double> getForceGroupEnergies();
+    /**
+     * Write the state of thermostats and modifiers to a checkpoint, so that a restarted simulation continues the same trajectory.
+     * This is complementary to Context::createCheckpoint(), which doesn't know about the state of this integrator.
+     * The random number generator is already saved in the checkpoint of the Context.
+     *
+     * @param stream    an output stream the checkpoint data should be written to
+     */
+    void createCheckpoint(std::ostream& stream) const;
+    /**
+     * Load the state of thermostats and modifiers from a checkpoint.
+     * It should be called after Context::loadCheckpoint(), with the same settings of this integrator.
+     *
+     * @param stream    an input stream the checkpoint data should be read from
+     */
+    void loadCheckpoint(std::istream& stream);
     /**
      * Advance a simulation through time by taking a series of time steps.
      *
@@ -417,6 +898,38 @@ public:
     void setDebugEnabled(bool enabled){
         debugEnabled = enabled;
     };
+    /**
+     * Get whether to accumulate the time spent in each phase of a step
+     */
+    bool getTimingEnabled() const {
+        return timingEnabled;
+    }
+    /**
+     * Set whether to accumulate the number of calls and the time spent in each phase of a step.
+     * On GPU platforms, the time is measured with device events, which are resolved lazily without synchronizing every step.
+     * Otherwise the wall time is measured with steady_clock.
+     * It should be set before the context is created.
+     */
+    void setTimingEnabled(bool enabled) {
+        timingEnabled = enabled;
+    }
+    /**
+     * Get the number of calls and the time (in seconds) spent in each phase since the context was created
+     * or the timings were reset, flattened as [calls0, seconds0, calls1, seconds1, ...] in the order of TimingPhase
+     */
+    std::vector<double> getTimings();
+    /**
+     * Get a table of the number of calls, the total time, the time per call and the fraction of step time of each phase
+     */
+    std::string getTimingReport();
+    /**
+     * Discard the accumulated timings, e.g. after warming up
+     */
+    void resetTimings();
+    /**
+     * Get the name of a phase in TimingPhase
+     */
+    static std::string getTimingPhaseName(int phase);
     /**
      * Get whether to use middle discretization scheme
      */
@@ -429,6 +942,115 @@ public:
     void setUseMiddleScheme(bool use){
         useMiddleScheme = use;
     };
+    /**
+     * Get whether to use isokinetic Nose-Hoover RESPA (SIN(R)) scheme
+     */
+    const bool& getUseSINR() const{
+        return useSINR;
+    };
+    /**
+     * Set whether to use isokinetic Nose-Hoover RESPA (SIN(R)) scheme of Leimkuhler, Margul and Tuckerman.
+     * Every degree of freedom is coupled to its own isokinetic Nose-Hoover thermostat,
+     * which removes the resonance and allows very large outer time step for slow forces.
+     * The step size of the integrator is the outer time step.
+     * The dynamics is not preserved, so this scheme should only be used for sampling.
+     * It cannot be used together with constraints, Drude particles, Langevin thermostat or periodic perturbation.
+     */
+    void setUseSINR(bool use){
+        useSINR = use;
+    };
+    /**
+     * Get the number of thermostat pairs per degree of freedom in SIN(R) scheme
+     */
+    int getSINRChainLength() const {
+        return sinrChainLength;
+    }
+    /**
+     * Set the number of thermostat pairs per degree of freedom in SIN(R) scheme
+     *
+     * @param length    the number of thermostat pairs
+     */
+    void setSINRChainLength(int length) {
+        sinrChainLength = length;
+    }
+    /**
+     * Get the friction of the stochastic thermostat variables in SIN(R) scheme (in /ps).
+     *
+     * @return the friction, measured in /ps
+     */
+    double getSINRFriction() const {
+        return sinrFriction;
+    }
+    /**
+     * Set the friction of the stochastic thermostat variables in SIN(R) scheme (in /ps).
+     */
+    void setSINRFriction(double fric) {
+        sinrFriction = fric;
+    }
+    /**
+     * Get the force groups integrated with the inner time step in SIN(R) scheme
+     *
+     * @return a set of bit flags for which force groups are fast forces
+     */
+    int getFastForceGroups() const {
+        return fastForceGroups;
+    }
+    /**
+     * Set the force groups integrated with the inner time step in SIN(R) scheme.
+     * All the other force groups are treated as slow forces and integrated with the outer time step.
+     *
+     * @param groups    a set of bit flags for which force groups are fast forces
+     */
+    void setFastForceGroups(int groups) {
+        fastForceGroups = groups;
+    }
+    /**
+     * Get the number of inner steps per outer step in SIN(R) scheme
+     */
+    int getRespaLoops() const {
+        return respaLoops;
+    }
+    /**
+     * Set the number of inner steps per outer step in SIN(R) scheme
+     *
+     * @param loops    the number of inner steps
+     */
+    void setRespaLoops(int loops) {
+        respaLoops = loops;
+    }
+    /**
+     * Vary a parameter with time by linear interpolation between the given points.
+     * The schedule is evaluated with the time of the context at the beginning of each step.
+     * Before the first point and after the last point, the parameter is kept constant.
+     *
+     * @param parameter   the parameter to vary, one of ScheduleParameter
+     * @param times       the times of the points in ascending order (in picoseconds)
+     * @param values      the values of the parameter at these points (in the units of the setter)
+     */
+    void setLinearSchedule(int parameter, const std::vector<double>& times, const std::vector<double>& values);
+    /**
+     * Vary a parameter with time as offset + amplitude * sin(2*pi*t/period + phase).
+     * The schedule is evaluated with the time of the context at the beginning of each step.
+     *
+     * @param parameter   the parameter to vary, one of ScheduleParameter
+     * @param offset      the mean value of the parameter (in the units of the setter)
+     * @param amplitude   the amplitude of the oscillation (in the units of the setter)
+     * @param period      the period of the oscillation (in picoseconds)
+     * @param phase       the phase at t=0 (in radians)
+     */
+    void setSinusoidalSchedule(int parameter, double offset, double amplitude, double period, double phase=0);
+    /**
+     * Remove the schedule of a parameter. The parameter keeps its current value.
+     *
+     * @param parameter   the parameter, one of ScheduleParameter
+     */
+    void clearSchedule(int parameter);
+    /**
+     * Get whether a parameter is varied by a schedule
+     *
+     * @param parameter   the parameter, one of ScheduleParameter
+     */
+    bool hasSchedule(int parameter) const;
 protected:
     /**
      * This will be called by the Context when it is created.  It informs the Integrator
@@ -446,6 +1068,8 @@ protected:
      */
     void stateChanged(State::DataType changed){
         forcesAreValid = false;
+        if (changed == State::Velocities)
+            isokineticStateIsValid = false;
     };
     /**
      * Get the names of all Kernels used by this Integrator.
@@ -475,13 +1099,95 @@ protected:
      * @param steps   the number of time steps to take
      */
     void stepMiddle(int steps);
+    /**
+     * Advance a simulation through time by taking a series of outer time steps.
+     *
+     * @param steps   the number of outer time steps to take
+     */
+    void stepSINR(int steps);
+    /**
+     * Create the modifier kernels which are enabled after the context is initialized,
+     * and recreate the electric field kernel if new electrolyte particles are added.
+     * This is called at the beginning of each step, so that Context.reinitialize() is not required.
+     */
+    void updateModifierKernels();
+    /**
+     * Set the scheduled parameters to their values at the current time of the context
+     */
+    void applySchedules();
+    /**
+     * Check whether any mode of periodic perturbation is active
+     */
+    bool usePeriodicPerturbation() const;
+    /**
+     * Count the step and check whether the velocity amplitude should be sampled for viscosity statistics
+     */
+    bool isViscositySampleDue();
+    /**
+     * Count the step and check whether the momentum should be exchanged for reverse non-equilibrium MD
+     */
+    bool isRNEMDExchangeDue();
+    /**
+     * Count the step and check whether the particles should be binned for density profiles
+     */
+    bool isDensityProfileSampleDue();
+    /**
+     * Count the step and check whether the COM motion should be sampled for the multi-tau correlator
+     */
+    bool isCorrelatorSampleDue();
+    /**
+     * Count the step and check whether the charge current should be added to the correlator for the conductivity
+     */
+    bool isConductivitySampleDue();
+    /**
+     * Count the step and record the group kinetic energies and temperatures if it is due
+     */
+    void recordGroupTemperatures();
+    /**
+     * Count the step and check whether the electrode observables should be sampled
+     */
+    bool isElectrodeSampleDue();
+    /**
+     * The particles thermostated by NH or Langevin dynamics and image particles are marked with bit flags,
+     * so that checking a particle doesn't require searching the lists.
+     */
+    enum ParticleFlag {
+        ParticleFlagNH = 1, ParticleFlagLD = 2, ParticleFlagImage = 4
+    };
+    void setParticleFlag(int i, int flag) {
+        if (i >= (int) particleFlags.size())
+            particleFlags.resize(i + 1, 0);
+        particleFlags[i] |= flag;
+    }
+    bool hasParticleFlag(int i, int flag) const {
+        return i >= 0 && i < (int) particleFlags.size() && (particleFlags[i] & flag) != 0;
+    }
+    /**
+     * Mark the beginning and end of a phase for timing. They are inline so that there is no cost when timing is disabled.
+     */
+    void beginPhase(int phase) {
+        if (timingActive)
+            recordPhase(phase, true);
+    }
+    void endPhase(int phase) {
+        if (timingActive)
+            recordPhase(phase, false);
+    }
+    void recordPhase(int phase, bool begin);
 private:
+    friend class VVIntegratorProxy;
+    struct ParameterSchedule {
+        bool sinusoidal;
+        std::vector<double> times, values;
+        double offset, amplitude, period, phase;
+    };
     bool debugEnabled;
     double temperature, frequency, drudeTemperature, drudeFrequency, maxDrudeDistance;
     int loopsPerStep, numNHChains;
-    bool useCOMTempGroup, autoSetCOMTempGroup, autoSetFriction, useMiddleScheme;
+    bool useCOMTempGroup, autoSetCOMTempGroup, autoSetFriction, useMiddleScheme, useMassiveNH;
     std::vector<int> particlesNH;
     std::vector<int> moleculesNH;
+    std::vector<char> particleFlags;
     std::vector<int> particleMolId;
     std::vector<double> moleculeMasses;
     std::vector<double> moleculeInvMasses;
@@ -490,6 +1196,7 @@ private:
 
     std::vector<int> particlesLD;
     double friction, drudeFriction;
+    bool useLangevinOU;
     int randomNumberSeed;
     Kernel ldKernel;
 
@@ -500,10 +1207,66 @@ private:
     double electricField;
     std::vector<int> particlesElectrolyte;
     Kernel imgKernel, efKernel;
+    int numElectrolyteInKernel;
+    int electrodeStatisticsInterval, electrodeNumBins;
+    bool electrodeStatisticsEnabled;
+    long long electrodeStepCount;
 
     // for periodic perturbation viscosity calculation
     double cosAcceleration;
     Kernel ppKernel;
+    struct CosAccelerationMode {
+        int flowAxis, gradientAxis, waveNumber;
+        double amplitude;
+    };
+    std::vector<CosAccelerationMode> cosAccelerationModes;
+    bool ppKernelCreated;
+    int numModesInKernel;
+    int viscosityStatisticsInterval;
+    long long viscosityStepCount;
+
+    // for reverse non-equilibrium MD viscosity calculation
+    Kernel rnemdKernel;
+    int rnemdInterval, rnemdNumSlabs;
+    bool rnemdKernelCreated;
+    long long rnemdStepCount;
+
+    // for density profiles along z
+    Kernel profileKernel;
+    int densityProfileInterval, densityProfileNumBins;
+    bool profileKernelCreated;
+    long long profileStepCount;
+
+    // for multi-tau correlator of COM motion
+    Kernel correlatorKernel;
+    int correlatorInterval, correlatorNumLevels;
+    std::vector<std::vector<int> > correlatorGroups;
+    bool correlatorKernelCreated;
+    long long correlatorStepCount;
+
+    // for ionic conductivity from charge current
+    Kernel conductivityKernel;
+    int conductivityInterval;
+    bool conductivityKernelCreated;
+    long long conductivityStepCount;
+
+    // for recording the kinetic energies of temperature groups
+    int groupTemperatureInterval;
+    long long groupTemperatureStepCount;
+    int groupTemperatureHistoryHead, groupTemperatureHistorySize;
+
+    // for isokinetic Nose-Hoover RESPA
+    bool useSINR, isokineticStateIsValid;
+    int sinrChainLength, fastForceGroups, respaLoops;
+    double sinrFriction;
+
+    // for parameters varied with time
+    std::map<int, ParameterSchedule> schedules;
+
+    // for timing the phases of a step, with device events if the platform supports it and steady_clock otherwise
+    bool timingEnabled, timingActive, timingKernelCreated;
+    Kernel timingKernel;
+    std::vector<double> hostTimings, phaseStartTimes;
 };
 
 } // namespace OpenMM
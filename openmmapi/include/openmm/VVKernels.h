@@ -37,6 +37,7 @@
 #include "openmm/Platform.h"
 #include "openmm/System.h"
 #include "openmm/Vec3.h"
+#include <iosfwd>
 #include <string>
 #include <vector>
 
@@ -128,6 +129,109 @@ public:
      * Compute the kinetic energy.
      */
     virtual double computeKineticEnergy(ContextImpl& context, const VVIntegrator& integrator) = 0;
+    /**
+     * Write the state of this kernel to a checkpoint.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     an output stream the checkpoint data should be written to
+     */
+    virtual void createCheckpoint(ContextImpl& context, std::ostream& stream) const = 0;
+    /**
+     * Load the state of this kernel from a checkpoint.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     an input stream the checkpoint data should be read from
+     */
+    virtual void loadCheckpoint(ContextImpl& context, std::istream& stream) = 0;
+};
+
+/**
+ * This kernel is invoked by VVIntegrator to take one time step with isokinetic Nose-Hoover RESPA (SIN(R)) scheme
+ */
+class IntegrateSINRStepKernel : public KernelImpl {
+public:
+    static std::string Name() {
+        return "IntegrateSINRStep";
+    }
+    IntegrateSINRStepKernel(std::string name, const Platform& platform) : KernelImpl(name, platform) {
+    }
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param integrator the VVIntegrator this kernel will be used for
+     */
+    virtual void initialize(const System& system, const VVIntegrator& integrator) = 0;
+    /**
+     * Rescale the velocities and the thermostat variables so that the isokinetic constraint is satisfied.
+     * This should be called whenever the velocities are set from outside the integrator.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     */
+    virtual void initializeIsokineticState(ContextImpl& context, const VVIntegrator& integrator) = 0;
+    /**
+     * Store the forces just calculated, so that they can be used at next step
+     * even if the forces in the context are overwritten in between.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     * @param slow           whether the forces are slow forces or fast forces
+     */
+    virtual void storeForce(ContextImpl& context, const VVIntegrator& integrator, bool slow) = 0;
+    /**
+     * Reset the extra forces to zero so that we can calculate external electric force etc
+     * @param context
+     * @param integrator
+     */
+    virtual void resetExtraForce(ContextImpl& context, const VVIntegrator& integrator) = 0;
+    /**
+     * Half outer step velocity update with slow forces under the isokinetic constraint.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     * @param useStoredForce whether to use the stored slow forces or the forces just calculated
+     */
+    virtual void integrateSlowVelocity(ContextImpl& context, const VVIntegrator& integrator, bool useStoredForce) = 0;
+    /**
+     * First half of the inner step (thermostat, fast force velocity update, position update).
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     */
+    virtual void firstIntegrateInner(ContextImpl& context, const VVIntegrator& integrator) = 0;
+    /**
+     * Second half of the inner step (fast force velocity update, thermostat).
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     */
+    virtual void secondIntegrateInner(ContextImpl& context, const VVIntegrator& integrator) = 0;
+    /**
+     * Reorder the atoms and update the time and step count at the end of outer step.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     */
+    virtual void finishStep(ContextImpl& context, const VVIntegrator& integrator) = 0;
+    /**
+     * Compute the kinetic energy.
+     */
+    virtual double computeKineticEnergy(ContextImpl& context, const VVIntegrator& integrator) = 0;
+    /**
+     * Write the state of this kernel to a checkpoint.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     an output stream the checkpoint data should be written to
+     */
+    virtual void createCheckpoint(ContextImpl& context, std::ostream& stream) const = 0;
+    /**
+     * Load the state of this kernel from a checkpoint.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     an input stream the checkpoint data should be read from
+     */
+    virtual void loadCheckpoint(ContextImpl& context, std::istream& stream) = 0;
 };
 
 /**
@@ -155,6 +259,50 @@ public:
          * @param integrator     the DrudeNoseHooverIntegrator this kernel is being used for
          */
         virtual void scaleVelocity(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Get the kinetic energies and degrees of freedom of the temperature groups after the last velocity scaling.
+         *
+         * @param context          the context in which to execute this kernel
+         * @param integrator       the DrudeNoseHooverIntegrator this kernel is being used for
+         * @param kineticEnergies  the kinetic energies of atomic motion, molecular COM motion and Drude relative motion
+         * @param dofs             the degrees of freedom of these temperature groups
+         */
+        virtual void getGroupKineticEnergies(ContextImpl& context, const VVIntegrator& integrator,
+                                             std::vector<double>& kineticEnergies, std::vector<double>& dofs) = 0;
+        /**
+         * Append the time and the kinetic energies of the temperature groups after the last velocity scaling
+         * to the ring buffer of history, without transferring any data from the device.
+         *
+         * @param context          the context in which to execute this kernel
+         * @param integrator       the DrudeNoseHooverIntegrator this kernel is being used for
+         * @param slot             the index of the record to write in the ring buffer
+         * @param capacity         the number of records of the ring buffer
+         */
+        virtual void recordGroupKineticEnergies(ContextImpl& context, const VVIntegrator& integrator, int slot, int capacity) = 0;
+        /**
+         * Get the ring buffer of history of the group kinetic energies.
+         *
+         * @param context          the context in which to execute this kernel
+         * @param integrator       the DrudeNoseHooverIntegrator this kernel is being used for
+         * @param history          the records of time and kinetic energies of the three temperature groups, in the order of slots
+         * @param dofs             the degrees of freedom of these temperature groups
+         */
+        virtual void getGroupKineticEnergyHistory(ContextImpl& context, const VVIntegrator& integrator,
+                                                  std::vector<double>& history, std::vector<double>& dofs) = 0;
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        virtual void createCheckpoint(ContextImpl& context, std::ostream& stream) const = 0;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        virtual void loadCheckpoint(ContextImpl& context, std::istream& stream) = 0;
     };
 
 /**
@@ -182,6 +330,14 @@ public:
          * @param integrator     the DrudeNoseHooverIntegrator this kernel is being used for
          */
         virtual void applyLangevinForce(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Update the velocities with the exact solution of Ornstein-Uhlenbeck process.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         * @param timeStep       the time interval of the Ornstein-Uhlenbeck process (in ps)
+         */
+        virtual void applyLangevinVelocity(ContextImpl& context, const VVIntegrator& integrator, double timeStep) = 0;
     };
 
 /**
@@ -209,6 +365,42 @@ class ModifyImageChargeKernel: public KernelImpl {
          * @param integrator     the DrudeNoseHooverIntegrator this kernel is being used for
          */
         virtual void updateImagePositions(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Accumulate the z-dipole of electrolyte and images, the moments of electrolyte charge
+         * and the lateral distribution of image charge of current configuration.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the DrudeNoseHooverIntegrator this kernel is being used for
+         */
+        virtual void accumulateElectrodeStatistics(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Get the averaged electrode observables.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the DrudeNoseHooverIntegrator this kernel is being used for
+         * @param stats          the mean and variance of z-dipole, the mean moments of electrolyte charge and the number of samples
+         * @param distribution   the mean image charge density in each lateral bin
+         */
+        virtual void getElectrodeStatistics(ContextImpl& context, const VVIntegrator& integrator,
+                                            std::vector<double>& stats, std::vector<double>& distribution) = 0;
+        /**
+         * Discard the accumulated electrode observables.
+         */
+        virtual void resetElectrodeStatistics(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        virtual void createCheckpoint(ContextImpl& context, std::ostream& stream) const = 0;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        virtual void loadCheckpoint(ContextImpl& context, std::istream& stream) = 0;
     };
 
 /**
@@ -263,10 +455,327 @@ class ModifyImageChargeKernel: public KernelImpl {
          * @param integrator     the DrudeNoseHooverIntegrator this kernel is being used for
          */
         virtual void applyCosineForce(ContextImpl& context, const VVIntegrator& integrator) = 0;
-        virtual void calcVelocityBias(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Calculate the velocity amplitude of the periodic perturbation.
+         *
+         * @param sample     whether to accumulate the amplitude into the viscosity statistics
+         */
+        virtual void calcVelocityBias(ContextImpl& context, const VVIntegrator& integrator, bool sample) = 0;
         virtual void removeVelocityBias(ContextImpl& context, const VVIntegrator& integrator) = 0;
         virtual void restoreVelocityBias(ContextImpl& context, const VVIntegrator& integrator) = 0;
-        virtual void calcViscosity(ContextImpl& context, const VVIntegrator& integrator, double& vMax, double& invVis) = 0;
+        virtual void calcViscosity(ContextImpl& context, const VVIntegrator& integrator, int mode, double& vMax, double& invVis) = 0;
+        /**
+         * Analyze the accumulated velocity amplitudes with block averaging.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         * @param mode           the index of the mode of periodic perturbation
+         * @param stats          the mean velocity amplitude, the mean reciprocal viscosity, its standard error,
+         *                       the autocorrelation time in samples and the number of samples
+         */
+        virtual void calcViscosityStatistics(ContextImpl& context, const VVIntegrator& integrator, int mode, std::vector<double>& stats) = 0;
+        /**
+         * Discard the accumulated velocity amplitudes.
+         */
+        virtual void resetViscosityStatistics(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        virtual void createCheckpoint(ContextImpl& context, std::ostream& stream) const = 0;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        virtual void loadCheckpoint(ContextImpl& context, std::istream& stream) = 0;
+    };
+
+/**
+ * This kernel is invoked by VVIntegrator to exchange momentum for reverse non-equilibrium MD
+ */
+    class ModifyRNEMDKernel: public KernelImpl {
+    public:
+        static std::string Name() {
+            return "ModifyRNEMD";
+        }
+        ModifyRNEMDKernel(std::string name, const Platform& platform) : KernelImpl(name, platform) {
+        }
+        /**
+         * Initialize the kernel.
+         *
+         * @param system     the System this kernel will be applied to
+         * @param integrator the VVIntegrator this kernel will be used for
+         * @param force      the DrudeForce to get particle parameters from
+         */
+        virtual void initialize(const System& system, const VVIntegrator& integrator, const DrudeForce* force) = 0;
+        /**
+         * Exchange the x-momentum between the fastest units in slab 0 and the middle slab,
+         * and accumulate the velocity profile.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         */
+        virtual void exchangeMomentum(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Calculate the momentum flux and viscosity from the accumulated exchanges.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         * @param stats          the transferred momentum, the elapsed time, the momentum flux, the velocity gradient, the viscosity
+         *                       and the number of exchanges
+         * @param profile        the average velocity of each slab
+         */
+        virtual void calcRNEMDStatistics(ContextImpl& context, const VVIntegrator& integrator,
+                                         std::vector<double>& stats, std::vector<double>& profile) = 0;
+        /**
+         * Discard the accumulated exchanges and velocity profile.
+         */
+        virtual void resetRNEMDStatistics(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        virtual void createCheckpoint(ContextImpl& context, std::ostream& stream) const = 0;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        virtual void loadCheckpoint(ContextImpl& context, std::istream& stream) = 0;
+    };
+
+/**
+ * This kernel is invoked by VVIntegrator to accumulate the density profiles along z
+ */
+    class CalcDensityProfileKernel: public KernelImpl {
+    public:
+        static std::string Name() {
+            return "CalcDensityProfile";
+        }
+        CalcDensityProfileKernel(std::string name, const Platform& platform) : KernelImpl(name, platform) {
+        }
+        /**
+         * Initialize the kernel.
+         *
+         * @param system     the System this kernel will be applied to
+         * @param integrator the VVIntegrator this kernel will be used for
+         * @param force      the DrudeForce to get particle parameters from
+         */
+        virtual void initialize(const System& system, const VVIntegrator& integrator, const DrudeForce* force) = 0;
+        /**
+         * Bin the particles of current configuration into the histograms.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         */
+        virtual void accumulateProfiles(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Get the averaged density profile of a group of particles.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         * @param group          the group of particles, one of VVIntegrator::ProfileGroup
+         * @param quantity       the quantity, one of VVIntegrator::ProfileQuantity
+         * @param profile        the density of the quantity in each bin
+         */
+        virtual void getProfile(ContextImpl& context, const VVIntegrator& integrator, int group, int quantity, std::vector<double>& profile) = 0;
+        /**
+         * Get the number of configurations accumulated in the histograms.
+         */
+        virtual int getNumSamples() const = 0;
+        /**
+         * Discard the accumulated histograms.
+         */
+        virtual void resetProfiles(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        virtual void createCheckpoint(ContextImpl& context, std::ostream& stream) const = 0;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        virtual void loadCheckpoint(ContextImpl& context, std::istream& stream) = 0;
+    };
+
+/**
+ * This kernel is invoked by VVIntegrator to correlate the COM motion of molecules with multi-tau correlator
+ */
+    class CalcMultiTauCorrelationKernel: public KernelImpl {
+    public:
+        static std::string Name() {
+            return "CalcMultiTauCorrelation";
+        }
+        CalcMultiTauCorrelationKernel(std::string name, const Platform& platform) : KernelImpl(name, platform) {
+        }
+        /**
+         * Initialize the kernel.
+         *
+         * @param system     the System this kernel will be applied to
+         * @param integrator the VVIntegrator this kernel will be used for
+         */
+        virtual void initialize(const System& system, const VVIntegrator& integrator) = 0;
+        /**
+         * Add the COM positions and velocities of current configuration to the correlator.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         */
+        virtual void addSample(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Get the correlation functions of a group of molecules.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         * @param group          the index of the group of molecules
+         * @param lagTimes       the lag times of the correlation functions
+         * @param msd            the mean squared displacement at each lag time
+         * @param vacf           the velocity autocorrelation at each lag time
+         */
+        virtual void getCorrelations(ContextImpl& context, const VVIntegrator& integrator, int group,
+                                     std::vector<double>& lagTimes, std::vector<double>& msd, std::vector<double>& vacf) = 0;
+        /**
+         * Discard the accumulated correlation functions. The history of the correlator is kept.
+         */
+        virtual void resetCorrelations(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        virtual void createCheckpoint(ContextImpl& context, std::ostream& stream) const = 0;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        virtual void loadCheckpoint(ContextImpl& context, std::istream& stream) = 0;
+    };
+
+/**
+ * This kernel is invoked by VVIntegrator to calculate the ionic conductivity from the charge current
+ */
+    class CalcConductivityKernel: public KernelImpl {
+    public:
+        static std::string Name() {
+            return "CalcConductivity";
+        }
+        CalcConductivityKernel(std::string name, const Platform& platform) : KernelImpl(name, platform) {
+        }
+        /**
+         * Initialize the kernel.
+         *
+         * @param system     the System this kernel will be applied to
+         * @param integrator the VVIntegrator this kernel will be used for
+         */
+        virtual void initialize(const System& system, const VVIntegrator& integrator) = 0;
+        /**
+         * Calculate the charge current of current step and integrate the translational dipole.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         * @param sample         whether to add the current and dipole to the correlator
+         */
+        virtual void accumulateCurrent(ContextImpl& context, const VVIntegrator& integrator, bool sample) = 0;
+        /**
+         * Get the correlation functions of the charge current and the translational dipole.
+         * The contribution of the mean current is subtracted, so that they are also meaningful under an electric field.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         * @param lagTimes       the lag times of the correlation functions
+         * @param cacf           the autocorrelation of charge current at each lag time
+         * @param msd            the mean squared displacement of translational dipole at each lag time
+         */
+        virtual void getCorrelations(ContextImpl& context, const VVIntegrator& integrator,
+                                     std::vector<double>& lagTimes, std::vector<double>& cacf, std::vector<double>& msd) = 0;
+        /**
+         * Calculate the conductivity.
+         *
+         * @param context        the context in which to execute this kernel
+         * @param integrator     the VVIntegrator this kernel is being used for
+         * @param fitTime        the upper limit of the Green-Kubo integral and the Einstein-Helfand fitting
+         * @param stats          the Green-Kubo, Einstein-Helfand and nonequilibrium conductivity, the mean current along z
+         *                       and the number of samples
+         */
+        virtual void calcConductivity(ContextImpl& context, const VVIntegrator& integrator, double fitTime, std::vector<double>& stats) = 0;
+        /**
+         * Discard the accumulated correlation functions and mean current. The history of the correlator is kept.
+         */
+        virtual void resetConductivity(ContextImpl& context, const VVIntegrator& integrator) = 0;
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        virtual void createCheckpoint(ContextImpl& context, std::ostream& stream) const = 0;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        virtual void loadCheckpoint(ContextImpl& context, std::istream& stream) = 0;
+    };
+
+/**
+ * This kernel is invoked by VVIntegrator to measure the time spent in each phase of a step
+ */
+    class CalcTimingKernel: public KernelImpl {
+    public:
+        static std::string Name() {
+            return "CalcTiming";
+        }
+        CalcTimingKernel(std::string name, const Platform& platform) : KernelImpl(name, platform) {
+        }
+        /**
+         * Initialize the kernel.
+         *
+         * @param system     the System this kernel will be applied to
+         * @param integrator the VVIntegrator this kernel will be used for
+         * @param vvKernel   the step kernel, which times the constraints and reordering inside its calls
+         */
+        virtual void initialize(const System& system, const VVIntegrator& integrator, Kernel& vvKernel) = 0;
+        /**
+         * Mark the beginning of a phase. Different phases can be nested.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param phase      the phase in VVIntegrator::TimingPhase
+         */
+        virtual void beginPhase(ContextImpl& context, int phase) = 0;
+        /**
+         * Mark the end of a phase.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param phase      the phase in VVIntegrator::TimingPhase
+         */
+        virtual void endPhase(ContextImpl& context, int phase) = 0;
+        /**
+         * Get the number of calls and the time (in seconds) of each phase, flattened as [calls0, seconds0, calls1, ...]
+         *
+         * @param context    the context in which to execute this kernel
+         * @param timings    on exit, the timings of all phases
+         */
+        virtual void getTimings(ContextImpl& context, std::vector<double>& timings) = 0;
+        /**
+         * Discard the accumulated timings
+         */
+        virtual void resetTimings(ContextImpl& context) = 0;
     };
 
 } // namespace OpenMM
@@ -36,6 +36,10 @@
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/VVKernels.h"
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
 #include <vector>
 #include "openmm/reference/SimTKOpenMMRealType.h"
 
@@ -63,10 +67,49 @@ VVIntegrator::VVIntegrator(double temperature, double frequency, double drudeTem
     setCosAcceleration(0.0);
     setUseCOMTempGroup(false);
     setUseMiddleScheme(false);
+    setUseMassiveNH(false);
+    setUseLangevinOU(false);
+    setUseSINR(false);
+    setSINRChainLength(4);
+    setSINRFriction(10.0);
+    setFastForceGroups(0);
+    setRespaLoops(4);
+    setViscosityStatisticsInterval(1);
+    setRNEMDInterval(0);
+    setRNEMDNumSlabs(20);
+    setDensityProfileInterval(0);
+    setDensityProfileNumBins(200);
+    setCorrelatorInterval(0);
+    setCorrelatorNumLevels(16);
+    setConductivityInterval(0);
+    setGroupTemperatureInterval(0);
+    setElectrodeStatisticsInterval(0);
+    setElectrodeNumBins(10);
     setDebugEnabled(false);
+    setTimingEnabled(false);
+    timingActive = false;
+    timingKernelCreated = false;
     autoSetCOMTempGroup = true;
     autoSetFriction = true;
     forcesAreValid = false;
+    isokineticStateIsValid = false;
+    numElectrolyteInKernel = 0;
+    electrodeStatisticsEnabled = false;
+    electrodeStepCount = 0;
+    ppKernelCreated = false;
+    numModesInKernel = 0;
+    viscosityStepCount = 0;
+    rnemdKernelCreated = false;
+    rnemdStepCount = 0;
+    profileKernelCreated = false;
+    profileStepCount = 0;
+    correlatorKernelCreated = false;
+    correlatorStepCount = 0;
+    conductivityKernelCreated = false;
+    conductivityStepCount = 0;
+    groupTemperatureStepCount = 0;
+    groupTemperatureHistoryHead = 0;
+    groupTemperatureHistorySize = 0;
 }
 
 VVIntegrator::~VVIntegrator() {
@@ -75,6 +118,7 @@ VVIntegrator::~VVIntegrator() {
 
 int VVIntegrator::addImagePair(int image, int parent) {
     particlesImage.push_back(image);
+    setParticleFlag(image, ParticleFlagImage);
     imagePairs.emplace_back(image, parent);
     return imagePairs.size();
 }
@@ -89,6 +133,47 @@ int VVIntegrator::getParticleMolId(int particle) const {
     return particleMolId[particle];
 }
 
+static int findRoot(vector<int>& parent, int i) {
+    while (parent[i] != i) {
+        // path halving
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+vector<int> VVIntegrator::findMolecules(int numParticles, const vector<int>& bondedPairs) {
+    if (bondedPairs.size() % 2 != 0)
+        throw OpenMMException("findMolecules: The bonded particles should be given in pairs");
+    vector<int> parent(numParticles), rank(numParticles, 0);
+    for (int i = 0; i < numParticles; i++)
+        parent[i] = i;
+    for (int k = 0; k < (int) bondedPairs.size(); k += 2) {
+        int p1 = bondedPairs[k], p2 = bondedPairs[k + 1];
+        if (p1 < 0 || p1 >= numParticles || p2 < 0 || p2 >= numParticles)
+            throw OpenMMException("findMolecules: Illegal particle index in bonded pairs");
+        int r1 = findRoot(parent, p1), r2 = findRoot(parent, p2);
+        if (r1 == r2)
+            continue;
+        if (rank[r1] < rank[r2])
+            std::swap(r1, r2);
+        parent[r2] = r1;
+        if (rank[r1] == rank[r2])
+            rank[r1]++;
+    }
+
+    // number the molecules in the order of their first particle
+    vector<int> molId(numParticles), rootMolId(numParticles, -1);
+    int numMolecules = 0;
+    for (int i = 0; i < numParticles; i++) {
+        int root = findRoot(parent, i);
+        if (rootMolId[root] == -1)
+            rootMolId[root] = numMolecules++;
+        molId[i] = rootMolId[root];
+    }
+    return molId;
+}
+
 void VVIntegrator::initialize(ContextImpl& contextRef) {
     if (owner != NULL && &contextRef.getOwner() != owner)
         throw OpenMMException("This Integrator is already bound to a context");
@@ -135,29 +220,48 @@ void VVIntegrator::initialize(ContextImpl& contextRef) {
         moleculeInvMasses.push_back(1.0 / moleculeMasses[i]);
 
     // handle particles thermostated by Langevin dynamics
+    vector<char> isMoleculeNH(numResidues, 0);
     for (int i = 0; i < system.getNumParticles(); i++) {
         if (!isParticleLD(i) && !isParticleImage(i)) {
             particlesNH.push_back(i);
-            if (std::find(moleculesNH.begin(), moleculesNH.end(), getParticleMolId(i)) == moleculesNH.end()) {
+            setParticleFlag(i, ParticleFlagNH);
+            if (!isMoleculeNH[getParticleMolId(i)]) {
+                isMoleculeNH[getParticleMolId(i)] = 1;
                 moleculesNH.push_back(getParticleMolId(i));
             }
         }
     }
     for (int i = 0; i < system.getNumParticles(); i++) {
-        if (isParticleLD(i)
-            && std::find(moleculesNH.begin(), moleculesNH.end(), getParticleMolId(i)) != moleculesNH.end()) {
+        if (isParticleLD(i) && isMoleculeNH[getParticleMolId(i)]) {
             throw OpenMMException("NH and Langevin thermostat cannot be applied on the same molecule");
         }
     }
 
     // conflicts
-    if (!particlesLD.empty() && cosAcceleration != 0)
+    if (!particlesLD.empty() && usePeriodicPerturbation())
         throw OpenMMException("Langevin thermostat and periodic perturbation shouldn't be used together");
+    if (useSINR) {
+        if (system.getNumConstraints() > 0)
+            throw OpenMMException("SIN(R) scheme cannot be used with constraints");
+        if (force != NULL && force->getNumParticles() > 0)
+            throw OpenMMException("SIN(R) scheme cannot be used with Drude polarizable model");
+        if (!particlesLD.empty())
+            throw OpenMMException("SIN(R) scheme and Langevin thermostat shouldn't be used together");
+        if (usePeriodicPerturbation())
+            throw OpenMMException("SIN(R) scheme and periodic perturbation shouldn't be used together");
+        if (sinrChainLength < 1 || respaLoops < 1)
+            throw OpenMMException("SIN(R) scheme requires at least one thermostat pair and one inner step");
+    }
 
     context = &contextRef;
     owner = &contextRef.getOwner();
 
-    if (useMiddleScheme){
+    if (useSINR){
+        vvKernel = context->getPlatform().createKernel(IntegrateSINRStepKernel::Name(), contextRef);
+        vvKernel.getAs<IntegrateSINRStepKernel>().initialize(contextRef.getSystem(), *this);
+        isokineticStateIsValid = false;
+    }
+    else if (useMiddleScheme){
         vvKernel = context->getPlatform().createKernel(IntegrateMiddleStepKernel::Name(), contextRef);
         vvKernel.getAs<IntegrateMiddleStepKernel>().initialize(contextRef.getSystem(), *this, force);
     }
@@ -165,7 +269,7 @@ void VVIntegrator::initialize(ContextImpl& contextRef) {
         vvKernel = context->getPlatform().createKernel(IntegrateVVStepKernel::Name(), contextRef);
         vvKernel.getAs<IntegrateVVStepKernel>().initialize(contextRef.getSystem(), *this, force);
     }
-    if (!particlesNH.empty()) {
+    if (!particlesNH.empty() && !useSINR) {
         nhKernel = context->getPlatform().createKernel(ModifyDrudeNoseKernel::Name(), contextRef);
         nhKernel.getAs<ModifyDrudeNoseKernel>().initialize(contextRef.getSystem(), *this, force);
     }
@@ -177,34 +281,117 @@ void VVIntegrator::initialize(ContextImpl& contextRef) {
         imgKernel = context->getPlatform().createKernel(ModifyImageChargeKernel::Name(), contextRef);
         imgKernel.getAs<ModifyImageChargeKernel>().initialize(contextRef.getSystem(), *this);
     }
-    if (!particlesElectrolyte.empty()){
-        efKernel = context->getPlatform().createKernel(ModifyElectricFieldKernel::Name(), contextRef);
-        efKernel.getAs<ModifyElectricFieldKernel>().initialize(contextRef.getSystem(), *this, vvKernel);
+    electrodeStatisticsEnabled = !particlesImage.empty() && electrodeStatisticsInterval > 0;
+    numElectrolyteInKernel = 0;
+    ppKernelCreated = false;
+    rnemdKernelCreated = false;
+    profileKernelCreated = false;
+    correlatorKernelCreated = false;
+    conductivityKernelCreated = false;
+    updateModifierKernels();
+
+    // the timing kernel is optional, so that the platforms without device events can still time the phases on host
+    timingActive = timingEnabled;
+    timingKernelCreated = false;
+    hostTimings = vector<double>(2 * NumTimingPhases, 0);
+    phaseStartTimes = vector<double>(NumTimingPhases, 0);
+    if (timingEnabled && context->getPlatform().supportsKernels(vector<string>(1, CalcTimingKernel::Name()))) {
+        timingKernel = context->getPlatform().createKernel(CalcTimingKernel::Name(), contextRef);
+        timingKernel.getAs<CalcTimingKernel>().initialize(contextRef.getSystem(), *this, vvKernel);
+        timingKernelCreated = true;
     }
-    if (cosAcceleration!=0){
-        ppKernel = context->getPlatform().createKernel(ModifyCosineAccelerateKernel::Name(), contextRef);
-        ppKernel.getAs<ModifyCosineAccelerateKernel>().initialize(contextRef.getSystem(), *this, vvKernel);
+}
+
+static const DrudeForce* findDrudeForce(const System& system) {
+    const DrudeForce* force = NULL;
+    for (int i = 0; i < system.getNumForces(); i++)
+        if (dynamic_cast<const DrudeForce*>(&system.getForce(i)) != NULL)
+            force = dynamic_cast<const DrudeForce*>(&system.getForce(i));
+    return force;
+}
+
+void VVIntegrator::updateModifierKernels() {
+    if ((int) particlesElectrolyte.size() != numElectrolyteInKernel) {
+        efKernel = context->getPlatform().createKernel(ModifyElectricFieldKernel::Name(), *context);
+        efKernel.getAs<ModifyElectricFieldKernel>().initialize(context->getSystem(), *this, vvKernel);
+        numElectrolyteInKernel = particlesElectrolyte.size();
+    }
+    // the kernel is recreated if modes are added after it is created
+    if (usePeriodicPerturbation() && (!ppKernelCreated || numModesInKernel != getNumCosAccelerationModes())) {
+        if (!particlesLD.empty())
+            throw OpenMMException("Langevin thermostat and periodic perturbation shouldn't be used together");
+        if (useSINR)
+            throw OpenMMException("SIN(R) scheme and periodic perturbation shouldn't be used together");
+        if (rnemdInterval > 0)
+            throw OpenMMException("Periodic perturbation and RNEMD shouldn't be used together");
+        ppKernel = context->getPlatform().createKernel(ModifyCosineAccelerateKernel::Name(), *context);
+        ppKernel.getAs<ModifyCosineAccelerateKernel>().initialize(context->getSystem(), *this, vvKernel);
+        ppKernelCreated = true;
+        numModesInKernel = getNumCosAccelerationModes();
+    }
+    if (rnemdInterval > 0 && !rnemdKernelCreated) {
+        if (useSINR)
+            throw OpenMMException("SIN(R) scheme and RNEMD shouldn't be used together");
+        if (usePeriodicPerturbation())
+            throw OpenMMException("Periodic perturbation and RNEMD shouldn't be used together");
+        rnemdKernel = context->getPlatform().createKernel(ModifyRNEMDKernel::Name(), *context);
+        rnemdKernel.getAs<ModifyRNEMDKernel>().initialize(context->getSystem(), *this, findDrudeForce(context->getSystem()));
+        rnemdKernelCreated = true;
+    }
+    if (densityProfileInterval > 0 && !profileKernelCreated) {
+        profileKernel = context->getPlatform().createKernel(CalcDensityProfileKernel::Name(), *context);
+        profileKernel.getAs<CalcDensityProfileKernel>().initialize(context->getSystem(), *this, findDrudeForce(context->getSystem()));
+        profileKernelCreated = true;
+    }
+    if (correlatorInterval > 0 && !correlatorGroups.empty() && !correlatorKernelCreated) {
+        correlatorKernel = context->getPlatform().createKernel(CalcMultiTauCorrelationKernel::Name(), *context);
+        correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().initialize(context->getSystem(), *this);
+        correlatorKernelCreated = true;
+    }
+    if (conductivityInterval > 0 && !conductivityKernelCreated) {
+        conductivityKernel = context->getPlatform().createKernel(CalcConductivityKernel::Name(), *context);
+        conductivityKernel.getAs<CalcConductivityKernel>().initialize(context->getSystem(), *this);
+        conductivityKernelCreated = true;
     }
 }
 
 void VVIntegrator::cleanup() {
+    timingKernel = Kernel();
+    timingActive = false;
+    timingKernelCreated = false;
     vvKernel = Kernel();
     nhKernel = Kernel();
     ldKernel = Kernel();
     imgKernel = Kernel();
     efKernel = Kernel();
     ppKernel = Kernel();
+    rnemdKernel = Kernel();
+    profileKernel = Kernel();
+    correlatorKernel = Kernel();
+    conductivityKernel = Kernel();
+    numElectrolyteInKernel = 0;
+    electrodeStatisticsEnabled = false;
+    ppKernelCreated = false;
+    rnemdKernelCreated = false;
+    profileKernelCreated = false;
+    correlatorKernelCreated = false;
+    conductivityKernelCreated = false;
 }
 
 vector<string> VVIntegrator::getKernelNames() {
     std::vector<std::string> names;
     names.push_back(IntegrateVVStepKernel::Name());
     names.push_back(IntegrateMiddleStepKernel::Name());
+    names.push_back(IntegrateSINRStepKernel::Name());
     names.push_back(ModifyDrudeNoseKernel::Name());
     names.push_back(ModifyDrudeLangevinKernel::Name());
     names.push_back(ModifyImageChargeKernel::Name());
     names.push_back(ModifyElectricFieldKernel::Name());
     names.push_back(ModifyCosineAccelerateKernel::Name());
+    names.push_back(ModifyRNEMDKernel::Name());
+    names.push_back(CalcDensityProfileKernel::Name());
+    names.push_back(CalcMultiTauCorrelationKernel::Name());
+    names.push_back(CalcConductivityKernel::Name());
     return names;
 }
 
@@ -214,7 +401,9 @@ double VVIntegrator::computeKineticEnergy() {
      * So I must mark the force as invalid
      */
     forcesAreValid = false;
-    if (useMiddleScheme)
+    if (useSINR)
+        return vvKernel.getAs<IntegrateSINRStepKernel>().computeKineticEnergy(*context, *this);
+    else if (useMiddleScheme)
         return vvKernel.getAs<IntegrateMiddleStepKernel>().computeKineticEnergy(*context, *this);
     else
         return vvKernel.getAs<IntegrateVVStepKernel>().computeKineticEnergy(*context, *this);
@@ -223,7 +412,10 @@ double VVIntegrator::computeKineticEnergy() {
 void VVIntegrator::step(int steps) {
     if (context == NULL)
         throw OpenMMException("This Integrator is not bound to a context!");
-    if (useMiddleScheme)
+    updateModifierKernels();
+    if (useSINR)
+        stepSINR(steps);
+    else if (useMiddleScheme)
         stepMiddle(steps);
     else
         stepVV(steps);
@@ -231,46 +423,99 @@ void VVIntegrator::step(int steps) {
 
 void VVIntegrator::stepMiddle(int steps) {
     for (int i = 0; i < steps; ++i) {
+        beginPhase(TimingStep);
+        applySchedules();
+        const bool usePP = usePeriodicPerturbation();
         context->updateContextState();
+        beginPhase(TimingForces);
         context->calcForcesAndEnergy(true, false);
+        endPhase(TimingForces);
 
         // Calculate extra forces because of Langevin thermostat, electrical field, cosine acceleration
-        if (!particlesLD.empty() || !particlesElectrolyte.empty() || cosAcceleration !=0)
+        // forceExtra is reset as long as the modifier exists, in case its strength is changed to zero
+        beginPhase(TimingExtraForces);
+        const bool useLangevinForce = !particlesLD.empty() && !useLangevinOU;
+        if (useLangevinForce || !particlesElectrolyte.empty() || ppKernelCreated)
             vvKernel.getAs<IntegrateMiddleStepKernel>().resetExtraForce(*context, *this);
-        if (!particlesLD.empty())
+        if (useLangevinForce)
             ldKernel.getAs<ModifyDrudeLangevinKernel>().applyLangevinForce(*context, *this);
-        if (!particlesElectrolyte.empty())
+        if (!particlesElectrolyte.empty() && electricField != 0)
             efKernel.getAs<ModifyElectricFieldKernel>().applyElectricForce(*context, *this);
-        if (cosAcceleration != 0)
+        if (usePP)
             ppKernel.getAs<ModifyCosineAccelerateKernel>().applyCosineForce(*context, *this);
+        endPhase(TimingExtraForces);
 
         // First half LFMiddle integrate (full-step velocity and half-step position update)
+        beginPhase(TimingFirstIntegrate);
         vvKernel.getAs<IntegrateMiddleStepKernel>().firstIntegrate(*context, *this);
+        endPhase(TimingFirstIntegrate);
+
+        // Velocity amplitude of periodic perturbation, which is removed for NH thermostat and sampled for viscosity
+        beginPhase(TimingThermostat);
+        const bool sampleViscosity = usePP && isViscositySampleDue();
+        if (usePP && (!particlesNH.empty() || sampleViscosity))
+            ppKernel.getAs<ModifyCosineAccelerateKernel>().calcVelocityBias(*context, *this, sampleViscosity);
 
         // NH thermostat
         if (!particlesNH.empty()){
-            if (cosAcceleration != 0){
-                ppKernel.getAs<ModifyCosineAccelerateKernel>().calcVelocityBias(*context, *this);
+            if (usePP)
                 ppKernel.getAs<ModifyCosineAccelerateKernel>().removeVelocityBias(*context, *this);
-            }
             nhKernel.getAs<ModifyDrudeNoseKernel>().scaleVelocity(*context, *this);
-            if (cosAcceleration != 0){
+            if (usePP){
                 ppKernel.getAs<ModifyCosineAccelerateKernel>().restoreVelocityBias(*context, *this);
             }
         }
 
+        // Langevin thermostat with OU process in the middle of the step
+        if (!particlesLD.empty() && useLangevinOU)
+            ldKernel.getAs<ModifyDrudeLangevinKernel>().applyLangevinVelocity(*context, *this, getStepSize());
+        endPhase(TimingThermostat);
+
         // Second half LFMiddle integrate (second-half position update)
+        beginPhase(TimingSecondIntegrate);
         vvKernel.getAs<IntegrateMiddleStepKernel>().secondIntegrate(*context, *this);
+        endPhase(TimingSecondIntegrate);
 
         // update the position of image particles
         if (!particlesImage.empty()){
+            beginPhase(TimingImageUpdate);
             imgKernel.getAs<ModifyImageChargeKernel>().updateImagePositions(*context, *this);
+            endPhase(TimingImageUpdate);
         }
+
+        // Exchange momentum for reverse non-equilibrium MD
+        beginPhase(TimingSampling);
+        if (isRNEMDExchangeDue())
+            rnemdKernel.getAs<ModifyRNEMDKernel>().exchangeMomentum(*context, *this);
+
+        // Bin the particles for density profiles
+        if (isDensityProfileSampleDue())
+            profileKernel.getAs<CalcDensityProfileKernel>().accumulateProfiles(*context, *this);
+
+        // Sample the COM motion for multi-tau correlator
+        if (isCorrelatorSampleDue())
+            correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().addSample(*context, *this);
+
+        // Accumulate the charge current for conductivity
+        if (conductivityKernelCreated)
+            conductivityKernel.getAs<CalcConductivityKernel>().accumulateCurrent(*context, *this, isConductivitySampleDue());
+
+        // Sample the electrode observables for image charge method
+        if (isElectrodeSampleDue())
+            imgKernel.getAs<ModifyImageChargeKernel>().accumulateElectrodeStatistics(*context, *this);
+
+        // Record the kinetic energies of temperature groups
+        recordGroupTemperatures();
+        endPhase(TimingSampling);
+        endPhase(TimingStep);
     }
 }
 
 void VVIntegrator::stepVV(int steps) {
     for (int i = 0; i < steps; ++i) {
+        beginPhase(TimingStep);
+        applySchedules();
+        const bool usePP = usePeriodicPerturbation();
 
         /** @ 2020-02-21
          * The friction and random forces from Langevin thermostat
@@ -287,56 +532,422 @@ void VVIntegrator::stepVV(int steps) {
             forcesAreValid = false;
 
         if (!forcesAreValid) {
+            beginPhase(TimingForces);
             context->calcForcesAndEnergy(true, false);
+            endPhase(TimingForces);
             forcesAreValid = true;
         }
 
+        // Langevin thermostat with OU process for half step
+        beginPhase(TimingThermostat);
+        if (!particlesLD.empty() && useLangevinOU)
+            ldKernel.getAs<ModifyDrudeLangevinKernel>().applyLangevinVelocity(*context, *this, getStepSize() / 2);
+
         // First half velocity verlet integrate (half-step velocity and full-step position update)
         if (!particlesNH.empty()){
-            if (cosAcceleration != 0){
-                ppKernel.getAs<ModifyCosineAccelerateKernel>().calcVelocityBias(*context, *this);
+            if (usePP){
+                ppKernel.getAs<ModifyCosineAccelerateKernel>().calcVelocityBias(*context, *this, false);
                 ppKernel.getAs<ModifyCosineAccelerateKernel>().removeVelocityBias(*context, *this);
             }
             nhKernel.getAs<ModifyDrudeNoseKernel>().scaleVelocity(*context, *this);
-            if (cosAcceleration != 0){
+            if (usePP){
                 ppKernel.getAs<ModifyCosineAccelerateKernel>().restoreVelocityBias(*context, *this);
             }
         }
+        endPhase(TimingThermostat);
+        beginPhase(TimingFirstIntegrate);
         vvKernel.getAs<IntegrateVVStepKernel>().firstIntegrate(*context, *this);
+        endPhase(TimingFirstIntegrate);
 
         // update the position of image particles
         if (!particlesImage.empty()){
+            beginPhase(TimingImageUpdate);
             imgKernel.getAs<ModifyImageChargeKernel>().updateImagePositions(*context, *this);
+            endPhase(TimingImageUpdate);
         }
 
         // Calculate FF forces from full-step position
+        beginPhase(TimingForces);
         context->calcForcesAndEnergy(true, false);
+        endPhase(TimingForces);
         forcesAreValid = true;
         // Calculate Langevin forces from half-step velocity and external electric force from charge
-        if (!particlesLD.empty() || !particlesElectrolyte.empty() || cosAcceleration !=0)
+        // forceExtra is reset as long as the modifier exists, in case its strength is changed to zero
+        beginPhase(TimingExtraForces);
+        const bool useLangevinForce = !particlesLD.empty() && !useLangevinOU;
+        if (useLangevinForce || !particlesElectrolyte.empty() || ppKernelCreated)
             vvKernel.getAs<IntegrateVVStepKernel>().resetExtraForce(*context, *this);
-        if (!particlesLD.empty())
+        if (useLangevinForce)
             ldKernel.getAs<ModifyDrudeLangevinKernel>().applyLangevinForce(*context, *this);
-        if (!particlesElectrolyte.empty())
+        if (!particlesElectrolyte.empty() && electricField != 0)
             efKernel.getAs<ModifyElectricFieldKernel>().applyElectricForce(*context, *this);
-        if (cosAcceleration != 0)
+        if (usePP)
             ppKernel.getAs<ModifyCosineAccelerateKernel>().applyCosineForce(*context, *this);
+        endPhase(TimingExtraForces);
 
         // Second half velocity verlet integrate (full-step velocity update)
+        beginPhase(TimingSecondIntegrate);
         vvKernel.getAs<IntegrateVVStepKernel>().secondIntegrate(*context, *this);
+        endPhase(TimingSecondIntegrate);
+        beginPhase(TimingThermostat);
+        if (!particlesLD.empty() && useLangevinOU)
+            ldKernel.getAs<ModifyDrudeLangevinKernel>().applyLangevinVelocity(*context, *this, getStepSize() / 2);
+
+        // Velocity amplitude of periodic perturbation is sampled for viscosity with full-step velocity
+        const bool sampleViscosity = usePP && isViscositySampleDue();
+        if (usePP && (!particlesNH.empty() || sampleViscosity))
+            ppKernel.getAs<ModifyCosineAccelerateKernel>().calcVelocityBias(*context, *this, sampleViscosity);
         if (!particlesNH.empty()) {
-            if (cosAcceleration != 0){
-                ppKernel.getAs<ModifyCosineAccelerateKernel>().calcVelocityBias(*context, *this);
+            if (usePP)
                 ppKernel.getAs<ModifyCosineAccelerateKernel>().removeVelocityBias(*context, *this);
-            }
             nhKernel.getAs<ModifyDrudeNoseKernel>().scaleVelocity(*context, *this);
-            if (cosAcceleration != 0){
+            if (usePP){
                 ppKernel.getAs<ModifyCosineAccelerateKernel>().restoreVelocityBias(*context, *this);
             }
         }
+        endPhase(TimingThermostat);
+
+        // Exchange momentum for reverse non-equilibrium MD
+        beginPhase(TimingSampling);
+        if (isRNEMDExchangeDue())
+            rnemdKernel.getAs<ModifyRNEMDKernel>().exchangeMomentum(*context, *this);
+
+        // Bin the particles for density profiles
+        if (isDensityProfileSampleDue())
+            profileKernel.getAs<CalcDensityProfileKernel>().accumulateProfiles(*context, *this);
+
+        // Sample the COM motion for multi-tau correlator
+        if (isCorrelatorSampleDue())
+            correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().addSample(*context, *this);
+
+        // Accumulate the charge current for conductivity
+        if (conductivityKernelCreated)
+            conductivityKernel.getAs<CalcConductivityKernel>().accumulateCurrent(*context, *this, isConductivitySampleDue());
+
+        // Sample the electrode observables for image charge method
+        if (isElectrodeSampleDue())
+            imgKernel.getAs<ModifyImageChargeKernel>().accumulateElectrodeStatistics(*context, *this);
+
+        // Record the kinetic energies of temperature groups
+        recordGroupTemperatures();
+        endPhase(TimingSampling);
+        endPhase(TimingStep);
     }
 }
 
+void VVIntegrator::stepSINR(int steps) {
+    IntegrateSINRStepKernel& sinrKernel = vvKernel.getAs<IntegrateSINRStepKernel>();
+
+    int groupsInUse = 0;
+    for (int i = 0; i < context->getSystem().getNumForces(); i++)
+        groupsInUse |= 1 << context->getSystem().getForce(i).getForceGroup();
+    const int fastGroups = groupsInUse & fastForceGroups;
+    const int slowGroups = groupsInUse & ~fastForceGroups;
+
+    for (int i = 0; i < steps; ++i) {
+        beginPhase(TimingStep);
+        applySchedules();
+        if (context->updateContextState())
+            forcesAreValid = false;
+
+        // Project the velocities set from outside onto the isokinetic surface
+        if (!isokineticStateIsValid) {
+            sinrKernel.initializeIsokineticState(*context, *this);
+            isokineticStateIsValid = true;
+        }
+
+        /**
+         * The fast and slow forces are stored separately from the FF forces of the context
+         * So they are not affected when someone query the forces and/or energy between steps
+         * They only need to be recalculated when the state of the context is changed
+         */
+        if (!forcesAreValid) {
+            beginPhase(TimingForces);
+            if (slowGroups != 0)
+                context->calcForcesAndEnergy(true, false, slowGroups);
+            if (!particlesElectrolyte.empty()) {
+                sinrKernel.resetExtraForce(*context, *this);
+                if (electricField != 0)
+                    efKernel.getAs<ModifyElectricFieldKernel>().applyElectricForce(*context, *this);
+            }
+            sinrKernel.storeForce(*context, *this, true);
+            if (fastGroups != 0)
+                context->calcForcesAndEnergy(true, false, fastGroups);
+            sinrKernel.storeForce(*context, *this, false);
+            endPhase(TimingForces);
+            forcesAreValid = true;
+        }
+
+        // Half outer step velocity update with slow forces
+        beginPhase(TimingSecondIntegrate);
+        sinrKernel.integrateSlowVelocity(*context, *this, true);
+        endPhase(TimingSecondIntegrate);
+
+        // Inner steps with fast forces
+        for (int j = 0; j < respaLoops; j++) {
+            beginPhase(TimingFirstIntegrate);
+            sinrKernel.firstIntegrateInner(*context, *this);
+            endPhase(TimingFirstIntegrate);
+            if (!particlesImage.empty()) {
+                beginPhase(TimingImageUpdate);
+                imgKernel.getAs<ModifyImageChargeKernel>().updateImagePositions(*context, *this);
+                endPhase(TimingImageUpdate);
+            }
+            if (fastGroups != 0) {
+                beginPhase(TimingForces);
+                context->calcForcesAndEnergy(true, false, fastGroups);
+                endPhase(TimingForces);
+            }
+            beginPhase(TimingSecondIntegrate);
+            sinrKernel.secondIntegrateInner(*context, *this);
+            endPhase(TimingSecondIntegrate);
+        }
+
+        // Half outer step velocity update with slow forces calculated from new positions
+        if (slowGroups != 0) {
+            beginPhase(TimingForces);
+            context->calcForcesAndEnergy(true, false, slowGroups);
+            endPhase(TimingForces);
+        }
+        if (!particlesElectrolyte.empty()) {
+            beginPhase(TimingExtraForces);
+            sinrKernel.resetExtraForce(*context, *this);
+            if (electricField != 0)
+                efKernel.getAs<ModifyElectricFieldKernel>().applyElectricForce(*context, *this);
+            endPhase(TimingExtraForces);
+        }
+        beginPhase(TimingSecondIntegrate);
+        sinrKernel.integrateSlowVelocity(*context, *this, false);
+        endPhase(TimingSecondIntegrate);
+
+        sinrKernel.finishStep(*context, *this);
+
+        // Bin the particles for density profiles
+        beginPhase(TimingSampling);
+        if (isDensityProfileSampleDue())
+            profileKernel.getAs<CalcDensityProfileKernel>().accumulateProfiles(*context, *this);
+
+        // Sample the COM motion for multi-tau correlator
+        if (isCorrelatorSampleDue())
+            correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().addSample(*context, *this);
+
+        // Accumulate the charge current for conductivity
+        if (conductivityKernelCreated)
+            conductivityKernel.getAs<CalcConductivityKernel>().accumulateCurrent(*context, *this, isConductivitySampleDue());
+
+        // Sample the electrode observables for image charge method
+        if (isElectrodeSampleDue())
+            imgKernel.getAs<ModifyImageChargeKernel>().accumulateElectrodeStatistics(*context, *this);
+
+        // Record the kinetic energies of temperature groups
+        recordGroupTemperatures();
+        endPhase(TimingSampling);
+        endPhase(TimingStep);
+    }
+}
+
+/**
+ * The checkpoint starts with a magic number, a version and a bitmask of the kernels whose state is written,
+ * so that loading a checkpoint created with different settings fails early.
+ * It is followed by the step counters, so that the sampling intervals continue in phase after restart
+ */
+static const int CHECKPOINT_MAGIC = 0x56564350; // "VVCP"
+static const int CHECKPOINT_VERSION = 2;
+enum {CP_VV = 1, CP_SINR = 2, CP_NH = 4, CP_PP = 8, CP_RNEMD = 16, CP_PROFILE = 32, CP_CORRELATOR = 64, CP_CONDUCTIVITY = 128, CP_ELECTRODE = 256};
+
+void VVIntegrator::createCheckpoint(std::ostream& stream) const {
+    if (context == NULL)
+        throw OpenMMException("This Integrator is not bound to a context!");
+
+    int kernels = 0;
+    if (useSINR)
+        kernels |= CP_SINR;
+    else if (!useMiddleScheme)
+        kernels |= CP_VV;
+    if (!particlesNH.empty() && !useSINR)
+        kernels |= CP_NH;
+    if (ppKernelCreated)
+        kernels |= CP_PP;
+    if (rnemdKernelCreated)
+        kernels |= CP_RNEMD;
+    if (profileKernelCreated)
+        kernels |= CP_PROFILE;
+    if (correlatorKernelCreated)
+        kernels |= CP_CORRELATOR;
+    if (conductivityKernelCreated)
+        kernels |= CP_CONDUCTIVITY;
+    if (electrodeStatisticsEnabled)
+        kernels |= CP_ELECTRODE;
+    stream.write((char*) &CHECKPOINT_MAGIC, sizeof(int));
+    stream.write((char*) &CHECKPOINT_VERSION, sizeof(int));
+    stream.write((char*) &kernels, sizeof(int));
+    stream.write((char*) &viscosityStepCount, sizeof(long long));
+    stream.write((char*) &rnemdStepCount, sizeof(long long));
+    stream.write((char*) &profileStepCount, sizeof(long long));
+    stream.write((char*) &correlatorStepCount, sizeof(long long));
+    stream.write((char*) &conductivityStepCount, sizeof(long long));
+    stream.write((char*) &groupTemperatureStepCount, sizeof(long long));
+    stream.write((char*) &electrodeStepCount, sizeof(long long));
+
+    if (kernels & CP_VV)
+        vvKernel.getAs<IntegrateVVStepKernel>().createCheckpoint(*context, stream);
+    if (kernels & CP_SINR)
+        vvKernel.getAs<IntegrateSINRStepKernel>().createCheckpoint(*context, stream);
+    if (kernels & CP_NH)
+        nhKernel.getAs<ModifyDrudeNoseKernel>().createCheckpoint(*context, stream);
+    if (kernels & CP_PP)
+        ppKernel.getAs<ModifyCosineAccelerateKernel>().createCheckpoint(*context, stream);
+    if (kernels & CP_RNEMD)
+        rnemdKernel.getAs<ModifyRNEMDKernel>().createCheckpoint(*context, stream);
+    if (kernels & CP_PROFILE)
+        profileKernel.getAs<CalcDensityProfileKernel>().createCheckpoint(*context, stream);
+    if (kernels & CP_CORRELATOR)
+        correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().createCheckpoint(*context, stream);
+    if (kernels & CP_CONDUCTIVITY)
+        conductivityKernel.getAs<CalcConductivityKernel>().createCheckpoint(*context, stream);
+    if (kernels & CP_ELECTRODE)
+        imgKernel.getAs<ModifyImageChargeKernel>().createCheckpoint(*context, stream);
+}
+
+void VVIntegrator::loadCheckpoint(std::istream& stream) {
+    if (context == NULL)
+        throw OpenMMException("This Integrator is not bound to a context!");
+
+    int magic, version, kernels;
+    stream.read((char*) &magic, sizeof(int));
+    stream.read((char*) &version, sizeof(int));
+    stream.read((char*) &kernels, sizeof(int));
+    if (!stream || magic != CHECKPOINT_MAGIC || version != CHECKPOINT_VERSION)
+        throw OpenMMException("loadCheckpoint: Invalid checkpoint for VVIntegrator");
+
+    // the kernels for cosine acceleration may not be created yet
+    updateModifierKernels();
+
+    if ((kernels & CP_SINR) != (useSINR ? CP_SINR : 0)
+        || (kernels & CP_VV) != (!useSINR && !useMiddleScheme ? CP_VV : 0)
+        || (kernels & CP_NH) != (!particlesNH.empty() && !useSINR ? CP_NH : 0)
+        || (kernels & CP_PP) != (ppKernelCreated ? CP_PP : 0)
+        || (kernels & CP_RNEMD) != (rnemdKernelCreated ? CP_RNEMD : 0)
+        || (kernels & CP_PROFILE) != (profileKernelCreated ? CP_PROFILE : 0)
+        || (kernels & CP_CORRELATOR) != (correlatorKernelCreated ? CP_CORRELATOR : 0)
+        || (kernels & CP_CONDUCTIVITY) != (conductivityKernelCreated ? CP_CONDUCTIVITY : 0)
+        || (kernels & CP_ELECTRODE) != (electrodeStatisticsEnabled ? CP_ELECTRODE : 0))
+        throw OpenMMException("loadCheckpoint: The checkpoint was created with different settings of VVIntegrator");
+
+    stream.read((char*) &viscosityStepCount, sizeof(long long));
+    stream.read((char*) &rnemdStepCount, sizeof(long long));
+    stream.read((char*) &profileStepCount, sizeof(long long));
+    stream.read((char*) &correlatorStepCount, sizeof(long long));
+    stream.read((char*) &conductivityStepCount, sizeof(long long));
+    stream.read((char*) &groupTemperatureStepCount, sizeof(long long));
+    stream.read((char*) &electrodeStepCount, sizeof(long long));
+
+    if (kernels & CP_VV)
+        vvKernel.getAs<IntegrateVVStepKernel>().loadCheckpoint(*context, stream);
+    if (kernels & CP_SINR)
+        vvKernel.getAs<IntegrateSINRStepKernel>().loadCheckpoint(*context, stream);
+    if (kernels & CP_NH)
+        nhKernel.getAs<ModifyDrudeNoseKernel>().loadCheckpoint(*context, stream);
+    if (kernels & CP_PP)
+        ppKernel.getAs<ModifyCosineAccelerateKernel>().loadCheckpoint(*context, stream);
+    if (kernels & CP_RNEMD)
+        rnemdKernel.getAs<ModifyRNEMDKernel>().loadCheckpoint(*context, stream);
+    if (kernels & CP_PROFILE)
+        profileKernel.getAs<CalcDensityProfileKernel>().loadCheckpoint(*context, stream);
+    if (kernels & CP_CORRELATOR)
+        correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().loadCheckpoint(*context, stream);
+    if (kernels & CP_CONDUCTIVITY)
+        conductivityKernel.getAs<CalcConductivityKernel>().loadCheckpoint(*context, stream);
+    if (kernels & CP_ELECTRODE)
+        imgKernel.getAs<ModifyImageChargeKernel>().loadCheckpoint(*context, stream);
+    if (!stream)
+        throw OpenMMException("loadCheckpoint: The checkpoint for VVIntegrator is truncated");
+
+    // velocities loaded from the checkpoint of the Context are already on the isokinetic surface
+    isokineticStateIsValid = true;
+    forcesAreValid = false;
+}
+
+void VVIntegrator::setLinearSchedule(int parameter, const std::vector<double>& times, const std::vector<double>& values) {
+    if (parameter < ScheduleTemperature || parameter > ScheduleCosAcceleration)
+        throw OpenMMException("setLinearSchedule: Illegal schedule parameter");
+    if (times.empty() || times.size() != values.size())
+        throw OpenMMException("setLinearSchedule: times and values should have the same non-zero length");
+    for (int i = 1; i < (int) times.size(); i++)
+        if (times[i] <= times[i - 1])
+            throw OpenMMException("setLinearSchedule: times should be in ascending order");
+    ParameterSchedule schedule;
+    schedule.sinusoidal = false;
+    schedule.times = times;
+    schedule.values = values;
+    schedules[parameter] = schedule;
+}
+
+void VVIntegrator::setSinusoidalSchedule(int parameter, double offset, double amplitude, double period, double phase) {
+    if (parameter < ScheduleTemperature || parameter > ScheduleCosAcceleration)
+        throw OpenMMException("setSinusoidalSchedule: Illegal schedule parameter");
+    if (period <= 0)
+        throw OpenMMException("setSinusoidalSchedule: period should be positive");
+    ParameterSchedule schedule;
+    schedule.sinusoidal = true;
+    schedule.offset = offset;
+    schedule.amplitude = amplitude;
+    schedule.period = period;
+    schedule.phase = phase;
+    schedules[parameter] = schedule;
+}
+
+void VVIntegrator::clearSchedule(int parameter) {
+    schedules.erase(parameter);
+}
+
+bool VVIntegrator::hasSchedule(int parameter) const {
+    return schedules.find(parameter) != schedules.end();
+}
+
+void VVIntegrator::applySchedules() {
+    if (schedules.empty())
+        return;
+
+    const double time = context->getTime();
+    for (const auto& item: schedules) {
+        const ParameterSchedule& schedule = item.second;
+        double value;
+        if (schedule.sinusoidal)
+            value = schedule.offset + schedule.amplitude * sin(2 * PI_M * time / schedule.period + schedule.phase);
+        else {
+            const std::vector<double>& times = schedule.times;
+            int n = times.size();
+            if (time <= times[0])
+                value = schedule.values[0];
+            else if (time >= times[n - 1])
+                value = schedule.values[n - 1];
+            else {
+                int i = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+                double frac = (time - times[i - 1]) / (times[i] - times[i - 1]);
+                value = schedule.values[i - 1] + frac * (schedule.values[i] - schedule.values[i - 1]);
+            }
+        }
+        switch (item.first) {
+            case ScheduleTemperature:
+                setTemperature(value);
+                break;
+            case ScheduleDrudeTemperature:
+                setDrudeTemperature(value);
+                break;
+            case ScheduleElectricField:
+                setElectricField(value);
+                break;
+            case ScheduleCosAcceleration:
+                setCosAcceleration(value);
+                break;
+        }
+    }
+
+    // cosine acceleration may become non-zero in the middle of step()
+    updateModifierKernels();
+}
+
 void VVIntegrator::propagateNHChain(std::vector<double> &eta, std::vector<double> &eta_dot,
                                     std::vector<double> &eta_dotdot, const std::vector<double> &eta_mass,
                                     const double& ke2, const double& ke2_target, const double& t_target,
@@ -375,9 +986,404 @@ void VVIntegrator::propagateNHChain(std::vector<double> &eta, std::vector<double
     }
 }
 
-std::vector<double> VVIntegrator::getViscosity() {
-    double vMax = 0, invVis = 0;
+int VVIntegrator::addCosAccelerationMode(int flowAxis, int gradientAxis, int waveNumber, double amplitude) {
+    if (flowAxis < 0 || flowAxis > 2 || gradientAxis < 0 || gradientAxis > 2 || flowAxis == gradientAxis)
+        throw OpenMMException("addCosAccelerationMode: flowAxis and gradientAxis should be two different axes of 0, 1 and 2");
+    if (waveNumber < 1)
+        throw OpenMMException("addCosAccelerationMode: waveNumber should be positive");
+    for (int i = 0; i < getNumCosAccelerationModes(); i++) {
+        int flow, gradient, n;
+        double a;
+        getCosAccelerationModeParameters(i, flow, gradient, n, a);
+        if (flow == flowAxis && gradient == gradientAxis && n == waveNumber)
+            throw OpenMMException("addCosAccelerationMode: This mode already exists");
+    }
+    CosAccelerationMode mode;
+    mode.flowAxis = flowAxis;
+    mode.gradientAxis = gradientAxis;
+    mode.waveNumber = waveNumber;
+    mode.amplitude = amplitude;
+    cosAccelerationModes.push_back(mode);
+    return cosAccelerationModes.size();
+}
+
+void VVIntegrator::getCosAccelerationModeParameters(int mode, int& flowAxis, int& gradientAxis, int& waveNumber, double& amplitude) const {
+    if (mode < 0 || mode >= getNumCosAccelerationModes())
+        throw OpenMMException("getCosAccelerationModeParameters: Illegal mode index");
+    if (mode == 0) {
+        flowAxis = 0;
+        gradientAxis = 2;
+        waveNumber = 1;
+        amplitude = cosAcceleration;
+    }
+    else {
+        const CosAccelerationMode& m = cosAccelerationModes[mode - 1];
+        flowAxis = m.flowAxis;
+        gradientAxis = m.gradientAxis;
+        waveNumber = m.waveNumber;
+        amplitude = m.amplitude;
+    }
+}
+
+void VVIntegrator::setCosAccelerationModeAmplitude(int mode, double amplitude) {
+    if (mode < 0 || mode >= getNumCosAccelerationModes())
+        throw OpenMMException("setCosAccelerationModeAmplitude: Illegal mode index");
+    if (mode == 0)
+        setCosAcceleration(amplitude);
+    else
+        cosAccelerationModes[mode - 1].amplitude = amplitude;
+}
+
+bool VVIntegrator::usePeriodicPerturbation() const {
     if (cosAcceleration != 0)
-        ppKernel.getAs<ModifyCosineAccelerateKernel>().calcViscosity(*context, *this, vMax, invVis);
+        return true;
+    for (auto& mode : cosAccelerationModes)
+        if (mode.amplitude != 0)
+            return true;
+    return false;
+}
+
+std::vector<double> VVIntegrator::getViscosity(int mode) {
+    int flowAxis, gradientAxis, waveNumber;
+    double amplitude;
+    getCosAccelerationModeParameters(mode, flowAxis, gradientAxis, waveNumber, amplitude);
+    double vMax = 0, invVis = 0;
+    if (ppKernelCreated && amplitude != 0)
+        ppKernel.getAs<ModifyCosineAccelerateKernel>().calcViscosity(*context, *this, mode, vMax, invVis);
     return std::vector<double>{vMax, invVis};
 }
+
+std::vector<double> VVIntegrator::getViscosityStatistics(int mode) {
+    int flowAxis, gradientAxis, waveNumber;
+    double amplitude;
+    getCosAccelerationModeParameters(mode, flowAxis, gradientAxis, waveNumber, amplitude);
+    std::vector<double> stats(5, 0);
+    if (ppKernelCreated && amplitude != 0) {
+        ppKernel.getAs<ModifyCosineAccelerateKernel>().calcViscosityStatistics(*context, *this, mode, stats);
+        // the autocorrelation time is returned by the kernel in the number of samples
+        stats[3] *= viscosityStatisticsInterval * getStepSize();
+    }
+    return stats;
+}
+
+void VVIntegrator::resetViscosityStatistics() {
+    if (ppKernelCreated)
+        ppKernel.getAs<ModifyCosineAccelerateKernel>().resetViscosityStatistics(*context, *this);
+    viscosityStepCount = 0;
+}
+
+std::vector<double> VVIntegrator::getRNEMDStatistics() {
+    std::vector<double> stats(6, 0), profile;
+    if (rnemdKernelCreated)
+        rnemdKernel.getAs<ModifyRNEMDKernel>().calcRNEMDStatistics(*context, *this, stats, profile);
+    return stats;
+}
+
+std::vector<double> VVIntegrator::getRNEMDVelocityProfile() {
+    std::vector<double> stats, profile(rnemdNumSlabs, 0);
+    if (rnemdKernelCreated)
+        rnemdKernel.getAs<ModifyRNEMDKernel>().calcRNEMDStatistics(*context, *this, stats, profile);
+    return profile;
+}
+
+void VVIntegrator::resetRNEMDStatistics() {
+    if (rnemdKernelCreated)
+        rnemdKernel.getAs<ModifyRNEMDKernel>().resetRNEMDStatistics(*context, *this);
+}
+
+bool VVIntegrator::isRNEMDExchangeDue() {
+    if (rnemdInterval <= 0)
+        return false;
+    rnemdStepCount++;
+    return rnemdStepCount % rnemdInterval == 0;
+}
+
+std::vector<double> VVIntegrator::getDensityProfile(int group, int quantity) {
+    if (group < ProfileElectrolyte || group > ProfileOther)
+        throw OpenMMException("getDensityProfile: Illegal group of particles");
+    if (quantity < ProfileNumber || quantity > ProfileDipole)
+        throw OpenMMException("getDensityProfile: Illegal quantity");
+    std::vector<double> profile(densityProfileNumBins, 0);
+    if (profileKernelCreated)
+        profileKernel.getAs<CalcDensityProfileKernel>().getProfile(*context, *this, group, quantity, profile);
+    return profile;
+}
+
+int VVIntegrator::getDensityProfileNumSamples() {
+    if (profileKernelCreated)
+        return profileKernel.getAs<CalcDensityProfileKernel>().getNumSamples();
+    return 0;
+}
+
+void VVIntegrator::resetDensityProfile() {
+    if (profileKernelCreated)
+        profileKernel.getAs<CalcDensityProfileKernel>().resetProfiles(*context, *this);
+}
+
+const std::vector<int>& VVIntegrator::getCorrelatorGroup(int group) const {
+    ASSERT_VALID_INDEX(group, correlatorGroups);
+    return correlatorGroups[group];
+}
+
+std::vector<double> VVIntegrator::getCorrelatorLagTimes() {
+    std::vector<double> lagTimes, msd, vacf;
+    if (correlatorKernelCreated)
+        correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().getCorrelations(*context, *this, 0, lagTimes, msd, vacf);
+    return lagTimes;
+}
+
+std::vector<double> VVIntegrator::getMSD(int group) {
+    ASSERT_VALID_INDEX(group, correlatorGroups);
+    std::vector<double> lagTimes, msd, vacf;
+    if (correlatorKernelCreated)
+        correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().getCorrelations(*context, *this, group, lagTimes, msd, vacf);
+    return msd;
+}
+
+std::vector<double> VVIntegrator::getVACF(int group) {
+    ASSERT_VALID_INDEX(group, correlatorGroups);
+    std::vector<double> lagTimes, msd, vacf;
+    if (correlatorKernelCreated)
+        correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().getCorrelations(*context, *this, group, lagTimes, msd, vacf);
+    return vacf;
+}
+
+void VVIntegrator::resetCorrelator() {
+    if (correlatorKernelCreated)
+        correlatorKernel.getAs<CalcMultiTauCorrelationKernel>().resetCorrelations(*context, *this);
+}
+
+std::vector<double> VVIntegrator::getConductivity(double fitTime) {
+    std::vector<double> stats(5, 0);
+    if (conductivityKernelCreated)
+        conductivityKernel.getAs<CalcConductivityKernel>().calcConductivity(*context, *this, fitTime, stats);
+    return stats;
+}
+
+std::vector<double> VVIntegrator::getConductivityLagTimes() {
+    std::vector<double> lagTimes, cacf, msd;
+    if (conductivityKernelCreated)
+        conductivityKernel.getAs<CalcConductivityKernel>().getCorrelations(*context, *this, lagTimes, cacf, msd);
+    return lagTimes;
+}
+
+std::vector<double> VVIntegrator::getChargeCurrentAutocorrelation() {
+    std::vector<double> lagTimes, cacf, msd;
+    if (conductivityKernelCreated)
+        conductivityKernel.getAs<CalcConductivityKernel>().getCorrelations(*context, *this, lagTimes, cacf, msd);
+    return cacf;
+}
+
+std::vector<double> VVIntegrator::getDipoleMSD() {
+    std::vector<double> lagTimes, cacf, msd;
+    if (conductivityKernelCreated)
+        conductivityKernel.getAs<CalcConductivityKernel>().getCorrelations(*context, *this, lagTimes, cacf, msd);
+    return msd;
+}
+
+void VVIntegrator::resetConductivity() {
+    if (conductivityKernelCreated)
+        conductivityKernel.getAs<CalcConductivityKernel>().resetConductivity(*context, *this);
+}
+
+std::vector<double> VVIntegrator::getGroupKineticEnergies() {
+    std::vector<double> kineticEnergies(3, 0), dofs(3, 0);
+    if (context != NULL && !particlesNH.empty() && !useSINR)
+        nhKernel.getAs<ModifyDrudeNoseKernel>().getGroupKineticEnergies(*context, *this, kineticEnergies, dofs);
+    return kineticEnergies;
+}
+
+std::vector<double> VVIntegrator::getGroupTemperatures() {
+    std::vector<double> kineticEnergies(3, 0), dofs(3, 0), temperatures(3, 0);
+    if (context != NULL && !particlesNH.empty() && !useSINR)
+        nhKernel.getAs<ModifyDrudeNoseKernel>().getGroupKineticEnergies(*context, *this, kineticEnergies, dofs);
+    for (int i = 0; i < 3; i++)
+        if (dofs[i] > 0)
+            temperatures[i] = 2 * kineticEnergies[i] / (dofs[i] * BOLTZ);
+    return temperatures;
+}
+
+std::vector<double> VVIntegrator::getGroupDOFs() {
+    std::vector<double> kineticEnergies(3, 0), dofs(3, 0);
+    if (context != NULL && !particlesNH.empty() && !useSINR)
+        nhKernel.getAs<ModifyDrudeNoseKernel>().getGroupKineticEnergies(*context, *this, kineticEnergies, dofs);
+    return dofs;
+}
+
+// The history of group kinetic energies is a ring buffer of fixed capacity on the device,
+// the oldest records are overwritten when it's full. The head and size are tracked here, so recording doesn't transfer any data
+static const int GROUP_TEMPERATURE_HISTORY_CAPACITY = 10000;
+static const int GROUP_KINETIC_ENERGY_RECORD_SIZE = 4;
+
+std::vector<double> VVIntegrator::getGroupTemperatureHistory() {
+    std::vector<double> history;
+    if (groupTemperatureHistorySize == 0)
+        return history;
+    std::vector<double> records, dofs;
+    nhKernel.getAs<ModifyDrudeNoseKernel>().getGroupKineticEnergyHistory(*context, *this, records, dofs);
+    history.reserve(groupTemperatureHistorySize * 7);
+    for (int i = 0; i < groupTemperatureHistorySize; i++) {
+        int slot = (groupTemperatureHistoryHead + i) % GROUP_TEMPERATURE_HISTORY_CAPACITY;
+        const double *record = &records[slot * GROUP_KINETIC_ENERGY_RECORD_SIZE];
+        history.push_back(record[0]);
+        for (int j = 0; j < 3; j++)
+            history.push_back(record[1 + j]);
+        for (int j = 0; j < 3; j++)
+            history.push_back(dofs[j] > 0 ? 2 * record[1 + j] / (dofs[j] * BOLTZ) : 0);
+    }
+    return history;
+}
+
+void VVIntegrator::resetGroupTemperatureHistory() {
+    groupTemperatureHistoryHead = 0;
+    groupTemperatureHistorySize = 0;
+}
+
+void VVIntegrator::recordGroupTemperatures() {
+    if (groupTemperatureInterval <= 0 || particlesNH.empty() || useSINR)
+        return;
+    groupTemperatureStepCount++;
+    if (groupTemperatureStepCount % groupTemperatureInterval != 0)
+        return;
+
+    int slot = (groupTemperatureHistoryHead + groupTemperatureHistorySize) % GROUP_TEMPERATURE_HISTORY_CAPACITY;
+    if (groupTemperatureHistorySize == GROUP_TEMPERATURE_HISTORY_CAPACITY)
+        groupTemperatureHistoryHead = (groupTemperatureHistoryHead + 1) % GROUP_TEMPERATURE_HISTORY_CAPACITY;
+    else
+        groupTemperatureHistorySize++;
+    nhKernel.getAs<ModifyDrudeNoseKernel>().recordGroupKineticEnergies(*context, *this, slot, GROUP_TEMPERATURE_HISTORY_CAPACITY);
+}
+
+std::vector<double> VVIntegrator::getElectrodeStatistics() {
+    std::vector<double> stats(6, 0), distribution;
+    if (electrodeStatisticsEnabled)
+        imgKernel.getAs<ModifyImageChargeKernel>().getElectrodeStatistics(*context, *this, stats, distribution);
+    return stats;
+}
+
+std::vector<double> VVIntegrator::getImageChargeDistribution() {
+    std::vector<double> stats, distribution;
+    if (electrodeStatisticsEnabled)
+        imgKernel.getAs<ModifyImageChargeKernel>().getElectrodeStatistics(*context, *this, stats, distribution);
+    return distribution;
+}
+
+void VVIntegrator::resetElectrodeStatistics() {
+    if (electrodeStatisticsEnabled)
+        imgKernel.getAs<ModifyImageChargeKernel>().resetElectrodeStatistics(*context, *this);
+}
+
+std::vector<double> VVIntegrator::getForceGroupEnergies() {
+    if (context == NULL)
+        throw OpenMMException("getForceGroupEnergies: This Integrator is not bound to a context!");
+    const System& system = context->getSystem();
+    int groupsInUse = 0;
+    for (int i = 0; i < system.getNumForces(); i++)
+        groupsInUse |= 1 << system.getForce(i).getForceGroup();
+
+    std::vector<double> energies(32, 0);
+    for (int group = 0; group < 32; group++) {
+        if (groupsInUse & (1 << group))
+            energies[group] = context->calcForcesAndEnergy(false, true, 1 << group);
+    }
+    // The forces of the current step have been overwritten
+    forcesAreValid = false;
+    return energies;
+}
+
+static double getSteadyClockSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void VVIntegrator::recordPhase(int phase, bool begin) {
+    if (timingKernelCreated) {
+        if (begin)
+            timingKernel.getAs<CalcTimingKernel>().beginPhase(*context, phase);
+        else
+            timingKernel.getAs<CalcTimingKernel>().endPhase(*context, phase);
+    }
+    else if (begin)
+        phaseStartTimes[phase] = getSteadyClockSeconds();
+    else {
+        hostTimings[2 * phase] += 1;
+        hostTimings[2 * phase + 1] += getSteadyClockSeconds() - phaseStartTimes[phase];
+    }
+}
+
+std::vector<double> VVIntegrator::getTimings() {
+    vector<double> timings(2 * NumTimingPhases, 0);
+    if (timingKernelCreated)
+        timingKernel.getAs<CalcTimingKernel>().getTimings(*context, timings);
+    else if (timingActive)
+        timings = hostTimings;
+    return timings;
+}
+
+std::string VVIntegrator::getTimingReport() {
+    if (!timingActive)
+        return "Timing is not enabled\n";
+    vector<double> timings = getTimings();
+    const double stepTime = timings[2 * TimingStep + 1];
+    string report = timingKernelCreated ? "Device time of each phase\n" : "Wall time of each phase\n";
+    char line[128];
+    snprintf(line, sizeof(line), "%-16s %12s %12s %14s %8s\n", "Phase", "Calls", "Total (s)", "Per call (us)", "Of step");
+    report += line;
+    for (int phase = 0; phase < NumTimingPhases; phase++) {
+        const double calls = timings[2 * phase], seconds = timings[2 * phase + 1];
+        if (calls == 0)
+            continue;
+        snprintf(line, sizeof(line), "%-16s %12.0f %12.4f %14.2f %7.1f%%\n", getTimingPhaseName(phase).c_str(),
+                 calls, seconds, seconds / calls * 1e6, stepTime > 0 ? seconds / stepTime * 100 : 0.0);
+        report += line;
+    }
+    return report;
+}
+
+void VVIntegrator::resetTimings() {
+    if (timingKernelCreated)
+        timingKernel.getAs<CalcTimingKernel>().resetTimings(*context);
+    std::fill(hostTimings.begin(), hostTimings.end(), 0.0);
+}
+
+std::string VVIntegrator::getTimingPhaseName(int phase) {
+    static const char* names[NumTimingPhases] = {"Step", "Forces", "ExtraForces", "FirstIntegrate", "SecondIntegrate",
+                                                 "Constraints", "Thermostat", "ImageUpdate", "Reorder", "Sampling"};
+    if (phase < 0 || phase >= NumTimingPhases)
+        throw OpenMMException("getTimingPhaseName: Illegal timing phase");
+    return names[phase];
+}
+
+bool VVIntegrator::isElectrodeSampleDue() {
+    if (!electrodeStatisticsEnabled)
+        return false;
+    electrodeStepCount++;
+    return electrodeStepCount % electrodeStatisticsInterval == 0;
+}
+
+bool VVIntegrator::isConductivitySampleDue() {
+    if (conductivityInterval <= 0)
+        return false;
+    conductivityStepCount++;
+    return conductivityStepCount % conductivityInterval == 0;
+}
+
+bool VVIntegrator::isCorrelatorSampleDue() {
+    if (correlatorInterval <= 0)
+        return false;
+    correlatorStepCount++;
+    return correlatorStepCount % correlatorInterval == 0;
+}
+
+bool VVIntegrator::isDensityProfileSampleDue() {
+    if (densityProfileInterval <= 0)
+        return false;
+    profileStepCount++;
+    return profileStepCount % densityProfileInterval == 0;
+}
+
+bool VVIntegrator::isViscositySampleDue() {
+    if (viscosityStatisticsInterval <= 0)
+        return false;
+    viscosityStepCount++;
+    return viscosityStepCount % viscosityStatisticsInterval == 0;
+}
@@ -35,16 +35,19 @@
 #include "openmm/VVKernels.h"
 #include "CudaContext.h"
 #include "CudaArray.h"
+#include <deque>
 
 namespace OpenMM {
 
+class CudaCalcTimingKernel;
+
 /**
  * This kernel is invoked by VVIntegrator to take one time step with middle scheme
  */
     class CudaIntegrateMiddleStepKernel : public IntegrateMiddleStepKernel {
     public:
         CudaIntegrateMiddleStepKernel(std::string name, const Platform &platform, CudaContext &cu) :
-                IntegrateMiddleStepKernel(name, platform), cu(cu), forceExtra(NULL), drudePairs(NULL) {
+                IntegrateMiddleStepKernel(name, platform), cu(cu), forceExtra(NULL), drudePairs(NULL), timer(NULL) {
         }
         ~CudaIntegrateMiddleStepKernel();
         /**
@@ -86,6 +89,12 @@ namespace OpenMM {
         CudaArray* getForceExtra(){
             return forceExtra;
         }
+        /**
+         * Set the timer for the constraints and reordering, which is owned by the timing kernel
+         */
+        void setTimer(CudaCalcTimingKernel* timingKernel){
+            timer = timingKernel;
+        }
     private:
         CudaContext& cu;
         double prevStepSize;
@@ -95,6 +104,7 @@ namespace OpenMM {
         CudaArray *oldDelta;
         CudaArray *drudePairs;
         CUfunction kernelVel, kernelPos1, kernelPos2, kernelPos3, kernelDrudeHardwall, kernelResetExtraForce;
+        CudaCalcTimingKernel* timer;
     };
 
 
@@ -104,7 +114,7 @@ namespace OpenMM {
 class CudaIntegrateVVStepKernel : public IntegrateVVStepKernel {
 public:
     CudaIntegrateVVStepKernel(std::string name, const Platform &platform, CudaContext &cu) :
-            IntegrateVVStepKernel(name, platform), cu(cu), forceExtra(NULL), drudePairs(NULL) {
+            IntegrateVVStepKernel(name, platform), cu(cu), forceExtra(NULL), drudePairs(NULL), timer(NULL) {
     }
     ~CudaIntegrateVVStepKernel();
     /**
@@ -142,10 +152,30 @@ public:
      * @param integrator    the DrudeNoseHooverIntegrator this kernel is being used for
      */
     double computeKineticEnergy(ContextImpl& context, const VVIntegrator& integrator);
+    /**
+     * Write the state of this kernel to a checkpoint.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     an output stream the checkpoint data should be written to
+     */
+    void createCheckpoint(ContextImpl& context, std::ostream& stream) const;
+    /**
+     * Load the state of this kernel from a checkpoint.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     an input stream the checkpoint data should be read from
+     */
+    void loadCheckpoint(ContextImpl& context, std::istream& stream);
 
     CudaArray* getForceExtra(){
         return forceExtra;
     }
+    /**
+     * Set the timer for the constraints and reordering, which is owned by the timing kernel
+     */
+    void setTimer(CudaCalcTimingKernel* timingKernel){
+        timer = timingKernel;
+    }
 private:
     CudaContext& cu;
     double prevStepSize;
@@ -154,6 +184,124 @@ private:
     CudaArray *forceExtra;
     CudaArray *drudePairs;
     CUfunction kernelVel, kernelPos, kernelDrudeHardwall, kernelResetExtraForce;
+    CudaCalcTimingKernel* timer;
+};
+
+/**
+ * This kernel is invoked by VVIntegrator to take one time step with isokinetic Nose-Hoover RESPA (SIN(R)) scheme
+ */
+class CudaIntegrateSINRStepKernel : public IntegrateSINRStepKernel {
+public:
+    CudaIntegrateSINRStepKernel(std::string name, const Platform &platform, CudaContext &cu) :
+            IntegrateSINRStepKernel(name, platform), cu(cu), forceExtra(NULL), forceSlow(NULL), forceFast(NULL),
+            v1(NULL), v2(NULL), sinrParams(NULL), timer(NULL) {
+    }
+    ~CudaIntegrateSINRStepKernel();
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param integrator the VVIntegrator this kernel will be used for
+     */
+    void initialize(const System& system, const VVIntegrator& integrator);
+    /**
+     * Rescale the velocities and the thermostat variables so that the isokinetic constraint is satisfied.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     */
+    void initializeIsokineticState(ContextImpl& context, const VVIntegrator& integrator);
+    /**
+     * Store the forces just calculated
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     * @param slow           whether the forces are slow forces or fast forces
+     */
+    void storeForce(ContextImpl& context, const VVIntegrator& integrator, bool slow);
+    /**
+     * Reset the extra forces to zero so that we can calculate external electric force etc
+     * @param context
+     * @param integrator
+     */
+    void resetExtraForce(ContextImpl& context, const VVIntegrator& integrator);
+    /**
+     * Half outer step velocity update with slow forces
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     * @param useStoredForce whether to use the stored slow forces or the forces just calculated
+     */
+    void integrateSlowVelocity(ContextImpl& context, const VVIntegrator& integrator, bool useStoredForce);
+    /**
+     * First half of the inner step
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     */
+    void firstIntegrateInner(ContextImpl& context, const VVIntegrator& integrator);
+    /**
+     * Second half of the inner step
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     */
+    void secondIntegrateInner(ContextImpl& context, const VVIntegrator& integrator);
+    /**
+     * Reorder the atoms and update the time and step count
+     *
+     * @param context        the context in which to execute this kernel
+     * @param integrator     the VVIntegrator this kernel is being used for
+     */
+    void finishStep(ContextImpl& context, const VVIntegrator& integrator);
+    /**
+     * Compute the kinetic energy.
+     *
+     * @param context       the context in which to execute this kernel
+     * @param integrator    the VVIntegrator this kernel is being used for
+     */
+    double computeKineticEnergy(ContextImpl& context, const VVIntegrator& integrator);
+    /**
+     * Write the state of this kernel to a checkpoint.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     an output stream the checkpoint data should be written to
+     */
+    void createCheckpoint(ContextImpl& context, std::ostream& stream) const;
+    /**
+     * Load the state of this kernel from a checkpoint.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     an input stream the checkpoint data should be read from
+     */
+    void loadCheckpoint(ContextImpl& context, std::istream& stream);
+
+    CudaArray* getForceExtra(){
+        return forceExtra;
+    }
+    /**
+     * Set the timer for the reordering, which is owned by the timing kernel
+     */
+    void setTimer(CudaCalcTimingKernel* timingKernel){
+        timer = timingKernel;
+    }
+private:
+    /**
+     * Upload the thermostat and time step parameters if any of them is changed
+     */
+    void updateParameters(const VVIntegrator& integrator);
+    CudaContext& cu;
+    int numAtoms, chainLength;
+    bool hasSlowForce, hasFastForce;
+    std::vector<double> prevParams;
+    CudaArray *forceExtra;
+    CudaArray *forceSlow;
+    CudaArray *forceFast;
+    CudaArray *v1;
+    CudaArray *v2;
+    CudaArray *sinrParams;
+    CUfunction kernelInit, kernelStore, kernelSlow, kernelInner1, kernelInner2, kernelResetExtraForce;
+    CudaCalcTimingKernel* timer;
 };
 
 /**
@@ -166,7 +314,10 @@ private:
                 particlesNH(NULL), moleculesNH(NULL), normalParticlesNH(NULL), pairParticlesNH(NULL),
                 particleMolId(NULL), particlesInMolecules(NULL), particlesSortedByMolId(NULL),
                 comVelm(NULL), kineticEnergyBufferNH(NULL),
-                kineticEnergiesNH(NULL), vscaleFactorsNH(NULL) {
+                kineticEnergiesNH(NULL), vscaleFactorsNH(NULL),
+                drudePartner(NULL), drudePairChain(NULL), moleculeChain(NULL),
+                massiveChainDof(NULL), massiveChainKE(NULL), massiveEtaDot(NULL), massiveEtaDotDot(NULL),
+                smallMoleculesNH(NULL), largeMoleculesNH(NULL), groupHistory(NULL) {
         }
 
         ~CudaModifyDrudeNoseKernel();
@@ -187,11 +338,79 @@ private:
          * @param integrator     the DrudeNoseHooverIntegrator this kernel is being used for
          */
         void scaleVelocity(ContextImpl &context, const VVIntegrator& integrator);
+        /**
+         * Get the kinetic energies and degrees of freedom of the temperature groups after the last velocity scaling.
+         * They are already downloaded for propagating the NH chains, so no data is transferred from the device,
+         * except for massive Nose-Hoover chains.
+         *
+         * @param context          the context in which to execute this kernel
+         * @param integrator       the DrudeNoseHooverIntegrator this kernel is being used for
+         * @param kineticEnergies  the kinetic energies of atomic motion, molecular COM motion and Drude relative motion
+         * @param dofs             the degrees of freedom of these temperature groups
+         */
+        void getGroupKineticEnergies(ContextImpl& context, const VVIntegrator& integrator,
+                                     std::vector<double>& kineticEnergies, std::vector<double>& dofs);
+        /**
+         * Append the time and the kinetic energies of the temperature groups after the last velocity scaling
+         * to the ring buffer of history, without transferring any data from the device.
+         *
+         * @param context          the context in which to execute this kernel
+         * @param integrator       the DrudeNoseHooverIntegrator this kernel is being used for
+         * @param slot             the index of the record to write in the ring buffer
+         * @param capacity         the number of records of the ring buffer
+         */
+        void recordGroupKineticEnergies(ContextImpl& context, const VVIntegrator& integrator, int slot, int capacity);
+        /**
+         * Get the ring buffer of history of the group kinetic energies.
+         *
+         * @param context          the context in which to execute this kernel
+         * @param integrator       the DrudeNoseHooverIntegrator this kernel is being used for
+         * @param history          the records of time and kinetic energies of the three temperature groups, in the order of slots
+         * @param dofs             the degrees of freedom of these temperature groups
+         */
+        void getGroupKineticEnergyHistory(ContextImpl& context, const VVIntegrator& integrator,
+                                          std::vector<double>& history, std::vector<double>& dofs);
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        void createCheckpoint(ContextImpl& context, std::ostream& stream) const;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        void loadCheckpoint(ContextImpl& context, std::istream& stream);
 
     private:
+        /**
+         * Recalculate the NH chain masses and target kinetic energies if the temperatures, frequencies
+         * or the length of NH chain are changed after initialization
+         */
+        void updateChainParameters(const VVIntegrator& integrator);
+        /**
+         * Build the index arrays and the chain variables for massive Nose-Hoover chains
+         */
+        void initializeMassive(const System &system, const VVIntegrator &integrator);
+        /**
+         * Allocate the chain variables with zero, if the length of NH chain is changed
+         */
+        void allocateMassiveChains(int chainLength);
+        /**
+         * Propagate the massive Nose-Hoover chains and scale the velocity
+         */
+        void scaleVelocityMassive(ContextImpl &context, const VVIntegrator& integrator);
+        /**
+         * Get the degrees of freedom of the temperature groups
+         */
+        std::vector<double> getGroupDofs() const;
         CudaContext &cu;
-        int numAtoms, numTempGroup;
+        int numAtoms, numTempGroup, prevNumNHChains;
         double realKbT, drudeKbT;
+        double prevTemperature, prevFrequency, prevDrudeTemperature, prevDrudeFrequency;
         CudaArray *particlesNH;
         CudaArray *moleculesNH;
         CudaArray *normalParticlesNH;
@@ -214,6 +433,25 @@ private:
         std::vector<double> kineticEnergiesNHVec; // 2 * kinetic energy
         std::vector<double> vscaleFactorsNHVec;
         CUfunction kernelKE, kernelKESum, kernelScale, kernelNormVel, kernelCOMVel;
+        // for massive Nose-Hoover chains
+        bool useMassive;
+        int numMassiveChains, massiveChainLength;
+        double massiveMoleculeDof;
+        CudaArray *drudePartner;
+        CudaArray *drudePairChain;
+        CudaArray *moleculeChain;
+        CudaArray *massiveChainDof;
+        CudaArray *massiveChainKE; // 2 * kinetic energy of each chain after the scaling
+        CudaArray *massiveEtaDot;
+        CudaArray *massiveEtaDotDot;
+        // molecules handled by one thread and by one thread block
+        std::vector<int> smallMoleculesNHVec, largeMoleculesNHVec;
+        CudaArray *smallMoleculesNH;
+        CudaArray *largeMoleculesNH;
+        CUfunction kernelMassiveMolecules, kernelMassiveLargeMolecules, kernelMassivePairs;
+        // ring buffer of the history of group kinetic energies
+        CudaArray *groupHistory;
+        CUfunction kernelRecordGroupKE, kernelMassiveRecordGroupKE;
     };
 
 /**
@@ -244,6 +482,14 @@ private:
          */
         void applyLangevinForce(ContextImpl &context, const VVIntegrator &integrator);
 
+        /**
+         * Update the velocities of particles thermolized by Langevin dynamics with Ornstein-Uhlenbeck process
+         * @param context
+         * @param integrator
+         * @param timeStep
+         */
+        void applyLangevinVelocity(ContextImpl &context, const VVIntegrator &integrator, double timeStep);
+
     private:
         CudaArray* forceExtra;
         CudaContext &cu;
@@ -251,7 +497,7 @@ private:
         std::vector<int2> pairParticlesLDVec;
         CudaArray *normalParticlesLD;
         CudaArray *pairParticlesLD;
-        CUfunction kernelApplyLangevin;
+        CUfunction kernelApplyLangevin, kernelLangevinVelocity;
     };
 
     /**
@@ -260,7 +506,8 @@ private:
     class CudaModifyImageChargeKernel : public ModifyImageChargeKernel {
     public:
         CudaModifyImageChargeKernel(std::string name, const Platform &platform, CudaContext &cu)
-                : ModifyImageChargeKernel(name, platform), cu(cu), imagePairs(NULL) {
+                : ModifyImageChargeKernel(name, platform), cu(cu), imagePairs(NULL),
+                  particleType(NULL), electrodeBuffer(NULL), electrodeSums(NULL) {
         }
 
         ~CudaModifyImageChargeKernel();
@@ -281,11 +528,52 @@ private:
          * @param integrator     the DrudeNoseHooverIntegrator this kernel is being used for
          */
         void updateImagePositions(ContextImpl &context, const VVIntegrator &integrator);
+        /**
+         * Accumulate the electrode observables of current configuration
+         * @param context
+         * @param integrator
+         */
+        void accumulateElectrodeStatistics(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Get the averaged electrode observables
+         * @param context
+         * @param integrator
+         * @param stats
+         * @param distribution
+         */
+        void getElectrodeStatistics(ContextImpl& context, const VVIntegrator& integrator,
+                                    std::vector<double>& stats, std::vector<double>& distribution);
+        /**
+         * Discard the accumulated electrode observables
+         * @param context
+         * @param integrator
+         */
+        void resetElectrodeStatistics(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        void createCheckpoint(ContextImpl& context, std::ostream& stream) const;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        void loadCheckpoint(ContextImpl& context, std::istream& stream);
 
     private:
         CudaContext &cu;
         CudaArray *imagePairs;
         CUfunction kernelImage;
+        // for electrode observables, which are allocated only if the sampling is enabled
+        int numBinsX, numBinsY, numElectrodeSamples;
+        CudaArray *particleType;
+        CudaArray *electrodeBuffer;
+        CudaArray *electrodeSums;
+        CUfunction kernelSampleElectrode, kernelAccumulateElectrode;
     };
 
 /**
@@ -327,7 +615,8 @@ private:
     class CudaModifyCosineAccelerateKernel: public ModifyCosineAccelerateKernel{
     public:
         CudaModifyCosineAccelerateKernel(std::string name, const Platform &platform, CudaContext &cu) :
-                ModifyCosineAccelerateKernel(name, platform), cu(cu), vMaxBuffer(NULL) {
+                ModifyCosineAccelerateKernel(name, platform), cu(cu), vBlockSums(NULL), vAmplitudes(NULL), vStatistics(NULL),
+                modeAxes(NULL), modeAmplitudes(NULL) {
         }
         ~CudaModifyCosineAccelerateKernel();
         /**
@@ -348,8 +637,9 @@ private:
          * Calculate the velocity bias because of the periodic perturbation force
          * @param context
          * @param integrator
+         * @param sample     whether to accumulate the velocity amplitude into the viscosity statistics
          */
-        void calcVelocityBias(ContextImpl& context, const VVIntegrator& integrator);
+        void calcVelocityBias(ContextImpl& context, const VVIntegrator& integrator, bool sample);
         /**
          * Remove the velocity bias before thermostat
          * @param context
@@ -369,16 +659,401 @@ private:
          * @param vMax
          * @param invVis
          */
-        void calcViscosity(ContextImpl& context, const VVIntegrator& integrator, double& vMax, double& invVis);
+        void calcViscosity(ContextImpl& context, const VVIntegrator& integrator, int mode, double& vMax, double& invVis);
+        /**
+         * Analyze the velocity amplitudes accumulated on the device with block averaging
+         * @param context
+         * @param integrator
+         * @param mode
+         * @param stats
+         */
+        void calcViscosityStatistics(ContextImpl& context, const VVIntegrator& integrator, int mode, std::vector<double>& stats);
+        /**
+         * Discard the velocity amplitudes accumulated on the device
+         * @param context
+         * @param integrator
+         */
+        void resetViscosityStatistics(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        void createCheckpoint(ContextImpl& context, std::ostream& stream) const;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        void loadCheckpoint(ContextImpl& context, std::istream& stream);
     private:
+        /**
+         * Get the factor converting the velocity amplitude of a mode to reciprocal viscosity
+         */
+        double calcInvViscosityFactor(const VVIntegrator& integrator, int mode) const;
+        /**
+         * Upload the amplitudes of all modes if they are changed
+         */
+        void updateAmplitudes(const VVIntegrator& integrator);
         CudaArray* forceExtra;
         CudaContext& cu;
         int numAtoms;
         double invMassTotal;
-        CudaArray* vMaxBuffer;
+        int numBlocks;
+        CudaArray* vBlockSums;
+        CudaArray* vAmplitudes;
+        CudaArray* vStatistics;
+        int numModes;
+        CudaArray* modeAxes;
+        CudaArray* modeAmplitudes;
+        std::vector<double> prevAmplitudes;
         CUfunction kernelAccelerate, kernelCalcV, kernelSumV, kernelRemoveBias, kernelRestoreBias;
     };
 
+    class CudaModifyRNEMDKernel: public ModifyRNEMDKernel{
+    public:
+        CudaModifyRNEMDKernel(std::string name, const Platform &platform, CudaContext &cu) :
+                ModifyRNEMDKernel(name, platform), cu(cu), units(NULL), unitParticles(NULL),
+                blockMaxV(NULL), blockMaxUnit(NULL), blockMinV(NULL), blockMinUnit(NULL), slabBuffer(NULL), slabProfile(NULL), transferred(NULL) {
+        }
+        ~CudaModifyRNEMDKernel();
+        /**
+         * Initialize the kernel.
+         *
+         * @param system     the System this kernel will be applied to
+         * @param integrator the VVIntegrator this kernel will be used for
+         * @param force      the DrudeForce to get particle parameters from
+         */
+        void initialize(const System& system, const VVIntegrator& integrator, const DrudeForce* force);
+        /**
+         * Exchange the x-momentum between the fastest units in slab 0 and the middle slab
+         * @param context
+         * @param integrator
+         */
+        void exchangeMomentum(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Calculate the momentum flux and viscosity from the accumulated exchanges
+         * @param context
+         * @param integrator
+         * @param stats
+         * @param profile
+         */
+        void calcRNEMDStatistics(ContextImpl& context, const VVIntegrator& integrator,
+                                 std::vector<double>& stats, std::vector<double>& profile);
+        /**
+         * Discard the accumulated exchanges and velocity profile
+         * @param context
+         * @param integrator
+         */
+        void resetRNEMDStatistics(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        void createCheckpoint(ContextImpl& context, std::ostream& stream) const;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        void loadCheckpoint(ContextImpl& context, std::istream& stream);
+    private:
+        CudaContext& cu;
+        int numUnits, numSlabs, numBlocks;
+        double elapsedTime;
+        CudaArray* units;
+        CudaArray* unitParticles;
+        CudaArray* blockMaxV;
+        CudaArray* blockMaxUnit;
+        CudaArray* blockMinV;
+        CudaArray* blockMinUnit;
+        CudaArray* slabBuffer;
+        CudaArray* slabProfile;
+        CudaArray* transferred;
+        CUfunction kernelFindCandidates, kernelExchange;
+    };
+
+    class CudaCalcDensityProfileKernel: public CalcDensityProfileKernel{
+    public:
+        CudaCalcDensityProfileKernel(std::string name, const Platform &platform, CudaContext &cu) :
+                CalcDensityProfileKernel(name, platform), cu(cu), particleInfo(NULL), profileBuffer(NULL), profiles(NULL) {
+        }
+        ~CudaCalcDensityProfileKernel();
+        /**
+         * Initialize the kernel.
+         *
+         * @param system     the System this kernel will be applied to
+         * @param integrator the VVIntegrator this kernel will be used for
+         * @param force      the DrudeForce to get particle parameters from
+         */
+        void initialize(const System& system, const VVIntegrator& integrator, const DrudeForce* force);
+        /**
+         * Bin the particles of current configuration into the histograms
+         * @param context
+         * @param integrator
+         */
+        void accumulateProfiles(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Get the averaged density profile of a group of particles
+         * @param context
+         * @param integrator
+         * @param group
+         * @param quantity
+         * @param profile
+         */
+        void getProfile(ContextImpl& context, const VVIntegrator& integrator, int group, int quantity, std::vector<double>& profile);
+        /**
+         * Get the number of configurations accumulated in the histograms
+         */
+        int getNumSamples() const {
+            return numSamples;
+        }
+        /**
+         * Discard the accumulated histograms
+         * @param context
+         * @param integrator
+         */
+        void resetProfiles(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        void createCheckpoint(ContextImpl& context, std::ostream& stream) const;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        void loadCheckpoint(ContextImpl& context, std::istream& stream);
+    private:
+        CudaContext& cu;
+        int numBins, numSamples;
+        CudaArray* particleInfo;
+        CudaArray* profileBuffer;
+        CudaArray* profiles;
+        CUfunction kernelBin, kernelAccumulate;
+    };
+
+    class CudaCalcMultiTauCorrelationKernel: public CalcMultiTauCorrelationKernel{
+    public:
+        CudaCalcMultiTauCorrelationKernel(std::string name, const Platform &platform, CudaContext &cu) :
+                CalcMultiTauCorrelationKernel(name, platform), cu(cu), trackedMolecules(NULL), trackedGroups(NULL),
+                particlesInMolecules(NULL), particlesSortedByMolId(NULL), particlesSortedLocal(NULL), atomLocation(NULL),
+                comVelm(NULL), comPos(NULL), comPosWrapped(NULL), posRing(NULL), velRing(NULL), corrBuffer(NULL), correlations(NULL) {
+        }
+        ~CudaCalcMultiTauCorrelationKernel();
+        /**
+         * Initialize the kernel.
+         *
+         * @param system     the System this kernel will be applied to
+         * @param integrator the VVIntegrator this kernel will be used for
+         */
+        void initialize(const System& system, const VVIntegrator& integrator);
+        /**
+         * Add the COM positions and velocities of current configuration to the correlator
+         * @param context
+         * @param integrator
+         */
+        void addSample(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Get the correlation functions of a group of molecules
+         * @param context
+         * @param integrator
+         * @param group
+         * @param lagTimes
+         * @param msd
+         * @param vacf
+         */
+        void getCorrelations(ContextImpl& context, const VVIntegrator& integrator, int group,
+                             std::vector<double>& lagTimes, std::vector<double>& msd, std::vector<double>& vacf);
+        /**
+         * Discard the accumulated correlation functions
+         * @param context
+         * @param integrator
+         */
+        void resetCorrelations(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        void createCheckpoint(ContextImpl& context, std::ostream& stream) const;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        void loadCheckpoint(ContextImpl& context, std::istream& stream);
+    private:
+        CudaContext& cu;
+        int numTracked, numLevels, numSamples;
+        std::vector<int> numMoleculesInGroup;
+        std::vector<int> levelCounts;
+        std::vector<double> lagCounts;
+        CudaArray* trackedMolecules;
+        CudaArray* trackedGroups;
+        CudaArray* particlesInMolecules;
+        CudaArray* particlesSortedByMolId;
+        CudaArray* particlesSortedLocal;
+        CudaArray* atomLocation;
+        CudaArray* comVelm;
+        CudaArray* comPos;
+        CudaArray* comPosWrapped;
+        CudaArray* posRing;
+        CudaArray* velRing;
+        CudaArray* corrBuffer;
+        CudaArray* correlations;
+        CUfunction kernelInvert, kernelMap, kernelCOMVel, kernelCOMPos, kernelAddSample, kernelAccumulate;
+    };
+
+    class CudaCalcConductivityKernel: public CalcConductivityKernel{
+    public:
+        CudaCalcConductivityKernel(std::string name, const Platform &platform, CudaContext &cu) :
+                CalcConductivityKernel(name, platform), cu(cu), chargeMask(NULL), blockCurrent(NULL), state(NULL),
+                ringM(NULL), ringJ(NULL), levelCounts(NULL), correlations(NULL), lagCounts(NULL) {
+        }
+        ~CudaCalcConductivityKernel();
+        /**
+         * Initialize the kernel.
+         *
+         * @param system     the System this kernel will be applied to
+         * @param integrator the VVIntegrator this kernel will be used for
+         */
+        void initialize(const System& system, const VVIntegrator& integrator);
+        /**
+         * Calculate the charge current of current step and integrate the translational dipole
+         * @param context
+         * @param integrator
+         * @param sample
+         */
+        void accumulateCurrent(ContextImpl& context, const VVIntegrator& integrator, bool sample);
+        /**
+         * Get the correlation functions of the charge current and the translational dipole
+         * @param context
+         * @param integrator
+         * @param lagTimes
+         * @param cacf
+         * @param msd
+         */
+        void getCorrelations(ContextImpl& context, const VVIntegrator& integrator,
+                             std::vector<double>& lagTimes, std::vector<double>& cacf, std::vector<double>& msd);
+        /**
+         * Calculate the conductivity
+         * @param context
+         * @param integrator
+         * @param fitTime
+         * @param stats
+         */
+        void calcConductivity(ContextImpl& context, const VVIntegrator& integrator, double fitTime, std::vector<double>& stats);
+        /**
+         * Discard the accumulated correlation functions and mean current
+         * @param context
+         * @param integrator
+         */
+        void resetConductivity(ContextImpl& context, const VVIntegrator& integrator);
+        /**
+         * Write the state of this kernel to a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an output stream the checkpoint data should be written to
+         */
+        void createCheckpoint(ContextImpl& context, std::ostream& stream) const;
+        /**
+         * Load the state of this kernel from a checkpoint.
+         *
+         * @param context    the context in which to execute this kernel
+         * @param stream     an input stream the checkpoint data should be read from
+         */
+        void loadCheckpoint(ContextImpl& context, std::istream& stream);
+    private:
+        CudaContext& cu;
+        int numLevels, numBlocks;
+        CudaArray* chargeMask;
+        CudaArray* blockCurrent;
+        CudaArray* state;
+        CudaArray* ringM;
+        CudaArray* ringJ;
+        CudaArray* levelCounts;
+        CudaArray* correlations;
+        CudaArray* lagCounts;
+        CUfunction kernelCurrent, kernelUpdate;
+    };
+
+/**
+ * This kernel is invoked by VVIntegrator to measure the time spent in each phase of a step with CUDA events.
+ * The events are recorded in the stream and their elapsed time is only queried when they have completed,
+ * so that timing doesn't synchronize the host with the device.
+ */
+    class CudaCalcTimingKernel: public CalcTimingKernel{
+    public:
+        CudaCalcTimingKernel(std::string name, const Platform &platform, CudaContext &cu) :
+                CalcTimingKernel(name, platform), cu(cu) {
+        }
+        ~CudaCalcTimingKernel();
+        /**
+         * Initialize the kernel.
+         * @param system
+         * @param integrator
+         * @param vvKernel
+         */
+        void initialize(const System& system, const VVIntegrator& integrator, Kernel& vvKernel);
+        /**
+         * Record the event at the beginning of a phase
+         * @param context
+         * @param phase
+         */
+        void beginPhase(ContextImpl& context, int phase) {
+            recordBegin(phase);
+        }
+        /**
+         * Record the event at the end of a phase
+         * @param context
+         * @param phase
+         */
+        void endPhase(ContextImpl& context, int phase) {
+            recordEnd(phase);
+        }
+        /**
+         * Wait for all the recorded events and get the timings of all phases
+         * @param context
+         * @param timings
+         */
+        void getTimings(ContextImpl& context, std::vector<double>& timings);
+        /**
+         * Discard the accumulated timings
+         * @param context
+         */
+        void resetTimings(ContextImpl& context);
+        /**
+         * Record the events of a phase. They are also called by the step kernels for the phases inside their calls.
+         * @param phase
+         */
+        void recordBegin(int phase);
+        void recordEnd(int phase);
+    private:
+        /**
+         * Add up the elapsed time of the completed pairs of events of a phase.
+         * If wait is true, all the pairs are waited for.
+         */
+        void collect(int phase, bool wait);
+        CUevent createEvent();
+        CudaContext& cu;
+        std::vector<CUevent> freeEvents;
+        std::vector<CUevent> beginEvents;
+        std::vector<std::deque<std::pair<CUevent, CUevent> > > pendingEvents;
+        std::vector<double> counts, seconds;
+    };
+
 } // namespace OpenMM
 
 #endif /*CUDA_VV_KERNELS_H_*/
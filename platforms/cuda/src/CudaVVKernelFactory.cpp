@@ -43,11 +43,17 @@ extern "C" OPENMM_EXPORT void registerKernelFactories() {
         CudaVVKernelFactory* factory = new CudaVVKernelFactory();
         platform.registerKernelFactory(IntegrateMiddleStepKernel::Name(), factory);
         platform.registerKernelFactory(IntegrateVVStepKernel::Name(), factory);
+        platform.registerKernelFactory(IntegrateSINRStepKernel::Name(), factory);
         platform.registerKernelFactory(ModifyDrudeNoseKernel::Name(), factory);
         platform.registerKernelFactory(ModifyDrudeLangevinKernel::Name(), factory);
         platform.registerKernelFactory(ModifyImageChargeKernel::Name(), factory);
         platform.registerKernelFactory(ModifyElectricFieldKernel::Name(), factory);
         platform.registerKernelFactory(ModifyCosineAccelerateKernel::Name(), factory);
+        platform.registerKernelFactory(ModifyRNEMDKernel::Name(), factory);
+        platform.registerKernelFactory(CalcDensityProfileKernel::Name(), factory);
+        platform.registerKernelFactory(CalcMultiTauCorrelationKernel::Name(), factory);
+        platform.registerKernelFactory(CalcConductivityKernel::Name(), factory);
+        platform.registerKernelFactory(CalcTimingKernel::Name(), factory);
     }
     catch (std::exception ex) {
         // Ignore
@@ -70,6 +76,8 @@ KernelImpl* CudaVVKernelFactory::createKernelImpl(std::string name, const Platfo
         return new CudaIntegrateMiddleStepKernel(name, platform, cu);
     if (name == IntegrateVVStepKernel::Name())
         return new CudaIntegrateVVStepKernel(name, platform, cu);
+    if (name == IntegrateSINRStepKernel::Name())
+        return new CudaIntegrateSINRStepKernel(name, platform, cu);
     if (name == ModifyDrudeNoseKernel::Name())
         return new CudaModifyDrudeNoseKernel(name, platform, cu);
     if (name == ModifyDrudeLangevinKernel::Name())
@@ -80,5 +88,15 @@ KernelImpl* CudaVVKernelFactory::createKernelImpl(std::string name, const Platfo
         return new CudaModifyElectricFieldKernel(name, platform, cu);
     if (name == ModifyCosineAccelerateKernel::Name())
         return new CudaModifyCosineAccelerateKernel(name, platform, cu);
+    if (name == ModifyRNEMDKernel::Name())
+        return new CudaModifyRNEMDKernel(name, platform, cu);
+    if (name == CalcDensityProfileKernel::Name())
+        return new CudaCalcDensityProfileKernel(name, platform, cu);
+    if (name == CalcMultiTauCorrelationKernel::Name())
+        return new CudaCalcMultiTauCorrelationKernel(name, platform, cu);
+    if (name == CalcConductivityKernel::Name())
+        return new CudaCalcConductivityKernel(name, platform, cu);
+    if (name == CalcTimingKernel::Name())
+        return new CudaCalcTimingKernel(name, platform, cu);
     throw OpenMMException((std::string("Tried to create kernel with illegal kernel name '")+name+"'").c_str());
 }
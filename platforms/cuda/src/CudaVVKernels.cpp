@@ -47,6 +47,74 @@ using namespace std;
 
 enum{TG_ATOM, TG_COM, TG_DRUDE, NUM_TG_MAX};
 
+/**
+ * A record of the history of group kinetic energies is made of the time and the kinetic energies of all temperature groups
+ */
+static const int GROUP_HISTORY_RECORD_SIZE = 1 + NUM_TG_MAX;
+
+/**
+ * Get the extra force array owned by the step kernel, so that the modifiers can add forces to it
+ */
+static CudaArray* getStepKernelForceExtra(const VVIntegrator& integrator, Kernel& vvKernel) {
+    if (integrator.getUseSINR())
+        return vvKernel.getAs<CudaIntegrateSINRStepKernel>().getForceExtra();
+    if (integrator.getUseMiddleScheme())
+        return vvKernel.getAs<CudaIntegrateMiddleStepKernel>().getForceExtra();
+    return vvKernel.getAs<CudaIntegrateVVStepKernel>().getForceExtra();
+}
+
+/**
+ * Write the raw content of a device array to a checkpoint, prefixed with its size in bytes.
+ * The size is 64-bit, so that arrays larger than 2 GB can be written.
+ */
+static void writeArrayToCheckpoint(CudaArray& array, std::ostream& stream) {
+    long long size = (long long) array.getSize() * array.getElementSize();
+    vector<char> buffer(size);
+    array.download(&buffer[0]);
+    stream.write((char*) &size, sizeof(long long));
+    stream.write(&buffer[0], size);
+}
+
+/**
+ * Read the content of a device array from a checkpoint.
+ * Nothing is uploaded if the size doesn't match or the checkpoint is truncated.
+ */
+static void readArrayFromCheckpoint(CudaArray& array, std::istream& stream) {
+    long long size;
+    stream.read((char*) &size, sizeof(long long));
+    if (stream.fail())
+        throw OpenMMException("Checkpoint is truncated before array " + array.getName());
+    if (size != (long long) array.getSize() * array.getElementSize())
+        throw OpenMMException("Checkpoint is incompatible with array " + array.getName());
+    vector<char> buffer(size);
+    stream.read(&buffer[0], size);
+    if (stream.fail())
+        throw OpenMMException("Checkpoint is truncated in array " + array.getName());
+    array.upload(&buffer[0]);
+}
+
+static void writeVectorToCheckpoint(const vector<double>& vec, std::ostream& stream) {
+    long long size = vec.size();
+    stream.write((char*) &size, sizeof(long long));
+    if (size > 0)
+        stream.write((char*) &vec[0], sizeof(double) * size);
+}
+
+static void readVectorFromCheckpoint(vector<double>& vec, const string& name, std::istream& stream) {
+    long long size;
+    stream.read((char*) &size, sizeof(long long));
+    if (stream.fail())
+        throw OpenMMException("Checkpoint is truncated before " + name);
+    if (size != (long long) vec.size())
+        throw OpenMMException("Checkpoint is incompatible with " + name);
+    vector<double> buffer(size);
+    if (size > 0)
+        stream.read((char*) &buffer[0], sizeof(double) * size);
+    if (stream.fail())
+        throw OpenMMException("Checkpoint is truncated in " + name);
+    vec = buffer;
+}
+
 CudaIntegrateMiddleStepKernel::~CudaIntegrateMiddleStepKernel() {
     delete forceExtra;
     delete drudePairs;
@@ -103,7 +171,8 @@ void CudaIntegrateMiddleStepKernel::initialize(const System& system, const VVInt
     kernelPos2 = cu.getKernel(module, "integrateMiddlePos2");
     kernelPos3 = cu.getKernel(module, "integrateMiddlePos3");
     kernelResetExtraForce = cu.getKernel(module, "resetExtraForce");
-    if (force != NULL and integrator.getMaxDrudeDistance() > 0)
+    // hardwall distance can be changed later, so the kernel is always fetched for Drude model
+    if (force != NULL)
         kernelDrudeHardwall = cu.getKernel(module, "applyHardWallConstraints");
 
     cout << "CUDA modules for velocity-Verlet-middle integrator are created\n"
@@ -146,7 +215,11 @@ void CudaIntegrateMiddleStepKernel::firstIntegrate(ContextImpl& context, const V
     cu.executeKernel(kernelVel, argsVel, numAtoms);
 
     // Apply velocity constraints
+    if (timer != NULL)
+        timer->recordBegin(VVIntegrator::TimingConstraints);
     integration.applyVelocityConstraints(integrator.getConstraintTolerance());
+    if (timer != NULL)
+        timer->recordEnd(VVIntegrator::TimingConstraints);
 
     // Half-step position update
     void *argsPos1[] = {&cu.getVelm().getDevicePointer(),
@@ -171,7 +244,11 @@ void CudaIntegrateMiddleStepKernel::secondIntegrate(ContextImpl &context, const
     cu.executeKernel(kernelPos2, argsPos2, numAtoms);
 
     // Apply position constraints
+    if (timer != NULL)
+        timer->recordBegin(VVIntegrator::TimingConstraints);
     integration.applyConstraints(integrator.getConstraintTolerance());
+    if (timer != NULL)
+        timer->recordEnd(VVIntegrator::TimingConstraints);
 
     // Adjust position and velocity after constraint
     void *argsPos3[] = {&cu.getPosq().getDevicePointer(),
@@ -211,7 +288,11 @@ void CudaIntegrateMiddleStepKernel::secondIntegrate(ContextImpl &context, const
 
     integration.computeVirtualSites();
 
+    if (timer != NULL)
+        timer->recordBegin(VVIntegrator::TimingReorder);
     cu.reorderAtoms();
+    if (timer != NULL)
+        timer->recordEnd(VVIntegrator::TimingReorder);
 
     // Update the time and step count.
     cu.setTime(cu.getTime() + integrator.getStepSize());
@@ -279,7 +360,8 @@ void CudaIntegrateVVStepKernel::initialize(const System& system, const VVIntegra
     kernelVel = cu.getKernel(module, "velocityVerletIntegrateVelocities");
     kernelPos = cu.getKernel(module, "velocityVerletIntegratePositions");
     kernelResetExtraForce = cu.getKernel(module, "resetExtraForce");
-    if (force != NULL and integrator.getMaxDrudeDistance() > 0)
+    // hardwall distance can be changed later, so the kernel is always fetched for Drude model
+    if (force != NULL)
         kernelDrudeHardwall = cu.getKernel(module, "applyHardWallConstraints");
 
     cout << "CUDA modules for velocity-Verlet integrator are created\n"
@@ -345,7 +427,11 @@ void CudaIntegrateVVStepKernel::firstIntegrate(ContextImpl& context, const VVInt
     cu.executeKernel(kernelVel, argsVel, numAtoms);
 
     // Apply position constraints.
+    if (timer != NULL)
+        timer->recordBegin(VVIntegrator::TimingConstraints);
     integration.applyConstraints(integrator.getConstraintTolerance());
+    if (timer != NULL)
+        timer->recordEnd(VVIntegrator::TimingConstraints);
 
     // Call the position integration kernel.
     CUdeviceptr posCorrection = (cu.getUseMixedPrecision() ? cu.getPosqCorrection().getDevicePointer() : 0);
@@ -375,7 +461,11 @@ void CudaIntegrateVVStepKernel::firstIntegrate(ContextImpl& context, const VVInt
      *  so that the atomIndex of Langevin Forces are correct at next step
      */
 
+    if (timer != NULL)
+        timer->recordBegin(VVIntegrator::TimingReorder);
     cu.reorderAtoms();
+    if (timer != NULL)
+        timer->recordEnd(VVIntegrator::TimingReorder);
 }
 
 void CudaIntegrateVVStepKernel::resetExtraForce(ContextImpl& context, const VVIntegrator& integrator) {
@@ -421,7 +511,11 @@ void CudaIntegrateVVStepKernel::secondIntegrate(ContextImpl &context, const VVIn
     cu.executeKernel(kernelVel, argsVel2, numAtoms);
 
     // Apply velocity constraints
+    if (timer != NULL)
+        timer->recordBegin(VVIntegrator::TimingConstraints);
     integration.applyVelocityConstraints(integrator.getConstraintTolerance());
+    if (timer != NULL)
+        timer->recordEnd(VVIntegrator::TimingConstraints);
 
     // Update the time and step count.
     cu.setTime(cu.getTime()+stepSize);
@@ -442,6 +536,250 @@ double CudaIntegrateVVStepKernel::computeKineticEnergy(ContextImpl& context, con
     return cu.getIntegrationUtilities().computeKineticEnergy(0);
 }
 
+void CudaIntegrateVVStepKernel::createCheckpoint(ContextImpl& context, std::ostream& stream) const {
+    cu.setAsCurrent();
+    // Langevin forces are calculated from half-step velocity and used at next step
+    writeArrayToCheckpoint(*forceExtra, stream);
+}
+
+void CudaIntegrateVVStepKernel::loadCheckpoint(ContextImpl& context, std::istream& stream) {
+    cu.setAsCurrent();
+    readArrayFromCheckpoint(*forceExtra, stream);
+}
+
+CudaIntegrateSINRStepKernel::~CudaIntegrateSINRStepKernel() {
+    delete forceExtra;
+    delete forceSlow;
+    delete forceFast;
+    delete v1;
+    delete v2;
+    delete sinrParams;
+}
+
+void CudaIntegrateSINRStepKernel::initialize(const System& system, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "Initializing CudaVVIntegrator-SINR...\n" << flush;
+
+    cu.getPlatformData().initializeContexts(system);
+    CudaIntegrationUtilities &integration = cu.getIntegrationUtilities();
+    integration.initRandomNumberGenerator((unsigned int) integrator.getRandomNumberSeed());
+
+    numAtoms = cu.getNumAtoms();
+    chainLength = integrator.getSINRChainLength();
+
+    // the force groups which are actually used, so that we don't calculate empty groups
+    int groupsInUse = 0;
+    for (int i = 0; i < system.getNumForces(); i++)
+        groupsInUse |= 1 << system.getForce(i).getForceGroup();
+    hasFastForce = (groupsInUse & integrator.getFastForceGroups()) != 0;
+    hasSlowForce = (groupsInUse & ~integrator.getFastForceGroups()) != 0;
+
+    // init forceExtra
+    if (cu.getUseDoublePrecision()) {
+        forceExtra = CudaArray::create<double3>(cu, numAtoms, "sinrForceExtra");
+        auto forceExtraVec = std::vector<double3>(numAtoms, make_double3(0, 0, 0));
+        forceExtra->upload(forceExtraVec);
+    }
+    else {
+        forceExtra = CudaArray::create<float3>(cu, numAtoms, "sinrForceExtra");
+        auto forceExtraVec = std::vector<float3>(numAtoms, make_float3(0, 0, 0));
+        forceExtra->upload(forceExtraVec);
+    }
+
+    // the stored forces and thermostat variables are indexed by the original atom index
+    int numThermostats = 3 * chainLength * numAtoms;
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
+        forceSlow = CudaArray::create<double4>(cu, numAtoms, "sinrForceSlow");
+        forceFast = CudaArray::create<double4>(cu, numAtoms, "sinrForceFast");
+        v1 = CudaArray::create<double>(cu, numThermostats, "sinrV1");
+        v2 = CudaArray::create<double>(cu, numThermostats, "sinrV2");
+        sinrParams = CudaArray::create<double>(cu, 7, "sinrParams");
+    }
+    else {
+        forceSlow = CudaArray::create<float4>(cu, numAtoms, "sinrForceSlow");
+        forceFast = CudaArray::create<float4>(cu, numAtoms, "sinrForceFast");
+        v1 = CudaArray::create<float>(cu, numThermostats, "sinrV1");
+        v2 = CudaArray::create<float>(cu, numThermostats, "sinrV2");
+        sinrParams = CudaArray::create<float>(cu, 7, "sinrParams");
+    }
+
+    map<string, string> defines;
+    defines["NUM_ATOMS"] = cu.intToString(numAtoms);
+    defines["PADDED_NUM_ATOMS"] = cu.intToString(cu.getPaddedNumAtoms());
+    defines["SINR_L"] = cu.intToString(chainLength);
+    CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::sinr, defines, "");
+    kernelInit = cu.getKernel(module, "initializeIsokineticState");
+    kernelStore = cu.getKernel(module, "storeIsokineticForce");
+    kernelSlow = cu.getKernel(module, "integrateIsokineticSlowVelocity");
+    kernelInner1 = cu.getKernel(module, "integrateIsokineticInner1");
+    kernelInner2 = cu.getKernel(module, "integrateIsokineticInner2");
+    kernelResetExtraForce = cu.getKernel(module, "resetExtraForce");
+
+    cout << "CUDA modules for SIN(R) integrator are created\n"
+         << "    NUM_ATOMS: " << numAtoms << ", PADDED_NUM_ATOMS: " << cu.getPaddedNumAtoms() << "\n"
+         << "    Thermostat length: " << chainLength << ", Friction: " << integrator.getSINRFriction() << " /ps\n"
+         << "    Fast force groups: " << integrator.getFastForceGroups() << ", RESPA loops: " << integrator.getRespaLoops() << "\n"
+         << "    Num thread blocks: " << cu.getNumThreadBlocks() << ", Thread block size: " << cu.ThreadBlockSize << "\n" << flush;
+}
+
+void CudaIntegrateSINRStepKernel::updateParameters(const VVIntegrator& integrator) {
+    double stepSize = integrator.getStepSize();
+    double h = stepSize / integrator.getRespaLoops();
+    double kT = BOLTZ * integrator.getTemperature();
+    double Q = kT / pow(integrator.getFrequency(), 2);
+    double gamma = integrator.getSINRFriction();
+    double decay = exp(-gamma * h);
+    double noise = sqrt(kT / Q * (1 - decay * decay));
+    std::vector<double> params = {kT, Q, Q, h, decay, noise, 0.5 * stepSize};
+    if (params == prevParams)
+        return;
+
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision())
+        sinrParams->upload(params);
+    else {
+        std::vector<float> paramsFloat(params.begin(), params.end());
+        sinrParams->upload(paramsFloat);
+    }
+    prevParams = params;
+}
+
+void CudaIntegrateSINRStepKernel::initializeIsokineticState(ContextImpl& context, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "SINR initialize isokinetic state\n" << flush;
+
+    cu.setAsCurrent();
+    updateParameters(integrator);
+
+    void *args[] = {&cu.getVelm().getDevicePointer(),
+                    &v1->getDevicePointer(),
+                    &v2->getDevicePointer(),
+                    &cu.getAtomIndexArray().getDevicePointer(),
+                    &sinrParams->getDevicePointer()};
+    cu.executeKernel(kernelInit, args, numAtoms);
+}
+
+void CudaIntegrateSINRStepKernel::storeForce(ContextImpl& context, const VVIntegrator& integrator, bool slow) {
+    if (integrator.getDebugEnabled())
+        cout << "SINR store " << (slow ? "slow" : "fast") << " force\n" << flush;
+
+    cu.setAsCurrent();
+
+    bool includeForce = slow ? hasSlowForce : hasFastForce;
+    bool includeExtra = slow;
+    void *args[] = {&cu.getForce().getDevicePointer(),
+                    &forceExtra->getDevicePointer(),
+                    slow ? &forceSlow->getDevicePointer() : &forceFast->getDevicePointer(),
+                    &cu.getAtomIndexArray().getDevicePointer(),
+                    &includeForce,
+                    &includeExtra};
+    cu.executeKernel(kernelStore, args, numAtoms);
+}
+
+void CudaIntegrateSINRStepKernel::resetExtraForce(ContextImpl& context, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "SINR reset extra force\n" << flush;
+
+    cu.setAsCurrent();
+
+    void *args1[] = {&forceExtra->getDevicePointer()};
+    cu.executeKernel(kernelResetExtraForce, args1, numAtoms);
+}
+
+void CudaIntegrateSINRStepKernel::integrateSlowVelocity(ContextImpl& context, const VVIntegrator& integrator, bool useStoredForce) {
+    if (integrator.getDebugEnabled())
+        cout << "SINR slow velocity integration\n" << flush;
+
+    cu.setAsCurrent();
+    updateParameters(integrator);
+
+    bool includeForce = hasSlowForce;
+    void *args[] = {&cu.getVelm().getDevicePointer(),
+                    &cu.getForce().getDevicePointer(),
+                    &forceExtra->getDevicePointer(),
+                    &forceSlow->getDevicePointer(),
+                    &v1->getDevicePointer(),
+                    &cu.getAtomIndexArray().getDevicePointer(),
+                    &sinrParams->getDevicePointer(),
+                    &useStoredForce,
+                    &includeForce};
+    cu.executeKernel(kernelSlow, args, numAtoms);
+}
+
+void CudaIntegrateSINRStepKernel::firstIntegrateInner(ContextImpl& context, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "SINR first-half inner integration\n" << flush;
+
+    cu.setAsCurrent();
+    CudaIntegrationUtilities &integration = cu.getIntegrationUtilities();
+
+    int randomIndex = integration.prepareRandomNumbers(chainLength * numAtoms);
+    CUdeviceptr posCorrection = (cu.getUseMixedPrecision() ? cu.getPosqCorrection().getDevicePointer() : 0);
+    void *args[] = {&cu.getPosq().getDevicePointer(),
+                    &posCorrection,
+                    &cu.getVelm().getDevicePointer(),
+                    &forceFast->getDevicePointer(),
+                    &v1->getDevicePointer(),
+                    &v2->getDevicePointer(),
+                    &cu.getAtomIndexArray().getDevicePointer(),
+                    &sinrParams->getDevicePointer(),
+                    &integration.getRandom().getDevicePointer(),
+                    &randomIndex};
+    cu.executeKernel(kernelInner1, args, numAtoms);
+
+    integration.computeVirtualSites();
+}
+
+void CudaIntegrateSINRStepKernel::secondIntegrateInner(ContextImpl& context, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "SINR second-half inner integration\n" << flush;
+
+    cu.setAsCurrent();
+
+    bool includeForce = hasFastForce;
+    void *args[] = {&cu.getVelm().getDevicePointer(),
+                    &cu.getForce().getDevicePointer(),
+                    &forceFast->getDevicePointer(),
+                    &v1->getDevicePointer(),
+                    &v2->getDevicePointer(),
+                    &cu.getAtomIndexArray().getDevicePointer(),
+                    &sinrParams->getDevicePointer(),
+                    &includeForce};
+    cu.executeKernel(kernelInner2, args, numAtoms);
+}
+
+void CudaIntegrateSINRStepKernel::finishStep(ContextImpl& context, const VVIntegrator& integrator) {
+    cu.setAsCurrent();
+
+    // The stored forces and thermostat variables are indexed by the original atom index
+    // So it is safe to reorder atoms here
+    if (timer != NULL)
+        timer->recordBegin(VVIntegrator::TimingReorder);
+    cu.reorderAtoms();
+    if (timer != NULL)
+        timer->recordEnd(VVIntegrator::TimingReorder);
+
+    // Update the time and step count.
+    cu.setTime(cu.getTime()+integrator.getStepSize());
+    cu.setStepCount(cu.getStepCount()+1);
+}
+
+double CudaIntegrateSINRStepKernel::computeKineticEnergy(ContextImpl& context, const VVIntegrator& integrator) {
+    return cu.getIntegrationUtilities().computeKineticEnergy(0);
+}
+
+void CudaIntegrateSINRStepKernel::createCheckpoint(ContextImpl& context, std::ostream& stream) const {
+    cu.setAsCurrent();
+    // the stored forces are recalculated after loading checkpoint, only thermostat variables are required
+    writeArrayToCheckpoint(*v1, stream);
+    writeArrayToCheckpoint(*v2, stream);
+}
+
+void CudaIntegrateSINRStepKernel::loadCheckpoint(ContextImpl& context, std::istream& stream) {
+    cu.setAsCurrent();
+    readArrayFromCheckpoint(*v1, stream);
+    readArrayFromCheckpoint(*v2, stream);
+}
+
 CudaModifyDrudeNoseKernel::~CudaModifyDrudeNoseKernel() {
     delete particlesNH;
     delete moleculesNH;
@@ -454,6 +792,16 @@ CudaModifyDrudeNoseKernel::~CudaModifyDrudeNoseKernel() {
     delete kineticEnergyBufferNH;
     delete kineticEnergiesNH;
     delete vscaleFactorsNH;
+    delete drudePartner;
+    delete drudePairChain;
+    delete moleculeChain;
+    delete massiveChainDof;
+    delete massiveChainKE;
+    delete massiveEtaDot;
+    delete massiveEtaDotDot;
+    delete smallMoleculesNH;
+    delete largeMoleculesNH;
+    delete groupHistory;
 }
 
 void CudaModifyDrudeNoseKernel::initialize(const System &system, const VVIntegrator &integrator, const DrudeForce* force) {
@@ -478,17 +826,13 @@ void CudaModifyDrudeNoseKernel::initialize(const System &system, const VVIntegra
 
     // Identify particles, pairs and residues
 
-    int id_start = 0;
-    for (int id_mol =0; id_mol < integrator.getNumMolecules(); id_mol++){
-        int n_particles_in_mol = 0;
-        for (int i = 0; i < system.getNumParticles(); i++) {
-            if (integrator.getParticleMolId(i) == id_mol){
-                n_particles_in_mol ++;
-                particlesSortedByMolIdVec.push_back(i);
-            }
-        }
-        particlesInMoleculesVec.push_back(make_int2(n_particles_in_mol, id_start));
-        id_start += n_particles_in_mol;
+    // The particles are bucketed by molecule in one pass, in ascending order of particle index in each molecule
+    vector<vector<int> > particlesOfMolecule(integrator.getNumMolecules());
+    for (int i = 0; i < system.getNumParticles(); i++)
+        particlesOfMolecule[integrator.getParticleMolId(i)].push_back(i);
+    for (int id_mol = 0; id_mol < integrator.getNumMolecules(); id_mol++) {
+        particlesInMoleculesVec.push_back(make_int2(particlesOfMolecule[id_mol].size(), particlesSortedByMolIdVec.size()));
+        particlesSortedByMolIdVec.insert(particlesSortedByMolIdVec.end(), particlesOfMolecule[id_mol].begin(), particlesOfMolecule[id_mol].end());
     }
 
     set<int> particlesNHSet;
@@ -572,24 +916,11 @@ void CudaModifyDrudeNoseKernel::initialize(const System &system, const VVIntegra
 
     // Initialize NH chain particles
 
-    int numNHChains = integrator.getNumNHChains();
-    etaMass = std::vector<vector<double> >(numTempGroup, std::vector<double>(numNHChains, 0.0));
-    eta = std::vector<vector<double> >(numTempGroup, std::vector<double>(numNHChains, 0.0));
-    etaDot = std::vector<vector<double> >(numTempGroup, std::vector<double>(numNHChains + 1, 0.0));
-    etaDotDot = std::vector<vector<double> >(numTempGroup, std::vector<double>(numNHChains, 0.0));
-
-    realKbT = BOLTZ * integrator.getTemperature();
-    drudeKbT = BOLTZ * integrator.getDrudeTemperature();
-    for (int i = 0; i < numTempGroup; i++) {
-        double tgKbT = i == TG_DRUDE ? drudeKbT : realKbT;
-        double tgMass = i == TG_DRUDE ?
-                        drudeKbT / pow(integrator.getDrudeFrequency(), 2) :
-                        realKbT / pow(integrator.getFrequency(), 2);
-        tempGroupNkbT.push_back(tempGroupDof[i] * tgKbT);
-        etaMass[i][0] = tempGroupDof[i] * tgMass;
-        for (int ich=1; ich < integrator.getNumNHChains(); ich++)
-            etaMass[i][ich] = tgMass;
-    }
+    eta = std::vector<vector<double> >(numTempGroup);
+    etaDot = std::vector<vector<double> >(numTempGroup);
+    etaDotDot = std::vector<vector<double> >(numTempGroup);
+    prevNumNHChains = 0;
+    updateChainParameters(integrator);
 
     // Initialize CudaArray
     particlesNH = CudaArray::create<int>(cu, (int) particlesNHVec.size(), "particlesNH");
@@ -643,6 +974,7 @@ void CudaModifyDrudeNoseKernel::initialize(const System &system, const VVIntegra
     defines["TG_ATOM"] = cu.intToString(TG_ATOM);
     defines["TG_COM"] = cu.intToString(TG_COM);
     defines["TG_DRUDE"] = cu.intToString(TG_DRUDE);
+    defines["GROUP_HISTORY_RECORD_SIZE"] = cu.intToString(GROUP_HISTORY_RECORD_SIZE);
 
     CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::drudeNoseHoover, defines, "");
     kernelCOMVel = cu.getKernel(module, "calcCOMVelocities");
@@ -650,6 +982,7 @@ void CudaModifyDrudeNoseKernel::initialize(const System &system, const VVIntegra
     kernelKE = cu.getKernel(module, "computeNormalizedKineticEnergies");
     kernelKESum = cu.getKernel(module, "sumNormalizedKineticEnergies");
     kernelScale = cu.getKernel(module, "scaleVelocity");
+    kernelRecordGroupKE = cu.getKernel(module, "recordGroupKineticEnergies");
 
     cout << "CUDA modules for Nose-Hoover thermostat are created\n"
          << "    Num molecules in NH thermostat: " << moleculesNHVec.size() << " / " << integrator.getNumMolecules() << "\n"
@@ -662,14 +995,377 @@ void CudaModifyDrudeNoseKernel::initialize(const System &system, const VVIntegra
         cout << "    DOF[" << i << "]: " << tempGroupDof[i] << ", NkbT[" << i << "]: " << tempGroupNkbT[i] << ", etaMass[" << i << "]: " << etaMass[i][0] << "\n";
     }
     cout << flush;
+
+    useMassive = integrator.getUseMassiveNH();
+    if (useMassive)
+        initializeMassive(system, integrator);
+}
+
+/**
+ * Molecules with more particles than this are thermolized by one thread block, instead of one thread
+ */
+static const int MASSIVE_NH_LARGE_MOLECULE = 32;
+static const int MASSIVE_NH_BLOCK_SIZE = 128;
+
+void CudaModifyDrudeNoseKernel::initializeMassive(const System &system, const VVIntegrator &integrator) {
+    /**
+     * One chain for each NH molecule and one chain for each Drude pair
+     * moleculeChain maps original molecule id to chain index
+     * drudePairChain maps original Drude particle index to the index of Drude pair
+     * drudePartner records the other particle of the Drude pair, or -1 for normal particles
+     */
+    numMassiveChains = moleculesNHVec.size() + pairParticlesNHVec.size();
+
+    std::vector<int> moleculeChainVec(integrator.getNumMolecules(), -1);
+    for (int i = 0; i < (int) moleculesNHVec.size(); i++)
+        moleculeChainVec[moleculesNHVec[i]] = i;
+
+    std::vector<int> drudePartnerVec(numAtoms, -1);
+    std::vector<int> drudePairChainVec(numAtoms, -1);
+    for (int i = 0; i < (int) pairParticlesNHVec.size(); i++) {
+        int2 pair = pairParticlesNHVec[i];
+        drudePartnerVec[pair.x] = pair.y;
+        drudePartnerVec[pair.y] = pair.x;
+        drudePairChainVec[pair.x] = i;
+    }
+
+    std::vector<double> chainDofVec(numMassiveChains, 3.0);
+    for (int i = 0; i < (int) moleculesNHVec.size(); i++)
+        chainDofVec[i] = 0;
+    for (int i: particlesNHVec) {
+        if (system.getParticleMass(i) != 0.0)
+            chainDofVec[moleculeChainVec[particleMolIdVec[i]]] += 3;
+    }
+    for (auto pair: pairParticlesNHVec)
+        chainDofVec[moleculeChainVec[particleMolIdVec[pair.x]]] -= 3;
+    for (int i = 0; i < system.getNumConstraints(); i++) {
+        int p, p1;
+        double distance;
+        system.getConstraintParameters(i, p, p1, distance);
+        if (integrator.isParticleNH(p))
+            chainDofVec[moleculeChainVec[particleMolIdVec[p]]] -= 1;
+    }
+
+    drudePartner = CudaArray::create<int>(cu, numAtoms, "massiveDrudePartner");
+    drudePairChain = CudaArray::create<int>(cu, numAtoms, "massiveDrudePairChain");
+    moleculeChain = CudaArray::create<int>(cu, max((int) moleculeChainVec.size(), 1), "massiveMoleculeChain");
+    drudePartner->upload(drudePartnerVec);
+    drudePairChain->upload(drudePairChainVec);
+    if (!moleculeChainVec.empty())
+        moleculeChain->upload(moleculeChainVec);
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
+        massiveChainDof = CudaArray::create<double>(cu, max(numMassiveChains, 1), "massiveChainDof");
+        massiveChainKE = CudaArray::create<double>(cu, max(numMassiveChains, 1), "massiveChainKE");
+        if (numMassiveChains > 0)
+            massiveChainDof->upload(chainDofVec);
+        massiveChainKE->upload(std::vector<double>(max(numMassiveChains, 1), 0.0));
+    }
+    else {
+        massiveChainDof = CudaArray::create<float>(cu, max(numMassiveChains, 1), "massiveChainDof");
+        massiveChainKE = CudaArray::create<float>(cu, max(numMassiveChains, 1), "massiveChainKE");
+        if (numMassiveChains > 0)
+            massiveChainDof->upload(std::vector<float>(chainDofVec.begin(), chainDofVec.end()));
+        massiveChainKE->upload(std::vector<float>(max(numMassiveChains, 1), 0.0f));
+    }
+
+    // Chains without degrees of freedom are skipped by the kernels, and don't count for the group temperatures
+    massiveMoleculeDof = 0;
+    for (int i = 0; i < (int) moleculesNHVec.size(); i++)
+        massiveMoleculeDof += max(chainDofVec[i], 0.0);
+    allocateMassiveChains(integrator.getNumNHChains());
+
+    for (int molId: moleculesNHVec) {
+        if (particlesInMoleculesVec[molId].x > MASSIVE_NH_LARGE_MOLECULE)
+            largeMoleculesNHVec.push_back(molId);
+        else
+            smallMoleculesNHVec.push_back(molId);
+    }
+    smallMoleculesNH = CudaArray::create<int>(cu, max((int) smallMoleculesNHVec.size(), 1), "massiveSmallMoleculesNH");
+    largeMoleculesNH = CudaArray::create<int>(cu, max((int) largeMoleculesNHVec.size(), 1), "massiveLargeMoleculesNH");
+    if (!smallMoleculesNHVec.empty())
+        smallMoleculesNH->upload(smallMoleculesNHVec);
+    if (!largeMoleculesNHVec.empty())
+        largeMoleculesNH->upload(largeMoleculesNHVec);
+
+    map<string, string> defines;
+    defines["NUM_MOLECULES_NH"] = cu.intToString(moleculesNHVec.size());
+    defines["NUM_SMALL_MOLECULES_NH"] = cu.intToString(smallMoleculesNHVec.size());
+    defines["NUM_LARGE_MOLECULES_NH"] = cu.intToString(largeMoleculesNHVec.size());
+    defines["THREAD_BLOCK_SIZE"] = cu.intToString(MASSIVE_NH_BLOCK_SIZE);
+    defines["NUM_PAIRS_NH"] = cu.intToString(pairParticlesNHVec.size());
+    defines["NUM_MASSIVE_CHAINS"] = cu.intToString(max(numMassiveChains, 1));
+    defines["GROUP_HISTORY_RECORD_SIZE"] = cu.intToString(GROUP_HISTORY_RECORD_SIZE);
+    CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::massiveNoseHoover, defines, "");
+    kernelMassiveMolecules = cu.getKernel(module, "massiveNHMolecules");
+    kernelMassiveLargeMolecules = cu.getKernel(module, "massiveNHLargeMolecules");
+    kernelMassivePairs = cu.getKernel(module, "massiveNHDrudePairs");
+    kernelMassiveRecordGroupKE = cu.getKernel(module, "recordMassiveGroupKineticEnergies");
+
+    cout << "CUDA modules for massive Nose-Hoover chains are created\n"
+         << "    Num molecular chains: " << moleculesNHVec.size() << " (" << largeMoleculesNHVec.size() << " large)"
+         << ", Num Drude pair chains: " << pairParticlesNHVec.size() << "\n" << flush;
+}
+
+void CudaModifyDrudeNoseKernel::allocateMassiveChains(int chainLength) {
+    delete massiveEtaDot;
+    delete massiveEtaDotDot;
+    massiveChainLength = chainLength;
+    // the top of etaDot is always zero, so that the last chain particle is not coupled
+    int sizeDot = max((chainLength + 1) * numMassiveChains, 1);
+    int sizeDotDot = max(chainLength * numMassiveChains, 1);
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
+        massiveEtaDot = CudaArray::create<double>(cu, sizeDot, "massiveEtaDot");
+        massiveEtaDotDot = CudaArray::create<double>(cu, sizeDotDot, "massiveEtaDotDot");
+        massiveEtaDot->upload(std::vector<double>(sizeDot, 0.0));
+        massiveEtaDotDot->upload(std::vector<double>(sizeDotDot, 0.0));
+    }
+    else {
+        massiveEtaDot = CudaArray::create<float>(cu, sizeDot, "massiveEtaDot");
+        massiveEtaDotDot = CudaArray::create<float>(cu, sizeDotDot, "massiveEtaDotDot");
+        massiveEtaDot->upload(std::vector<float>(sizeDot, 0.0f));
+        massiveEtaDotDot->upload(std::vector<float>(sizeDotDot, 0.0f));
+    }
+}
+
+void CudaModifyDrudeNoseKernel::scaleVelocityMassive(ContextImpl& context, const VVIntegrator& integrator) {
+    if (integrator.getNumNHChains() != massiveChainLength)
+        allocateMassiveChains(integrator.getNumNHChains());
+
+    double dt2 = integrator.getStepSize() / integrator.getLoopsPerStep() / 2;
+    double realQ = realKbT / pow(integrator.getFrequency(), 2);
+    double drudeQ = drudeKbT / pow(integrator.getDrudeFrequency(), 2);
+    int numNHChains = massiveChainLength;
+    int loopsPerStep = integrator.getLoopsPerStep();
+
+    // Create appropriate pointer for the precision mode.
+
+    float dt2Float = (float) dt2;
+    float realKbTFloat = (float) realKbT;
+    float realQFloat = (float) realQ;
+    float drudeKbTFloat = (float) drudeKbT;
+    float drudeQFloat = (float) drudeQ;
+    void *dt2Ptr, *realKbTPtr, *realQPtr, *drudeKbTPtr, *drudeQPtr;
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
+        dt2Ptr = &dt2;
+        realKbTPtr = &realKbT;
+        realQPtr = &realQ;
+        drudeKbTPtr = &drudeKbT;
+        drudeQPtr = &drudeQ;
+    }
+    else {
+        dt2Ptr = &dt2Float;
+        realKbTPtr = &realKbTFloat;
+        realQPtr = &realQFloat;
+        drudeKbTPtr = &drudeKbTFloat;
+        drudeQPtr = &drudeQFloat;
+    }
+
+    if (!pairParticlesNHVec.empty()) {
+        void *argsPairs[] = {&cu.getVelm().getDevicePointer(),
+                             &pairParticlesNH->getDevicePointer(),
+                             &cu.getAtomIndexArray().getDevicePointer(),
+                             &drudePairChain->getDevicePointer(),
+                             &massiveEtaDot->getDevicePointer(),
+                             &massiveEtaDotDot->getDevicePointer(),
+                             &massiveChainKE->getDevicePointer(),
+                             drudeKbTPtr, drudeQPtr, dt2Ptr,
+                             &numNHChains, &loopsPerStep};
+        cu.executeKernel(kernelMassivePairs, argsPairs, pairParticlesNHVec.size());
+    }
+
+    if (!smallMoleculesNHVec.empty()) {
+        void *argsMolecules[] = {&cu.getVelm().getDevicePointer(),
+                                 &particlesInMolecules->getDevicePointer(),
+                                 &particlesSortedByMolId->getDevicePointer(),
+                                 &smallMoleculesNH->getDevicePointer(),
+                                 &particleMolId->getDevicePointer(),
+                                 &cu.getAtomIndexArray().getDevicePointer(),
+                                 &drudePartner->getDevicePointer(),
+                                 &moleculeChain->getDevicePointer(),
+                                 &massiveChainDof->getDevicePointer(),
+                                 &massiveEtaDot->getDevicePointer(),
+                                 &massiveEtaDotDot->getDevicePointer(),
+                                 &massiveChainKE->getDevicePointer(),
+                                 realKbTPtr, realQPtr, dt2Ptr,
+                                 &numNHChains, &loopsPerStep};
+        cu.executeKernel(kernelMassiveMolecules, argsMolecules, smallMoleculesNHVec.size());
+    }
+
+    if (!largeMoleculesNHVec.empty()) {
+        void *argsLarge[] = {&cu.getVelm().getDevicePointer(),
+                             &particlesInMolecules->getDevicePointer(),
+                             &particlesSortedByMolId->getDevicePointer(),
+                             &largeMoleculesNH->getDevicePointer(),
+                             &particleMolId->getDevicePointer(),
+                             &cu.getAtomIndexArray().getDevicePointer(),
+                             &drudePartner->getDevicePointer(),
+                             &moleculeChain->getDevicePointer(),
+                             &massiveChainDof->getDevicePointer(),
+                             &massiveEtaDot->getDevicePointer(),
+                             &massiveEtaDotDot->getDevicePointer(),
+                             &massiveChainKE->getDevicePointer(),
+                             realKbTPtr, realQPtr, dt2Ptr,
+                             &numNHChains, &loopsPerStep};
+        int numBlocks = min((int) largeMoleculesNHVec.size(), cu.getNumThreadBlocks());
+        cu.executeKernel(kernelMassiveLargeMolecules, argsLarge, numBlocks * MASSIVE_NH_BLOCK_SIZE, MASSIVE_NH_BLOCK_SIZE);
+    }
+}
+
+
+void CudaModifyDrudeNoseKernel::updateChainParameters(const VVIntegrator& integrator) {
+    int numNHChains = integrator.getNumNHChains();
+    if (numNHChains == prevNumNHChains
+        && integrator.getTemperature() == prevTemperature && integrator.getFrequency() == prevFrequency
+        && integrator.getDrudeTemperature() == prevDrudeTemperature && integrator.getDrudeFrequency() == prevDrudeFrequency)
+        return;
+
+    // Keep the state of existing chain particles, new chain particles start from rest
+    if (numNHChains != prevNumNHChains) {
+        for (int i = 0; i < numTempGroup; i++) {
+            eta[i].resize(numNHChains, 0.0);
+            etaDot[i].resize(numNHChains + 1, 0.0);
+            etaDot[i][numNHChains] = 0.0;
+            etaDotDot[i].resize(numNHChains, 0.0);
+        }
+    }
+
+    etaMass = std::vector<vector<double> >(numTempGroup, std::vector<double>(numNHChains, 0.0));
+    tempGroupNkbT.clear();
+    realKbT = BOLTZ * integrator.getTemperature();
+    drudeKbT = BOLTZ * integrator.getDrudeTemperature();
+    for (int i = 0; i < numTempGroup; i++) {
+        double tgKbT = i == TG_DRUDE ? drudeKbT : realKbT;
+        double tgMass = i == TG_DRUDE ?
+                        drudeKbT / pow(integrator.getDrudeFrequency(), 2) :
+                        realKbT / pow(integrator.getFrequency(), 2);
+        tempGroupNkbT.push_back(tempGroupDof[i] * tgKbT);
+        etaMass[i][0] = tempGroupDof[i] * tgMass;
+        for (int ich=1; ich < numNHChains; ich++)
+            etaMass[i][ich] = tgMass;
+    }
+
+    if (prevNumNHChains != 0 && integrator.getDebugEnabled())
+        cout << "Nose-Hoover thermostat parameters are updated\n"
+             << "    Real T: " << integrator.getTemperature() << " K, Drude T: " << integrator.getDrudeTemperature() << " K\n"
+             << "    Real coupling frequency: " << integrator.getFrequency() << " /ps, Drude coupling frequency: " << integrator.getDrudeFrequency() << " /ps\n"
+             << "    Num NH chain: " << numNHChains << "\n" << flush;
+
+    prevNumNHChains = numNHChains;
+    prevTemperature = integrator.getTemperature();
+    prevFrequency = integrator.getFrequency();
+    prevDrudeTemperature = integrator.getDrudeTemperature();
+    prevDrudeFrequency = integrator.getDrudeFrequency();
+}
+
+vector<double> CudaModifyDrudeNoseKernel::getGroupDofs() const {
+    /**
+     * The molecular chains of massive Nose-Hoover chains include the COM motion of molecules,
+     * so they are reported as the atomic group, and the COM group is empty
+     */
+    if (!useMassive)
+        return tempGroupDof;
+    vector<double> dofs(NUM_TG_MAX, 0);
+    dofs[TG_ATOM] = massiveMoleculeDof;
+    dofs[TG_DRUDE] = 3.0 * pairParticlesNHVec.size();
+    return dofs;
+}
+
+void CudaModifyDrudeNoseKernel::getGroupKineticEnergies(ContextImpl& context, const VVIntegrator& integrator,
+                                                        vector<double>& kineticEnergies, vector<double>& dofs) {
+    /**
+     * kineticEnergiesNHVec is 2 * kinetic energy before the scaling.
+     * For massive Nose-Hoover chains, the kinetic energies of all chains are downloaded and summed
+     */
+    kineticEnergies = vector<double>(NUM_TG_MAX, 0);
+    dofs = getGroupDofs();
+    if (useMassive) {
+        cu.setAsCurrent();
+        vector<double> chainKE;
+        if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision())
+            massiveChainKE->download(chainKE);
+        else {
+            vector<float> chainKEFloat;
+            massiveChainKE->download(chainKEFloat);
+            chainKE.assign(chainKEFloat.begin(), chainKEFloat.end());
+        }
+        for (int i = 0; i < numMassiveChains; i++)
+            kineticEnergies[i < (int) moleculesNHVec.size() ? TG_ATOM : TG_DRUDE] += chainKE[i] / 2;
+        return;
+    }
+    for (int i = 0; i < (int) kineticEnergiesNHVec.size(); i++)
+        kineticEnergies[i] = kineticEnergiesNHVec[i] * vscaleFactorsNHVec[i] * vscaleFactorsNHVec[i] / 2;
+}
+
+void CudaModifyDrudeNoseKernel::recordGroupKineticEnergies(ContextImpl& context, const VVIntegrator& integrator,
+                                                           int slot, int capacity) {
+    cu.setAsCurrent();
+    if (groupHistory == NULL || groupHistory->getSize() != capacity * GROUP_HISTORY_RECORD_SIZE) {
+        delete groupHistory;
+        groupHistory = CudaArray::create<double>(cu, capacity * GROUP_HISTORY_RECORD_SIZE, "groupHistory");
+    }
+    double time = context.getTime();
+    if (useMassive) {
+        void *args[] = {&massiveChainKE->getDevicePointer(),
+                        &groupHistory->getDevicePointer(),
+                        &slot, &time};
+        cu.executeKernel(kernelMassiveRecordGroupKE, args, MASSIVE_NH_BLOCK_SIZE, MASSIVE_NH_BLOCK_SIZE);
+    }
+    else {
+        void *args[] = {&kineticEnergiesNH->getDevicePointer(),
+                        &vscaleFactorsNH->getDevicePointer(),
+                        &groupHistory->getDevicePointer(),
+                        &slot, &time};
+        cu.executeKernel(kernelRecordGroupKE, args, 1);
+    }
+}
+
+void CudaModifyDrudeNoseKernel::getGroupKineticEnergyHistory(ContextImpl& context, const VVIntegrator& integrator,
+                                                             vector<double>& history, vector<double>& dofs) {
+    history.clear();
+    dofs = getGroupDofs();
+    if (groupHistory != NULL) {
+        cu.setAsCurrent();
+        groupHistory->download(history);
+    }
+}
+
+void CudaModifyDrudeNoseKernel::createCheckpoint(ContextImpl& context, std::ostream& stream) const {
+    cu.setAsCurrent();
+    for (int i = 0; i < numTempGroup; i++) {
+        writeVectorToCheckpoint(eta[i], stream);
+        writeVectorToCheckpoint(etaDot[i], stream);
+        writeVectorToCheckpoint(etaDotDot[i], stream);
+    }
+    if (useMassive) {
+        writeArrayToCheckpoint(*massiveEtaDot, stream);
+        writeArrayToCheckpoint(*massiveEtaDotDot, stream);
+    }
 }
 
+void CudaModifyDrudeNoseKernel::loadCheckpoint(ContextImpl& context, std::istream& stream) {
+    cu.setAsCurrent();
+    for (int i = 0; i < numTempGroup; i++) {
+        readVectorFromCheckpoint(eta[i], "eta of Nose-Hoover chains", stream);
+        readVectorFromCheckpoint(etaDot[i], "etaDot of Nose-Hoover chains", stream);
+        readVectorFromCheckpoint(etaDotDot[i], "etaDotDot of Nose-Hoover chains", stream);
+    }
+    if (useMassive) {
+        readArrayFromCheckpoint(*massiveEtaDot, stream);
+        readArrayFromCheckpoint(*massiveEtaDotDot, stream);
+    }
+}
 
 void CudaModifyDrudeNoseKernel::scaleVelocity(ContextImpl& context, const VVIntegrator& integrator) {
     if (integrator.getDebugEnabled())
         cout << "DrudeNoseModifier scale velocity\n" << flush;
 
     cu.setAsCurrent();
+    updateChainParameters(integrator);
+
+    if (useMassive) {
+        scaleVelocityMassive(context, integrator);
+        return;
+    }
 
     if (integrator.getUseCOMTempGroup()){
         void *argsCOMVel[] = {&cu.getVelm().getDevicePointer(),
@@ -760,14 +1456,7 @@ void CudaModifyDrudeLangevinKernel::initialize(const System &system, const VVInt
     if (integrator.getDebugEnabled())
         cout << "Initializing CudaModifyDrudeLangevinKernel...\n" << flush;
 
-    if (integrator.getUseMiddleScheme()){
-        CudaIntegrateMiddleStepKernel* stepKernel = &vvKernel.getAs<CudaIntegrateMiddleStepKernel>();
-        forceExtra = stepKernel->getForceExtra();
-    }
-    else{
-        CudaIntegrateVVStepKernel* stepKernel = &vvKernel.getAs<CudaIntegrateVVStepKernel>();
-        forceExtra = stepKernel->getForceExtra();
-    }
+    forceExtra = getStepKernelForceExtra(integrator, vvKernel);
     CudaIntegrationUtilities &integration = cu.getIntegrationUtilities();
     cu.getIntegrationUtilities().initRandomNumberGenerator((unsigned int) integrator.getRandomNumberSeed());
 
@@ -815,11 +1504,13 @@ void CudaModifyDrudeLangevinKernel::initialize(const System &system, const VVInt
     defines["NUM_PAIRS_LD"] = cu.intToString(pairParticlesLDVec.size());
     CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::drudeLangevin, defines, "");
     kernelApplyLangevin = cu.getKernel(module, "addExtraForceDrudeLangevin");
+    kernelLangevinVelocity = cu.getKernel(module, "integrateDrudeLangevinVelocity");
 
     cout << "CUDA modules for DrudeLangevinModifier are created\n"
          << "    Num normal particles: " << normalParticlesLDVec.size() << ", Num Drude pairs: " << pairParticlesLDVec.size() << "\n"
          << "    Real T: " << integrator.getTemperature() << " K, Drude T: " << integrator.getDrudeTemperature() << " K\n"
-         << "    Real friction: " << integrator.getFriction() << " /ps, Drude friction: " << integrator.getDrudeFriction() << " /ps\n" << flush;
+         << "    Real friction: " << integrator.getFriction() << " /ps, Drude friction: " << integrator.getDrudeFriction() << " /ps\n"
+         << "    Use Ornstein-Uhlenbeck velocity update: " << integrator.getUseLangevinOU() << "\n" << flush;
 }
 
 void CudaModifyDrudeLangevinKernel::applyLangevinForce(ContextImpl& context, const VVIntegrator& integrator) {
@@ -870,33 +1561,116 @@ void CudaModifyDrudeLangevinKernel::applyLangevinForce(ContextImpl& context, con
     cu.executeKernel(kernelApplyLangevin, args1, integrator.getParticlesLD().size());
 }
 
-CudaModifyImageChargeKernel::~CudaModifyImageChargeKernel() {
-    delete imagePairs;
-}
-
-void CudaModifyImageChargeKernel::initialize(const System& system, const VVIntegrator& integrator) {
+void CudaModifyDrudeLangevinKernel::applyLangevinVelocity(ContextImpl& context, const VVIntegrator& integrator, double timeStep) {
     if (integrator.getDebugEnabled())
-        cout << "Initializing CudaModifyImageChargeKernel...\n" << flush;
+        cout << "CudaModifyDrudeLangevinKernel apply Ornstein-Uhlenbeck velocity update\n" << flush;
 
-    // Identify particle pairs and ordinary particles.
+    cu.setAsCurrent();
+    CudaIntegrationUtilities &integration = cu.getIntegrationUtilities();
 
-    auto imagePairsVec = std::vector<int2>(0);
-    for (auto pair: integrator.getImagePairs())
-        imagePairsVec.push_back(make_int2(pair.first, pair.second));
+    // Compute integrator coefficients.
 
-    imagePairs = CudaArray::create<int2>(cu, max((int) imagePairsVec.size(), 1), "imagePairs");
-    if (!imagePairsVec.empty())
-        imagePairs->upload(imagePairsVec);
+    double vscale = exp(-timeStep * integrator.getFriction());
+    double noisescale = sqrt(BOLTZ * integrator.getTemperature() * (1 - vscale * vscale)); // / sqrt(mass)
+    double vscaleDrude = exp(-timeStep * integrator.getDrudeFriction());
+    double noisescaleDrude = sqrt(BOLTZ * integrator.getDrudeTemperature() * (1 - vscaleDrude * vscaleDrude)); // / sqrt(mass)
 
-    map<string, string> defines;
-    defines["NUM_IMAGES"] = cu.intToString(imagePairsVec.size());
-    defines["PADDED_NUM_ATOMS"] = cu.intToString(cu.getPaddedNumAtoms());
-    CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps+CudaVVKernelSources::imageCharge, defines, "");
-    kernelImage = cu.getKernel(module, "updateImagePositions");
+    // Create appropriate pointer for the precision mode.
+
+    float vscaleFloat = (float) vscale;
+    float noisescaleFloat = (float) noisescale;
+    float vscaleDrudeFloat = (float) vscaleDrude;
+    float noisescaleDrudeFloat = (float) noisescaleDrude;
+    void *vscalePtr, *noisePtr, *vscaleDrudePtr, *noiseDrudePtr;
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
+        vscalePtr = &vscale;
+        noisePtr = &noisescale;
+        vscaleDrudePtr = &vscaleDrude;
+        noiseDrudePtr = &noisescaleDrude;
+    }
+    else {
+        vscalePtr = &vscaleFloat;
+        noisePtr = &noisescaleFloat;
+        vscaleDrudePtr = &vscaleDrudeFloat;
+        noiseDrudePtr = &noisescaleDrudeFloat;
+    }
+
+    // Call the Ornstein-Uhlenbeck velocity kernel
+
+    int randomIndex = integration.prepareRandomNumbers(normalParticlesLD->getSize() + 2 * pairParticlesLD->getSize());
+    void *args1[] = {&cu.getVelm().getDevicePointer(),
+                     &normalParticlesLD->getDevicePointer(),
+                     &pairParticlesLD->getDevicePointer(),
+                     vscalePtr, noisePtr, vscaleDrudePtr, noiseDrudePtr,
+                     &integration.getRandom().getDevicePointer(),
+                     &randomIndex};
+    cu.executeKernel(kernelLangevinVelocity, args1, integrator.getParticlesLD().size());
+
+    // With middle scheme, the constraints are applied on positions after the second half-step position update
+    if (!integrator.getUseMiddleScheme())
+        integration.applyVelocityConstraints(integrator.getConstraintTolerance());
+}
+
+CudaModifyImageChargeKernel::~CudaModifyImageChargeKernel() {
+    delete imagePairs;
+    delete particleType;
+    delete electrodeBuffer;
+    delete electrodeSums;
+}
+
+void CudaModifyImageChargeKernel::initialize(const System& system, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "Initializing CudaModifyImageChargeKernel...\n" << flush;
+
+    // Identify particle pairs and ordinary particles.
+
+    auto imagePairsVec = std::vector<int2>(0);
+    for (auto pair: integrator.getImagePairs())
+        imagePairsVec.push_back(make_int2(pair.first, pair.second));
+
+    imagePairs = CudaArray::create<int2>(cu, max((int) imagePairsVec.size(), 1), "imagePairs");
+    if (!imagePairsVec.empty())
+        imagePairs->upload(imagePairsVec);
+
+    // The electrode observables are sampled only if it is enabled before the context is created
+    numBinsX = numBinsY = numElectrodeSamples = 0;
+    if (integrator.getElectrodeStatisticsInterval() > 0) {
+        numBinsX = integrator.getElectrodeNumBins();
+        numBinsY = integrator.getElectrodeNumBins();
+        if (numBinsX < 1)
+            throw OpenMMException("Electrode statistics requires at least one lateral bin");
+        const vector<int>& electrolytes = integrator.getParticlesElectrolyte();
+        vector<int> particleTypeVec(system.getNumParticles(), 0);
+        for (int i : electrolytes)
+            particleTypeVec[i] = 1;
+        for (int i = 0; i < system.getNumParticles(); i++)
+            if (integrator.isParticleImage(i))
+                particleTypeVec[i] = 2;
+        particleType = CudaArray::create<int>(cu, system.getNumParticles(), "electrodeParticleType");
+        particleType->upload(particleTypeVec);
+        const int bufferSize = 4 + numBinsX * numBinsY;
+        electrodeBuffer = CudaArray::create<long long>(cu, bufferSize, "electrodeBuffer");
+        electrodeBuffer->upload(vector<long long>(bufferSize, 0));
+        electrodeSums = CudaArray::create<double>(cu, bufferSize + 1, "electrodeSums");
+        electrodeSums->upload(vector<double>(bufferSize + 1, 0));
+    }
+
+    map<string, string> defines;
+    defines["NUM_IMAGES"] = cu.intToString(imagePairsVec.size());
+    defines["NUM_ATOMS"] = cu.intToString(system.getNumParticles());
+    defines["PADDED_NUM_ATOMS"] = cu.intToString(cu.getPaddedNumAtoms());
+    CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps+CudaVVKernelSources::imageCharge, defines, "");
+    kernelImage = cu.getKernel(module, "updateImagePositions");
+    kernelSampleElectrode = cu.getKernel(module, "sampleElectrodeObservables");
+    kernelAccumulateElectrode = cu.getKernel(module, "accumulateElectrodeObservables");
 
     cout << "CUDA modules for ImageChargeModifier are created\n"
          << "    Num image pairs: " << imagePairsVec.size() << "\n"
-         << "    Mirror location (z): " << integrator.getMirrorLocation() << " nm\n" << flush;
+         << "    Mirror location (z): " << integrator.getMirrorLocation() << " nm\n";
+    if (electrodeSums != NULL)
+        cout << "    Electrode statistics interval: " << integrator.getElectrodeStatisticsInterval()
+             << " steps, Num lateral bins: " << numBinsX << " x " << numBinsY << "\n";
+    cout << flush;
 }
 
 void CudaModifyImageChargeKernel::updateImagePositions(ContextImpl& context, const VVIntegrator& integrator) {
@@ -931,6 +1705,75 @@ void CudaModifyImageChargeKernel::updateImagePositions(ContextImpl& context, con
     cu.executeKernel(kernelImage, args2, integrator.getImagePairs().size());
 }
 
+void CudaModifyImageChargeKernel::accumulateElectrodeStatistics(ContextImpl& context, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "CudaModifyImageChargeKernel accumulate electrode statistics\n" << flush;
+
+    if (electrodeSums == NULL)
+        return;
+
+    cu.setAsCurrent();
+    void *args1[] = {&cu.getPosq().getDevicePointer(),
+                     &cu.getAtomIndexArray().getDevicePointer(),
+                     &particleType->getDevicePointer(),
+                     &electrodeBuffer->getDevicePointer(),
+                     cu.getInvPeriodicBoxSizePointer(),
+                     &numBinsX,
+                     &numBinsY};
+    cu.executeKernel(kernelSampleElectrode, args1, cu.getNumAtoms());
+
+    int bufferSize = electrodeBuffer->getSize();
+    void *args2[] = {&electrodeBuffer->getDevicePointer(),
+                     &electrodeSums->getDevicePointer(),
+                     &bufferSize};
+    cu.executeKernel(kernelAccumulateElectrode, args2, bufferSize);
+    numElectrodeSamples++;
+}
+
+void CudaModifyImageChargeKernel::getElectrodeStatistics(ContextImpl& context, const VVIntegrator& integrator,
+                                                         vector<double>& stats, vector<double>& distribution) {
+    stats = vector<double>(6, 0);
+    distribution = vector<double>(numBinsX * numBinsY, 0);
+    if (electrodeSums == NULL || numElectrodeSamples == 0)
+        return;
+
+    cu.setAsCurrent();
+    vector<double> sums;
+    electrodeSums->download(sums);
+    const double n = numElectrodeSamples;
+    const double meanDipole = sums[0] / n;
+    stats = {meanDipole, sums[1] / n - meanDipole * meanDipole, sums[2] / n, sums[3] / n, sums[4] / n, n};
+
+    double4 box = cu.getPeriodicBoxSize();
+    const double binArea = box.x * box.y / (numBinsX * numBinsY);
+    for (int i = 0; i < numBinsX * numBinsY; i++)
+        distribution[i] = sums[5 + i] / n / binArea;
+}
+
+void CudaModifyImageChargeKernel::resetElectrodeStatistics(ContextImpl& context, const VVIntegrator& integrator) {
+    if (electrodeSums == NULL)
+        return;
+    cu.setAsCurrent();
+    electrodeSums->upload(vector<double>(electrodeSums->getSize(), 0));
+    numElectrodeSamples = 0;
+}
+
+void CudaModifyImageChargeKernel::createCheckpoint(ContextImpl& context, std::ostream& stream) const {
+    if (electrodeSums == NULL)
+        return;
+    cu.setAsCurrent();
+    writeArrayToCheckpoint(*electrodeSums, stream);
+    stream.write((char*) &numElectrodeSamples, sizeof(int));
+}
+
+void CudaModifyImageChargeKernel::loadCheckpoint(ContextImpl& context, std::istream& stream) {
+    if (electrodeSums == NULL)
+        return;
+    cu.setAsCurrent();
+    readArrayFromCheckpoint(*electrodeSums, stream);
+    stream.read((char*) &numElectrodeSamples, sizeof(int));
+}
+
 CudaModifyElectricFieldKernel::~CudaModifyElectricFieldKernel() {
     delete particlesElectrolyte;
 }
@@ -939,14 +1782,7 @@ void CudaModifyElectricFieldKernel::initialize(const System &system, const VVInt
     if (integrator.getDebugEnabled())
         cout << "Initializing CudaModifyElectricFieldKernel...\n" << flush;
 
-    if (integrator.getUseMiddleScheme()){
-        CudaIntegrateMiddleStepKernel* stepKernel = &vvKernel.getAs<CudaIntegrateMiddleStepKernel>();
-        forceExtra = stepKernel->getForceExtra();
-    }
-    else{
-        CudaIntegrateVVStepKernel* stepKernel = &vvKernel.getAs<CudaIntegrateVVStepKernel>();
-        forceExtra = stepKernel->getForceExtra();
-    }
+    forceExtra = getStepKernelForceExtra(integrator, vvKernel);
     CudaIntegrationUtilities &integration = cu.getIntegrationUtilities();
     cu.getIntegrationUtilities().initRandomNumberGenerator((unsigned int) integrator.getRandomNumberSeed());
 
@@ -990,29 +1826,41 @@ void CudaModifyElectricFieldKernel::applyElectricForce(ContextImpl& context, con
     cu.executeKernel(kernelApplyElectricForce, args1, particlesElectrolyte->getSize());
 }
 
+/**
+ * The number of levels of block averaging for the viscosity statistics.
+ * The block size at the last level is 2^(NUM_BLOCK_LEVELS-1) samples.
+ */
+static const int NUM_BLOCK_LEVELS = 32;
+
+/**
+ * The number of threads in each block for the reduction of velocity amplitudes. It should be a power of 2
+ */
+static const int COS_ACCELERATE_BLOCK_SIZE = 128;
+
 CudaModifyCosineAccelerateKernel::~CudaModifyCosineAccelerateKernel() {
-    delete vMaxBuffer;
+    delete vBlockSums;
+    delete vAmplitudes;
+    delete vStatistics;
+    delete modeAxes;
+    delete modeAmplitudes;
 }
 
 void CudaModifyCosineAccelerateKernel::initialize(const System &system, const VVIntegrator &integrator, Kernel& vvKernel) {
     if (integrator.getDebugEnabled())
         cout << "Initializing CosineAccelerateModifier...\n" << flush;
 
-    if (integrator.getUseMiddleScheme()){
-        CudaIntegrateMiddleStepKernel* stepKernel = &vvKernel.getAs<CudaIntegrateMiddleStepKernel>();
-        forceExtra = stepKernel->getForceExtra();
-    }
-    else{
-        CudaIntegrateVVStepKernel* stepKernel = &vvKernel.getAs<CudaIntegrateVVStepKernel>();
-        forceExtra = stepKernel->getForceExtra();
-    }
+    forceExtra = getStepKernelForceExtra(integrator, vvKernel);
     CudaIntegrationUtilities &integration = cu.getIntegrationUtilities();
     cu.getIntegrationUtilities().initRandomNumberGenerator((unsigned int) integrator.getRandomNumberSeed());
 
     numAtoms = cu.getNumAtoms();
+    numModes = integrator.getNumCosAccelerationModes();
     map<string, string> defines;
     defines["NUM_ATOMS"] = cu.intToString(numAtoms);
     defines["PADDED_NUM_ATOMS"] = cu.intToString(cu.getPaddedNumAtoms());
+    defines["NUM_MODES"] = cu.intToString(numModes);
+    defines["NUM_BLOCK_LEVELS"] = cu.intToString(NUM_BLOCK_LEVELS);
+    defines["THREAD_BLOCK_SIZE"] = cu.intToString(COS_ACCELERATE_BLOCK_SIZE);
     CUmodule module= cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::cosineAccelerate, defines, "");
     kernelAccelerate = cu.getKernel(module, "addCosAcceleration");
     kernelCalcV = cu.getKernel(module, "calcPeriodicVelocityBias");
@@ -1020,10 +1868,33 @@ void CudaModifyCosineAccelerateKernel::initialize(const System &system, const VV
     kernelRestoreBias = cu.getKernel(module, "restorePeriodicVelocityBias");
     kernelSumV = cu.getKernel(module, "sumV");
 
-    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision())
-        vMaxBuffer = CudaArray::create<double>(cu, numAtoms, "cosAccelerateVMaxBuffer");
-    else
-        vMaxBuffer = CudaArray::create<float>(cu, numAtoms, "cosAccelerateVMaxBuffer");
+    numBlocks = min((numAtoms + COS_ACCELERATE_BLOCK_SIZE - 1) / COS_ACCELERATE_BLOCK_SIZE, cu.getNumThreadBlocks());
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
+        vBlockSums = CudaArray::create<double>(cu, numModes * numBlocks, "cosAccelerateVBlockSums");
+        vAmplitudes = CudaArray::create<double>(cu, numModes, "cosAccelerateVAmplitudes");
+        vAmplitudes->upload(vector<double>(numModes, 0));
+        modeAmplitudes = CudaArray::create<double>(cu, numModes, "cosAccelerateModeAmplitudes");
+    }
+    else {
+        vBlockSums = CudaArray::create<float>(cu, numModes * numBlocks, "cosAccelerateVBlockSums");
+        vAmplitudes = CudaArray::create<float>(cu, numModes, "cosAccelerateVAmplitudes");
+        vAmplitudes->upload(vector<float>(numModes, 0));
+        modeAmplitudes = CudaArray::create<float>(cu, numModes, "cosAccelerateModeAmplitudes");
+    }
+    vStatistics = CudaArray::create<double>(cu, numModes * 4 * NUM_BLOCK_LEVELS, "cosAccelerateVStatistics");
+    vStatistics->upload(vector<double>(numModes * 4 * NUM_BLOCK_LEVELS, 0));
+
+    vector<int4> modeAxesVec(numModes);
+    for (int m = 0; m < numModes; m++) {
+        int flowAxis, gradientAxis, waveNumber;
+        double amplitude;
+        integrator.getCosAccelerationModeParameters(m, flowAxis, gradientAxis, waveNumber, amplitude);
+        modeAxesVec[m] = make_int4(flowAxis, gradientAxis, waveNumber, 0);
+    }
+    modeAxes = CudaArray::create<int4>(cu, numModes, "cosAccelerateModeAxes");
+    modeAxes->upload(modeAxesVec);
+    prevAmplitudes.clear();
+    updateAmplitudes(integrator);
 
     double massTotal = 0;
     for (int i = 0; i < numAtoms; i++)
@@ -1031,7 +1902,24 @@ void CudaModifyCosineAccelerateKernel::initialize(const System &system, const VV
     invMassTotal = 1.0 / massTotal;
 
     cout << "CUDA modules for CosineAccelerateModifier are created\n"
-         << "    Cosine acceleration strength: " << integrator.getCosAcceleration() << " nm/ps^2\n" << flush;
+         << "    Cosine acceleration strength: " << integrator.getCosAcceleration() << " nm/ps^2\n"
+         << "    Number of perturbation modes: " << numModes << "\n" << flush;
+}
+
+void CudaModifyCosineAccelerateKernel::updateAmplitudes(const VVIntegrator& integrator) {
+    vector<double> amplitudes(numModes);
+    for (int m = 0; m < numModes; m++) {
+        int flowAxis, gradientAxis, waveNumber;
+        integrator.getCosAccelerationModeParameters(m, flowAxis, gradientAxis, waveNumber, amplitudes[m]);
+    }
+    if (amplitudes == prevAmplitudes)
+        return;
+
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision())
+        modeAmplitudes->upload(amplitudes);
+    else
+        modeAmplitudes->upload(vector<float>(amplitudes.begin(), amplitudes.end()));
+    prevAmplitudes = amplitudes;
 }
 
 void CudaModifyCosineAccelerateKernel::applyCosineForce(ContextImpl& context, const VVIntegrator& integrator) {
@@ -1041,44 +1929,41 @@ void CudaModifyCosineAccelerateKernel::applyCosineForce(ContextImpl& context, co
     cu.setAsCurrent();
     CudaIntegrationUtilities &integration = cu.getIntegrationUtilities();
 
-    double acceleration = integrator.getCosAcceleration(); //
-    float accelerationFloat = (float) acceleration;
-    void *accelerationPtr;
-    if (cu.getUseDoublePrecision()) {
-        accelerationPtr = &acceleration;
-    } else {
-        accelerationPtr = &accelerationFloat;
-    }
+    // the amplitudes may be changed by the user or by a schedule
+    updateAmplitudes(integrator);
 
     void *args1[] = {&cu.getPosq().getDevicePointer(),
                      &cu.getVelm().getDevicePointer(),
                      &forceExtra->getDevicePointer(),
-                     accelerationPtr,
+                     &modeAxes->getDevicePointer(),
+                     &modeAmplitudes->getDevicePointer(),
                      cu.getInvPeriodicBoxSizePointer()};
     cu.executeKernel(kernelAccelerate, args1, numAtoms);
 }
 
-void CudaModifyCosineAccelerateKernel::calcVelocityBias(ContextImpl& context, const VVIntegrator& integrator) {
+void CudaModifyCosineAccelerateKernel::calcVelocityBias(ContextImpl& context, const VVIntegrator& integrator, bool sample) {
     if (integrator.getDebugEnabled())
         cout << "CosineAccelerateModifier calculate velocity bias\n" << flush;
 
     cu.setAsCurrent();
     CudaIntegrationUtilities &integration = cu.getIntegrationUtilities();
 
+    // Each block reduces its atoms into one partial sum per mode, and a single block adds up the partial sums
     void *args1[] = {&cu.getPosq().getDevicePointer(),
                      &cu.getVelm().getDevicePointer(),
-                     &vMaxBuffer->getDevicePointer(),
+                     &vBlockSums->getDevicePointer(),
+                     &modeAxes->getDevicePointer(),
                      cu.getInvPeriodicBoxSizePointer()};
-    cu.executeKernel(kernelCalcV, args1, numAtoms);
+    cu.executeKernel(kernelCalcV, args1, numBlocks * COS_ACCELERATE_BLOCK_SIZE, COS_ACCELERATE_BLOCK_SIZE);
 
-    int bufferSize = vMaxBuffer->getSize();
-    // Use only one threadBlock for this kernel because we use shared memory
-    int workGroupSize = 512;
-    void *args2[] = {&vMaxBuffer->getDevicePointer(),
+    int sampleInt = sample;
+    void *args2[] = {&vBlockSums->getDevicePointer(),
+                     &vAmplitudes->getDevicePointer(),
                      &invMassTotal,
-                     &bufferSize};
-    cu.executeKernel(kernelSumV, args2, workGroupSize, workGroupSize,
-                     workGroupSize * vMaxBuffer->getElementSize());
+                     &numBlocks,
+                     &vStatistics->getDevicePointer(),
+                     &sampleInt};
+    cu.executeKernel(kernelSumV, args2, COS_ACCELERATE_BLOCK_SIZE, COS_ACCELERATE_BLOCK_SIZE);
 }
 
 void CudaModifyCosineAccelerateKernel::removeVelocityBias(ContextImpl& context, const VVIntegrator& integrator) {
@@ -1090,7 +1975,9 @@ void CudaModifyCosineAccelerateKernel::removeVelocityBias(ContextImpl& context,
 
     void *args1[] = {&cu.getPosq().getDevicePointer(),
                      &cu.getVelm().getDevicePointer(),
-                     &vMaxBuffer->getDevicePointer(),
+                     &vAmplitudes->getDevicePointer(),
+                     &modeAxes->getDevicePointer(),
+                     &modeAmplitudes->getDevicePointer(),
                      cu.getInvPeriodicBoxSizePointer()};
     cu.executeKernel(kernelRemoveBias, args1, numAtoms);
 }
@@ -1104,31 +1991,970 @@ void CudaModifyCosineAccelerateKernel::restoreVelocityBias(ContextImpl& context,
 
     void *args1[] = {&cu.getPosq().getDevicePointer(),
                      &cu.getVelm().getDevicePointer(),
-                     &vMaxBuffer->getDevicePointer(),
+                     &vAmplitudes->getDevicePointer(),
+                     &modeAxes->getDevicePointer(),
+                     &modeAmplitudes->getDevicePointer(),
                      cu.getInvPeriodicBoxSizePointer()};
     cu.executeKernel(kernelRestoreBias, args1, numAtoms);
 }
 
-void CudaModifyCosineAccelerateKernel::calcViscosity(ContextImpl& context, const VVIntegrator& integrator, double& vMax, double& invVis) {
+void CudaModifyCosineAccelerateKernel::calcViscosity(ContextImpl& context, const VVIntegrator& integrator, int mode, double& vMax, double& invVis) {
     if (integrator.getDebugEnabled())
         cout << "CosineAccelerateModifier calculate viscosity\n" << flush;
 
     cu.setAsCurrent();
     CudaIntegrationUtilities &integration = cu.getIntegrationUtilities();
 
+    CUresult result;
+    CUdeviceptr amplitudePtr = vAmplitudes->getDevicePointer() + (size_t) mode * vAmplitudes->getElementSize();
     if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
-        auto vMaxBufferVec = std::vector<double>(numAtoms, 0);
-        vMaxBuffer->download(vMaxBufferVec);
-        vMax = vMaxBufferVec[0];
+        double v;
+        result = cuMemcpyDtoH(&v, amplitudePtr, sizeof(double));
+        vMax = v;
     } else {
-        auto vMaxBufferVec = std::vector<float>(numAtoms, 0);
-        vMaxBuffer->download(vMaxBufferVec);
-        vMax = (double) vMaxBufferVec[0];
+        float v;
+        result = cuMemcpyDtoH(&v, amplitudePtr, sizeof(float));
+        vMax = (double) v;
     }
+    if (result != CUDA_SUCCESS)
+        throw OpenMMException("Error downloading velocity amplitude of cosine acceleration");
+
+    invVis = vMax * calcInvViscosityFactor(integrator, mode);
+}
+
+double CudaModifyCosineAccelerateKernel::calcInvViscosityFactor(const VVIntegrator& integrator, int mode) const {
+    int flowAxis, gradientAxis, waveNumber;
+    double amplitude;
+    integrator.getCosAccelerationModeParameters(mode, flowAxis, gradientAxis, waveNumber, amplitude);
+    if (amplitude == 0)
+        return 0;
 
     double4 box = cu.getPeriodicBoxSize();
     double vol = box.x * box.y * box.z;
+    double length = gradientAxis == 0 ? box.x : (gradientAxis == 1 ? box.y : box.z);
+    double k = 2 * 3.1415926 * waveNumber / length;
+    return vol * invMassTotal / amplitude * k * k;
+}
+
+void CudaModifyCosineAccelerateKernel::calcViscosityStatistics(ContextImpl& context, const VVIntegrator& integrator, int mode, vector<double>& stats) {
+    if (integrator.getDebugEnabled())
+        cout << "CosineAccelerateModifier calculate viscosity statistics\n" << flush;
+
+    cu.setAsCurrent();
+    vector<double> allLevels;
+    vStatistics->download(allLevels);
+    vector<double> levels(allLevels.begin() + mode * 4 * NUM_BLOCK_LEVELS, allLevels.begin() + (mode + 1) * 4 * NUM_BLOCK_LEVELS);
+
+    // Samples at the first level are the velocity amplitudes of each sampled step
+    const double numSamples = levels[0];
+    double mean = 0, var = 0, error = 0, tau = 0;
+    if (numSamples > 0)
+        mean = levels[1] / numSamples;
+    if (numSamples > 1) {
+        var = (levels[2] - levels[1] * mean) / (numSamples - 1);
+        error = sqrt(max(var, 0.0) / numSamples);
+        // The standard error of correlated samples is underestimated at small block sizes.
+        // It reaches a plateau once the blocks are longer than the correlation time,
+        // so the largest estimate among the levels with enough blocks is used.
+        for (int level = 1; level < NUM_BLOCK_LEVELS; level++) {
+            double n = levels[4 * level];
+            if (n < 32)
+                break;
+            double blockMean = levels[4 * level + 1] / n;
+            double blockVar = (levels[4 * level + 2] - levels[4 * level + 1] * blockMean) / (n - 1);
+            error = max(error, sqrt(max(blockVar, 0.0) / n));
+        }
+        if (var > 0)
+            tau = 0.5 * numSamples * error * error / var;
+    }
+
+    const double factor = calcInvViscosityFactor(integrator, mode);
+    stats = {mean, mean * factor, error * fabs(factor), tau, numSamples};
+}
+
+void CudaModifyCosineAccelerateKernel::resetViscosityStatistics(ContextImpl& context, const VVIntegrator& integrator) {
+    cu.setAsCurrent();
+    vStatistics->upload(vector<double>(numModes * 4 * NUM_BLOCK_LEVELS, 0));
+}
+
+void CudaModifyCosineAccelerateKernel::createCheckpoint(ContextImpl& context, std::ostream& stream) const {
+    cu.setAsCurrent();
+    // the velocity amplitudes are recalculated before they are used in every step
+    writeArrayToCheckpoint(*vStatistics, stream);
+}
 
-    invVis = vMax * vol * invMassTotal / integrator.getCosAcceleration()
-             * (2 * 3.1415926 / box.z) * (2 * 3.1415926 / box.z);
+void CudaModifyCosineAccelerateKernel::loadCheckpoint(ContextImpl& context, std::istream& stream) {
+    cu.setAsCurrent();
+    readArrayFromCheckpoint(*vStatistics, stream);
+}
+
+/**
+ * The number of threads in each block for candidate selection of RNEMD. It should be a power of 2
+ */
+static const int RNEMD_BLOCK_SIZE = 128;
+
+CudaModifyRNEMDKernel::~CudaModifyRNEMDKernel() {
+    delete units;
+    delete unitParticles;
+    delete blockMaxV;
+    delete blockMaxUnit;
+    delete blockMinV;
+    delete blockMinUnit;
+    delete slabBuffer;
+    delete slabProfile;
+    delete transferred;
+}
+
+void CudaModifyRNEMDKernel::initialize(const System &system, const VVIntegrator &integrator, const DrudeForce* force) {
+    if (integrator.getDebugEnabled())
+        cout << "Initializing RNEMDModifier...\n" << flush;
+
+    cu.setAsCurrent();
+    numSlabs = integrator.getRNEMDNumSlabs();
+    if (numSlabs < 4 || numSlabs % 2 != 0)
+        throw OpenMMException("RNEMD requires an even number of slabs, and at least four slabs");
+
+    // Each unit is a molecule, so that the exchange doesn't break the constraints or the relative motion of Drude pairs.
+    // Image particles and massless particles are not exchanged
+    vector<vector<int> > particlesOfMolecule(integrator.getNumMolecules());
+    for (int i = 0; i < system.getNumParticles(); i++) {
+        if (system.getParticleMass(i) == 0 || integrator.isParticleImage(i))
+            continue;
+        particlesOfMolecule[integrator.getParticleMolId(i)].push_back(i);
+    }
+    vector<int2> unitsVec;
+    vector<int> unitParticlesVec;
+    for (int id_mol = 0; id_mol < integrator.getNumMolecules(); id_mol++) {
+        if (particlesOfMolecule[id_mol].empty())
+            continue;
+        unitsVec.push_back(make_int2(particlesOfMolecule[id_mol].size(), unitParticlesVec.size()));
+        unitParticlesVec.insert(unitParticlesVec.end(), particlesOfMolecule[id_mol].begin(), particlesOfMolecule[id_mol].end());
+    }
+    numUnits = unitsVec.size();
+    units = CudaArray::create<int2>(cu, max(numUnits, 1), "rnemdUnits");
+    unitParticles = CudaArray::create<int>(cu, max((int) unitParticlesVec.size(), 1), "rnemdUnitParticles");
+    if (numUnits > 0) {
+        units->upload(unitsVec);
+        unitParticles->upload(unitParticlesVec);
+    }
+
+    map<string, string> defines;
+    defines["NUM_UNITS"] = cu.intToString(numUnits);
+    defines["NUM_SLABS"] = cu.intToString(numSlabs);
+    defines["THREAD_BLOCK_SIZE"] = cu.intToString(RNEMD_BLOCK_SIZE);
+    CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::rnemd, defines, "");
+    kernelFindCandidates = cu.getKernel(module, "findExchangeCandidates");
+    kernelExchange = cu.getKernel(module, "exchangeMomentum");
+
+    // executeKernel() launches at most getNumThreadBlocks() blocks
+    numBlocks = min((max(numUnits, 1) + RNEMD_BLOCK_SIZE - 1) / RNEMD_BLOCK_SIZE, cu.getNumThreadBlocks());
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
+        blockMaxV = CudaArray::create<double>(cu, numBlocks, "rnemdBlockMaxV");
+        blockMinV = CudaArray::create<double>(cu, numBlocks, "rnemdBlockMinV");
+    }
+    else {
+        blockMaxV = CudaArray::create<float>(cu, numBlocks, "rnemdBlockMaxV");
+        blockMinV = CudaArray::create<float>(cu, numBlocks, "rnemdBlockMinV");
+    }
+    blockMaxUnit = CudaArray::create<int>(cu, numBlocks, "rnemdBlockMaxUnit");
+    blockMinUnit = CudaArray::create<int>(cu, numBlocks, "rnemdBlockMinUnit");
+    slabBuffer = CudaArray::create<long long>(cu, 2 * numSlabs, "rnemdSlabBuffer");
+    slabBuffer->upload(vector<long long>(2 * numSlabs, 0));
+    slabProfile = CudaArray::create<double>(cu, 2 * numSlabs, "rnemdSlabProfile");
+    slabProfile->upload(vector<double>(2 * numSlabs, 0));
+    transferred = CudaArray::create<double>(cu, 2, "rnemdTransferred");
+    transferred->upload(vector<double>(2, 0));
+    elapsedTime = 0;
+
+    cout << "CUDA modules for RNEMDModifier are created\n"
+         << "    Num units: " << numUnits << ", Num slabs: " << numSlabs << "\n"
+         << "    Exchange interval: " << integrator.getRNEMDInterval() << " steps\n" << flush;
+}
+
+void CudaModifyRNEMDKernel::exchangeMomentum(ContextImpl& context, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "RNEMDModifier exchange momentum\n" << flush;
+
+    cu.setAsCurrent();
+    void *args1[] = {&cu.getPosq().getDevicePointer(),
+                     &cu.getVelm().getDevicePointer(),
+                     &units->getDevicePointer(),
+                     &unitParticles->getDevicePointer(),
+                     &blockMaxV->getDevicePointer(),
+                     &blockMaxUnit->getDevicePointer(),
+                     &blockMinV->getDevicePointer(),
+                     &blockMinUnit->getDevicePointer(),
+                     &slabBuffer->getDevicePointer(),
+                     cu.getInvPeriodicBoxSizePointer()};
+    cu.executeKernel(kernelFindCandidates, args1, numBlocks * RNEMD_BLOCK_SIZE, RNEMD_BLOCK_SIZE);
+
+    // Use only one threadBlock for this kernel because we use shared memory
+    void *args2[] = {&cu.getVelm().getDevicePointer(),
+                     &units->getDevicePointer(),
+                     &unitParticles->getDevicePointer(),
+                     &blockMaxV->getDevicePointer(),
+                     &blockMaxUnit->getDevicePointer(),
+                     &blockMinV->getDevicePointer(),
+                     &blockMinUnit->getDevicePointer(),
+                     &numBlocks,
+                     &slabBuffer->getDevicePointer(),
+                     &slabProfile->getDevicePointer(),
+                     &transferred->getDevicePointer()};
+    cu.executeKernel(kernelExchange, args2, RNEMD_BLOCK_SIZE, RNEMD_BLOCK_SIZE);
+
+    elapsedTime += integrator.getRNEMDInterval() * integrator.getStepSize();
+}
+
+/**
+ * Fit the slope of the velocity profile by least squares
+ */
+static double fitSlope(const vector<double>& z, const vector<double>& v) {
+    double zMean = 0, vMean = 0;
+    for (int i = 0; i < (int) z.size(); i++) {
+        zMean += z[i];
+        vMean += v[i];
+    }
+    zMean /= z.size();
+    vMean /= z.size();
+    double szv = 0, szz = 0;
+    for (int i = 0; i < (int) z.size(); i++) {
+        szv += (z[i] - zMean) * (v[i] - vMean);
+        szz += (z[i] - zMean) * (z[i] - zMean);
+    }
+    return szz > 0 ? szv / szz : 0;
+}
+
+void CudaModifyRNEMDKernel::calcRNEMDStatistics(ContextImpl& context, const VVIntegrator& integrator,
+                                                vector<double>& stats, vector<double>& profile) {
+    if (integrator.getDebugEnabled())
+        cout << "RNEMDModifier calculate statistics\n" << flush;
+
+    cu.setAsCurrent();
+    vector<double> slabs, transferredVec;
+    slabProfile->download(slabs);
+    transferred->download(transferredVec);
+
+    profile.assign(numSlabs, 0);
+    for (int i = 0; i < numSlabs; i++)
+        if (slabs[numSlabs + i] > 0)
+            profile[i] = slabs[i] / slabs[numSlabs + i];
+
+    // The slabs where the momentum is exchanged are excluded from the fitting
+    double4 box = cu.getPeriodicBoxSize();
+    vector<double> z1, v1, z2, v2;
+    for (int i = 1; i < numSlabs / 2; i++) {
+        z1.push_back((i + 0.5) * box.z / numSlabs);
+        v1.push_back(profile[i]);
+    }
+    for (int i = numSlabs / 2 + 1; i < numSlabs; i++) {
+        z2.push_back((i + 0.5) * box.z / numSlabs);
+        v2.push_back(profile[i]);
+    }
+    double gradient = (fitSlope(z1, v1) - fitSlope(z2, v2)) / 2;
+
+    // The momentum flows through both halves of the box
+    double momentum = transferredVec[0];
+    double flux = elapsedTime > 0 ? momentum / (2 * elapsedTime * box.x * box.y) : 0;
+    double viscosity = gradient != 0 ? flux / gradient : 0;
+    stats = {momentum, elapsedTime, flux, gradient, viscosity, transferredVec[1]};
+}
+
+void CudaModifyRNEMDKernel::resetRNEMDStatistics(ContextImpl& context, const VVIntegrator& integrator) {
+    cu.setAsCurrent();
+    slabProfile->upload(vector<double>(2 * numSlabs, 0));
+    transferred->upload(vector<double>(2, 0));
+    elapsedTime = 0;
+}
+
+void CudaModifyRNEMDKernel::createCheckpoint(ContextImpl& context, std::ostream& stream) const {
+    cu.setAsCurrent();
+    writeArrayToCheckpoint(*slabProfile, stream);
+    writeArrayToCheckpoint(*transferred, stream);
+    stream.write((char*) &elapsedTime, sizeof(double));
+}
+
+void CudaModifyRNEMDKernel::loadCheckpoint(ContextImpl& context, std::istream& stream) {
+    cu.setAsCurrent();
+    readArrayFromCheckpoint(*slabProfile, stream);
+    readArrayFromCheckpoint(*transferred, stream);
+    stream.read((char*) &elapsedTime, sizeof(double));
+}
+
+static const int NUM_PROFILE_GROUPS = 3;
+
+CudaCalcDensityProfileKernel::~CudaCalcDensityProfileKernel() {
+    delete particleInfo;
+    delete profileBuffer;
+    delete profiles;
+}
+
+void CudaCalcDensityProfileKernel::initialize(const System &system, const VVIntegrator &integrator, const DrudeForce* force) {
+    if (integrator.getDebugEnabled())
+        cout << "Initializing DensityProfileCalculator...\n" << flush;
+
+    cu.setAsCurrent();
+    numBins = integrator.getDensityProfileNumBins();
+    if (numBins < 1)
+        throw OpenMMException("Density profile requires at least one bin");
+
+    // Drude particles belong to the group of their parent atoms
+    const int numParticles = system.getNumParticles();
+    vector<int2> particleInfoVec(cu.getPaddedNumAtoms(), make_int2(-1, -1));
+    vector<int> parent(numParticles, -1);
+    if (force != NULL) {
+        for (int i = 0; i < force->getNumParticles(); i++) {
+            int p, p1, p2, p3, p4;
+            double charge, polarizability, aniso12, aniso34;
+            force->getParticleParameters(i, p, p1, p2, p3, p4, charge, polarizability, aniso12, aniso34);
+            parent[p] = p1;
+            particleInfoVec[p1].y = p;
+            particleInfoVec[p].y = -2;
+        }
+    }
+    const vector<int>& electrolytes = integrator.getParticlesElectrolyte();
+    set<int> electrolyteSet(electrolytes.begin(), electrolytes.end());
+    for (int i = 0; i < numParticles; i++) {
+        int atom = parent[i] >= 0 ? parent[i] : i;
+        if (integrator.isParticleImage(atom))
+            particleInfoVec[i].x = VVIntegrator::ProfileImage;
+        else if (electrolyteSet.count(atom) > 0)
+            particleInfoVec[i].x = VVIntegrator::ProfileElectrolyte;
+        else
+            particleInfoVec[i].x = VVIntegrator::ProfileOther;
+    }
+    particleInfo = CudaArray::create<int2>(cu, particleInfoVec.size(), "densityProfileParticleInfo");
+    particleInfo->upload(particleInfoVec);
+
+    const int bufferSize = 3 * NUM_PROFILE_GROUPS * numBins;
+    profileBuffer = CudaArray::create<long long>(cu, bufferSize, "densityProfileBuffer");
+    profileBuffer->upload(vector<long long>(bufferSize, 0));
+    profiles = CudaArray::create<double>(cu, bufferSize, "densityProfiles");
+    profiles->upload(vector<double>(bufferSize, 0));
+    numSamples = 0;
+
+    map<string, string> defines;
+    defines["NUM_ATOMS"] = cu.intToString(numParticles);
+    defines["NUM_BINS"] = cu.intToString(numBins);
+    defines["NUM_GROUPS"] = cu.intToString(NUM_PROFILE_GROUPS);
+    CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::densityProfile, defines, "");
+    kernelBin = cu.getKernel(module, "binParticles");
+    kernelAccumulate = cu.getKernel(module, "accumulateProfiles");
+
+    cout << "CUDA modules for DensityProfileCalculator are created\n"
+         << "    Num bins: " << numBins << ", Sampling interval: " << integrator.getDensityProfileInterval() << " steps\n" << flush;
+}
+
+void CudaCalcDensityProfileKernel::accumulateProfiles(ContextImpl& context, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "DensityProfileCalculator accumulate profiles\n" << flush;
+
+    cu.setAsCurrent();
+    void *args1[] = {&cu.getPosq().getDevicePointer(),
+                     &particleInfo->getDevicePointer(),
+                     &profileBuffer->getDevicePointer(),
+                     cu.getInvPeriodicBoxSizePointer()};
+    cu.executeKernel(kernelBin, args1, cu.getNumAtoms());
+
+    void *args2[] = {&profileBuffer->getDevicePointer(),
+                     &profiles->getDevicePointer()};
+    cu.executeKernel(kernelAccumulate, args2, profiles->getSize());
+    numSamples++;
+}
+
+void CudaCalcDensityProfileKernel::getProfile(ContextImpl& context, const VVIntegrator& integrator, int group, int quantity, vector<double>& profile) {
+    cu.setAsCurrent();
+    vector<double> profilesVec;
+    profiles->download(profilesVec);
+
+    double4 box = cu.getPeriodicBoxSize();
+    const double binVolume = box.x * box.y * box.z / numBins;
+    const int offset = (quantity * NUM_PROFILE_GROUPS + group) * numBins;
+    profile.assign(numBins, 0);
+    if (numSamples > 0)
+        for (int i = 0; i < numBins; i++)
+            profile[i] = profilesVec[offset + i] / numSamples / binVolume;
+}
+
+void CudaCalcDensityProfileKernel::resetProfiles(ContextImpl& context, const VVIntegrator& integrator) {
+    cu.setAsCurrent();
+    profiles->upload(vector<double>(profiles->getSize(), 0));
+    numSamples = 0;
+}
+
+void CudaCalcDensityProfileKernel::createCheckpoint(ContextImpl& context, std::ostream& stream) const {
+    cu.setAsCurrent();
+    writeArrayToCheckpoint(*profiles, stream);
+    stream.write((char*) &numSamples, sizeof(int));
+}
+
+void CudaCalcDensityProfileKernel::loadCheckpoint(ContextImpl& context, std::istream& stream) {
+    cu.setAsCurrent();
+    readArrayFromCheckpoint(*profiles, stream);
+    stream.read((char*) &numSamples, sizeof(int));
+}
+
+static const int CORRELATOR_BUFFER_SIZE = 16;
+static const int CORRELATOR_AVERAGE_SIZE = 2;
+
+CudaCalcMultiTauCorrelationKernel::~CudaCalcMultiTauCorrelationKernel() {
+    delete trackedMolecules;
+    delete trackedGroups;
+    delete particlesInMolecules;
+    delete particlesSortedByMolId;
+    delete particlesSortedLocal;
+    delete atomLocation;
+    delete comVelm;
+    delete comPos;
+    delete comPosWrapped;
+    delete posRing;
+    delete velRing;
+    delete corrBuffer;
+    delete correlations;
+}
+
+void CudaCalcMultiTauCorrelationKernel::initialize(const System &system, const VVIntegrator &integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "Initializing MultiTauCorrelator...\n" << flush;
+
+    cu.setAsCurrent();
+    numLevels = integrator.getCorrelatorNumLevels();
+    if (numLevels < 1)
+        throw OpenMMException("Multi-tau correlator requires at least one level");
+
+    // The molecules which contain any particle of a group are tracked for that group
+    const int numMolecules = integrator.getNumMolecules();
+    const int numGroups = integrator.getNumCorrelatorGroups();
+    vector<int> moleculeGroup(numMolecules, -1);
+    for (int group = 0; group < numGroups; group++) {
+        for (int particle : integrator.getCorrelatorGroup(group)) {
+            int id_mol = integrator.getParticleMolId(particle);
+            if (moleculeGroup[id_mol] != -1 && moleculeGroup[id_mol] != group)
+                throw OpenMMException("A molecule shouldn't belong to more than one group of multi-tau correlator");
+            moleculeGroup[id_mol] = group;
+        }
+    }
+    vector<int> trackedMoleculesVec, trackedGroupsVec;
+    numMoleculesInGroup = vector<int>(numGroups, 0);
+    for (int id_mol = 0; id_mol < numMolecules; id_mol++) {
+        if (moleculeGroup[id_mol] != -1) {
+            trackedMoleculesVec.push_back(id_mol);
+            trackedGroupsVec.push_back(moleculeGroup[id_mol]);
+            numMoleculesInGroup[moleculeGroup[id_mol]]++;
+        }
+    }
+    numTracked = trackedMoleculesVec.size();
+
+    // Same layout as the Nose-Hoover thermostat, so that calcCOMVelocities can be reused
+    vector<int2> particlesInMoleculesVec;
+    vector<int> particlesSortedByMolIdVec;
+    vector<vector<int> > particlesOfMolecule(numMolecules);
+    for (int i = 0; i < system.getNumParticles(); i++)
+        particlesOfMolecule[integrator.getParticleMolId(i)].push_back(i);
+    for (int id_mol = 0; id_mol < numMolecules; id_mol++) {
+        particlesInMoleculesVec.push_back(make_int2(particlesOfMolecule[id_mol].size(), particlesSortedByMolIdVec.size()));
+        particlesSortedByMolIdVec.insert(particlesSortedByMolIdVec.end(), particlesOfMolecule[id_mol].begin(), particlesOfMolecule[id_mol].end());
+    }
+
+    trackedMolecules = CudaArray::create<int>(cu, max(numTracked, 1), "correlatorTrackedMolecules");
+    trackedGroups = CudaArray::create<int>(cu, max(numTracked, 1), "correlatorTrackedGroups");
+    particlesInMolecules = CudaArray::create<int2>(cu, max(numMolecules, 1), "correlatorParticlesInMolecules");
+    particlesSortedByMolId = CudaArray::create<int>(cu, system.getNumParticles(), "correlatorParticlesSortedByMolId");
+    particlesSortedLocal = CudaArray::create<int>(cu, system.getNumParticles(), "correlatorParticlesSortedLocal");
+    atomLocation = CudaArray::create<int>(cu, system.getNumParticles(), "correlatorAtomLocation");
+    if (numTracked > 0) {
+        trackedMolecules->upload(trackedMoleculesVec);
+        trackedGroups->upload(trackedGroupsVec);
+    }
+    if (numMolecules > 0)
+        particlesInMolecules->upload(particlesInMoleculesVec);
+    particlesSortedByMolId->upload(particlesSortedByMolIdVec);
+
+    const int ringSize = max(numLevels * CORRELATOR_BUFFER_SIZE * numTracked, 1);
+    if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
+        comVelm = CudaArray::create<double4>(cu, max(numMolecules, 1), "correlatorCOMVelm");
+        comPos = CudaArray::create<double4>(cu, max(numTracked, 1), "correlatorCOMPos");
+        comPosWrapped = CudaArray::create<double4>(cu, max(numTracked, 1), "correlatorCOMPosWrapped");
+        posRing = CudaArray::create<double4>(cu, ringSize, "correlatorPosRing");
+        velRing = CudaArray::create<double4>(cu, ringSize, "correlatorVelRing");
+        comVelm->upload(vector<double4>(comVelm->getSize(), make_double4(0, 0, 0, 0)));
+    }
+    else {
+        comVelm = CudaArray::create<float4>(cu, max(numMolecules, 1), "correlatorCOMVelm");
+        comPos = CudaArray::create<float4>(cu, max(numTracked, 1), "correlatorCOMPos");
+        comPosWrapped = CudaArray::create<float4>(cu, max(numTracked, 1), "correlatorCOMPosWrapped");
+        posRing = CudaArray::create<float4>(cu, ringSize, "correlatorPosRing");
+        velRing = CudaArray::create<float4>(cu, ringSize, "correlatorVelRing");
+        comVelm->upload(vector<float4>(comVelm->getSize(), make_float4(0, 0, 0, 0)));
+    }
+
+    const int corrSize = 2 * max(numGroups, 1) * numLevels * CORRELATOR_BUFFER_SIZE;
+    corrBuffer = CudaArray::create<long long>(cu, corrSize, "correlatorBuffer");
+    corrBuffer->upload(vector<long long>(corrSize, 0));
+    correlations = CudaArray::create<double>(cu, corrSize, "correlations");
+    correlations->upload(vector<double>(corrSize, 0));
+    levelCounts = vector<int>(numLevels, 0);
+    lagCounts = vector<double>(numLevels * CORRELATOR_BUFFER_SIZE, 0);
+    numSamples = 0;
+
+    map<string, string> defines;
+    defines["NUM_ATOMS"] = cu.intToString(system.getNumParticles());
+    defines["NUM_MOLECULES"] = cu.intToString(numTracked);
+    defines["NUM_GROUPS"] = cu.intToString(max(numGroups, 1));
+    defines["NUM_LEVELS"] = cu.intToString(numLevels);
+    defines["BUFFER_SIZE"] = cu.intToString(CORRELATOR_BUFFER_SIZE);
+    defines["AVERAGE_SIZE"] = cu.intToString(CORRELATOR_AVERAGE_SIZE);
+    CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::correlator, defines, "");
+    kernelInvert = cu.getKernel(module, "invertAtomIndex");
+    kernelMap = cu.getKernel(module, "mapParticles");
+    kernelCOMPos = cu.getKernel(module, "updateCOMPositions");
+    kernelAddSample = cu.getKernel(module, "addSample");
+    kernelAccumulate = cu.getKernel(module, "accumulateCorrelations");
+
+    // Only calcCOMVelocities is used from the Nose-Hoover module, with the tracked molecules in place of NH molecules
+    map<string, string> definesNH;
+    definesNH["NUM_PARTICLES_NH"] = "0";
+    definesNH["NUM_MOLECULES_NH"] = cu.intToString(numTracked);
+    definesNH["NUM_NORMAL_PARTICLES_NH"] = "0";
+    definesNH["NUM_PAIRS_NH"] = "0";
+    definesNH["NUM_TG"] = "1";
+    definesNH["TG_ATOM"] = cu.intToString(TG_ATOM);
+    definesNH["TG_COM"] = cu.intToString(TG_COM);
+    definesNH["TG_DRUDE"] = cu.intToString(TG_DRUDE);
+    CUmodule moduleNH = cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::drudeNoseHoover, definesNH, "");
+    kernelCOMVel = cu.getKernel(moduleNH, "calcCOMVelocities");
+
+    cout << "CUDA modules for MultiTauCorrelator are created\n"
+         << "    Num groups: " << numGroups << ", Num molecules tracked: " << numTracked << " / " << numMolecules << "\n"
+         << "    Num levels: " << numLevels << ", Sampling interval: " << integrator.getCorrelatorInterval() << " steps\n" << flush;
+}
+
+void CudaCalcMultiTauCorrelationKernel::addSample(ContextImpl& context, const VVIntegrator& integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "MultiTauCorrelator add sample\n" << flush;
+
+    if (numTracked == 0)
+        return;
+
+    cu.setAsCurrent();
+    void *argsInvert[] = {&cu.getAtomIndexArray().getDevicePointer(),
+                          &atomLocation->getDevicePointer()};
+    cu.executeKernel(kernelInvert, argsInvert, cu.getNumAtoms());
+
+    void *argsMap[] = {&atomLocation->getDevicePointer(),
+                       &particlesSortedByMolId->getDevicePointer(),
+                       &particlesSortedLocal->getDevicePointer()};
+    cu.executeKernel(kernelMap, argsMap, cu.getNumAtoms());
+
+    void *argsCOMVel[] = {&cu.getVelm().getDevicePointer(),
+                          &comVelm->getDevicePointer(),
+                          &particlesInMolecules->getDevicePointer(),
+                          &particlesSortedLocal->getDevicePointer(),
+                          &trackedMolecules->getDevicePointer()};
+    cu.executeKernel(kernelCOMVel, argsCOMVel, numTracked);
+
+    int firstSample = numSamples == 0;
+    void *argsCOMPos[] = {&cu.getPosq().getDevicePointer(),
+                          &cu.getVelm().getDevicePointer(),
+                          &particlesInMolecules->getDevicePointer(),
+                          &particlesSortedLocal->getDevicePointer(),
+                          &trackedMolecules->getDevicePointer(),
+                          &comPos->getDevicePointer(),
+                          &comPosWrapped->getDevicePointer(),
+                          &firstSample,
+                          cu.getPeriodicBoxSizePointer(),
+                          cu.getInvPeriodicBoxSizePointer()};
+    cu.executeKernel(kernelCOMPos, argsCOMPos, numTracked);
+
+    /**
+     * Every level receives a value when the previous level has received AVERAGE_SIZE values since last time.
+     * On average less than two levels are updated for each sample
+     */
+    int prevHead = 0;
+    for (int level = 0; level < numLevels; level++) {
+        int head = levelCounts[level] % CORRELATOR_BUFFER_SIZE;
+        int numLags = min(levelCounts[level] + 1, CORRELATOR_BUFFER_SIZE);
+        void *argsAdd[] = {&posRing->getDevicePointer(),
+                           &velRing->getDevicePointer(),
+                           &comPos->getDevicePointer(),
+                           &comVelm->getDevicePointer(),
+                           &trackedMolecules->getDevicePointer(),
+                           &trackedGroups->getDevicePointer(),
+                           &corrBuffer->getDevicePointer(),
+                           &level,
+                           &head,
+                           &prevHead,
+                           &numLags};
+        cu.executeKernel(kernelAddSample, argsAdd, numTracked);
+        levelCounts[level]++;
+        for (int lag = 0; lag < numLags; lag++)
+            lagCounts[level * CORRELATOR_BUFFER_SIZE + lag]++;
+        if (levelCounts[level] % CORRELATOR_AVERAGE_SIZE != 0)
+            break;
+        prevHead = head;
+    }
+
+    void *argsAccumulate[] = {&corrBuffer->getDevicePointer(),
+                              &correlations->getDevicePointer()};
+    cu.executeKernel(kernelAccumulate, argsAccumulate, correlations->getSize());
+    numSamples++;
+}
+
+void CudaCalcMultiTauCorrelationKernel::getCorrelations(ContextImpl& context, const VVIntegrator& integrator, int group,
+                                                        vector<double>& lagTimes, vector<double>& msd, vector<double>& vacf) {
+    cu.setAsCurrent();
+    vector<double> correlationsVec;
+    correlations->download(correlationsVec);
+
+    /**
+     * Level 0 covers lags from 0 to BUFFER_SIZE-1.
+     * The other levels start from BUFFER_SIZE/AVERAGE_SIZE, because the shorter lags are covered by previous level
+     */
+    const int numGroups = correlations->getSize() / (2 * numLevels * CORRELATOR_BUFFER_SIZE);
+    const double dt = integrator.getCorrelatorInterval() * integrator.getStepSize();
+    const int nMol = numMoleculesInGroup[group];
+    lagTimes.clear();
+    msd.clear();
+    vacf.clear();
+    if (nMol == 0)
+        return;
+    double spacing = 1;
+    for (int level = 0; level < numLevels; level++) {
+        for (int lag = level == 0 ? 0 : CORRELATOR_BUFFER_SIZE / CORRELATOR_AVERAGE_SIZE; lag < CORRELATOR_BUFFER_SIZE; lag++) {
+            double count = lagCounts[level * CORRELATOR_BUFFER_SIZE + lag];
+            if (count == 0)
+                break;
+            lagTimes.push_back(lag * spacing * dt);
+            msd.push_back(correlationsVec[((0 * numGroups + group) * numLevels + level) * CORRELATOR_BUFFER_SIZE + lag] / count / nMol);
+            vacf.push_back(correlationsVec[((1 * numGroups + group) * numLevels + level) * CORRELATOR_BUFFER_SIZE + lag] / count / nMol);
+        }
+        spacing *= CORRELATOR_AVERAGE_SIZE;
+    }
+}
+
+void CudaCalcMultiTauCorrelationKernel::resetCorrelations(ContextImpl& context, const VVIntegrator& integrator) {
+    cu.setAsCurrent();
+    correlations->upload(vector<double>(correlations->getSize(), 0));
+    lagCounts.assign(lagCounts.size(), 0);
+}
+
+void CudaCalcMultiTauCorrelationKernel::createCheckpoint(ContextImpl& context, std::ostream& stream) const {
+    cu.setAsCurrent();
+    writeArrayToCheckpoint(*comPos, stream);
+    writeArrayToCheckpoint(*comPosWrapped, stream);
+    writeArrayToCheckpoint(*posRing, stream);
+    writeArrayToCheckpoint(*velRing, stream);
+    writeArrayToCheckpoint(*correlations, stream);
+    writeVectorToCheckpoint(vector<double>(levelCounts.begin(), levelCounts.end()), stream);
+    writeVectorToCheckpoint(lagCounts, stream);
+    stream.write((char*) &numSamples, sizeof(int));
+}
+
+void CudaCalcMultiTauCorrelationKernel::loadCheckpoint(ContextImpl& context, std::istream& stream) {
+    cu.setAsCurrent();
+    readArrayFromCheckpoint(*comPos, stream);
+    readArrayFromCheckpoint(*comPosWrapped, stream);
+    readArrayFromCheckpoint(*posRing, stream);
+    readArrayFromCheckpoint(*velRing, stream);
+    readArrayFromCheckpoint(*correlations, stream);
+    vector<double> levelCountsVec(levelCounts.size());
+    readVectorFromCheckpoint(levelCountsVec, "levelCounts of the multi-tau correlator", stream);
+    levelCounts = vector<int>(levelCountsVec.begin(), levelCountsVec.end());
+    readVectorFromCheckpoint(lagCounts, "lagCounts of the multi-tau correlator", stream);
+    stream.read((char*) &numSamples, sizeof(int));
+}
+
+static const int CONDUCTIVITY_BLOCK_SIZE = 128;
+
+CudaCalcConductivityKernel::~CudaCalcConductivityKernel() {
+    delete chargeMask;
+    delete blockCurrent;
+    delete state;
+    delete ringM;
+    delete ringJ;
+    delete levelCounts;
+    delete correlations;
+    delete lagCounts;
+}
+
+void CudaCalcConductivityKernel::initialize(const System &system, const VVIntegrator &integrator) {
+    if (integrator.getDebugEnabled())
+        cout << "Initializing ConductivityCalculator...\n" << flush;
+
+    cu.setAsCurrent();
+    numLevels = integrator.getCorrelatorNumLevels();
+    if (numLevels < 1)
+        throw OpenMMException("Multi-tau correlator requires at least one level");
+
+    // Image particles are not real charges, so they are excluded from the current
+    const int numParticles = system.getNumParticles();
+    vector<int> chargeMaskVec(numParticles, 1);
+    for (int i = 0; i < numParticles; i++)
+        if (integrator.isParticleImage(i))
+            chargeMaskVec[i] = 0;
+    chargeMask = CudaArray::create<int>(cu, numParticles, "conductivityChargeMask");
+    chargeMask->upload(chargeMaskVec);
+
+    numBlocks = min((numParticles + CONDUCTIVITY_BLOCK_SIZE - 1) / CONDUCTIVITY_BLOCK_SIZE, cu.getNumThreadBlocks());
+    blockCurrent = CudaArray::create<double>(cu, 3 * numBlocks, "conductivityBlockCurrent");
+    state = CudaArray::create<double>(cu, 7, "conductivityState");
+    state->upload(vector<double>(7, 0));
+    const int ringSize = numLevels * CORRELATOR_BUFFER_SIZE * 3;
+    ringM = CudaArray::create<double>(cu, ringSize, "conductivityRingM");
+    ringJ = CudaArray::create<double>(cu, ringSize, "conductivityRingJ");
+    levelCounts = CudaArray::create<int>(cu, numLevels, "conductivityLevelCounts");
+    levelCounts->upload(vector<int>(numLevels, 0));
+    correlations = CudaArray::create<double>(cu, 2 * numLevels * CORRELATOR_BUFFER_SIZE, "conductivityCorrelations");
+    correlations->upload(vector<double>(correlations->getSize(), 0));
+    lagCounts = CudaArray::create<double>(cu, numLevels * CORRELATOR_BUFFER_SIZE, "conductivityLagCounts");
+    lagCounts->upload(vector<double>(lagCounts->getSize(), 0));
+
+    map<string, string> defines;
+    defines["NUM_ATOMS"] = cu.intToString(numParticles);
+    defines["NUM_LEVELS"] = cu.intToString(numLevels);
+    defines["BUFFER_SIZE"] = cu.intToString(CORRELATOR_BUFFER_SIZE);
+    defines["AVERAGE_SIZE"] = cu.intToString(CORRELATOR_AVERAGE_SIZE);
+    defines["THREAD_BLOCK_SIZE"] = cu.intToString(CONDUCTIVITY_BLOCK_SIZE);
+    CUmodule module = cu.createModule(CudaVVKernelSources::vectorOps + CudaVVKernelSources::conductivity, defines, "");
+    kernelCurrent = cu.getKernel(module, "calcChargeCurrent");
+    kernelUpdate = cu.getKernel(module, "updateConductivity");
+
+    cout << "CUDA modules for ConductivityCalculator are created\n"
+         << "    Num levels: " << numLevels << ", Sampling interval: " << integrator.getConductivityInterval() << " steps\n" << flush;
+}
+
+void CudaCalcConductivityKernel::accumulateCurrent(ContextImpl& context, const VVIntegrator& integrator, bool sample) {
+    if (integrator.getDebugEnabled())
+        cout << "ConductivityCalculator accumulate current\n" << flush;
+
+    cu.setAsCurrent();
+    void *args1[] = {&cu.getPosq().getDevicePointer(),
+                     &cu.getVelm().getDevicePointer(),
+                     &cu.getAtomIndexArray().getDevicePointer(),
+                     &chargeMask->getDevicePointer(),
+                     &blockCurrent->getDevicePointer()};
+    cu.executeKernel(kernelCurrent, args1, numBlocks * CONDUCTIVITY_BLOCK_SIZE, CONDUCTIVITY_BLOCK_SIZE);
+
+    double dt = integrator.getStepSize();
+    int sampleFlag = sample;
+    void *args2[] = {&blockCurrent->getDevicePointer(),
+                     &numBlocks,
+                     &state->getDevicePointer(),
+                     &ringM->getDevicePointer(),
+                     &ringJ->getDevicePointer(),
+                     &levelCounts->getDevicePointer(),
+                     &correlations->getDevicePointer(),
+                     &lagCounts->getDevicePointer(),
+                     &dt,
+                     &sampleFlag};
+    cu.executeKernel(kernelUpdate, args2, CONDUCTIVITY_BLOCK_SIZE, CONDUCTIVITY_BLOCK_SIZE);
+}
+
+void CudaCalcConductivityKernel::getCorrelations(ContextImpl& context, const VVIntegrator& integrator,
+                                                 vector<double>& lagTimes, vector<double>& cacf, vector<double>& msd) {
+    cu.setAsCurrent();
+    vector<double> correlationsVec, lagCountsVec, stateVec;
+    correlations->download(correlationsVec);
+    lagCounts->download(lagCountsVec);
+    state->download(stateVec);
+
+    // The drift of the translational dipole caused by the mean current is subtracted
+    double meanJ2 = 0;
+    if (stateVec[6] > 0)
+        for (int c = 0; c < 3; c++)
+            meanJ2 += (stateVec[3 + c] / stateVec[6]) * (stateVec[3 + c] / stateVec[6]);
+
+    const double dt = integrator.getConductivityInterval() * integrator.getStepSize();
+    lagTimes.clear();
+    cacf.clear();
+    msd.clear();
+    double spacing = 1;
+    for (int level = 0; level < numLevels; level++) {
+        for (int lag = level == 0 ? 0 : CORRELATOR_BUFFER_SIZE / CORRELATOR_AVERAGE_SIZE; lag < CORRELATOR_BUFFER_SIZE; lag++) {
+            double count = lagCountsVec[level * CORRELATOR_BUFFER_SIZE + lag];
+            if (count == 0)
+                break;
+            double t = lag * spacing * dt;
+            lagTimes.push_back(t);
+            msd.push_back(correlationsVec[(0 * numLevels + level) * CORRELATOR_BUFFER_SIZE + lag] / count - meanJ2 * t * t);
+            cacf.push_back(correlationsVec[(1 * numLevels + level) * CORRELATOR_BUFFER_SIZE + lag] / count - meanJ2);
+        }
+        spacing *= CORRELATOR_AVERAGE_SIZE;
+    }
+}
+
+void CudaCalcConductivityKernel::calcConductivity(ContextImpl& context, const VVIntegrator& integrator, double fitTime, vector<double>& stats) {
+    if (integrator.getDebugEnabled())
+        cout << "ConductivityCalculator calculate conductivity\n" << flush;
+
+    vector<double> lagTimes, cacf, msd;
+    getCorrelations(context, integrator, lagTimes, cacf, msd);
+    vector<double> stateVec, lagCountsVec;
+    state->download(stateVec);
+    lagCounts->download(lagCountsVec);
+
+    // With image charges, the electrolyte only occupies half of the box
+    double4 box = cu.getPeriodicBoxSize();
+    double volume = box.x * box.y * box.z;
+    if (!integrator.getImagePairs().empty())
+        volume /= 2;
+    const double kT = BOLTZ * integrator.getTemperature();
+
+    // Green-Kubo integral with trapezoidal rule, and Einstein-Helfand slope fitted in the second half of fitTime
+    double integral = 0;
+    vector<double> tFit, msdFit;
+    for (int i = 0; i < (int) lagTimes.size() && lagTimes[i] <= fitTime; i++) {
+        if (i > 0)
+            integral += (cacf[i] + cacf[i - 1]) * (lagTimes[i] - lagTimes[i - 1]) / 2;
+        if (lagTimes[i] >= fitTime / 2) {
+            tFit.push_back(lagTimes[i]);
+            msdFit.push_back(msd[i]);
+        }
+    }
+    double sigmaGK = integral / (3 * volume * kT);
+    double sigmaEH = tFit.size() > 1 ? fitSlope(tFit, msdFit) / (6 * volume * kT) : 0;
+
+    double meanJz = stateVec[6] > 0 ? stateVec[5] / stateVec[6] : 0;
+    // The field is in kJ/nm.e per particle, which is converted to kJ/mol.nm.e as kT
+    double field = integrator.getElectricField() * AVOGADRO;
+    double sigmaNE = field != 0 ? meanJz / (volume * field) : 0;
+    stats = {sigmaGK, sigmaEH, sigmaNE, meanJz, lagCountsVec[0]};
+}
+
+void CudaCalcConductivityKernel::resetConductivity(ContextImpl& context, const VVIntegrator& integrator) {
+    cu.setAsCurrent();
+    vector<double> stateVec;
+    state->download(stateVec);
+    for (int i = 3; i < 7; i++)
+        stateVec[i] = 0;
+    state->upload(stateVec);
+    correlations->upload(vector<double>(correlations->getSize(), 0));
+    lagCounts->upload(vector<double>(lagCounts->getSize(), 0));
+}
+
+void CudaCalcConductivityKernel::createCheckpoint(ContextImpl& context, std::ostream& stream) const {
+    cu.setAsCurrent();
+    writeArrayToCheckpoint(*state, stream);
+    writeArrayToCheckpoint(*ringM, stream);
+    writeArrayToCheckpoint(*ringJ, stream);
+    writeArrayToCheckpoint(*levelCounts, stream);
+    writeArrayToCheckpoint(*correlations, stream);
+    writeArrayToCheckpoint(*lagCounts, stream);
+}
+
+void CudaCalcConductivityKernel::loadCheckpoint(ContextImpl& context, std::istream& stream) {
+    cu.setAsCurrent();
+    readArrayFromCheckpoint(*state, stream);
+    readArrayFromCheckpoint(*ringM, stream);
+    readArrayFromCheckpoint(*ringJ, stream);
+    readArrayFromCheckpoint(*levelCounts, stream);
+    readArrayFromCheckpoint(*correlations, stream);
+    readArrayFromCheckpoint(*lagCounts, stream);
+}
+
+/**
+ * The number of pairs of events of a phase waiting to be queried, above which the oldest pair is waited for
+ */
+static const int MAX_PENDING_TIMING_EVENTS = 256;
+
+CudaCalcTimingKernel::~CudaCalcTimingKernel() {
+    cu.setAsCurrent();
+    for (auto& pending : pendingEvents) {
+        for (auto& pair : pending) {
+            freeEvents.push_back(pair.first);
+            freeEvents.push_back(pair.second);
+        }
+    }
+    for (CUevent event : beginEvents)
+        if (event != NULL)
+            freeEvents.push_back(event);
+    for (CUevent event : freeEvents)
+        cuEventDestroy(event);
+}
+
+void CudaCalcTimingKernel::initialize(const System& system, const VVIntegrator& integrator, Kernel& vvKernel) {
+    if (integrator.getDebugEnabled())
+        cout << "Initializing CudaCalcTimingKernel...\n" << flush;
+
+    beginEvents = vector<CUevent>(VVIntegrator::NumTimingPhases, NULL);
+    pendingEvents.resize(VVIntegrator::NumTimingPhases);
+    counts = vector<double>(VVIntegrator::NumTimingPhases, 0);
+    seconds = vector<double>(VVIntegrator::NumTimingPhases, 0);
+
+    if (integrator.getUseSINR())
+        vvKernel.getAs<CudaIntegrateSINRStepKernel>().setTimer(this);
+    else if (integrator.getUseMiddleScheme())
+        vvKernel.getAs<CudaIntegrateMiddleStepKernel>().setTimer(this);
+    else
+        vvKernel.getAs<CudaIntegrateVVStepKernel>().setTimer(this);
+}
+
+CUevent CudaCalcTimingKernel::createEvent() {
+    if (!freeEvents.empty()) {
+        CUevent event = freeEvents.back();
+        freeEvents.pop_back();
+        return event;
+    }
+    CUevent event;
+    if (cuEventCreate(&event, CU_EVENT_DEFAULT) != CUDA_SUCCESS)
+        throw OpenMMException("Error creating event for timing");
+    return event;
+}
+
+void CudaCalcTimingKernel::recordBegin(int phase) {
+    cu.setAsCurrent();
+    if (beginEvents[phase] == NULL)
+        beginEvents[phase] = createEvent();
+    cuEventRecord(beginEvents[phase], cu.getCurrentStream());
+}
+
+void CudaCalcTimingKernel::recordEnd(int phase) {
+    if (beginEvents[phase] == NULL)
+        return;
+    cu.setAsCurrent();
+    CUevent end = createEvent();
+    cuEventRecord(end, cu.getCurrentStream());
+    pendingEvents[phase].push_back(make_pair(beginEvents[phase], end));
+    beginEvents[phase] = NULL;
+    counts[phase]++;
+    collect(phase, false);
+}
+
+void CudaCalcTimingKernel::collect(int phase, bool wait) {
+    auto& pending = pendingEvents[phase];
+    while (!pending.empty()) {
+        CUevent begin = pending.front().first, end = pending.front().second;
+        if (wait || pending.size() > MAX_PENDING_TIMING_EVENTS) {
+            if (cuEventSynchronize(end) != CUDA_SUCCESS)
+                throw OpenMMException("Error waiting for timing event");
+        }
+        else if (cuEventQuery(end) != CUDA_SUCCESS)
+            break;
+        float ms;
+        if (cuEventElapsedTime(&ms, begin, end) != CUDA_SUCCESS)
+            throw OpenMMException("Error querying elapsed time of timing events");
+        seconds[phase] += ms * 1e-3;
+        freeEvents.push_back(begin);
+        freeEvents.push_back(end);
+        pending.pop_front();
+    }
+}
+
+void CudaCalcTimingKernel::getTimings(ContextImpl& context, vector<double>& timings) {
+    cu.setAsCurrent();
+    timings.resize(2 * VVIntegrator::NumTimingPhases);
+    for (int phase = 0; phase < VVIntegrator::NumTimingPhases; phase++) {
+        collect(phase, true);
+        timings[2 * phase] = counts[phase];
+        timings[2 * phase + 1] = seconds[phase];
+    }
+}
+
+void CudaCalcTimingKernel::resetTimings(ContextImpl& context) {
+    cu.setAsCurrent();
+    for (int phase = 0; phase < VVIntegrator::NumTimingPhases; phase++) {
+        // the pending events belong to the period being discarded
+        collect(phase, true);
+        counts[phase] = 0;
+        seconds[phase] = 0;
+    }
 }
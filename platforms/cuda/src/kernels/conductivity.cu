@@ -0,0 +1,147 @@
+/**
+ * Charge current and multi-tau correlator for ionic conductivity
+ *
+ * The charge current J = sum(q_i * v_i) is calculated every step, and integrated into the translational dipole M.
+ * At the sampling interval, J and M are added to a multi-tau correlator, which has the same structure as the one
+ * for molecular COM motion, but only for a single vector. So it runs in one thread block in double precision.
+ * The rings are stored as ring[((level*BUFFER_SIZE+slot)*3+component],
+ * and the correlations as correlations[(quantity*NUM_LEVELS+level)*BUFFER_SIZE+lag],
+ * where quantity is 0 for the MSD of M and 1 for the autocorrelation of J.
+ * state stores M (0-2), the sum of J over steps (3-5) and the number of steps (6).
+ */
+
+/**
+ * Sum the charge current of each thread block. Particles with chargeMask equal to 0 (image particles) are excluded.
+ */
+extern "C" __global__ void calcChargeCurrent(const real4 *__restrict__ posq,
+                                             const mixed4 *__restrict__ velm,
+                                             const int *__restrict__ atomIndex,
+                                             const int *__restrict__ chargeMask,
+                                             double *__restrict__ blockCurrent) {
+    __shared__ double3 current[THREAD_BLOCK_SIZE];
+    const unsigned int tid = threadIdx.x;
+    current[tid] = make_double3(0, 0, 0);
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < NUM_ATOMS; i += blockDim.x * gridDim.x) {
+        if (chargeMask[atomIndex[i]] == 0)
+            continue;
+        mixed4 velocity = velm[i];
+        double charge = posq[i].w;
+        current[tid].x += charge * velocity.x;
+        current[tid].y += charge * velocity.y;
+        current[tid].z += charge * velocity.z;
+    }
+    __syncthreads();
+    for (unsigned int k = blockDim.x / 2; k > 0; k >>= 1) {
+        if (tid < k) {
+            current[tid].x += current[tid + k].x;
+            current[tid].y += current[tid + k].y;
+            current[tid].z += current[tid + k].z;
+        }
+        __syncthreads();
+    }
+    if (tid == 0) {
+        blockCurrent[3 * blockIdx.x] = current[0].x;
+        blockCurrent[3 * blockIdx.x + 1] = current[0].y;
+        blockCurrent[3 * blockIdx.x + 2] = current[0].z;
+    }
+}
+
+/**
+ * Sum the charge current of all thread blocks, integrate the translational dipole,
+ * and add them to the correlator if sample is not zero.
+ * The numThreads of this kernel equals to threadBlockSize.
+ * So there is only one threadBlock for this kernel
+ */
+extern "C" __global__ void updateConductivity(const double *__restrict__ blockCurrent,
+                                              int numBlocks,
+                                              double *__restrict__ state,
+                                              double *__restrict__ ringM,
+                                              double *__restrict__ ringJ,
+                                              int *__restrict__ levelCounts,
+                                              double *__restrict__ correlations,
+                                              double *__restrict__ lagCounts,
+                                              double dt,
+                                              int sample) {
+    __shared__ double3 current[THREAD_BLOCK_SIZE];
+    __shared__ int head, numLags, proceed;
+    const unsigned int tid = threadIdx.x;
+    current[tid] = make_double3(0, 0, 0);
+    for (int i = tid; i < numBlocks; i += blockDim.x) {
+        current[tid].x += blockCurrent[3 * i];
+        current[tid].y += blockCurrent[3 * i + 1];
+        current[tid].z += blockCurrent[3 * i + 2];
+    }
+    __syncthreads();
+    for (unsigned int k = blockDim.x / 2; k > 0; k >>= 1) {
+        if (tid < k) {
+            current[tid].x += current[tid + k].x;
+            current[tid].y += current[tid + k].y;
+            current[tid].z += current[tid + k].z;
+        }
+        __syncthreads();
+    }
+    if (tid == 0) {
+        double3 J = current[0];
+        state[0] += J.x * dt;
+        state[1] += J.y * dt;
+        state[2] += J.z * dt;
+        state[3] += J.x;
+        state[4] += J.y;
+        state[5] += J.z;
+        state[6] += 1;
+        head = 0;
+    }
+    if (!sample)
+        return;
+
+    for (int level = 0; level < NUM_LEVELS; level++) {
+        if (tid == 0) {
+            const int prevHead = head;
+            const int count = levelCounts[level];
+            head = count % BUFFER_SIZE;
+            numLags = min(count + 1, BUFFER_SIZE);
+            double *m = &ringM[(level * BUFFER_SIZE + head) * 3];
+            double *j = &ringJ[(level * BUFFER_SIZE + head) * 3];
+            if (level == 0) {
+                for (int c = 0; c < 3; c++) {
+                    m[c] = state[c];
+                    j[c] = (c == 0 ? current[0].x : c == 1 ? current[0].y : current[0].z);
+                }
+            }
+            else {
+                // M is decimated and J is averaged, as in the correlator for COM motion
+                const int prevOffset = (level - 1) * BUFFER_SIZE;
+                for (int c = 0; c < 3; c++) {
+                    m[c] = ringM[(prevOffset + prevHead) * 3 + c];
+                    j[c] = 0;
+                    for (int k = 0; k < AVERAGE_SIZE; k++)
+                        j[c] += ringJ[(prevOffset + (prevHead - k + BUFFER_SIZE) % BUFFER_SIZE) * 3 + c];
+                    j[c] /= AVERAGE_SIZE;
+                }
+            }
+            levelCounts[level] = count + 1;
+            proceed = (count + 1) % AVERAGE_SIZE == 0;
+        }
+        __syncthreads();
+
+        // Each thread keeps its own copy, because thread 0 rewrites the shared flag for the next level
+        // as soon as it passes the barrier below, while the other threads may not have read it yet
+        const bool proceedToNextLevel = proceed;
+        const int offset = level * BUFFER_SIZE;
+        for (int lag = tid; lag < numLags; lag += blockDim.x) {
+            const int slot = offset + (head - lag + BUFFER_SIZE) % BUFFER_SIZE;
+            double msd = 0, cacf = 0;
+            for (int c = 0; c < 3; c++) {
+                double dm = ringM[(offset + head) * 3 + c] - ringM[slot * 3 + c];
+                msd += dm * dm;
+                cacf += ringJ[(offset + head) * 3 + c] * ringJ[slot * 3 + c];
+            }
+            correlations[(0 * NUM_LEVELS + level) * BUFFER_SIZE + lag] += msd;
+            correlations[(1 * NUM_LEVELS + level) * BUFFER_SIZE + lag] += cacf;
+            lagCounts[level * BUFFER_SIZE + lag] += 1;
+        }
+        __syncthreads();
+        if (!proceedToNextLevel)
+            break;
+    }
+}
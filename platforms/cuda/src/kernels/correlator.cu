@@ -0,0 +1,171 @@
+/**
+ * Multi-tau correlator for the mean squared displacement and velocity autocorrelation of molecular COM
+ *
+ * Each level keeps the last BUFFER_SIZE values of each molecule in a ring buffer.
+ * Every AVERAGE_SIZE values received by a level, one value is passed to the next level,
+ * so the lag time covered by level l is AVERAGE_SIZE^l times that of level 0.
+ * The velocity passed to the next level is averaged over these values,
+ * while the position is decimated so that the displacements are exact.
+ * The rings are stored as ring[(level*BUFFER_SIZE+slot)*NUM_MOLECULES+i], where i is the index in trackedMolecules.
+ * The correlations of one sample are accumulated in fixed point as
+ * corrBuffer[((quantity*NUM_GROUPS+group)*NUM_LEVELS+level)*BUFFER_SIZE+lag], where quantity is 0 for MSD and 1 for VACF.
+ */
+
+/**
+ * The positions and velocities may be reordered by the context.
+ * Map the particles sorted by molecule id to the current location in posq and velm,
+ * so that each molecule is always followed by the same entry of the rings.
+ */
+extern "C" __global__ void invertAtomIndex(const int *__restrict__ atomIndex,
+                                           int *__restrict__ atomLocation) {
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < NUM_ATOMS; i += blockDim.x * gridDim.x)
+        atomLocation[atomIndex[i]] = i;
+}
+
+extern "C" __global__ void mapParticles(const int *__restrict__ atomLocation,
+                                        const int *__restrict__ particlesSortedByMolId,
+                                        int *__restrict__ particlesSortedLocal) {
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < NUM_ATOMS; i += blockDim.x * gridDim.x)
+        particlesSortedLocal[i] = atomLocation[particlesSortedByMolId[i]];
+}
+
+/**
+ * Calculate the COM position of each tracked molecule and unwrap it from the position of last sample.
+ * The atoms are made whole around the first atom of the molecule with minimum image convention,
+ * so the molecules should be smaller than half of the box, and move less than half of the box between samples.
+ */
+extern "C" __global__ void updateCOMPositions(const real4 *__restrict__ posq,
+                                              const mixed4 *__restrict__ velm,
+                                              const int2 *__restrict__ particlesInMolecules,
+                                              const int *__restrict__ particlesSortedLocal,
+                                              const int *__restrict__ trackedMolecules,
+                                              mixed4 *__restrict__ comPos,
+                                              mixed4 *__restrict__ comPosWrapped,
+                                              int firstSample,
+                                              real4 periodicBoxSize,
+                                              real4 invPeriodicBoxSize) {
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < NUM_MOLECULES; i += blockDim.x * gridDim.x) {
+        int2 range = particlesInMolecules[trackedMolecules[i]];
+        real4 pos0 = posq[particlesSortedLocal[range.y]];
+        mixed3 com = make_mixed3(0, 0, 0);
+        mixed comMass = 0;
+        for (int j = 0; j < range.x; j++) {
+            int index = particlesSortedLocal[range.y + j];
+            mixed4 velocity = velm[index];
+            if (velocity.w == 0)
+                continue;
+            real4 pos = posq[index];
+            real3 delta = make_real3(pos.x - pos0.x, pos.y - pos0.y, pos.z - pos0.z);
+            delta.x -= floor(delta.x * invPeriodicBoxSize.x + 0.5f) * periodicBoxSize.x;
+            delta.y -= floor(delta.y * invPeriodicBoxSize.y + 0.5f) * periodicBoxSize.y;
+            delta.z -= floor(delta.z * invPeriodicBoxSize.z + 0.5f) * periodicBoxSize.z;
+            mixed mass = RECIP(velocity.w);
+            com.x += delta.x * mass;
+            com.y += delta.y * mass;
+            com.z += delta.z * mass;
+            comMass += mass;
+        }
+        if (comMass != 0)
+            com *= RECIP(comMass);
+        com.x += pos0.x;
+        com.y += pos0.y;
+        com.z += pos0.z;
+
+        if (firstSample) {
+            comPos[i] = make_mixed4(com.x, com.y, com.z, 0);
+        }
+        else {
+            mixed4 prev = comPosWrapped[i];
+            mixed3 delta = make_mixed3(com.x - prev.x, com.y - prev.y, com.z - prev.z);
+            delta.x -= floor(delta.x * invPeriodicBoxSize.x + 0.5f) * periodicBoxSize.x;
+            delta.y -= floor(delta.y * invPeriodicBoxSize.y + 0.5f) * periodicBoxSize.y;
+            delta.z -= floor(delta.z * invPeriodicBoxSize.z + 0.5f) * periodicBoxSize.z;
+            comPos[i].x += delta.x;
+            comPos[i].y += delta.y;
+            comPos[i].z += delta.z;
+        }
+        comPosWrapped[i] = make_mixed4(com.x, com.y, com.z, 0);
+    }
+}
+
+/**
+ * Add one value of each molecule to a level and correlate it with the values already in the ring.
+ * For level 0 the value is the current COM position and velocity,
+ * otherwise it is obtained from the last AVERAGE_SIZE values of the previous level.
+ *
+ * @param head       the slot of the ring which the new value is written to
+ * @param prevHead   the slot of the latest value in the ring of previous level
+ * @param numLags    the number of values in the ring after adding the new one, at most BUFFER_SIZE
+ */
+extern "C" __global__ void addSample(mixed4 *__restrict__ posRing,
+                                     mixed4 *__restrict__ velRing,
+                                     const mixed4 *__restrict__ comPos,
+                                     const mixed4 *__restrict__ comVelm,
+                                     const int *__restrict__ trackedMolecules,
+                                     const int *__restrict__ trackedGroups,
+                                     unsigned long long *__restrict__ corrBuffer,
+                                     int level,
+                                     int head,
+                                     int prevHead,
+                                     int numLags) {
+    __shared__ unsigned long long sums[2 * NUM_GROUPS * BUFFER_SIZE];
+    for (int k = threadIdx.x; k < 2 * NUM_GROUPS * BUFFER_SIZE; k += blockDim.x)
+        sums[k] = 0;
+    __syncthreads();
+
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < NUM_MOLECULES; i += blockDim.x * gridDim.x) {
+        mixed4 pos, vel;
+        if (level == 0) {
+            pos = comPos[i];
+            vel = comVelm[trackedMolecules[i]];
+        }
+        else {
+            const int prevOffset = (level - 1) * BUFFER_SIZE;
+            pos = posRing[(prevOffset + prevHead) * NUM_MOLECULES + i];
+            vel = make_mixed4(0, 0, 0, 0);
+            for (int k = 0; k < AVERAGE_SIZE; k++) {
+                mixed4 v = velRing[(prevOffset + (prevHead - k + BUFFER_SIZE) % BUFFER_SIZE) * NUM_MOLECULES + i];
+                vel.x += v.x;
+                vel.y += v.y;
+                vel.z += v.z;
+            }
+            vel.x /= AVERAGE_SIZE;
+            vel.y /= AVERAGE_SIZE;
+            vel.z /= AVERAGE_SIZE;
+        }
+        const int offset = level * BUFFER_SIZE;
+        posRing[(offset + head) * NUM_MOLECULES + i] = pos;
+        velRing[(offset + head) * NUM_MOLECULES + i] = vel;
+
+        const int group = trackedGroups[i];
+        for (int lag = 0; lag < numLags; lag++) {
+            const int slot = (offset + (head - lag + BUFFER_SIZE) % BUFFER_SIZE) * NUM_MOLECULES + i;
+            mixed4 pos0 = posRing[slot];
+            mixed4 vel0 = velRing[slot];
+            mixed dx = pos.x - pos0.x;
+            mixed dy = pos.y - pos0.y;
+            mixed dz = pos.z - pos0.z;
+            mixed msd = dx * dx + dy * dy + dz * dz;
+            mixed vacf = vel.x * vel0.x + vel.y * vel0.y + vel.z * vel0.z;
+            atomicAdd(&sums[(0 * NUM_GROUPS + group) * BUFFER_SIZE + lag], static_cast<unsigned long long>((long long) (msd * 0x100000000)));
+            atomicAdd(&sums[(1 * NUM_GROUPS + group) * BUFFER_SIZE + lag], static_cast<unsigned long long>((long long) (vacf * 0x100000000)));
+        }
+    }
+
+    __syncthreads();
+    for (int k = threadIdx.x; k < 2 * NUM_GROUPS * BUFFER_SIZE; k += blockDim.x) {
+        if (sums[k] != 0) {
+            const int lag = k % BUFFER_SIZE;
+            const int quantityGroup = k / BUFFER_SIZE;
+            atomicAdd(&corrBuffer[(quantityGroup * NUM_LEVELS + level) * BUFFER_SIZE + lag], sums[k]);
+        }
+    }
+}
+
+extern "C" __global__ void accumulateCorrelations(unsigned long long *__restrict__ corrBuffer,
+                                                  double *__restrict__ correlations) {
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < 2 * NUM_GROUPS * NUM_LEVELS * BUFFER_SIZE; i += blockDim.x * gridDim.x) {
+        correlations[i] += ((long long) corrBuffer[i]) / (double) 0x100000000;
+        corrBuffer[i] = 0;
+    }
+}
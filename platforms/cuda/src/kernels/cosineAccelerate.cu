@@ -1,85 +1,177 @@
+/**
+ * Periodic perturbation with NUM_MODES modes.
+ * For each mode, modeAxes stores the flow axis, the gradient axis and the wave number in x, y and z.
+ * The velocity amplitude of each mode is reduced in two passes.
+ * Each thread block writes its partial sums to blockSums[m*gridDim.x+blockIdx.x],
+ * and a single block adds them up into vAmplitudes[m].
+ */
+
+template <class T>
+inline __device__ auto getComponent(const T& v, int axis) -> decltype(v.x) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+template <class T, class S>
+inline __device__ void addToComponent(T& v, int axis, S value) {
+    if (axis == 0)
+        v.x += value;
+    else if (axis == 1)
+        v.y += value;
+    else
+        v.z += value;
+}
+
+inline __device__ mixed calcModeCos(const real4& pos, const int4& axes, const real4& invBoxSize) {
+    return cos(2 * 3.1415926 * axes.z * getComponent(pos, axes.y) * getComponent(invBoxSize, axes.y));
+}
 
 extern "C" __global__ void addCosAcceleration(const real4 *__restrict__ posq,
                                               const mixed4 *__restrict__ velm,
                                               real3 *__restrict__ forceExtra,
-                                              real acceleration,
+                                              const int4 *__restrict__ modeAxes,
+                                              const mixed *__restrict__ amplitudes,
                                               const real4 invBoxSize) {
 
     for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
-        forceExtra[index].x += acceleration * cos(2 * 3.1415926 * posq[index].z * invBoxSize.z) * RECIP(velm[index].w);
-//        if (blockIdx.x * blockDim.x + threadIdx.x == 0) {
-//            printf("forceExtraAfter=%f %f %f\n", forceExtra[0].x, forceExtra[100].x, forceExtra[200].x);
-//        }
+        if (velm[index].w == 0)
+            continue;
+        real4 pos = posq[index];
+        real3 force = forceExtra[index];
+        real mass = RECIP(velm[index].w);
+        for (int m = 0; m < NUM_MODES; m++) {
+            int4 axes = modeAxes[m];
+            addToComponent(force, axes.x, amplitudes[m] * calcModeCos(pos, axes, invBoxSize) * mass);
+        }
+        forceExtra[index] = force;
     }
 }
 
 extern "C" __global__ void calcPeriodicVelocityBias(const real4 *__restrict__ posq,
                                                     const mixed4 *__restrict__ velm,
-                                                    mixed *__restrict__ VBuffer,
+                                                    mixed *__restrict__ blockSums,
+                                                    const int4 *__restrict__ modeAxes,
                                                     const real4 invBoxSize) {
+    __shared__ mixed temp[THREAD_BLOCK_SIZE];
+    const unsigned int tid = threadIdx.x;
+    mixed sums[NUM_MODES];
+    for (int m = 0; m < NUM_MODES; m++)
+        sums[m] = 0;
 
     for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
-        if (velm[index].w == 0)
-            VBuffer[index] = 0;
-        else
-            VBuffer[index] = RECIP(velm[index].w) * velm[index].x * 2 * cos(2 * 3.1415926 * posq[index].z * invBoxSize.z);
+        mixed4 velocity = velm[index];
+        if (velocity.w == 0)
+            continue;
+        real4 pos = posq[index];
+        for (int m = 0; m < NUM_MODES; m++) {
+            int4 axes = modeAxes[m];
+            sums[m] += RECIP(velocity.w) * getComponent(velocity, axes.x) * 2 * calcModeCos(pos, axes, invBoxSize);
+        }
+    }
+
+    for (int m = 0; m < NUM_MODES; m++) {
+        temp[tid] = sums[m];
+        __syncthreads();
+        for (unsigned int k = blockDim.x / 2; k > 0; k >>= 1) {
+            if (tid < k)
+                temp[tid] += temp[tid + k];
+            __syncthreads();
+        }
+        if (tid == 0)
+            blockSums[m * gridDim.x + blockIdx.x] = temp[0];
+        __syncthreads();
     }
+}
 
-//    if (blockIdx.x * blockDim.x + threadIdx.x == 0) {
-//        printf("buf[0]=%f, mass=%f, vx=%f, z=%f, lz=%f\n",
-//                VBuffer[0], RECIP(velm[0].w), velm[0].x, posq[0].z, RECIP(invBoxSize.z));
-//    }
+/**
+ * Accumulate one sample into the levels of block averaging (Flyvbjerg and Petersen)
+ * Each level stores the count, sum and sum of squares of its samples, and the sample waiting for its pair.
+ * The average of each pair of samples at one level is a sample of the next level.
+ */
+inline __device__ void accumulateBlockStatistics(double *__restrict__ stats, double value) {
+    for (int level = 0; level < NUM_BLOCK_LEVELS; level++) {
+        double *levelStats = stats + 4 * level;
+        levelStats[0] += 1;
+        levelStats[1] += value;
+        levelStats[2] += value * value;
+        if (((long long) levelStats[0]) % 2 == 1) {
+            levelStats[3] = value;
+            return;
+        }
+        value = (levelStats[3] + value) / 2;
+    }
 }
 
-extern "C" __global__ void sumV(mixed *__restrict__ VBuffer,
+extern "C" __global__ void sumV(const mixed *__restrict__ blockSums,
+                                mixed *__restrict__ vAmplitudes,
                                 double invMassTotal,
-                                int bufferSize) {
+                                int numBlocks,
+                                double *__restrict__ stats,
+                                int sample) {
     /**
-     * Sum VBuffer
-     * The numThreads of this kernel equals to threadBlockSize.
-     * So there is only one threadBlock for this kernel
+     * Sum the partial sums of the thread blocks of each mode
+     * There is only one thread block for this kernel
      */
-    extern __shared__ mixed temp[];
-    unsigned int tid = threadIdx.x;
-
-    temp[tid] = 0;
-    for (unsigned int index = tid; index < bufferSize; index += blockDim.x) {
-        temp[tid] += VBuffer[index];
-    }
-    __syncthreads();
+    __shared__ mixed temp[THREAD_BLOCK_SIZE];
+    const unsigned int tid = threadIdx.x;
 
-    for (unsigned int k = blockDim.x / 2; k > 0; k >>= 1) {
-        if (tid < k)
-            temp[tid] += temp[tid + k];
+    for (int m = 0; m < NUM_MODES; m++) {
+        temp[tid] = 0;
+        for (int index = tid; index < numBlocks; index += blockDim.x)
+            temp[tid] += blockSums[m * numBlocks + index];
         __syncthreads();
-    }
 
-    if (tid == 0) {
-        VBuffer[0] = temp[0] * invMassTotal;
-//        printf("invMassTotal = %f; Vgpu = %f\n", invMassTotal, VBuffer[0]);
+        for (unsigned int k = blockDim.x / 2; k > 0; k >>= 1) {
+            if (tid < k)
+                temp[tid] += temp[tid + k];
+            __syncthreads();
+        }
+
+        if (tid == 0) {
+            vAmplitudes[m] = temp[0] * invMassTotal;
+            if (sample)
+                accumulateBlockStatistics(stats + 4 * NUM_BLOCK_LEVELS * m, vAmplitudes[m]);
+        }
+        __syncthreads();
     }
 }
 
 extern "C" __global__ void removePeriodicVelocityBias(const real4 *__restrict__ posq,
                                                       mixed4 *__restrict__ velm,
-                                                      const mixed *__restrict__ VBuffer,
+                                                      const mixed *__restrict__ vAmplitudes,
+                                                      const int4 *__restrict__ modeAxes,
+                                                      const mixed *__restrict__ amplitudes,
                                                       const real4 invBoxSize) {
 
-    mixed V = VBuffer[0];
-
     for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
-        velm[index].x -= V * cos(2 * 3.1415926 * posq[index].z * invBoxSize.z);
+        mixed4 velocity = velm[index];
+        real4 pos = posq[index];
+        for (int m = 0; m < NUM_MODES; m++) {
+            if (amplitudes[m] == 0)
+                continue;
+            int4 axes = modeAxes[m];
+            addToComponent(velocity, axes.x, -vAmplitudes[m] * calcModeCos(pos, axes, invBoxSize));
+        }
+        velm[index] = velocity;
     }
 }
 
 
 extern "C" __global__ void restorePeriodicVelocityBias(const real4 *__restrict__ posq,
                                                        mixed4 *__restrict__ velm,
-                                                       const mixed *__restrict__ VBuffer,
+                                                       const mixed *__restrict__ vAmplitudes,
+                                                       const int4 *__restrict__ modeAxes,
+                                                       const mixed *__restrict__ amplitudes,
                                                        const real4 invBoxSize) {
-    mixed V = VBuffer[0];
 
     for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
-        velm[index].x += V * cos(2 * 3.1415926 * posq[index].z * invBoxSize.z);
+        mixed4 velocity = velm[index];
+        real4 pos = posq[index];
+        for (int m = 0; m < NUM_MODES; m++) {
+            if (amplitudes[m] == 0)
+                continue;
+            int4 axes = modeAxes[m];
+            addToComponent(velocity, axes.x, vAmplitudes[m] * calcModeCos(pos, axes, invBoxSize));
+        }
+        velm[index] = velocity;
     }
 }
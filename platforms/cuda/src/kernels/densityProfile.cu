@@ -0,0 +1,53 @@
+/**
+ * Histograms of number, charge and induced dipole along z for each group of particles
+ *
+ * The histograms of one sample are accumulated in fixed point, as the forces are,
+ * and then added to the accumulated histograms in double precision.
+ * The histograms are stored as profileBuffer[(quantity*NUM_GROUPS+group)*NUM_BINS+bin],
+ * where quantity is 0 for number, 1 for charge and 2 for the z component of induced dipole.
+ *
+ * For each particle, particleInfo.x is the group (or -1 if it is not counted),
+ * and particleInfo.y is the index of its Drude particle, or -2 if it is a Drude particle itself, or -1 otherwise.
+ */
+
+inline __device__ int getBin(real z, real invBoxSizeZ) {
+    real scaled = z * invBoxSizeZ;
+    scaled -= floor(scaled);
+    return min((int) (scaled * NUM_BINS), NUM_BINS - 1);
+}
+
+extern "C" __global__ void binParticles(const real4 *__restrict__ posq,
+                                        const int2 *__restrict__ particleInfo,
+                                        unsigned long long *__restrict__ profileBuffer,
+                                        const real4 invBoxSize) {
+    for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
+        int2 info = particleInfo[index];
+        if (info.x < 0)
+            continue;
+        real4 pos = posq[index];
+        int bin = getBin(pos.z, invBoxSize.z);
+
+        // Drude particles contribute to charge but not to number, so that the induced charge is also included
+        if (info.y != -2)
+            atomicAdd(&profileBuffer[(0 * NUM_GROUPS + info.x) * NUM_BINS + bin], (unsigned long long) 0x100000000);
+        atomicAdd(&profileBuffer[(1 * NUM_GROUPS + info.x) * NUM_BINS + bin],
+                  static_cast<unsigned long long>((long long) (pos.w * 0x100000000)));
+
+        // The induced dipole of a Drude pair is binned at the position of the parent atom
+        if (info.y >= 0) {
+            real4 posDrude = posq[info.y];
+            real dz = posDrude.z - pos.z;
+            dz -= floor(dz * invBoxSize.z + 0.5f) / invBoxSize.z;
+            atomicAdd(&profileBuffer[(2 * NUM_GROUPS + info.x) * NUM_BINS + bin],
+                      static_cast<unsigned long long>((long long) (posDrude.w * dz * 0x100000000)));
+        }
+    }
+}
+
+extern "C" __global__ void accumulateProfiles(unsigned long long *__restrict__ profileBuffer,
+                                              double *__restrict__ profiles) {
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < 3 * NUM_GROUPS * NUM_BINS; i += blockDim.x * gridDim.x) {
+        profiles[i] += ((long long) profileBuffer[i]) / (double) 0x100000000;
+        profileBuffer[i] = 0;
+    }
+}
@@ -58,3 +58,70 @@ extern "C" __global__ void addExtraForceDrudeLangevin(const mixed4 *__restrict__
         forceExtra[particles.y] += mass2fract * cmForce + relForce;
     }
 }
+
+/**
+ * Update the velocities with the exact solution of Ornstein-Uhlenbeck process
+ * For Drude pairs, the COM motion and the relative motion are thermolized separately
+ */
+
+extern "C" __global__ void integrateDrudeLangevinVelocity(mixed4 *__restrict__ velm,
+                                                          const int *__restrict__ normalParticles,
+                                                          const int2 *__restrict__ pairParticles,
+                                                          mixed vscale,
+                                                          mixed noisescale,
+                                                          mixed vscaleDrude,
+                                                          mixed noisescaleDrude,
+                                                          const float4 *__restrict__ random,
+                                                          unsigned int randomIndex) {
+    // Update normal particles
+
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < NUM_NORMAL_PARTICLES_LD; i += blockDim.x * gridDim.x) {
+        int index = normalParticles[i];
+        mixed4 velocity = velm[index];
+        if (velocity.w != 0) {
+            mixed sqrtInvMass = SQRT(velocity.w);
+            float4 rand = random[randomIndex + i];
+            velocity.x = vscale * velocity.x + noisescale * sqrtInvMass * rand.x;
+            velocity.y = vscale * velocity.y + noisescale * sqrtInvMass * rand.y;
+            velocity.z = vscale * velocity.z + noisescale * sqrtInvMass * rand.z;
+            velm[index] = velocity;
+        }
+    }
+    // Update Drude particle pairs
+
+    randomIndex += NUM_NORMAL_PARTICLES_LD;
+    for (int i = blockIdx.x*blockDim.x+threadIdx.x; i < NUM_PAIRS_LD; i += blockDim.x*gridDim.x) {
+        int2 particles = pairParticles[i];
+        mixed4 velocity1 = velm[particles.x];
+        mixed4 velocity2 = velm[particles.y];
+        mixed mass1 = RECIP(velocity1.w);
+        mixed mass2 = RECIP(velocity2.w);
+        mixed totMass = mass1+mass2;
+        mixed invTotMass = RECIP(totMass);
+        mixed sqrtInvTotMass = SQRT(invTotMass);
+        mixed sqrtInvRedMass = SQRT(totMass*velocity1.w*velocity2.w);
+        mixed mass1fract = invTotMass*mass1;
+        mixed mass2fract = invTotMass*mass2;
+        mixed4 cmVel = velocity1*mass1fract+velocity2*mass2fract;
+        mixed4 relVel = velocity2-velocity1;
+
+        float4 rand1 = random[randomIndex+2*i];
+        float4 rand2 = random[randomIndex+2*i+1];
+
+        cmVel.x = vscale * cmVel.x + noisescale * sqrtInvTotMass * rand1.x;
+        cmVel.y = vscale * cmVel.y + noisescale * sqrtInvTotMass * rand1.y;
+        cmVel.z = vscale * cmVel.z + noisescale * sqrtInvTotMass * rand1.z;
+        relVel.x = vscaleDrude * relVel.x + noisescaleDrude * sqrtInvRedMass * rand2.x;
+        relVel.y = vscaleDrude * relVel.y + noisescaleDrude * sqrtInvRedMass * rand2.y;
+        relVel.z = vscaleDrude * relVel.z + noisescaleDrude * sqrtInvRedMass * rand2.z;
+
+        velocity1.x = cmVel.x - relVel.x * mass2fract;
+        velocity1.y = cmVel.y - relVel.y * mass2fract;
+        velocity1.z = cmVel.z - relVel.z * mass2fract;
+        velocity2.x = cmVel.x + relVel.x * mass1fract;
+        velocity2.y = cmVel.y + relVel.y * mass1fract;
+        velocity2.z = cmVel.z + relVel.z * mass1fract;
+        velm[particles.x] = velocity1;
+        velm[particles.y] = velocity2;
+    }
+}
@@ -207,3 +207,22 @@ extern "C" __global__ void scaleVelocity(mixed4 *__restrict__ velm,
         velm[particles.y] = velAtom2;
     }
 }
+
+/**
+ * Append the time and the kinetic energies of temperature groups after the scaling to the ring buffer of history.
+ * The slot is tracked by the host, so that recording doesn't require any data transfer.
+ * The missing temperature groups are recorded as zero.
+ */
+
+extern "C" __global__ void recordGroupKineticEnergies(const mixed *__restrict__ kineticEnergies,
+                                                      const mixed *__restrict__ vscaleFactors,
+                                                      double *__restrict__ history,
+                                                      int slot,
+                                                      double time) {
+    if (blockIdx.x*blockDim.x+threadIdx.x != 0)
+        return;
+    double *record = &history[slot * GROUP_HISTORY_RECORD_SIZE];
+    record[0] = time;
+    for (int i = 0; i < GROUP_HISTORY_RECORD_SIZE - 1; i++)
+        record[1 + i] = i < NUM_TG ? (double) (kineticEnergies[i] * vscaleFactors[i] * vscaleFactors[i] / 2) : 0;
+}
@@ -26,3 +26,60 @@ extern "C" __global__ void updateImagePositions(real4 *__restrict__ posq,
 #endif
     }
 }
+
+/**
+ * Electrode observables for image charge method
+ *
+ * For each particle, particleType is 1 for electrolyte, 2 for image and 0 otherwise.
+ * The observables of one sample are accumulated in fixed point as buffer[0] for z-dipole of electrolyte and images,
+ * buffer[1-3] for the zeroth, first and second moment of electrolyte charge along z,
+ * and buffer[4+ix*numBinsY+iy] for the image charge in lateral bins.
+ */
+extern "C" __global__ void sampleElectrodeObservables(const real4 *__restrict__ posq,
+                                                      const int *__restrict__ atomIndex,
+                                                      const int *__restrict__ particleType,
+                                                      unsigned long long *__restrict__ buffer,
+                                                      real4 invPeriodicBoxSize,
+                                                      int numBinsX,
+                                                      int numBinsY) {
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < NUM_ATOMS; i += blockDim.x * gridDim.x) {
+        int type = particleType[atomIndex[i]];
+        if (type == 0)
+            continue;
+        real4 pos = posq[i];
+        atomicAdd(&buffer[0], static_cast<unsigned long long>((long long) (pos.w * pos.z * 0x100000000)));
+        if (type == 1) {
+            atomicAdd(&buffer[1], static_cast<unsigned long long>((long long) (pos.w * 0x100000000)));
+            atomicAdd(&buffer[2], static_cast<unsigned long long>((long long) (pos.w * pos.z * 0x100000000)));
+            atomicAdd(&buffer[3], static_cast<unsigned long long>((long long) (pos.w * pos.z * pos.z * 0x100000000)));
+        }
+        else {
+            real sx = pos.x * invPeriodicBoxSize.x;
+            real sy = pos.y * invPeriodicBoxSize.y;
+            sx -= floor(sx);
+            sy -= floor(sy);
+            int ix = min((int) (sx * numBinsX), numBinsX - 1);
+            int iy = min((int) (sy * numBinsY), numBinsY - 1);
+            atomicAdd(&buffer[4 + ix * numBinsY + iy], static_cast<unsigned long long>((long long) (pos.w * 0x100000000)));
+        }
+    }
+}
+
+/**
+ * Add the observables of one sample to the accumulated sums and clear the buffer.
+ * The square of z-dipole is also accumulated for its fluctuation, so sums has one more element than buffer
+ */
+extern "C" __global__ void accumulateElectrodeObservables(unsigned long long *__restrict__ buffer,
+                                                          double *__restrict__ sums,
+                                                          int bufferSize) {
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < bufferSize; i += blockDim.x * gridDim.x) {
+        double value = ((long long) buffer[i]) / (double) 0x100000000;
+        if (i == 0) {
+            sums[0] += value;
+            sums[1] += value * value;
+        }
+        else
+            sums[i + 1] += value;
+        buffer[i] = 0;
+    }
+}
@@ -0,0 +1,292 @@
+/**
+ * Massive Nose-Hoover chains
+ *
+ * There is one chain for each NH molecule and one chain for each Drude pair.
+ * The chain variables are stored in structure-of-arrays form, etaDot[ich*NUM_MASSIVE_CHAINS+chain],
+ * so that the chains can be integrated in parallel with coalesced memory access.
+ * Chains [0, numMoleculesNH) are molecular chains, and the others are Drude pair chains.
+ *
+ * The chains are indexed by the original molecule id and the original Drude particle index,
+ * so that their state follows the molecules when atoms are reordered.
+ * chainKE[chain] records 2 * kinetic energy of each chain after the scaling, for reporting group temperatures.
+ */
+
+/**
+ * Propagate one chain and return the velocity scaling factor.
+ * This is the same algorithm as VVIntegrator::propagateNHChain
+ */
+inline __device__ mixed propagateMassiveChain(mixed *__restrict__ etaDot,
+                                              mixed *__restrict__ etaDotDot,
+                                              int chain, mixed ke2, mixed ke2Target,
+                                              mixed Q0, mixed Q, mixed kT,
+                                              mixed dt2, int numNHChains, int loopsPerStep) {
+    const mixed dt4 = dt2 / 2;
+    const mixed dt8 = dt4 / 2;
+    mixed factor = 1;
+    mixed expfac;
+
+    etaDotDot[chain] = (ke2 - ke2Target) / Q0;
+    for (int iloop = 0; iloop < loopsPerStep; iloop++) {
+        for (int ich = numNHChains - 1; ich >= 0; ich--) {
+            int idx = ich * NUM_MASSIVE_CHAINS + chain;
+            expfac = EXP(-dt8 * etaDot[idx + NUM_MASSIVE_CHAINS]);
+            etaDot[idx] = (etaDot[idx] * expfac + etaDotDot[idx] * dt4) * expfac;
+        }
+        factor *= EXP(-dt2 * etaDot[chain]);
+
+        etaDotDot[chain] = (ke2 * factor * factor - ke2Target) / Q0;
+        etaDot[chain] = (etaDot[chain] * expfac + etaDotDot[chain] * dt4) * expfac;
+        for (int ich = 1; ich < numNHChains; ich++) {
+            int idx = ich * NUM_MASSIVE_CHAINS + chain;
+            int idxPrev = idx - NUM_MASSIVE_CHAINS;
+            mixed QPrev = ich == 1 ? Q0 : Q;
+            expfac = EXP(-dt8 * etaDot[idx + NUM_MASSIVE_CHAINS]);
+            etaDotDot[idx] = (QPrev * etaDot[idxPrev] * etaDot[idxPrev] - kT) / Q;
+            etaDot[idx] = (etaDot[idx] * expfac + etaDotDot[idx] * dt4) * expfac;
+        }
+    }
+    return factor;
+}
+
+/**
+ * Thermolize the relative motion of each Drude pair with its own chain
+ * Scaling the relative velocity doesn't change the COM velocity of the pair
+ */
+
+extern "C" __global__ void massiveNHDrudePairs(mixed4 *__restrict__ velm,
+                                               const int2 *__restrict__ pairParticles,
+                                               const int *__restrict__ atomIndex,
+                                               const int *__restrict__ drudePairChain,
+                                               mixed *__restrict__ etaDot,
+                                               mixed *__restrict__ etaDotDot,
+                                               mixed *__restrict__ chainKE,
+                                               mixed drudeKbT,
+                                               mixed drudeQ,
+                                               mixed dt2,
+                                               int numNHChains,
+                                               int loopsPerStep) {
+    for (int i = blockIdx.x*blockDim.x+threadIdx.x; i < NUM_PAIRS_NH; i += blockDim.x*gridDim.x) {
+        int2 particles = pairParticles[i];
+        int chain = NUM_MOLECULES_NH + drudePairChain[atomIndex[particles.x]];
+        mixed4 velocity1 = velm[particles.x];
+        mixed4 velocity2 = velm[particles.y];
+        mixed mass1 = RECIP(velocity1.w);
+        mixed mass2 = RECIP(velocity2.w);
+        mixed invTotMass = RECIP(mass1+mass2);
+        mixed redMass = mass1*mass2*invTotMass;
+        mixed mass1fract = invTotMass*mass1;
+        mixed mass2fract = invTotMass*mass2;
+        mixed4 cmVel = velocity1*mass1fract+velocity2*mass2fract;
+        mixed4 relVel = velocity2-velocity1;
+
+        mixed ke2 = redMass * (relVel.x*relVel.x + relVel.y*relVel.y + relVel.z*relVel.z);
+        mixed scale = propagateMassiveChain(etaDot, etaDotDot, chain, ke2, 3 * drudeKbT,
+                                            3 * drudeQ, drudeQ, drudeKbT, dt2, numNHChains, loopsPerStep);
+        chainKE[chain] = ke2 * scale * scale;
+
+        velocity1.x = cmVel.x - relVel.x * mass2fract * scale;
+        velocity1.y = cmVel.y - relVel.y * mass2fract * scale;
+        velocity1.z = cmVel.z - relVel.z * mass2fract * scale;
+        velocity2.x = cmVel.x + relVel.x * mass1fract * scale;
+        velocity2.y = cmVel.y + relVel.y * mass1fract * scale;
+        velocity2.z = cmVel.z + relVel.z * mass1fract * scale;
+        velm[particles.x] = velocity1;
+        velm[particles.y] = velocity2;
+    }
+}
+
+/**
+ * 2 * kinetic energy of a particle for the molecular chain.
+ * A Drude pair contributes with its COM motion, counted by the particle with the smaller index
+ */
+inline __device__ mixed getMoleculeKineticEnergy(const mixed4 *__restrict__ velm, int index, int partner) {
+    mixed4 velocity = velm[index];
+    if (velocity.w == 0)
+        return 0;
+    if (partner < 0)
+        return (velocity.x*velocity.x + velocity.y*velocity.y + velocity.z*velocity.z) / velocity.w;
+    if (partner < index)
+        return 0;
+    mixed4 velocity2 = velm[partner];
+    mixed mass1 = RECIP(velocity.w);
+    mixed mass2 = RECIP(velocity2.w);
+    mixed4 momentum = velocity*mass1 + velocity2*mass2;
+    return (momentum.x*momentum.x + momentum.y*momentum.y + momentum.z*momentum.z) / (mass1+mass2);
+}
+
+/**
+ * Scale the velocity of a particle by the molecular chain.
+ * A Drude pair is scaled with its COM velocity, by the particle with the smaller index
+ */
+inline __device__ void scaleMoleculeVelocity(mixed4 *__restrict__ velm, int index, int partner, mixed scale) {
+    mixed4 velocity = velm[index];
+    if (velocity.w == 0)
+        return;
+    if (partner < 0) {
+        velocity.x *= scale;
+        velocity.y *= scale;
+        velocity.z *= scale;
+        velm[index] = velocity;
+    }
+    else if (partner > index) {
+        mixed4 velocity2 = velm[partner];
+        mixed mass1 = RECIP(velocity.w);
+        mixed mass2 = RECIP(velocity2.w);
+        mixed4 cmVel = (velocity*mass1 + velocity2*mass2) * RECIP(mass1+mass2);
+        mixed4 delta = cmVel * (scale - 1);
+        velocity.x += delta.x;
+        velocity.y += delta.y;
+        velocity.z += delta.z;
+        velocity2.x += delta.x;
+        velocity2.y += delta.y;
+        velocity2.z += delta.z;
+        velm[index] = velocity;
+        velm[partner] = velocity2;
+    }
+}
+
+/**
+ * Thermolize each small molecule with its own chain, one thread per molecule
+ * Drude pairs contribute with their COM motion, so that the relative motion is not affected
+ */
+
+extern "C" __global__ void massiveNHMolecules(mixed4 *__restrict__ velm,
+                                              const int2 *__restrict__ particlesInMolecules,
+                                              const int *__restrict__ particlesSortedByMolId,
+                                              const int *__restrict__ smallMoleculesNH,
+                                              const int *__restrict__ particleMolId,
+                                              const int *__restrict__ atomIndex,
+                                              const int *__restrict__ drudePartner,
+                                              const int *__restrict__ moleculeChain,
+                                              const mixed *__restrict__ chainDof,
+                                              mixed *__restrict__ etaDot,
+                                              mixed *__restrict__ etaDotDot,
+                                              mixed *__restrict__ chainKE,
+                                              mixed realKbT,
+                                              mixed realQ,
+                                              mixed dt2,
+                                              int numNHChains,
+                                              int loopsPerStep) {
+    for (int i = blockIdx.x*blockDim.x+threadIdx.x; i < NUM_SMALL_MOLECULES_NH; i += blockDim.x*gridDim.x) {
+        int2 range = particlesInMolecules[smallMoleculesNH[i]];
+        int chain = moleculeChain[particleMolId[atomIndex[particlesSortedByMolId[range.y]]]];
+        mixed dof = chainDof[chain];
+        if (dof <= 0)
+            continue;
+
+        mixed ke2 = 0;
+        for (int j = 0; j < range.x; j++) {
+            int index = particlesSortedByMolId[range.y + j];
+            ke2 += getMoleculeKineticEnergy(velm, index, drudePartner[index]);
+        }
+
+        mixed scale = propagateMassiveChain(etaDot, etaDotDot, chain, ke2, dof * realKbT,
+                                            dof * realQ, realQ, realKbT, dt2, numNHChains, loopsPerStep);
+        chainKE[chain] = ke2 * scale * scale;
+
+        for (int j = 0; j < range.x; j++) {
+            int index = particlesSortedByMolId[range.y + j];
+            scaleMoleculeVelocity(velm, index, drudePartner[index], scale);
+        }
+    }
+}
+
+/**
+ * Thermolize each large molecule (e.g. an electrode slab) with its own chain, one thread block per molecule
+ * The kinetic energy is reduced in shared memory, and the chain is propagated by the first thread
+ */
+
+extern "C" __global__ void massiveNHLargeMolecules(mixed4 *__restrict__ velm,
+                                                   const int2 *__restrict__ particlesInMolecules,
+                                                   const int *__restrict__ particlesSortedByMolId,
+                                                   const int *__restrict__ largeMoleculesNH,
+                                                   const int *__restrict__ particleMolId,
+                                                   const int *__restrict__ atomIndex,
+                                                   const int *__restrict__ drudePartner,
+                                                   const int *__restrict__ moleculeChain,
+                                                   const mixed *__restrict__ chainDof,
+                                                   mixed *__restrict__ etaDot,
+                                                   mixed *__restrict__ etaDotDot,
+                                                   mixed *__restrict__ chainKE,
+                                                   mixed realKbT,
+                                                   mixed realQ,
+                                                   mixed dt2,
+                                                   int numNHChains,
+                                                   int loopsPerStep) {
+    __shared__ mixed ke2Buffer[THREAD_BLOCK_SIZE];
+    __shared__ mixed scale;
+    const unsigned int tid = threadIdx.x;
+    for (int i = blockIdx.x; i < NUM_LARGE_MOLECULES_NH; i += gridDim.x) {
+        int2 range = particlesInMolecules[largeMoleculesNH[i]];
+        int chain = moleculeChain[particleMolId[atomIndex[particlesSortedByMolId[range.y]]]];
+        mixed dof = chainDof[chain];
+        if (dof <= 0)
+            continue;
+
+        mixed ke2 = 0;
+        for (int j = tid; j < range.x; j += blockDim.x) {
+            int index = particlesSortedByMolId[range.y + j];
+            ke2 += getMoleculeKineticEnergy(velm, index, drudePartner[index]);
+        }
+        ke2Buffer[tid] = ke2;
+        __syncthreads();
+        for (unsigned int k = blockDim.x / 2; k > 0; k >>= 1) {
+            if (tid < k)
+                ke2Buffer[tid] += ke2Buffer[tid + k];
+            __syncthreads();
+        }
+
+        if (tid == 0) {
+            scale = propagateMassiveChain(etaDot, etaDotDot, chain, ke2Buffer[0], dof * realKbT,
+                                          dof * realQ, realQ, realKbT, dt2, numNHChains, loopsPerStep);
+            chainKE[chain] = ke2Buffer[0] * scale * scale;
+        }
+        __syncthreads();
+
+        for (int j = tid; j < range.x; j += blockDim.x) {
+            int index = particlesSortedByMolId[range.y + j];
+            scaleMoleculeVelocity(velm, index, drudePartner[index], scale);
+        }
+        // the shared buffers are reused by the next molecule
+        __syncthreads();
+    }
+}
+
+/**
+ * Sum the kinetic energies of all chains and append them to the ring buffer of history, in one thread block.
+ * The molecular chains are recorded as the atomic group, which includes the molecular COM motion,
+ * and the Drude pair chains as the Drude group. The COM group is empty.
+ */
+
+extern "C" __global__ void recordMassiveGroupKineticEnergies(const mixed *__restrict__ chainKE,
+                                                             double *__restrict__ history,
+                                                             int slot,
+                                                             double time) {
+    __shared__ double atomBuffer[THREAD_BLOCK_SIZE];
+    __shared__ double drudeBuffer[THREAD_BLOCK_SIZE];
+    const unsigned int tid = threadIdx.x;
+    double atom = 0, drude = 0;
+    for (int i = tid; i < NUM_MOLECULES_NH + NUM_PAIRS_NH; i += blockDim.x) {
+        if (i < NUM_MOLECULES_NH)
+            atom += chainKE[i];
+        else
+            drude += chainKE[i];
+    }
+    atomBuffer[tid] = atom;
+    drudeBuffer[tid] = drude;
+    __syncthreads();
+    for (unsigned int k = blockDim.x / 2; k > 0; k >>= 1) {
+        if (tid < k) {
+            atomBuffer[tid] += atomBuffer[tid + k];
+            drudeBuffer[tid] += drudeBuffer[tid + k];
+        }
+        __syncthreads();
+    }
+    if (tid == 0) {
+        double *record = &history[slot * GROUP_HISTORY_RECORD_SIZE];
+        record[0] = time;
+        record[1] = atomBuffer[0] / 2;
+        record[2] = 0;
+        record[3] = drudeBuffer[0] / 2;
+    }
+}
@@ -0,0 +1,175 @@
+/**
+ * Reverse non-equilibrium MD for viscosity (Muller-Plathe)
+ *
+ * Each unit is a molecule, given by the number of particles and the offset of its first particle in unitParticles.
+ * The unit with the largest vx in slab 0 and the unit with the smallest vx in slab NUM_SLABS/2 exchange their x-momentum.
+ * The exchange is performed between the centers of mass: all the particles of a molecule are shifted by the same velocity,
+ * so that the relative motion inside the molecule, including the constraints and the Drude pairs, is not affected.
+ * The units may have different masses (e.g. a cation and an anion), so the exchange is performed as an
+ * elastic collision along x (Tenney and Maginn), which conserves both the momentum and the kinetic energy.
+ * It reduces to swapping the COM velocities of Muller-Plathe if the masses are equal.
+ * The candidates are selected with a parallel arg-max/arg-min reduction,
+ * and the exchange is performed on the device, so that there is no data transfer to the host.
+ */
+
+inline __device__ int getSlab(real z, real invBoxSizeZ) {
+    real scaled = z * invBoxSizeZ;
+    scaled -= floor(scaled);
+    return min((int) (scaled * NUM_SLABS), NUM_SLABS - 1);
+}
+
+inline __device__ void getUnitMomentum(const mixed4 *__restrict__ velm, const int *__restrict__ unitParticles,
+                                       int2 unit, mixed &momentum, mixed &mass) {
+    momentum = 0;
+    mass = 0;
+    for (int j = unit.y; j < unit.y + unit.x; j++) {
+        mixed4 velocity = velm[unitParticles[j]];
+        mixed m = RECIP(velocity.w);
+        mass += m;
+        momentum += velocity.x * m;
+    }
+}
+
+/**
+ * Shift the x-velocity of all the particles of a unit by the same amount
+ */
+inline __device__ void shiftUnitVelocity(mixed4 *__restrict__ velm, const int *__restrict__ unitParticles,
+                                         int2 unit, mixed delta) {
+    for (int j = unit.y; j < unit.y + unit.x; j++)
+        velm[unitParticles[j]].x += delta;
+}
+
+/**
+ * Reduce the candidates in shared memory. The largest velocity in slab 0 and the smallest velocity in the middle slab are kept
+ */
+inline __device__ void reduceCandidates(mixed *maxV, int *maxUnit, mixed *minV, int *minUnit) {
+    const unsigned int tid = threadIdx.x;
+    __syncthreads();
+    for (unsigned int k = blockDim.x / 2; k > 0; k >>= 1) {
+        if (tid < k) {
+            if (maxV[tid + k] > maxV[tid]) {
+                maxV[tid] = maxV[tid + k];
+                maxUnit[tid] = maxUnit[tid + k];
+            }
+            if (minV[tid + k] < minV[tid]) {
+                minV[tid] = minV[tid + k];
+                minUnit[tid] = minUnit[tid + k];
+            }
+        }
+        __syncthreads();
+    }
+}
+
+extern "C" __global__ void findExchangeCandidates(const real4 *__restrict__ posq,
+                                                  const mixed4 *__restrict__ velm,
+                                                  const int2 *__restrict__ units,
+                                                  const int *__restrict__ unitParticles,
+                                                  mixed *__restrict__ blockMaxV,
+                                                  int *__restrict__ blockMaxUnit,
+                                                  mixed *__restrict__ blockMinV,
+                                                  int *__restrict__ blockMinUnit,
+                                                  unsigned long long *__restrict__ slabBuffer,
+                                                  const real4 invBoxSize) {
+    __shared__ mixed maxV[THREAD_BLOCK_SIZE];
+    __shared__ int maxUnit[THREAD_BLOCK_SIZE];
+    __shared__ mixed minV[THREAD_BLOCK_SIZE];
+    __shared__ int minUnit[THREAD_BLOCK_SIZE];
+    const unsigned int tid = threadIdx.x;
+    maxV[tid] = -1e30;
+    maxUnit[tid] = -1;
+    minV[tid] = 1e30;
+    minUnit[tid] = -1;
+
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < NUM_UNITS; i += blockDim.x * gridDim.x) {
+        int2 unit = units[i];
+        mixed momentum, mass;
+        getUnitMomentum(velm, unitParticles, unit, momentum, mass);
+        mixed v = momentum / mass;
+        // The slab of a molecule is decided by its first particle, so that it is not affected by the periodic boundary
+        int slab = getSlab(posq[unitParticles[unit.y]].z, invBoxSize.z);
+
+        // The velocity profile is accumulated in fixed point, as the forces are
+        atomicAdd(&slabBuffer[slab], static_cast<unsigned long long>((long long) (momentum * 0x100000000)));
+        atomicAdd(&slabBuffer[NUM_SLABS + slab], static_cast<unsigned long long>((long long) (mass * 0x100000000)));
+
+        if (slab == 0 && v > maxV[tid]) {
+            maxV[tid] = v;
+            maxUnit[tid] = i;
+        }
+        if (slab == NUM_SLABS / 2 && v < minV[tid]) {
+            minV[tid] = v;
+            minUnit[tid] = i;
+        }
+    }
+
+    reduceCandidates(maxV, maxUnit, minV, minUnit);
+    if (tid == 0) {
+        blockMaxV[blockIdx.x] = maxV[0];
+        blockMaxUnit[blockIdx.x] = maxUnit[0];
+        blockMinV[blockIdx.x] = minV[0];
+        blockMinUnit[blockIdx.x] = minUnit[0];
+    }
+}
+
+/**
+ * Select the candidates among all thread blocks and exchange their momentum.
+ * The numThreads of this kernel equals to threadBlockSize.
+ * So there is only one threadBlock for this kernel
+ */
+extern "C" __global__ void exchangeMomentum(mixed4 *__restrict__ velm,
+                                            const int2 *__restrict__ units,
+                                            const int *__restrict__ unitParticles,
+                                            const mixed *__restrict__ blockMaxV,
+                                            const int *__restrict__ blockMaxUnit,
+                                            const mixed *__restrict__ blockMinV,
+                                            const int *__restrict__ blockMinUnit,
+                                            int numBlocks,
+                                            unsigned long long *__restrict__ slabBuffer,
+                                            double *__restrict__ slabProfile,
+                                            double *__restrict__ transferred) {
+    __shared__ mixed maxV[THREAD_BLOCK_SIZE];
+    __shared__ int maxUnit[THREAD_BLOCK_SIZE];
+    __shared__ mixed minV[THREAD_BLOCK_SIZE];
+    __shared__ int minUnit[THREAD_BLOCK_SIZE];
+    const unsigned int tid = threadIdx.x;
+    maxV[tid] = -1e30;
+    maxUnit[tid] = -1;
+    minV[tid] = 1e30;
+    minUnit[tid] = -1;
+
+    for (int i = tid; i < numBlocks; i += blockDim.x) {
+        if (blockMaxV[i] > maxV[tid]) {
+            maxV[tid] = blockMaxV[i];
+            maxUnit[tid] = blockMaxUnit[i];
+        }
+        if (blockMinV[i] < minV[tid]) {
+            minV[tid] = blockMinV[i];
+            minUnit[tid] = blockMinUnit[i];
+        }
+    }
+
+    // Move the profile of this step to the accumulated profile, and clear the buffer for the next exchange
+    for (int i = tid; i < 2 * NUM_SLABS; i += blockDim.x) {
+        slabProfile[i] += ((long long) slabBuffer[i]) / (double) 0x100000000;
+        slabBuffer[i] = 0;
+    }
+
+    reduceCandidates(maxV, maxUnit, minV, minUnit);
+    if (tid == 0 && maxUnit[0] >= 0 && minUnit[0] >= 0 && maxV[0] > minV[0]) {
+        int2 unit1 = units[maxUnit[0]];
+        int2 unit2 = units[minUnit[0]];
+        mixed momentum1, mass1, momentum2, mass2;
+        getUnitMomentum(velm, unitParticles, unit1, momentum1, mass1);
+        getUnitMomentum(velm, unitParticles, unit2, momentum2, mass2);
+
+        // Elastic collision: each COM velocity is reflected about the COM velocity of the two units
+        mixed vCOM = (momentum1 + momentum2) / (mass1 + mass2);
+        mixed delta1 = 2 * (vCOM - momentum1 / mass1);
+        mixed delta2 = 2 * (vCOM - momentum2 / mass2);
+        shiftUnitVelocity(velm, unitParticles, unit1, delta1);
+        shiftUnitVelocity(velm, unitParticles, unit2, delta2);
+
+        transferred[0] -= mass1 * delta1;
+        transferred[1] += 1;
+    }
+}
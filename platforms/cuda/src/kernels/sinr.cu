@@ -0,0 +1,313 @@
+/**
+ * Isokinetic Nose-Hoover RESPA (SIN(R)) integration
+ *
+ * Each degree of freedom is coupled to SINR_L pairs of thermostat variables (v1, v2)
+ * under the isokinetic constraint m*v^2 + L/(L+1) * sum_j Q1*v1_j^2 = L*kT
+ *
+ * The thermostat variables are stored by the original atom index, so that they are not affected by atom reordering
+ * The layout is v1[(j*3+dim)*NUM_ATOMS+atom]
+ *
+ * params: [kT, Q1, Q2, inner step size, OU decay factor, OU noise factor, outer half step size]
+ */
+
+inline __device__ int sinrIndex(int j, int dim, int atom) {
+    return (j * 3 + dim) * NUM_ATOMS + atom;
+}
+
+/**
+ * Velocity update with force f for time t while keeping the isokinetic constraint
+ * Return the new velocity. v1 should be divided by sdot
+ */
+inline __device__ mixed sinrForceUpdate(mixed v, mixed f, mixed invMass, mixed LkT, mixed t, mixed& sdot) {
+    mixed a = f * v / LkT;
+    mixed b = f * f * invMass / LkT;
+    mixed sb = SQRT(b);
+    mixed x = sb * t;
+    mixed s;
+    if (x < 0.01) {
+        mixed t2 = t * t;
+        s = t + a * t2 / 2 + b * t2 * t / 6 + a * b * t2 * t2 / 24;
+        sdot = 1 + a * t + b * t2 / 2 + a * b * t2 * t / 6;
+    } else {
+        mixed sh = sinh(x);
+        mixed ch = cosh(x);
+        s = a / b * (ch - 1) + sh / sb;
+        sdot = a / sb * sh + ch;
+    }
+    return (v + f * invMass * s) / sdot;
+}
+
+/**
+ * Thermostat coupling for time t (v2 is propagated for t/2 before and after)
+ */
+inline __device__ void sinrThermostatUpdate(mixed& v, mixed* v1, mixed* v2, mixed mass,
+                                            mixed kT, mixed Q1, mixed Q2, mixed t) {
+    for (int j = 0; j < SINR_L; j++)
+        v2[j] += 0.5 * t * (Q1 * v1[j] * v1[j] - kT) / Q2;
+
+    mixed sum = mass * v * v;
+    for (int j = 0; j < SINR_L; j++) {
+        v1[j] *= EXP(-v2[j] * t);
+        sum += (mixed) SINR_L / (SINR_L + 1) * Q1 * v1[j] * v1[j];
+    }
+    mixed H = SQRT(SINR_L * kT / sum);
+    v *= H;
+    for (int j = 0; j < SINR_L; j++)
+        v1[j] *= H;
+
+    for (int j = 0; j < SINR_L; j++)
+        v2[j] += 0.5 * t * (Q1 * v1[j] * v1[j] - kT) / Q2;
+}
+
+/**
+ * Project the velocities and the thermostat variables onto the isokinetic surface
+ */
+
+extern "C" __global__ void initializeIsokineticState(mixed4 *__restrict__ velm,
+                                                     mixed *__restrict__ v1,
+                                                     mixed *__restrict__ v2,
+                                                     const int *__restrict__ atomIndex,
+                                                     const mixed *__restrict__ params) {
+    const mixed kT = params[0];
+    const mixed Q1 = params[1];
+    const mixed v1Init = SQRT(kT / Q1);
+
+    for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
+        mixed4 velocity = velm[index];
+        int atom = atomIndex[index];
+        if (velocity.w == 0) {
+            for (int dim = 0; dim < 3; dim++) {
+                for (int j = 0; j < SINR_L; j++) {
+                    v1[sinrIndex(j, dim, atom)] = 0;
+                    v2[sinrIndex(j, dim, atom)] = 0;
+                }
+            }
+            continue;
+        }
+        mixed mass = RECIP(velocity.w);
+        mixed vel[3] = {velocity.x, velocity.y, velocity.z};
+        for (int dim = 0; dim < 3; dim++) {
+            mixed sum = mass * vel[dim] * vel[dim] + (mixed) SINR_L / (SINR_L + 1) * SINR_L * kT;
+            mixed H = SQRT(SINR_L * kT / sum);
+            vel[dim] *= H;
+            for (int j = 0; j < SINR_L; j++) {
+                v1[sinrIndex(j, dim, atom)] = v1Init * H;
+                v2[sinrIndex(j, dim, atom)] = 0;
+            }
+        }
+        velm[index] = make_mixed4(vel[0], vel[1], vel[2], velocity.w);
+    }
+}
+
+/**
+ * Store the forces just calculated by the original atom index
+ */
+
+extern "C" __global__ void storeIsokineticForce(const long long *__restrict__ force,
+                                                const real3 *__restrict__ forceExtra,
+                                                mixed4 *__restrict__ forceStored,
+                                                const int *__restrict__ atomIndex,
+                                                bool includeForce,
+                                                bool includeExtra) {
+    const mixed fscale = 1 / (mixed) 0x100000000;
+    for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
+        mixed4 f = make_mixed4(0, 0, 0, 0);
+        if (includeForce) {
+            f.x += fscale * force[index];
+            f.y += fscale * force[index + PADDED_NUM_ATOMS];
+            f.z += fscale * force[index + PADDED_NUM_ATOMS * 2];
+        }
+        if (includeExtra) {
+            f.x += forceExtra[index].x;
+            f.y += forceExtra[index].y;
+            f.z += forceExtra[index].z;
+        }
+        forceStored[atomIndex[index]] = f;
+    }
+}
+
+/**
+ * Half outer step velocity update with slow forces
+ */
+
+extern "C" __global__ void integrateIsokineticSlowVelocity(mixed4 *__restrict__ velm,
+                                                           const long long *__restrict__ force,
+                                                           const real3 *__restrict__ forceExtra,
+                                                           mixed4 *__restrict__ forceSlow,
+                                                           mixed *__restrict__ v1,
+                                                           const int *__restrict__ atomIndex,
+                                                           const mixed *__restrict__ params,
+                                                           bool useStoredForce,
+                                                           bool includeForce) {
+    const mixed LkT = SINR_L * params[0];
+    const mixed dt = params[6];
+    const mixed fscale = 1 / (mixed) 0x100000000;
+
+    for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
+        int atom = atomIndex[index];
+        mixed4 f;
+        if (useStoredForce)
+            f = forceSlow[atom];
+        else {
+            f = make_mixed4(forceExtra[index].x, forceExtra[index].y, forceExtra[index].z, 0);
+            if (includeForce) {
+                f.x += fscale * force[index];
+                f.y += fscale * force[index + PADDED_NUM_ATOMS];
+                f.z += fscale * force[index + PADDED_NUM_ATOMS * 2];
+            }
+            forceSlow[atom] = f;
+        }
+
+        mixed4 velocity = velm[index];
+        if (velocity.w == 0)
+            continue;
+        mixed vel[3] = {velocity.x, velocity.y, velocity.z};
+        mixed force3[3] = {f.x, f.y, f.z};
+        for (int dim = 0; dim < 3; dim++) {
+            mixed sdot;
+            vel[dim] = sinrForceUpdate(vel[dim], force3[dim], velocity.w, LkT, dt, sdot);
+            mixed invSdot = RECIP(sdot);
+            for (int j = 0; j < SINR_L; j++)
+                v1[sinrIndex(j, dim, atom)] *= invSdot;
+        }
+        velm[index] = make_mixed4(vel[0], vel[1], vel[2], velocity.w);
+    }
+}
+
+/**
+ * First half of the inner step: thermostat, fast force velocity update, OU process on v2 and position update
+ */
+
+extern "C" __global__ void integrateIsokineticInner1(real4 *__restrict__ posq,
+                                                     real4 *__restrict__ posqCorrection,
+                                                     mixed4 *__restrict__ velm,
+                                                     const mixed4 *__restrict__ forceFast,
+                                                     mixed *__restrict__ v1,
+                                                     mixed *__restrict__ v2,
+                                                     const int *__restrict__ atomIndex,
+                                                     const mixed *__restrict__ params,
+                                                     const float4 *__restrict__ random,
+                                                     unsigned int randomIndex) {
+    const mixed kT = params[0];
+    const mixed Q1 = params[1];
+    const mixed Q2 = params[2];
+    const mixed h = params[3];
+    const mixed decay = params[4];
+    const mixed noise = params[5];
+
+    for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
+        mixed4 velocity = velm[index];
+        if (velocity.w == 0)
+            continue;
+        int atom = atomIndex[index];
+        mixed mass = RECIP(velocity.w);
+        mixed4 f = forceFast[atom];
+        mixed vel[3] = {velocity.x, velocity.y, velocity.z};
+        mixed force3[3] = {f.x, f.y, f.z};
+        for (int dim = 0; dim < 3; dim++) {
+            mixed v1Local[SINR_L], v2Local[SINR_L];
+            for (int j = 0; j < SINR_L; j++) {
+                v1Local[j] = v1[sinrIndex(j, dim, atom)];
+                v2Local[j] = v2[sinrIndex(j, dim, atom)];
+            }
+            sinrThermostatUpdate(vel[dim], v1Local, v2Local, mass, kT, Q1, Q2, 0.5 * h);
+
+            mixed sdot;
+            vel[dim] = sinrForceUpdate(vel[dim], force3[dim], velocity.w, SINR_L * kT, 0.5 * h, sdot);
+            mixed invSdot = RECIP(sdot);
+            for (int j = 0; j < SINR_L; j++) {
+                v1Local[j] *= invSdot;
+                float4 rand = random[randomIndex + j * NUM_ATOMS + atom];
+                float r = (dim == 0 ? rand.x : (dim == 1 ? rand.y : rand.z));
+                v2Local[j] = decay * v2Local[j] + noise * r;
+                v1[sinrIndex(j, dim, atom)] = v1Local[j];
+                v2[sinrIndex(j, dim, atom)] = v2Local[j];
+            }
+        }
+        velm[index] = make_mixed4(vel[0], vel[1], vel[2], velocity.w);
+
+#ifdef USE_MIXED_PRECISION
+        real4 pos1 = posq[index];
+        real4 pos2 = posqCorrection[index];
+        mixed4 pos = make_mixed4(pos1.x+(mixed)pos2.x, pos1.y+(mixed)pos2.y, pos1.z+(mixed)pos2.z, pos1.w);
+#else
+        real4 pos = posq[index];
+#endif
+        pos.x += h * vel[0];
+        pos.y += h * vel[1];
+        pos.z += h * vel[2];
+#ifdef USE_MIXED_PRECISION
+        posq[index] = make_real4((real) pos.x, (real) pos.y, (real) pos.z, (real) pos.w);
+        posqCorrection[index] = make_real4(pos.x-(real) pos.x, pos.y-(real) pos.y, pos.z-(real) pos.z, 0);
+#else
+        posq[index] = pos;
+#endif
+    }
+}
+
+/**
+ * Second half of the inner step: store fast force, fast force velocity update and thermostat
+ */
+
+extern "C" __global__ void integrateIsokineticInner2(mixed4 *__restrict__ velm,
+                                                     const long long *__restrict__ force,
+                                                     mixed4 *__restrict__ forceFast,
+                                                     mixed *__restrict__ v1,
+                                                     mixed *__restrict__ v2,
+                                                     const int *__restrict__ atomIndex,
+                                                     const mixed *__restrict__ params,
+                                                     bool includeForce) {
+    const mixed kT = params[0];
+    const mixed Q1 = params[1];
+    const mixed Q2 = params[2];
+    const mixed h = params[3];
+    const mixed fscale = 1 / (mixed) 0x100000000;
+
+    for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < NUM_ATOMS; index += blockDim.x * gridDim.x) {
+        int atom = atomIndex[index];
+        mixed4 f = make_mixed4(0, 0, 0, 0);
+        if (includeForce) {
+            f.x = fscale * force[index];
+            f.y = fscale * force[index + PADDED_NUM_ATOMS];
+            f.z = fscale * force[index + PADDED_NUM_ATOMS * 2];
+        }
+        forceFast[atom] = f;
+
+        mixed4 velocity = velm[index];
+        if (velocity.w == 0)
+            continue;
+        mixed mass = RECIP(velocity.w);
+        mixed vel[3] = {velocity.x, velocity.y, velocity.z};
+        mixed force3[3] = {f.x, f.y, f.z};
+        for (int dim = 0; dim < 3; dim++) {
+            mixed v1Local[SINR_L], v2Local[SINR_L];
+            for (int j = 0; j < SINR_L; j++) {
+                v1Local[j] = v1[sinrIndex(j, dim, atom)];
+                v2Local[j] = v2[sinrIndex(j, dim, atom)];
+            }
+
+            mixed sdot;
+            vel[dim] = sinrForceUpdate(vel[dim], force3[dim], velocity.w, SINR_L * kT, 0.5 * h, sdot);
+            mixed invSdot = RECIP(sdot);
+            for (int j = 0; j < SINR_L; j++)
+                v1Local[j] *= invSdot;
+
+            sinrThermostatUpdate(vel[dim], v1Local, v2Local, mass, kT, Q1, Q2, 0.5 * h);
+            for (int j = 0; j < SINR_L; j++) {
+                v1[sinrIndex(j, dim, atom)] = v1Local[j];
+                v2[sinrIndex(j, dim, atom)] = v2Local[j];
+            }
+        }
+        velm[index] = make_mixed4(vel[0], vel[1], vel[2], velocity.w);
+    }
+}
+
+/**
+ * Reset extra force
+ */
+
+extern "C" __global__ void resetExtraForce(real3 *__restrict__ forceExtra) {
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < NUM_ATOMS; i += blockDim.x * gridDim.x) {
+        forceExtra[i] = make_real3(0, 0, 0);
+    }
+}
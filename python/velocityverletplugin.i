@@ -10,6 +10,7 @@
  */
 
 %include "std_vector.i"
+%include "std_string.i"
 namespace std {
   %template(vectord) vector<double>;
   %template(vectori) vector<int>;
@@ -22,6 +23,7 @@ namespace std {
 #include "OpenMMVelocityVerlet.h"
 #include "openmm/RPMDIntegrator.h"
 #include "openmm/RPMDMonteCarloBarostat.h"
+#include <sstream>
 %}
 
 %pythoncode %{
@@ -60,6 +62,10 @@ import simtk.unit as unit
     val=unit.Quantity(val, 1 / unit.picosecond)
 %}
 
+%pythonappend OpenMM::VVIntegrator::getSINRFriction() const %{
+    val=unit.Quantity(val, 1 / unit.picosecond)
+%}
+
 %pythonappend OpenMM::VVIntegrator::getMirrorLocation() const %{
     val=unit.Quantity(val, unit.nanometer)
 %}
@@ -72,16 +78,142 @@ import simtk.unit as unit
     val=unit.Quantity(val, unit.nanometer / unit.picosecond / unit.picosecond)
 %}
 
-%pythonappend OpenMM::VVIntegrator::getViscosity() %{
+%pythonappend OpenMM::VVIntegrator::getViscosity %{
     val=(unit.Quantity(val[0], unit.nanometer / unit.picosecond),
          unit.Quantity(val[1], unit.picosecond / (unit.dalton * unit.item) * unit.nanometer).in_units_of((unit.pascal * unit.second)**(-1))
         )
 %}
 
+%pythonappend OpenMM::VVIntegrator::getViscosityStatistics %{
+    val=(unit.Quantity(val[0], unit.nanometer / unit.picosecond),
+         unit.Quantity(val[1], unit.picosecond / (unit.dalton * unit.item) * unit.nanometer).in_units_of((unit.pascal * unit.second)**(-1)),
+         unit.Quantity(val[2], unit.picosecond / (unit.dalton * unit.item) * unit.nanometer).in_units_of((unit.pascal * unit.second)**(-1)),
+         unit.Quantity(val[3], unit.picosecond),
+         int(val[4])
+        )
+%}
+
+%pythonappend OpenMM::VVIntegrator::getRNEMDStatistics() %{
+    val=(unit.Quantity(val[0], unit.dalton * unit.nanometer / unit.picosecond),
+         unit.Quantity(val[1], unit.picosecond),
+         unit.Quantity(val[2], unit.dalton / unit.nanometer / unit.picosecond**2),
+         unit.Quantity(val[3], unit.picosecond**(-1)),
+         unit.Quantity(val[4], unit.dalton * unit.item / unit.nanometer / unit.picosecond).in_units_of(unit.pascal * unit.second),
+         int(val[5])
+        )
+%}
+
+%pythonappend OpenMM::VVIntegrator::getRNEMDVelocityProfile() %{
+    val=unit.Quantity(list(val), unit.nanometer / unit.picosecond)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getCorrelatorLagTimes() %{
+    val=unit.Quantity(list(val), unit.picosecond)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getMSD(int group) %{
+    val=unit.Quantity(list(val), unit.nanometer**2)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getVACF(int group) %{
+    val=unit.Quantity(list(val), unit.nanometer**2 / unit.picosecond**2)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getConductivity(double fitTime) %{
+    val=(unit.Quantity(val[0], unit.elementary_charge**2 / (unit.nanometer * unit.picosecond * unit.kilojoule_per_mole * unit.item)).in_units_of(unit.ampere / unit.volt / unit.meter),
+         unit.Quantity(val[1], unit.elementary_charge**2 / (unit.nanometer * unit.picosecond * unit.kilojoule_per_mole * unit.item)).in_units_of(unit.ampere / unit.volt / unit.meter),
+         unit.Quantity(val[2], unit.elementary_charge**2 / (unit.nanometer * unit.picosecond * unit.kilojoule_per_mole * unit.item)).in_units_of(unit.ampere / unit.volt / unit.meter),
+         unit.Quantity(val[3], unit.elementary_charge * unit.nanometer / unit.picosecond),
+         int(val[4])
+        )
+%}
+
+%pythonappend OpenMM::VVIntegrator::getConductivityLagTimes() %{
+    val=unit.Quantity(list(val), unit.picosecond)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getChargeCurrentAutocorrelation() %{
+    val=unit.Quantity(list(val), unit.elementary_charge**2 * unit.nanometer**2 / unit.picosecond**2)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getDipoleMSD() %{
+    val=unit.Quantity(list(val), unit.elementary_charge**2 * unit.nanometer**2)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getGroupKineticEnergies() %{
+    val=unit.Quantity(list(val), unit.kilojoule_per_mole)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getGroupTemperatures() %{
+    val=unit.Quantity(list(val), unit.kelvin)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getElectrodeStatistics() %{
+    val=(unit.Quantity(val[0], unit.elementary_charge * unit.nanometer),
+         unit.Quantity(val[1], unit.elementary_charge**2 * unit.nanometer**2),
+         unit.Quantity(val[2], unit.elementary_charge),
+         unit.Quantity(val[3], unit.elementary_charge * unit.nanometer),
+         unit.Quantity(val[4], unit.elementary_charge * unit.nanometer**2),
+         int(val[5])
+        )
+%}
+
+%pythonappend OpenMM::VVIntegrator::getImageChargeDistribution() %{
+    val=unit.Quantity(list(val), unit.elementary_charge / unit.nanometer**2)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getForceGroupEnergies() %{
+    val=unit.Quantity(list(val), unit.kilojoule_per_mole)
+%}
+
+%pythonappend OpenMM::VVIntegrator::getTimings() %{
+    val=dict((VVIntegrator.getTimingPhaseName(i), (int(val[2*i]), val[2*i+1]*unit.second))
+             for i in range(VVIntegrator.NumTimingPhases))
+%}
+
+%pythonappend OpenMM::VVIntegrator::getDensityProfile(int group, int quantity) %{
+    if quantity == VVIntegrator.ProfileNumber:
+        val=unit.Quantity(list(val), unit.nanometer**(-3))
+    elif quantity == VVIntegrator.ProfileCharge:
+        val=unit.Quantity(list(val), unit.elementary_charge / unit.nanometer**3)
+    else:
+        val=unit.Quantity(list(val), unit.elementary_charge / unit.nanometer**2)
+%}
+
 namespace OpenMM {
 
 class VVIntegrator : public Integrator {
 public:
+   enum ScheduleParameter {
+       ScheduleTemperature = 0,
+       ScheduleDrudeTemperature = 1,
+       ScheduleElectricField = 2,
+       ScheduleCosAcceleration = 3
+   };
+   enum ProfileGroup {
+       ProfileElectrolyte = 0,
+       ProfileImage = 1,
+       ProfileOther = 2
+   };
+   enum ProfileQuantity {
+       ProfileNumber = 0,
+       ProfileCharge = 1,
+       ProfileDipole = 2
+   };
+   enum TimingPhase {
+       TimingStep = 0,
+       TimingForces = 1,
+       TimingExtraForces = 2,
+       TimingFirstIntegrate = 3,
+       TimingSecondIntegrate = 4,
+       TimingConstraints = 5,
+       TimingThermostat = 6,
+       TimingImageUpdate = 7,
+       TimingReorder = 8,
+       TimingSampling = 9,
+       NumTimingPhases = 10
+   };
+
    VVIntegrator(double temperature, double frequency, double drudeTemperature, double drudeFrequency, double stepSize, int numNHChains=3, int loopsPerStep=1) ;
 
    double getTemperature() const ;
@@ -103,14 +235,34 @@ public:
    void setUseCOMTempGroup(bool) ;
    bool getUseMiddleScheme() const ;
    void setUseMiddleScheme(bool) ;
+   bool getUseMassiveNH() const ;
+   void setUseMassiveNH(bool) ;
+   bool getUseSINR() const ;
+   void setUseSINR(bool) ;
+   int getSINRChainLength() const ;
+   void setSINRChainLength(int) ;
+   double getSINRFriction() const ;
+   void setSINRFriction(double) ;
+   int getFastForceGroups() const ;
+   void setFastForceGroups(int) ;
+   int getRespaLoops() const ;
+   void setRespaLoops(int) ;
+
+   void setLinearSchedule(int parameter, const std::vector<double>& times, const std::vector<double>& values) ;
+   void setSinusoidalSchedule(int parameter, double offset, double amplitude, double period, double phase=0) ;
+   void clearSchedule(int parameter) ;
+   bool hasSchedule(int parameter) const ;
 
    int addParticleLangevin(int particle) ;
+   static std::vector<int> findMolecules(int numParticles, const std::vector<int>& bondedPairs) ;
    int getRandomNumberSeed() const ;
    void setRandomNumberSeed(int seed) ;
    int getFriction() const ;
    void setFriction(double fric) ;
    int getDrudeFriction() const ;
    void setDrudeFriction(int fric) ;
+   bool getUseLangevinOU() const ;
+   void setUseLangevinOU(bool) ;
 
    int addImagePair(int, int) ;
    void setMirrorLocation(double) ;
@@ -121,11 +273,105 @@ public:
 
    void setCosAcceleration(double) ;
    double getCosAcceleration() const ;
-   std::vector<double> getViscosity();
+   int addCosAccelerationMode(int flowAxis, int gradientAxis, int waveNumber, double amplitude) ;
+   int getNumCosAccelerationModes() const ;
+   %apply int& OUTPUT {int& flowAxis};
+   %apply int& OUTPUT {int& gradientAxis};
+   %apply int& OUTPUT {int& waveNumber};
+   %apply double& OUTPUT {double& amplitude};
+   void getCosAccelerationModeParameters(int mode, int& flowAxis, int& gradientAxis, int& waveNumber, double& amplitude) const ;
+   %clear int& flowAxis;
+   %clear int& gradientAxis;
+   %clear int& waveNumber;
+   %clear double& amplitude;
+   void setCosAccelerationModeAmplitude(int mode, double amplitude) ;
+   std::vector<double> getViscosity(int mode=0);
+   int getViscosityStatisticsInterval() const ;
+   void setViscosityStatisticsInterval(int) ;
+   std::vector<double> getViscosityStatistics(int mode=0);
+   void resetViscosityStatistics();
+   int getRNEMDInterval() const ;
+   void setRNEMDInterval(int) ;
+   int getRNEMDNumSlabs() const ;
+   void setRNEMDNumSlabs(int) ;
+   std::vector<double> getRNEMDStatistics();
+   std::vector<double> getRNEMDVelocityProfile();
+   void resetRNEMDStatistics();
+   int getDensityProfileInterval() const ;
+   void setDensityProfileInterval(int) ;
+   int getDensityProfileNumBins() const ;
+   void setDensityProfileNumBins(int) ;
+   std::vector<double> getDensityProfile(int group, int quantity);
+   int getDensityProfileNumSamples();
+   void resetDensityProfile();
+   int getCorrelatorInterval() const ;
+   void setCorrelatorInterval(int) ;
+   int getCorrelatorNumLevels() const ;
+   void setCorrelatorNumLevels(int) ;
+   int addCorrelatorGroup(const std::vector<int>& particles) ;
+   int getNumCorrelatorGroups() const ;
+   const std::vector<int>& getCorrelatorGroup(int group) const ;
+   std::vector<double> getCorrelatorLagTimes();
+   std::vector<double> getMSD(int group);
+   std::vector<double> getVACF(int group);
+   void resetCorrelator();
+   int getConductivityInterval() const ;
+   void setConductivityInterval(int) ;
+   std::vector<double> getConductivity(double fitTime);
+   std::vector<double> getConductivityLagTimes();
+   std::vector<double> getChargeCurrentAutocorrelation();
+   std::vector<double> getDipoleMSD();
+   void resetConductivity();
+   std::vector<double> getGroupKineticEnergies();
+   std::vector<double> getGroupTemperatures();
+   std::vector<double> getGroupDOFs();
+   int getGroupTemperatureInterval() const ;
+   void setGroupTemperatureInterval(int) ;
+   std::vector<double> getGroupTemperatureHistory();
+   void resetGroupTemperatureHistory();
+   int getElectrodeStatisticsInterval() const ;
+   void setElectrodeStatisticsInterval(int) ;
+   int getElectrodeNumBins() const ;
+   void setElectrodeNumBins(int) ;
+   std::vector<double> getElectrodeStatistics();
+   std::vector<double> getImageChargeDistribution();
+   void resetElectrodeStatistics();
+   std::vector<double> getForceGroupEnergies();
 
    bool getDebugEnabled() const ;
    void setDebugEnabled(bool) ;
+   bool getTimingEnabled() const ;
+   void setTimingEnabled(bool) ;
+   std::vector<double> getTimings();
+   std::string getTimingReport();
+   void resetTimings();
+   static std::string getTimingPhaseName(int phase);
+
+   %extend {
+      static OpenMM::VVIntegrator& cast(OpenMM::Integrator& integrator) {
+         return dynamic_cast<OpenMM::VVIntegrator&>(integrator);
+      }
+
+      static bool isinstance(OpenMM::Integrator& integrator) {
+         return (dynamic_cast<OpenMM::VVIntegrator*>(&integrator) != NULL);
+      }
+
+      PyObject* createCheckpoint() {
+         std::stringstream stream(std::ios_base::out | std::ios_base::binary);
+         self->createCheckpoint(stream);
+         std::string str = stream.str();
+         return PyBytes_FromStringAndSize(str.c_str(), str.size());
+      }
 
+      void loadCheckpoint(PyObject* checkpoint) {
+         char* buffer;
+         Py_ssize_t length;
+         if (PyBytes_AsStringAndSize(checkpoint, &buffer, &length) != 0)
+            throw OpenMM::OpenMMException("loadCheckpoint: checkpoint must be bytes");
+         std::stringstream stream(std::string(buffer, length), std::ios_base::in | std::ios_base::binary);
+         self->loadCheckpoint(stream);
+      }
+   }
 };
 
 }
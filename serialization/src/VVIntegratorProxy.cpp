@@ -0,0 +1,253 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2015 Stanford University and the Authors.      *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/serialization/VVIntegratorProxy.h"
+#include "openmm/serialization/SerializationNode.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/VVIntegrator.h"
+#include <utility>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+VVIntegratorProxy::VVIntegratorProxy() : SerializationProxy("VVIntegrator") {
+}
+
+/**
+ * Store a list of particle indices as ranges of consecutive indices
+ */
+static void serializeRanges(SerializationNode& node, const vector<int>& particles) {
+    int i = 0;
+    while (i < (int) particles.size()) {
+        int count = 1;
+        while (i + count < (int) particles.size() && particles[i + count] == particles[i] + count)
+            count++;
+        node.createChildNode("Range").setIntProperty("start", particles[i]).setIntProperty("count", count);
+        i += count;
+    }
+}
+
+static vector<int> deserializeRanges(const SerializationNode& node) {
+    vector<int> particles;
+    for (auto& range : node.getChildren()) {
+        int start = range.getIntProperty("start");
+        int count = range.getIntProperty("count");
+        for (int i = 0; i < count; i++)
+            particles.push_back(start + i);
+    }
+    return particles;
+}
+
+void VVIntegratorProxy::serialize(const void* object, SerializationNode& node) const {
+    node.setIntProperty("version", 1);
+    const VVIntegrator& integrator = *reinterpret_cast<const VVIntegrator*>(object);
+    node.setDoubleProperty("stepSize", integrator.getStepSize());
+    node.setDoubleProperty("constraintTolerance", integrator.getConstraintTolerance());
+    node.setDoubleProperty("temperature", integrator.temperature);
+    node.setDoubleProperty("frequency", integrator.frequency);
+    node.setDoubleProperty("drudeTemperature", integrator.drudeTemperature);
+    node.setDoubleProperty("drudeFrequency", integrator.drudeFrequency);
+    node.setIntProperty("numNHChains", integrator.numNHChains);
+    node.setIntProperty("loopsPerStep", integrator.loopsPerStep);
+    // the settings which are determined in initialize() if they are not set explicitly
+    node.setBoolProperty("autoSetCOMTempGroup", integrator.autoSetCOMTempGroup);
+    node.setBoolProperty("useCOMTempGroup", integrator.useCOMTempGroup);
+    node.setBoolProperty("autoSetFriction", integrator.autoSetFriction);
+    node.setDoubleProperty("friction", integrator.friction);
+    node.setDoubleProperty("drudeFriction", integrator.drudeFriction);
+    node.setDoubleProperty("maxDrudeDistance", integrator.maxDrudeDistance);
+    node.setBoolProperty("useMiddleScheme", integrator.useMiddleScheme);
+    node.setBoolProperty("useMassiveNH", integrator.useMassiveNH);
+    node.setBoolProperty("useLangevinOU", integrator.useLangevinOU);
+    node.setIntProperty("randomSeed", integrator.randomNumberSeed);
+    node.setDoubleProperty("mirrorLocation", integrator.mirrorLocation);
+    node.setDoubleProperty("electricField", integrator.electricField);
+    node.setDoubleProperty("cosAcceleration", integrator.cosAcceleration);
+    node.setIntProperty("viscosityStatisticsInterval", integrator.viscosityStatisticsInterval);
+    node.setIntProperty("rnemdInterval", integrator.rnemdInterval);
+    node.setIntProperty("rnemdNumSlabs", integrator.rnemdNumSlabs);
+    node.setIntProperty("densityProfileInterval", integrator.densityProfileInterval);
+    node.setIntProperty("densityProfileNumBins", integrator.densityProfileNumBins);
+    node.setIntProperty("correlatorInterval", integrator.correlatorInterval);
+    node.setIntProperty("correlatorNumLevels", integrator.correlatorNumLevels);
+    node.setIntProperty("conductivityInterval", integrator.conductivityInterval);
+    node.setIntProperty("groupTemperatureInterval", integrator.groupTemperatureInterval);
+    node.setIntProperty("electrodeStatisticsInterval", integrator.electrodeStatisticsInterval);
+    node.setIntProperty("electrodeNumBins", integrator.electrodeNumBins);
+    node.setBoolProperty("useSINR", integrator.useSINR);
+    node.setIntProperty("sinrChainLength", integrator.sinrChainLength);
+    node.setDoubleProperty("sinrFriction", integrator.sinrFriction);
+    node.setIntProperty("fastForceGroups", integrator.fastForceGroups);
+    node.setIntProperty("respaLoops", integrator.respaLoops);
+    node.setBoolProperty("debugEnabled", integrator.debugEnabled);
+    node.setBoolProperty("timingEnabled", integrator.timingEnabled);
+
+    serializeRanges(node.createChildNode("ParticlesLangevin"), integrator.particlesLD);
+    serializeRanges(node.createChildNode("ParticlesElectrolyte"), integrator.particlesElectrolyte);
+
+    // image pairs are stored as ranges in which both image and parent indices are consecutive
+    SerializationNode& imagePairs = node.createChildNode("ImagePairs");
+    const vector<pair<int, int> >& pairs = integrator.imagePairs;
+    int i = 0;
+    while (i < (int) pairs.size()) {
+        int count = 1;
+        while (i + count < (int) pairs.size()
+               && pairs[i + count].first == pairs[i].first + count
+               && pairs[i + count].second == pairs[i].second + count)
+            count++;
+        imagePairs.createChildNode("Range").setIntProperty("image", pairs[i].first)
+                                           .setIntProperty("parent", pairs[i].second)
+                                           .setIntProperty("count", count);
+        i += count;
+    }
+
+    SerializationNode& modes = node.createChildNode("CosAccelerationModes");
+    for (auto& mode : integrator.cosAccelerationModes)
+        modes.createChildNode("Mode").setIntProperty("flowAxis", mode.flowAxis)
+                                     .setIntProperty("gradientAxis", mode.gradientAxis)
+                                     .setIntProperty("waveNumber", mode.waveNumber)
+                                     .setDoubleProperty("amplitude", mode.amplitude);
+
+    SerializationNode& correlatorGroups = node.createChildNode("CorrelatorGroups");
+    for (auto& group : integrator.correlatorGroups)
+        serializeRanges(correlatorGroups.createChildNode("Group"), group);
+
+    SerializationNode& schedules = node.createChildNode("Schedules");
+    for (auto& item : integrator.schedules) {
+        const VVIntegrator::ParameterSchedule& schedule = item.second;
+        SerializationNode& scheduleNode = schedules.createChildNode("Schedule");
+        scheduleNode.setIntProperty("parameter", item.first);
+        scheduleNode.setBoolProperty("sinusoidal", schedule.sinusoidal);
+        if (schedule.sinusoidal) {
+            scheduleNode.setDoubleProperty("offset", schedule.offset);
+            scheduleNode.setDoubleProperty("amplitude", schedule.amplitude);
+            scheduleNode.setDoubleProperty("period", schedule.period);
+            scheduleNode.setDoubleProperty("phase", schedule.phase);
+        }
+        else {
+            for (int j = 0; j < (int) schedule.times.size(); j++)
+                scheduleNode.createChildNode("Point").setDoubleProperty("t", schedule.times[j])
+                                                     .setDoubleProperty("value", schedule.values[j]);
+        }
+    }
+}
+
+void* VVIntegratorProxy::deserialize(const SerializationNode& node) const {
+    if (node.getIntProperty("version") != 1)
+        throw OpenMMException("Unsupported version number");
+    VVIntegrator* integrator = new VVIntegrator(node.getDoubleProperty("temperature"),
+                                                node.getDoubleProperty("frequency"),
+                                                node.getDoubleProperty("drudeTemperature"),
+                                                node.getDoubleProperty("drudeFrequency"),
+                                                node.getDoubleProperty("stepSize"),
+                                                node.getIntProperty("numNHChains"),
+                                                node.getIntProperty("loopsPerStep"));
+    try {
+        integrator->setConstraintTolerance(node.getDoubleProperty("constraintTolerance"));
+        if (!node.getBoolProperty("autoSetCOMTempGroup"))
+            integrator->setUseCOMTempGroup(node.getBoolProperty("useCOMTempGroup"));
+        if (!node.getBoolProperty("autoSetFriction")) {
+            integrator->setFriction(node.getDoubleProperty("friction"));
+            integrator->setDrudeFriction(node.getDoubleProperty("drudeFriction"));
+        }
+        integrator->setMaxDrudeDistance(node.getDoubleProperty("maxDrudeDistance"));
+        integrator->setUseMiddleScheme(node.getBoolProperty("useMiddleScheme"));
+        integrator->setUseMassiveNH(node.getBoolProperty("useMassiveNH"));
+        integrator->setUseLangevinOU(node.getBoolProperty("useLangevinOU"));
+        integrator->setRandomNumberSeed(node.getIntProperty("randomSeed"));
+        integrator->setMirrorLocation(node.getDoubleProperty("mirrorLocation"));
+        integrator->setElectricField(node.getDoubleProperty("electricField"));
+        integrator->setCosAcceleration(node.getDoubleProperty("cosAcceleration"));
+        integrator->setViscosityStatisticsInterval(node.getIntProperty("viscosityStatisticsInterval", 1));
+        integrator->setRNEMDInterval(node.getIntProperty("rnemdInterval", 0));
+        integrator->setRNEMDNumSlabs(node.getIntProperty("rnemdNumSlabs", 20));
+        integrator->setDensityProfileInterval(node.getIntProperty("densityProfileInterval", 0));
+        integrator->setDensityProfileNumBins(node.getIntProperty("densityProfileNumBins", 200));
+        integrator->setCorrelatorInterval(node.getIntProperty("correlatorInterval", 0));
+        integrator->setCorrelatorNumLevels(node.getIntProperty("correlatorNumLevels", 16));
+        integrator->setConductivityInterval(node.getIntProperty("conductivityInterval", 0));
+        integrator->setGroupTemperatureInterval(node.getIntProperty("groupTemperatureInterval", 0));
+        integrator->setElectrodeStatisticsInterval(node.getIntProperty("electrodeStatisticsInterval", 0));
+        integrator->setElectrodeNumBins(node.getIntProperty("electrodeNumBins", 10));
+        integrator->setUseSINR(node.getBoolProperty("useSINR"));
+        integrator->setSINRChainLength(node.getIntProperty("sinrChainLength"));
+        integrator->setSINRFriction(node.getDoubleProperty("sinrFriction"));
+        integrator->setFastForceGroups(node.getIntProperty("fastForceGroups"));
+        integrator->setRespaLoops(node.getIntProperty("respaLoops"));
+        integrator->setDebugEnabled(node.getBoolProperty("debugEnabled"));
+        integrator->setTimingEnabled(node.getBoolProperty("timingEnabled", false));
+
+        for (int particle : deserializeRanges(node.getChildNode("ParticlesLangevin")))
+            integrator->addParticleLangevin(particle);
+        for (int particle : deserializeRanges(node.getChildNode("ParticlesElectrolyte")))
+            integrator->addParticleElectrolyte(particle);
+        for (auto& range : node.getChildNode("ImagePairs").getChildren()) {
+            int image = range.getIntProperty("image");
+            int parent = range.getIntProperty("parent");
+            int count = range.getIntProperty("count");
+            for (int i = 0; i < count; i++)
+                integrator->addImagePair(image + i, parent + i);
+        }
+
+        for (auto& mode : node.getChildNode("CosAccelerationModes").getChildren())
+            integrator->addCosAccelerationMode(mode.getIntProperty("flowAxis"),
+                                               mode.getIntProperty("gradientAxis"),
+                                               mode.getIntProperty("waveNumber"),
+                                               mode.getDoubleProperty("amplitude"));
+
+        for (auto& group : node.getChildNode("CorrelatorGroups").getChildren())
+            integrator->addCorrelatorGroup(deserializeRanges(group));
+
+        for (auto& schedule : node.getChildNode("Schedules").getChildren()) {
+            int parameter = schedule.getIntProperty("parameter");
+            if (schedule.getBoolProperty("sinusoidal"))
+                integrator->setSinusoidalSchedule(parameter,
+                                                  schedule.getDoubleProperty("offset"),
+                                                  schedule.getDoubleProperty("amplitude"),
+                                                  schedule.getDoubleProperty("period"),
+                                                  schedule.getDoubleProperty("phase"));
+            else {
+                vector<double> times, values;
+                for (auto& point : schedule.getChildren()) {
+                    times.push_back(point.getDoubleProperty("t"));
+                    values.push_back(point.getDoubleProperty("value"));
+                }
+                integrator->setLinearSchedule(parameter, times, values);
+            }
+        }
+    }
+    catch (...) {
+        delete integrator;
+        throw;
+    }
+    return integrator;
+}
@@ -0,0 +1,211 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2015 Stanford University and the Authors.      *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/VVIntegrator.h"
+#include "openmm/serialization/XmlSerializer.h"
+#include <iostream>
+#include <sstream>
+
+using namespace OpenMM;
+using namespace std;
+
+extern "C" void registerVVSerializationProxies();
+
+static string serialize(const VVIntegrator& integrator) {
+    stringstream buffer;
+    XmlSerializer::serialize<Integrator>(&integrator, "Integrator", buffer);
+    return buffer.str();
+}
+
+static void assertSameCosAccelerationModes(const VVIntegrator& integrator1, const VVIntegrator& integrator2) {
+    ASSERT_EQUAL(integrator1.getNumCosAccelerationModes(), integrator2.getNumCosAccelerationModes());
+    for (int i = 0; i < integrator1.getNumCosAccelerationModes(); i++) {
+        int flow1, gradient1, n1, flow2, gradient2, n2;
+        double amplitude1, amplitude2;
+        integrator1.getCosAccelerationModeParameters(i, flow1, gradient1, n1, amplitude1);
+        integrator2.getCosAccelerationModeParameters(i, flow2, gradient2, n2, amplitude2);
+        ASSERT_EQUAL(flow1, flow2);
+        ASSERT_EQUAL(gradient1, gradient2);
+        ASSERT_EQUAL(n1, n2);
+        ASSERT_EQUAL(amplitude1, amplitude2);
+    }
+}
+
+void testSerialization() {
+    // Create an integrator which uses every property and child list of the proxy.
+
+    VVIntegrator integrator(300, 10, 1, 50, 0.002, 5, 2);
+    integrator.setConstraintTolerance(1e-6);
+    integrator.setUseCOMTempGroup(true);
+    integrator.setFriction(2.5);
+    integrator.setDrudeFriction(15);
+    integrator.setMaxDrudeDistance(0.025);
+    integrator.setUseMiddleScheme(true);
+    integrator.setUseMassiveNH(true);
+    integrator.setUseLangevinOU(true);
+    integrator.setRandomNumberSeed(1234);
+    integrator.setMirrorLocation(3.5);
+    integrator.setElectricField(0.7);
+    integrator.setCosAcceleration(0.02);
+    integrator.setViscosityStatisticsInterval(5);
+    integrator.setRNEMDInterval(20);
+    integrator.setRNEMDNumSlabs(16);
+    integrator.setDensityProfileInterval(10);
+    integrator.setDensityProfileNumBins(150);
+    integrator.setCorrelatorInterval(4);
+    integrator.setCorrelatorNumLevels(12);
+    integrator.setConductivityInterval(3);
+    integrator.setGroupTemperatureInterval(7);
+    integrator.setElectrodeStatisticsInterval(9);
+    integrator.setElectrodeNumBins(25);
+    integrator.setUseSINR(true);
+    integrator.setSINRChainLength(4);
+    integrator.setSINRFriction(0.3);
+    integrator.setFastForceGroups(1 << 2 | 1 << 5);
+    integrator.setRespaLoops(6);
+    integrator.setTimingEnabled(true);
+
+    // non-contiguous particle lists are stored as several ranges
+    for (int i : {0, 1, 2, 7, 8, 20, 3})
+        integrator.addParticleLangevin(i);
+    for (int i : {10, 12, 13, 14, 30})
+        integrator.addParticleElectrolyte(i);
+
+    // image pairs whose offsets change between ranges
+    for (int i = 0; i < 4; i++)
+        integrator.addImagePair(100 + i, 10 + i);
+    for (int i = 0; i < 3; i++)
+        integrator.addImagePair(104 + i, 20 + 2 * i);
+    integrator.addImagePair(200, 11);
+
+    integrator.addCosAccelerationMode(1, 2, 1, 0.01);
+    integrator.addCosAccelerationMode(0, 1, 2, 0.03);
+
+    integrator.addCorrelatorGroup({0, 1, 2, 3});
+    integrator.addCorrelatorGroup({10, 12, 30, 31, 32});
+
+    integrator.setLinearSchedule(VVIntegrator::ScheduleTemperature, {0, 10, 25.5}, {300, 350, 320});
+    integrator.setSinusoidalSchedule(VVIntegrator::ScheduleElectricField, 0.5, 0.25, 2.0, 0.1);
+
+    // Serialize and then deserialize it.
+
+    stringstream buffer;
+    XmlSerializer::serialize<Integrator>(&integrator, "Integrator", buffer);
+    VVIntegrator* copy = dynamic_cast<VVIntegrator*>(XmlSerializer::deserialize<Integrator>(buffer));
+    ASSERT(copy != NULL);
+    VVIntegrator& integrator2 = *copy;
+
+    // Compare the two integrators to see if they are identical.
+
+    ASSERT_EQUAL(integrator.getStepSize(), integrator2.getStepSize());
+    ASSERT_EQUAL(integrator.getConstraintTolerance(), integrator2.getConstraintTolerance());
+    ASSERT_EQUAL(integrator.getTemperature(), integrator2.getTemperature());
+    ASSERT_EQUAL(integrator.getFrequency(), integrator2.getFrequency());
+    ASSERT_EQUAL(integrator.getDrudeTemperature(), integrator2.getDrudeTemperature());
+    ASSERT_EQUAL(integrator.getDrudeFrequency(), integrator2.getDrudeFrequency());
+    ASSERT_EQUAL(integrator.getNumNHChains(), integrator2.getNumNHChains());
+    ASSERT_EQUAL(integrator.getLoopsPerStep(), integrator2.getLoopsPerStep());
+    ASSERT_EQUAL(integrator.getUseCOMTempGroup(), integrator2.getUseCOMTempGroup());
+    ASSERT_EQUAL(integrator.getFriction(), integrator2.getFriction());
+    ASSERT_EQUAL(integrator.getDrudeFriction(), integrator2.getDrudeFriction());
+    ASSERT_EQUAL(integrator.getMaxDrudeDistance(), integrator2.getMaxDrudeDistance());
+    ASSERT_EQUAL(integrator.getUseMiddleScheme(), integrator2.getUseMiddleScheme());
+    ASSERT_EQUAL(integrator.getUseMassiveNH(), integrator2.getUseMassiveNH());
+    ASSERT_EQUAL(integrator.getUseLangevinOU(), integrator2.getUseLangevinOU());
+    ASSERT_EQUAL(integrator.getRandomNumberSeed(), integrator2.getRandomNumberSeed());
+    ASSERT_EQUAL(integrator.getMirrorLocation(), integrator2.getMirrorLocation());
+    ASSERT_EQUAL(integrator.getElectricField(), integrator2.getElectricField());
+    ASSERT_EQUAL(integrator.getCosAcceleration(), integrator2.getCosAcceleration());
+    ASSERT_EQUAL(integrator.getViscosityStatisticsInterval(), integrator2.getViscosityStatisticsInterval());
+    ASSERT_EQUAL(integrator.getRNEMDInterval(), integrator2.getRNEMDInterval());
+    ASSERT_EQUAL(integrator.getRNEMDNumSlabs(), integrator2.getRNEMDNumSlabs());
+    ASSERT_EQUAL(integrator.getDensityProfileInterval(), integrator2.getDensityProfileInterval());
+    ASSERT_EQUAL(integrator.getDensityProfileNumBins(), integrator2.getDensityProfileNumBins());
+    ASSERT_EQUAL(integrator.getCorrelatorInterval(), integrator2.getCorrelatorInterval());
+    ASSERT_EQUAL(integrator.getCorrelatorNumLevels(), integrator2.getCorrelatorNumLevels());
+    ASSERT_EQUAL(integrator.getConductivityInterval(), integrator2.getConductivityInterval());
+    ASSERT_EQUAL(integrator.getGroupTemperatureInterval(), integrator2.getGroupTemperatureInterval());
+    ASSERT_EQUAL(integrator.getElectrodeStatisticsInterval(), integrator2.getElectrodeStatisticsInterval());
+    ASSERT_EQUAL(integrator.getElectrodeNumBins(), integrator2.getElectrodeNumBins());
+    ASSERT_EQUAL(integrator.getUseSINR(), integrator2.getUseSINR());
+    ASSERT_EQUAL(integrator.getSINRChainLength(), integrator2.getSINRChainLength());
+    ASSERT_EQUAL(integrator.getSINRFriction(), integrator2.getSINRFriction());
+    ASSERT_EQUAL(integrator.getFastForceGroups(), integrator2.getFastForceGroups());
+    ASSERT_EQUAL(integrator.getRespaLoops(), integrator2.getRespaLoops());
+    ASSERT_EQUAL(integrator.getTimingEnabled(), integrator2.getTimingEnabled());
+
+    ASSERT(integrator.getParticlesLD() == integrator2.getParticlesLD());
+    ASSERT(integrator.getParticlesElectrolyte() == integrator2.getParticlesElectrolyte());
+    ASSERT(integrator.getImagePairs() == integrator2.getImagePairs());
+    assertSameCosAccelerationModes(integrator, integrator2);
+    ASSERT_EQUAL(integrator.getNumCorrelatorGroups(), integrator2.getNumCorrelatorGroups());
+    for (int i = 0; i < integrator.getNumCorrelatorGroups(); i++)
+        ASSERT(integrator.getCorrelatorGroup(i) == integrator2.getCorrelatorGroup(i));
+    for (int parameter = VVIntegrator::ScheduleTemperature; parameter <= VVIntegrator::ScheduleCosAcceleration; parameter++)
+        ASSERT_EQUAL(integrator.hasSchedule(parameter), integrator2.hasSchedule(parameter));
+
+    // The schedules have no getters, so the copy is compared through its own serialization.
+
+    ASSERT_EQUAL(serialize(integrator), serialize(integrator2));
+    delete copy;
+}
+
+void testDefaultSettings() {
+    // The settings determined in initialize() should remain automatic after a round trip.
+
+    VVIntegrator integrator(300, 10, 1, 50, 0.001);
+    stringstream buffer;
+    XmlSerializer::serialize<Integrator>(&integrator, "Integrator", buffer);
+    VVIntegrator* copy = dynamic_cast<VVIntegrator*>(XmlSerializer::deserialize<Integrator>(buffer));
+    ASSERT(copy != NULL);
+    ASSERT_EQUAL(serialize(integrator), serialize(*copy));
+    ASSERT_EQUAL(0, copy->getNumCorrelatorGroups());
+    ASSERT_EQUAL(1, copy->getNumCosAccelerationModes());
+    ASSERT(copy->getImagePairs().empty());
+    ASSERT(!copy->getTimingEnabled());
+    delete copy;
+}
+
+int main() {
+    try {
+        registerVVSerializationProxies();
+        testSerialization();
+        testDefaultSettings();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}